@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "BulkUploadJob.h"
+#include "DavProvider.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <string>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+BulkUploadJob::BulkUploadJob(shared_ptr<DavProvider> const& provider,
+                             string const& item_id, int64_t size,
+                             string const& content_type,
+                             PropertySet properties, Context const& ctx)
+    : DavUploadJob(provider, item_id, size, content_type, true, string(),
+                   properties, ctx, false),
+      mtime_(QDateTime::currentDateTimeUtc().toTime_t())
+{
+    data_.reserve(size_);
+    connect(&reader_, &QIODevice::readyRead,
+            this, &BulkUploadJob::onReadyRead);
+    connect(&reader_, &QIODevice::readChannelFinished,
+            this, &BulkUploadJob::onReadChannelFinished);
+}
+
+BulkUploadJob::~BulkUploadJob()
+{
+    if (queued_)
+    {
+        provider_->bulk_uploader().remove(token_);
+    }
+}
+
+void BulkUploadJob::onReadyRead()
+{
+    if (promise_set_ || queued_ || sent_alone_)
+    {
+        return;
+    }
+    data_.append(reader_.readAll());
+    if (data_.size() > size_)
+    {
+        fail(boost::copy_exception(
+                 LogicException("Upload is larger than the declared size")));
+        return;
+    }
+    if (data_.size() == size_)
+    {
+        reader_.close();
+        queued_ = true;
+        token_ = provider_->bulk_uploader().add(
+            session_, context_, item_id_, data_, mtime_,
+            [this](BulkUploader::Result const& result) {
+                onBulkResult(result);
+            });
+    }
+    else if (read_channel_finished_ && reader_.bytesAvailable() == 0)
+    {
+        fail(boost::copy_exception(
+                 LogicException("Upload is smaller than the declared size")));
+    }
+}
+
+void BulkUploadJob::onReadChannelFinished()
+{
+    read_channel_finished_ = true;
+    onReadyRead();
+}
+
+void BulkUploadJob::onBulkResult(BulkUploader::Result const& result)
+{
+    queued_ = false;
+    switch (result.outcome)
+    {
+    case BulkUploader::Outcome::uploaded:
+    {
+        provider_->invalidate_cache(session_->base_url(), item_id_);
+        PropertySet available = 0;
+        Item const item = make_uploaded_item(
+            *provider_, *session_, item_id_, result.etag, result.file_id,
+            size_, mtime_, available);
+        complete(item, available);
+        break;
+    }
+    case BulkUploader::Outcome::failed:
+        provider_->invalidate_cache(session_->base_url(), item_id_);
+        fail(result.error);
+        break;
+    case BulkUploader::Outcome::send_alone:
+    {
+        sent_alone_ = true;
+        unique_ptr<QBuffer> body(new QBuffer);
+        body->setData(data_);
+        body->open(QIODevice::ReadOnly);
+        data_.clear();
+        send(move(body));
+        break;
+    }
+    }
+}
+
+boost::future<void> BulkUploadJob::cancel()
+{
+    if (queued_ && !promise_set_)
+    {
+        provider_->bulk_uploader().remove(token_);
+        queued_ = false;
+    }
+    return DavUploadJob::cancel();
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "BulkUploader.h"
+#include "DavUploadJob.h"
+#include "dav_properties.h"
+
+// Upload a small file as part of a bulk upload: the data is read into
+// memory and handed to the provider's BulkUploader, falling back to
+// an ordinary PUT if the file ends up being sent on its own.
+class BulkUploadJob : public DavUploadJob
+{
+    Q_OBJECT
+public:
+    BulkUploadJob(std::shared_ptr<DavProvider> const& provider,
+                  std::string const& item_id, int64_t size,
+                  std::string const& content_type, PropertySet properties,
+                  unity::storage::provider::Context const& ctx);
+    ~BulkUploadJob();
+
+    boost::future<void> cancel() override;
+
+private Q_SLOTS:
+    void onReadyRead();
+    void onReadChannelFinished();
+
+private:
+    void onBulkResult(BulkUploader::Result const& result);
+
+    // Modification time requested with X-File-Mtime, which the bulk
+    // upload endpoint requires, in seconds since the epoch.
+    int64_t const mtime_;
+    QByteArray data_;
+    bool read_channel_finished_ = false;
+    // Set while the file waits in a batch or for its result.
+    bool queued_ = false;
+    bool sent_alone_ = false;
+    uint64_t token_ = 0;
+};
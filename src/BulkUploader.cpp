@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "BulkUploader.h"
+#include "DavProvider.h"
+#include "http_error.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QUrl>
+#include <QUuid>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+// Send a batch early once it holds this much data.
+constexpr int64_t MAX_BATCH_BYTES = 16 * 1024 * 1024;
+
+}
+
+BulkUploader::BulkUploader(DavProvider& provider, int window_ms, int max_files)
+    : provider_(provider), window_ms_(max(0, window_ms)),
+      max_files_(max(2, max_files))
+{
+}
+
+BulkUploader::~BulkUploader()
+{
+    for (auto reply : replies_)
+    {
+        reply->disconnect(this);
+        reply->abort();
+        delete reply;
+    }
+}
+
+bool BulkUploader::supported(DavSession const& session) const
+{
+    return session.bulk_upload_url().isValid() &&
+        unsupported_.find(session.account()) == unsupported_.end();
+}
+
+uint64_t BulkUploader::add(shared_ptr<DavSession const> const& session,
+                           Context const& ctx, string const& item_id,
+                           QByteArray const& data, int64_t mtime,
+                           Callback callback)
+{
+    string const& account = session->account();
+    Batch& batch = batches_[account];
+    if (!batch.timer)
+    {
+        batch.session = session;
+        batch.ctx = ctx;
+        batch.timer.reset(new QTimer);
+        batch.timer->setSingleShot(true);
+        connect(batch.timer.get(), &QTimer::timeout,
+                this, [this, account] { flush(account); });
+        batch.timer->start(window_ms_);
+    }
+    uint64_t const token = next_token_++;
+    File file;
+    file.token = token;
+    file.item_id = item_id;
+    file.path = '/' + QUrl::fromPercentEncoding(QByteArray::fromStdString(item_id));
+    file.data = data;
+    file.mtime = mtime;
+    file.callback = move(callback);
+    batch.files.push_back(move(file));
+    batch.bytes += data.size();
+
+    if (int(batch.files.size()) >= max_files_ ||
+        (batch.files.size() > 1 && batch.bytes >= MAX_BATCH_BYTES))
+    {
+        flush(account);
+    }
+    return token;
+}
+
+void BulkUploader::remove(uint64_t token)
+{
+    for (auto& pair : batches_)
+    {
+        auto& files = pair.second.files;
+        auto it = find_if(files.begin(), files.end(),
+                          [token](File const& f) { return f.token == token; });
+        if (it != files.end())
+        {
+            pair.second.bytes -= it->data.size();
+            files.erase(it);
+            return;
+        }
+    }
+    withdrawn_.insert(token);
+}
+
+void BulkUploader::flush(string const& account)
+{
+    auto it = batches_.find(account);
+    if (it == batches_.end())
+    {
+        return;
+    }
+    // The batch is finished with once this returns, so take what is
+    // needed from it.
+    auto const session = it->second.session;
+    Context const ctx = it->second.ctx;
+    vector<File> files = move(it->second.files);
+    it->second.timer.release()->deleteLater();
+    batches_.erase(it);
+
+    if (files.empty())
+    {
+        return;
+    }
+    if (files.size() == 1 || !supported(*session))
+    {
+        for (auto const& file : files)
+        {
+            file.callback(Result{Outcome::send_alone, {}, {}, {}});
+        }
+        return;
+    }
+
+    QByteArray const boundary = "boundary_" + QUuid::createUuid().toRfc4122().toHex();
+    QByteArray body;
+    for (auto& file : files)
+    {
+        body += "--" + boundary + "\r\n";
+        body += "X-File-Path: " + file.path.toUtf8() + "\r\n";
+        body += "X-File-MD5: " + QCryptographicHash::hash(
+            file.data, QCryptographicHash::Md5).toHex() + "\r\n";
+        body += "X-File-Mtime: " + QByteArray::number(qint64(file.mtime)) + "\r\n";
+        body += "Content-Length: " + QByteArray::number(file.data.size()) + "\r\n";
+        body += "\r\n";
+        body += file.data;
+        body += "\r\n";
+        // The uploads hold on to their own copy.
+        file.data.clear();
+    }
+    body += "--" + boundary + "--\r\n";
+
+    QNetworkRequest request(session->bulk_upload_url());
+    request.setHeader(QNetworkRequest::ContentTypeHeader,
+                      "multipart/related; boundary=" + boundary);
+    request.setHeader(QNetworkRequest::ContentLengthHeader,
+                      QVariant::fromValue(qint64(body.size())));
+    DavProvider::set_request_priority(
+        request, RequestScheduler::Priority::transfer);
+    DavProvider::set_request_operation(request, QStringLiteral("bulk_upload"));
+
+    auto data = new QBuffer;
+    data->setData(body);
+    data->open(QIODevice::ReadOnly);
+    QNetworkReply* reply = provider_.send_request(
+        request, QByteArrayLiteral("POST"), data, ctx);
+    data->setParent(reply);
+    replies_.insert(reply);
+    connect(reply, &QNetworkReply::finished,
+            this, [this, reply, account, files] {
+                finish(reply, account, files);
+            });
+}
+
+void BulkUploader::finish(QNetworkReply* reply, string const& account,
+                          vector<File> const& files)
+{
+    replies_.erase(reply);
+    reply->deleteLater();
+
+    vector<File> wanted;
+    for (auto const& file : files)
+    {
+        if (withdrawn_.erase(file.token) == 0)
+        {
+            wanted.push_back(file);
+        }
+    }
+
+    auto const status = reply->attribute(
+        QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    // Servers without the endpoint reject the POST without touching
+    // the files, so they can still be sent one by one.
+    if (status == 404 || status == 405 || status == 501)
+    {
+        qDebug() << "Server does not support bulk uploads:" << status;
+        unsupported_.insert(account);
+        for (auto const& file : wanted)
+        {
+            file.callback(Result{Outcome::send_alone, {}, {}, {}});
+        }
+        return;
+    }
+    if (status / 100 != 2)
+    {
+        QByteArray const body = reply->read(MAX_ERROR_BODY_LENGTH);
+        for (auto const& file : wanted)
+        {
+            file.callback(Result{Outcome::failed, {}, {},
+                        translate_http_error(reply, body, file.item_id)});
+        }
+        return;
+    }
+
+    // The response maps each X-File-Path to the outcome for that
+    // file.
+    QJsonParseError parse_error;
+    QJsonObject const results = QJsonDocument::fromJson(
+        reply->readAll(), &parse_error).object();
+    for (auto const& file : wanted)
+    {
+        QJsonObject const result = results[file.path].toObject();
+        if (parse_error.error != QJsonParseError::NoError || result.isEmpty())
+        {
+            file.callback(Result{Outcome::failed, {}, {},
+                        boost::copy_exception(RemoteCommsException(
+                            "Bulk upload response has no result for " +
+                            file.item_id))});
+        }
+        else if (result["error"].toBool())
+        {
+            file.callback(Result{Outcome::failed, {}, {},
+                        boost::copy_exception(RemoteCommsException(
+                            "Upload of " + file.item_id + " failed: " +
+                            result["message"].toString().toStdString()))});
+        }
+        else
+        {
+            // Nextcloud reports the ETag without quotes.
+            QByteArray etag = result["etag"].toString().toUtf8();
+            if (!etag.isEmpty() && !etag.startsWith('"'))
+            {
+                etag = '"' + etag + '"';
+            }
+            file.callback(Result{Outcome::uploaded, etag,
+                        result["fileid"].toString().toUtf8(), {}});
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QObject>
+#include <QTimer>
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class DavProvider;
+class DavSession;
+class QNetworkReply;
+
+// Gathers small uploads made close together into batches sent with
+// Nextcloud's bulk upload endpoint, which stores many files from one
+// multipart POST.
+//
+// Files wait up to the batching window for others to join them.  A
+// batch holding a single file gains nothing, so that file is handed
+// back to be sent with a PUT as usual, as are the files of a batch
+// sent to a server without the endpoint.  The endpoint always
+// overwrites, so it is only suitable for uploads that may do so.
+class BulkUploader : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Outcome
+    {
+        uploaded,
+        failed,
+        // The file should be uploaded on its own.
+        send_alone,
+    };
+    struct Result
+    {
+        Outcome outcome;
+        // For uploaded files, as reported by the server.
+        QByteArray etag;
+        QByteArray file_id;
+        boost::exception_ptr error;
+    };
+    typedef std::function<void(Result const& result)> Callback;
+
+    BulkUploader(DavProvider& provider, int window_ms, int max_files);
+    ~BulkUploader();
+
+    // Whether the account's server might support bulk uploads.
+    bool supported(DavSession const& session) const;
+
+    // Queue a file to be uploaded, returning a token that can be
+    // passed to remove().  The callback is not called from within
+    // add().
+    uint64_t add(std::shared_ptr<DavSession const> const& session,
+                 unity::storage::provider::Context const& ctx,
+                 std::string const& item_id, QByteArray const& data,
+                 int64_t mtime, Callback callback);
+    // Withdraw a file that hasn't been sent yet.  The callback won't
+    // be called.
+    void remove(uint64_t token);
+
+private:
+    struct File
+    {
+        uint64_t token;
+        std::string item_id;
+        // The file's path below the account's root, as sent in
+        // X-File-Path.
+        QString path;
+        QByteArray data;
+        int64_t mtime;
+        Callback callback;
+    };
+    struct Batch
+    {
+        std::shared_ptr<DavSession const> session;
+        unity::storage::provider::Context ctx;
+        std::vector<File> files;
+        int64_t bytes = 0;
+        std::unique_ptr<QTimer> timer;
+    };
+
+    void flush(std::string const& account);
+    void finish(QNetworkReply* reply, std::string const& account,
+                std::vector<File> const& files);
+
+    DavProvider& provider_;
+    int const window_ms_;
+    int const max_files_;
+    uint64_t next_token_ = 0;
+    // Batches still gathering files, keyed by account.
+    std::map<std::string, Batch> batches_;
+    // Accounts whose servers turned out not to support bulk uploads.
+    std::set<std::string> unsupported_;
+    // Files withdrawn after their batch was sent.
+    std::set<uint64_t> withdrawn_;
+    std::set<QNetworkReply*> replies_;
+};
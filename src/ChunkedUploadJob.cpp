@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "ChunkedUploadJob.h"
+#include "DavProvider.h"
+#include "DavSession.h"
+#include "RetrieveMetadataHandler.h"
+#include "http_error.h"
+#include "settings.h"
+
+#include <QBuffer>
+#include <QDebug>
+#include <QTimer>
+#include <QUuid>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+constexpr int64_t DEFAULT_CHUNK_SIZE = 10 * 1024 * 1024;
+constexpr int64_t DEFAULT_PARALLEL_CHUNKS = 3;
+constexpr int64_t DEFAULT_RETRIES = 3;
+// Delay before the first retry of a request, doubling for each
+// subsequent attempt.
+constexpr int RETRY_DELAY_MS = 500;
+constexpr int READ_BUFFER_SIZE = 64 * 1024;
+
+}
+
+ChunkedUploadJob::ChunkedUploadJob(shared_ptr<DavProvider> const& provider,
+                                   QUrl const& upload_collection,
+                                   string const& item_id, int64_t size,
+                                   string const& content_type,
+                                   bool allow_overwrite,
+                                   string const& old_etag,
+                                   PropertySet properties, Context const& ctx)
+    : DavUploadJob(provider, item_id, size, content_type, allow_overwrite,
+                   old_etag, properties, ctx, false),
+      destination_(session_->id_to_url(item_id)),
+      upload_url_(upload_collection.resolved(
+          QUrl(QString::fromLatin1(QUuid::createUuid().toRfc4122().toHex()) + "/"))),
+      chunk_size_(max<int64_t>(1, get_setting("DAV_UPLOAD_CHUNK_SIZE",
+                                              DEFAULT_CHUNK_SIZE))),
+      max_parallel_(max<int64_t>(1, get_setting("DAV_UPLOAD_PARALLEL_CHUNKS",
+                                                DEFAULT_PARALLEL_CHUNKS))),
+      max_retries_(get_setting("DAV_UPLOAD_RETRIES", DEFAULT_RETRIES))
+{
+    // Don't let the socket buffer more than we're prepared to send.
+    reader_.setReadBufferSize(READ_BUFFER_SIZE);
+    connect(&reader_, &QIODevice::readyRead,
+            this, &ChunkedUploadJob::onReadyRead);
+    connect(&reader_, &QIODevice::readChannelFinished,
+            this, &ChunkedUploadJob::onReadChannelFinished);
+
+    if (old_etag_.empty())
+    {
+        createCollection();
+        return;
+    }
+    // The final MOVE targets the staging collection rather than the
+    // file, so If-Match can't be used there: check the ETag before
+    // starting instead.
+    precondition_.reset(
+        new RetrieveMetadataHandler(
+            provider_, item_id_, dav_property::required, context_,
+            [this](Item const& item, boost::exception_ptr const& error) {
+                if (promise_set_)
+                {
+                    return;
+                }
+                if (error)
+                {
+                    fail(error);
+                }
+                else if (item.etag != old_etag_)
+                {
+                    fail(boost::copy_exception(ConflictException(
+                        "ETag of " + item_id_ + " has changed")));
+                }
+                else
+                {
+                    createCollection();
+                }
+            }));
+}
+
+ChunkedUploadJob::~ChunkedUploadJob() = default;
+
+QNetworkRequest ChunkedUploadJob::makeRequest(QUrl const& url) const
+{
+    QNetworkRequest request(url);
+    // Nextcloud uses these to check quota and the destination up
+    // front, rather than after all the data has been sent.
+    request.setRawHeader(QByteArrayLiteral("Destination"),
+                         destination_.toEncoded());
+    request.setRawHeader(QByteArrayLiteral("OC-Total-Length"),
+                         QByteArray::number(qint64(size_)));
+    DavProvider::set_request_priority(
+        request, RequestScheduler::Priority::transfer);
+    // Record the chunk uploads and their assembly separately from
+    // other PUT and MOVE requests.
+    DavProvider::set_request_operation(request, QStringLiteral("upload"));
+    return request;
+}
+
+void ChunkedUploadJob::createCollection()
+{
+    QNetworkRequest request = makeRequest(upload_url_);
+    if (reply_)
+    {
+        reply_.release()->deleteLater();
+    }
+    reply_.reset(provider_->send_request(
+        request, QByteArrayLiteral("MKCOL"), nullptr, context_));
+    assert(reply_.get() != nullptr);
+    connect(reply_.get(), &QNetworkReply::finished,
+            this, &ChunkedUploadJob::onMkcolFinished);
+}
+
+void ChunkedUploadJob::onMkcolFinished()
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    // Servers without chunked uploads have no uploads area to create
+    // the collection in.  Nothing has been read from the client yet,
+    // so the file can still be sent in one go.
+    if (attempts_ == 0 && (status == 404 || status == 405 || status == 501))
+    {
+        qDebug() << "Server does not support chunked uploads:" << status;
+        provider_->chunked_upload_unsupported(session_->account());
+        sendWhole();
+        return;
+    }
+    // A retried MKCOL may find the collection created by an attempt
+    // whose response was lost.
+    if (status / 100 != 2 && !(status == 405 && attempts_ > 0))
+    {
+        if (retry(reply_.get(), attempts_, [this] { createCollection(); }))
+        {
+            return;
+        }
+        fail(translate_http_error(reply_.get(), QByteArray(), item_id_));
+        return;
+    }
+    collection_created_ = true;
+    attempts_ = 0;
+    onReadyRead();
+}
+
+void ChunkedUploadJob::sendWhole()
+{
+    handed_over_ = true;
+    reader_.disconnect(this);
+    send();
+}
+
+void ChunkedUploadJob::onReadyRead()
+{
+    if (!collection_created_ || move_sent_ || promise_set_)
+    {
+        return;
+    }
+    while (int(in_flight_.size()) < max_parallel_)
+    {
+        int64_t n = min<int64_t>(reader_.bytesAvailable(),
+                                 chunk_size_ - current_.size());
+        if (n > 0)
+        {
+            current_.append(reader_.read(n));
+            bytes_read_ += n;
+        }
+        if (bytes_read_ > size_)
+        {
+            fail(boost::copy_exception(
+                     LogicException("Upload is larger than the declared size")));
+            return;
+        }
+        bool const complete = (bytes_read_ == size_);
+        if (current_.size() < chunk_size_ && !(complete && !current_.isEmpty()))
+        {
+            break;
+        }
+
+        unique_ptr<Chunk> chunk(new Chunk);
+        chunk->index = next_index_++;
+        chunk->data.swap(current_);
+        Chunk* c = chunk.get();
+        in_flight_.emplace(c->index, move(chunk));
+        sendChunk(c);
+    }
+
+    if (bytes_read_ == size_ && in_flight_.empty())
+    {
+        sendMove();
+    }
+    else if (read_channel_finished_ && reader_.bytesAvailable() == 0 &&
+             bytes_read_ < size_)
+    {
+        fail(boost::copy_exception(
+                 LogicException("Upload is smaller than the declared size")));
+    }
+}
+
+void ChunkedUploadJob::onReadChannelFinished()
+{
+    read_channel_finished_ = true;
+    onReadyRead();
+}
+
+void ChunkedUploadJob::sendChunk(Chunk* chunk)
+{
+    if (chunk->reply)
+    {
+        // Retrying: the previous attempt is still inside its
+        // finished signal handler.
+        chunk->reply.release()->deleteLater();
+        chunk->body.release()->deleteLater();
+    }
+    // Chunks are numbered from one, zero padded so the server's
+    // ordering by name matches the upload order.
+    QUrl url = upload_url_.resolved(
+        QUrl(QStringLiteral("%1").arg(chunk->index + 1, 5, 10, QChar('0'))));
+    QNetworkRequest request = makeRequest(url);
+    request.setHeader(QNetworkRequest::ContentLengthHeader,
+                      QVariant::fromValue(qint64(chunk->data.size())));
+
+    chunk->body.reset(new QBuffer);
+    chunk->body->setData(chunk->data);
+    chunk->body->open(QIODevice::ReadOnly);
+    chunk->reply.reset(provider_->send_request(
+        request, QByteArrayLiteral("PUT"), chunk->body.get(), context_));
+    assert(chunk->reply.get() != nullptr);
+    connect(chunk->reply.get(), &QNetworkReply::finished,
+            this, [this, chunk] { onChunkFinished(chunk); });
+}
+
+void ChunkedUploadJob::onChunkFinished(Chunk* chunk)
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    auto status = chunk->reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status / 100 != 2)
+    {
+        if (retry(chunk->reply.get(), chunk->attempts,
+                  [this, chunk] { sendChunk(chunk); }))
+        {
+            return;
+        }
+        fail(translate_http_error(chunk->reply.get(), QByteArray(), item_id_));
+        return;
+    }
+
+    chunk->reply.release()->deleteLater();
+    chunk->body.release()->deleteLater();
+    in_flight_.erase(chunk->index);
+    onReadyRead();
+}
+
+void ChunkedUploadJob::sendMove()
+{
+    move_sent_ = true;
+    QNetworkRequest request = makeRequest(
+        upload_url_.resolved(QUrl(QStringLiteral(".file"))));
+    if (!allow_overwrite_)
+    {
+        request.setRawHeader(QByteArrayLiteral("Overwrite"),
+                             QByteArrayLiteral("F"));
+    }
+
+    if (reply_)
+    {
+        reply_.release()->deleteLater();
+    }
+    reply_.reset(provider_->send_request(
+        request, QByteArrayLiteral("MOVE"), nullptr, context_));
+    assert(reply_.get() != nullptr);
+    connect(reply_.get(), &QNetworkReply::finished,
+            this, &ChunkedUploadJob::onMoveFinished);
+}
+
+void ChunkedUploadJob::onMoveFinished()
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    provider_->invalidate_cache(session_->base_url(), item_id_);
+    // If a retried MOVE can't find the upload, the previous attempt
+    // succeeded but we never saw the response.
+    if (status / 100 != 2 && !(status == 404 && attempts_ > 0))
+    {
+        if (retry(reply_.get(), attempts_, [this] { sendMove(); }))
+        {
+            return;
+        }
+        fail(translate_http_error(reply_.get(), QByteArray(), item_id_));
+        return;
+    }
+    collection_created_ = false;
+    handed_over_ = true;
+    // The MOVE response doesn't describe the assembled file.
+    complete(Item(), 0);
+}
+
+bool ChunkedUploadJob::retry(QNetworkReply* reply, int& attempts,
+                             function<void()> const& send)
+{
+    if (attempts >= max_retries_ || !is_transient_error(reply))
+    {
+        return false;
+    }
+    int const delay = RETRY_DELAY_MS << attempts;
+    attempts++;
+    qWarning() << "Retrying" << reply->url() << "in" << delay << "ms:"
+               << reply->errorString();
+    QTimer::singleShot(delay, this, [this, send] {
+            if (!promise_set_)
+            {
+                send();
+            }
+        });
+    return true;
+}
+
+void ChunkedUploadJob::fail(boost::exception_ptr const& error)
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    DavUploadJob::fail(error);
+
+    for (auto& pair : in_flight_)
+    {
+        pair.second->reply->abort();
+    }
+    if (reply_)
+    {
+        reply_->abort();
+    }
+    if (collection_created_)
+    {
+        // Clean up the partial upload on a best effort basis.
+        QNetworkRequest request(upload_url_);
+        DavProvider::set_request_priority(
+            request, RequestScheduler::Priority::background);
+        DavProvider::set_request_operation(request, QStringLiteral("upload"));
+        QNetworkReply* reply = provider_->send_request(
+            request, QByteArrayLiteral("DELETE"), nullptr, context_);
+        connect(reply, &QNetworkReply::finished,
+                reply, &QObject::deleteLater);
+        collection_created_ = false;
+    }
+}
+
+boost::future<void> ChunkedUploadJob::cancel()
+{
+    if (handed_over_)
+    {
+        return DavUploadJob::cancel();
+    }
+    if (!promise_set_)
+    {
+        if (precondition_ && !reply_)
+        {
+            precondition_->abort();
+        }
+        else
+        {
+            fail(boost::copy_exception(CancelledException("Upload cancelled")));
+        }
+    }
+    return boost::make_ready_future();
+}
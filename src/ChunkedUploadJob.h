@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QUrl>
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "DavUploadJob.h"
+#include "dav_properties.h"
+
+class RetrieveMetadataHandler;
+class QBuffer;
+
+// Upload a file using Nextcloud's chunked upload protocol: the data
+// is PUT in chunks to a collection created under the user's uploads
+// area, which is then MOVEd over the destination to assemble it.
+// Several chunks are kept in flight at once, and a failed chunk is
+// retried without restarting the upload.  If the server won't create
+// the collection, the file is sent with an ordinary PUT instead.
+class ChunkedUploadJob : public DavUploadJob
+{
+    Q_OBJECT
+public:
+    ChunkedUploadJob(std::shared_ptr<DavProvider> const& provider,
+                     QUrl const& upload_collection,
+                     std::string const& item_id, int64_t size,
+                     std::string const& content_type,
+                     bool allow_overwrite, std::string const& old_etag,
+                     PropertySet properties,
+                     unity::storage::provider::Context const& ctx);
+    ~ChunkedUploadJob();
+
+    boost::future<void> cancel() override;
+
+private Q_SLOTS:
+    void onMkcolFinished();
+    void onReadyRead();
+    void onReadChannelFinished();
+    void onMoveFinished();
+
+private:
+    struct Chunk
+    {
+        int index;
+        QByteArray data;
+        std::unique_ptr<QBuffer> body;
+        std::unique_ptr<QNetworkReply> reply;
+        int attempts = 0;
+    };
+
+    QNetworkRequest makeRequest(QUrl const& url) const;
+    void createCollection();
+    void sendWhole();
+    void sendChunk(Chunk* chunk);
+    void onChunkFinished(Chunk* chunk);
+    void sendMove();
+    bool retry(QNetworkReply* reply, int& attempts, std::function<void()> const& send);
+    void fail(boost::exception_ptr const& error);
+
+    QUrl const destination_;
+    QUrl const upload_url_;
+    int64_t const chunk_size_;
+    int const max_parallel_;
+    int const max_retries_;
+
+    std::unique_ptr<QNetworkReply> reply_;
+    bool collection_created_ = false;
+
+    QByteArray current_;
+    int next_index_ = 0;
+    int64_t bytes_read_ = 0;
+    bool read_channel_finished_ = false;
+    std::map<int, std::unique_ptr<Chunk>> in_flight_;
+    bool move_sent_ = false;
+    // Retries of the current MKCOL or MOVE request.
+    int attempts_ = 0;
+    // Set once DavUploadJob has taken over, either to PUT the file
+    // whole or to retrieve the assembled file's metadata.
+    bool handed_over_ = false;
+
+    std::unique_ptr<RetrieveMetadataHandler> precondition_;
+};
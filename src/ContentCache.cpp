@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "ContentCache.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <iterator>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+
+// Files are named with the hex SHA-1 of their key.
+constexpr int NAME_LENGTH = 40;
+constexpr int MAX_HEADER_LENGTH = 1024;
+
+}
+
+ContentCache::ContentCache(QString const& directory, int64_t budget)
+    : directory_(directory), budget_(max<int64_t>(0, budget))
+{
+    if (budget_ > 0)
+    {
+        load();
+    }
+}
+
+ContentCache::~ContentCache() = default;
+
+QString ContentCache::default_directory()
+{
+    return QStandardPaths::writableLocation(
+        QStandardPaths::GenericCacheLocation) +
+        QStringLiteral("/storage-provider-webdav/content");
+}
+
+bool ContentCache::enabled() const
+{
+    return budget_ > 0;
+}
+
+QString const& ContentCache::directory() const
+{
+    return directory_;
+}
+
+int64_t ContentCache::size() const
+{
+    return size_;
+}
+
+string ContentCache::file_name(string const& account, string const& item_id)
+{
+    // Item IDs are percent encoded, so can not contain a newline.
+    return QCryptographicHash::hash(
+        QByteArray::fromStdString(account + '\n' + item_id),
+        QCryptographicHash::Sha1).toHex().toStdString();
+}
+
+QString ContentCache::path(string const& name) const
+{
+    return directory_ + '/' + QString::fromStdString(name);
+}
+
+void ContentCache::load()
+{
+    QDir dir(directory_);
+    if (!dir.mkpath(QStringLiteral(".")))
+    {
+        qWarning() << "Could not create content cache directory" << directory_;
+        return;
+    }
+    // Most recently modified first.
+    for (auto const& info : dir.entryInfoList(QDir::Files | QDir::Hidden,
+                                              QDir::Time))
+    {
+        string const name = info.fileName().toStdString();
+        if (name.size() != NAME_LENGTH ||
+            name.find_first_not_of("0123456789abcdef") != string::npos)
+        {
+            // Left over from an interrupted write.
+            QFile::remove(info.filePath());
+            continue;
+        }
+        lru_.push_back({name, info.size()});
+        index_[name] = prev(lru_.end());
+        size_ += info.size();
+    }
+    evict();
+}
+
+bool ContentCache::open(string const& account, string const& item_id,
+                        CachedFile& cached)
+{
+    string const name = file_name(account, item_id);
+    auto it = index_.find(name);
+    if (it == index_.end())
+    {
+        return false;
+    }
+    unique_ptr<QFile> file(new QFile(path(name)));
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        drop(name);
+        return false;
+    }
+    QByteArray const header = file->readLine(MAX_HEADER_LENGTH);
+    if (!header.endsWith('\n'))
+    {
+        qWarning() << "Removing corrupt content cache file" << file->fileName();
+        file->remove();
+        drop(name);
+        return false;
+    }
+    // Record the use in the modification time, so the order survives
+    // restarts.
+    futimens(file->handle(), nullptr);
+    lru_.splice(lru_.begin(), lru_, it->second);
+
+    cached.etag = header.left(header.size() - 1).toStdString();
+    cached.offset = header.size();
+    cached.size = file->size() - header.size();
+    cached.file = move(file);
+    return true;
+}
+
+unique_ptr<QSaveFile> ContentCache::begin_write(string const& account,
+                                                string const& item_id,
+                                                string const& etag,
+                                                int64_t size)
+{
+    if (!enabled() || etag.empty() || etag.find('\n') != string::npos ||
+        etag.size() >= MAX_HEADER_LENGTH)
+    {
+        return nullptr;
+    }
+    QByteArray const header = QByteArray::fromStdString(etag) + '\n';
+    // Don't copy a file that commit() would only throw away.
+    if (size >= 0 && header.size() + size > budget_)
+    {
+        return nullptr;
+    }
+    unique_ptr<QSaveFile> file(new QSaveFile(path(file_name(account, item_id))));
+    if (!file->open(QIODevice::WriteOnly) ||
+        file->write(header) != header.size())
+    {
+        return nullptr;
+    }
+    return file;
+}
+
+bool ContentCache::commit(string const& account, string const& item_id,
+                          unique_ptr<QSaveFile> file)
+{
+    int64_t const size = file->size();
+    if (size > budget_)
+    {
+        // The file is discarded when it is destroyed.
+        return false;
+    }
+    if (!file->commit())
+    {
+        qWarning() << "Could not write content cache file" << file->fileName()
+                   << ":" << file->errorString();
+        return false;
+    }
+    string const name = file_name(account, item_id);
+    // The previous copy, if any, has been replaced.
+    drop(name);
+    lru_.push_front({name, size});
+    index_[name] = lru_.begin();
+    size_ += size;
+    evict();
+    return true;
+}
+
+void ContentCache::remove(string const& account, string const& item_id)
+{
+    string const name = file_name(account, item_id);
+    if (index_.find(name) != index_.end())
+    {
+        drop(name);
+        QFile::remove(path(name));
+    }
+}
+
+void ContentCache::drop(string const& name)
+{
+    auto it = index_.find(name);
+    if (it == index_.end())
+    {
+        return;
+    }
+    size_ -= it->second->size;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+void ContentCache::evict()
+{
+    while (size_ > budget_ && !lru_.empty())
+    {
+        Entry const& entry = lru_.back();
+        QFile::remove(path(entry.name));
+        size_ -= entry.size;
+        index_.erase(entry.name);
+        lru_.pop_back();
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class QFile;
+class QSaveFile;
+
+// A persistent cache of downloaded file contents, keyed by account
+// and item ID.
+//
+// Each file is stored with the ETag it was downloaded with on a
+// header line, so a cached copy can be served as is if the ETag is
+// known to be current, or revalidated with If-None-Match otherwise.
+// The total size is kept within a budget by evicting the least
+// recently used files.  The order of use is recorded in the files'
+// modification times, so it survives restarts.
+class ContentCache
+{
+public:
+    // A cached copy of a file, opened for reading.
+    struct CachedFile
+    {
+        std::unique_ptr<QFile> file;
+        std::string etag;
+        // Where the content starts, after the header, and its length.
+        int64_t offset = 0;
+        int64_t size = 0;
+    };
+
+    // A budget of zero disables the cache.
+    ContentCache(QString const& directory, int64_t budget);
+    ~ContentCache();
+
+    ContentCache(ContentCache const&) = delete;
+    ContentCache& operator=(ContentCache const&) = delete;
+
+    // A directory under $XDG_CACHE_HOME.
+    static QString default_directory();
+
+    bool enabled() const;
+    QString const& directory() const;
+    // The total size of the cached files.
+    int64_t size() const;
+
+    // Open the cached copy of a file, marking it as recently used.
+    bool open(std::string const& account, std::string const& item_id,
+              CachedFile& cached);
+    // Start writing a new copy of a file, to be passed to commit()
+    // once complete.  size is the length of the content if known, or
+    // else -1.  Returns nullptr if the cache is disabled, the file
+    // won't fit in the budget or it couldn't be created.
+    std::unique_ptr<QSaveFile> begin_write(std::string const& account,
+                                           std::string const& item_id,
+                                           std::string const& etag,
+                                           int64_t size);
+    // Replace the cached copy of a file with the new one, evicting
+    // other files if necessary to stay within the budget.
+    bool commit(std::string const& account, std::string const& item_id,
+                std::unique_ptr<QSaveFile> file);
+    void remove(std::string const& account, std::string const& item_id);
+
+private:
+    struct Entry
+    {
+        std::string name;
+        int64_t size;
+    };
+
+    static std::string file_name(std::string const& account,
+                                 std::string const& item_id);
+    QString path(std::string const& name) const;
+    void load();
+    // Forget a file, without removing it.
+    void drop(std::string const& name);
+    void evict();
+
+    QString const directory_;
+    int64_t const budget_;
+    int64_t size_ = 0;
+    // Most recently used files are at the front of the list.
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
@@ -17,7 +17,9 @@
  */
 
 #include "CopyMoveHandler.h"
+#include "DavProvider.h"
 #include "RetrieveMetadataHandler.h"
+#include "Trace.h"
 #include "item_id.h"
 #include "http_error.h"
 
@@ -29,15 +31,17 @@ CopyMoveHandler::CopyMoveHandler(shared_ptr<DavProvider> const& provider,
                                  string const& new_parent_id,
                                  string const& new_name,
                                  bool copy,
+                                 PropertySet properties,
                                  Context const& ctx)
     : provider_(provider), item_id_(item_id),
       new_item_id_(make_child_id(new_parent_id, new_name, is_folder(item_id))),
-      context_(ctx)
+      base_url_(provider->base_url(ctx)), copy_(copy),
+      properties_(properties), context_(ctx),
+      trace_call_(Trace::current_call())
 {
-    QUrl const base_url = provider->base_url(ctx);
-    QNetworkRequest request(id_to_url(item_id_, base_url));
+    QNetworkRequest request(id_to_url(item_id_, base_url_));
     request.setRawHeader(QByteArrayLiteral("Destination"),
-                         id_to_url(new_item_id_, base_url).toEncoded());
+                         id_to_url(new_item_id_, base_url_).toEncoded());
     // Error out of the operation would overwrite an existing resource.
     request.setRawHeader(QByteArrayLiteral("Overwrite"),
                          QByteArrayLiteral("F"));
@@ -59,18 +63,24 @@ boost::future<Item> CopyMoveHandler::get_future()
 void CopyMoveHandler::onFinished()
 {
     auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!copy_)
+    {
+        provider_->invalidate_cache(base_url_, item_id_);
+    }
+    provider_->invalidate_cache(base_url_, new_item_id_);
 
     if (status != 201 && status != 204)
     {
         promise_.set_exception(
             translate_http_error(reply_.get(), QByteArray(), item_id_));
+        Trace::end_call(trace_call_);
         deleteLater();
         return;
     }
 
     metadata_.reset(
         new RetrieveMetadataHandler(
-            provider_, new_item_id_, context_,
+            provider_, new_item_id_, properties_, context_,
             [this](Item const& item, boost::exception_ptr const& error) {
                 if (error)
                 {
@@ -80,6 +90,7 @@ void CopyMoveHandler::onFinished()
                 {
                     promise_.set_value(item);
                 }
+                Trace::end_call(trace_call_);
                 deleteLater();
             }));
 }
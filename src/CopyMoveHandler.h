@@ -23,8 +23,11 @@
 #include <QNetworkReply>
 #include <unity/storage/provider/ProviderBase.h>
 
+#include <cstdint>
 #include <memory>
 
+#include "dav_properties.h"
+
 class DavProvider;
 class RetrieveMetadataHandler;
 
@@ -36,6 +39,7 @@ public:
                     std::string const& new_parent_id,
                     std::string const& new_name,
                     bool copy,
+                    PropertySet properties,
                     unity::storage::provider::Context const& ctx);
     ~CopyMoveHandler();
 
@@ -50,7 +54,12 @@ private:
     std::shared_ptr<DavProvider> const provider_;
     std::string const item_id_;
     std::string const new_item_id_;
+    QUrl const base_url_;
+    bool const copy_;
+    PropertySet const properties_;
     unity::storage::provider::Context const context_;
+    // The D-Bus call this is the result of, for tracing.
+    uint64_t const trace_call_;
 
     std::unique_ptr<QNetworkReply> reply_;
     std::unique_ptr<RetrieveMetadataHandler> metadata_;
@@ -17,7 +17,9 @@
  */
 
 #include "CreateFolderHandler.h"
+#include "DavProvider.h"
 #include "RetrieveMetadataHandler.h"
+#include "Trace.h"
 #include "item_id.h"
 #include "http_error.h"
 
@@ -27,12 +29,14 @@ using namespace unity::storage::provider;
 CreateFolderHandler::CreateFolderHandler(shared_ptr<DavProvider> const& provider,
                                          string const& parent_id,
                                          string const& name,
+                                         PropertySet properties,
                                          Context const& ctx)
     : provider_(provider), item_id_(make_child_id(parent_id, name, true)),
-      context_(ctx)
+      base_url_(provider->base_url(ctx)), properties_(properties),
+      context_(ctx), trace_call_(Trace::current_call())
 {
-    QUrl const base_url = provider->base_url(ctx);
-    QNetworkRequest request(id_to_url(item_id_, base_url));
+    QNetworkRequest request(id_to_url(item_id_, base_url_));
+    DavProvider::set_request_operation(request, QStringLiteral("create_folder"));
     reply_.reset(provider->send_request(request, QByteArrayLiteral("MKCOL"),
                                         nullptr, ctx));
     connect(reply_.get(), &QNetworkReply::finished,
@@ -49,18 +53,20 @@ boost::future<Item> CreateFolderHandler::get_future()
 void CreateFolderHandler::onFinished()
 {
     auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    provider_->invalidate_cache(base_url_, item_id_);
 
     if (status != 201)
     {
         promise_.set_exception(
             translate_http_error(reply_.get(), QByteArray(), item_id_));
+        Trace::end_call(trace_call_);
         deleteLater();
         return;
     }
 
     metadata_.reset(
         new RetrieveMetadataHandler(
-            provider_, item_id_, context_,
+            provider_, item_id_, properties_, context_,
             [this](Item const& item, boost::exception_ptr const& error) {
                 if (error)
                 {
@@ -70,6 +76,7 @@ void CreateFolderHandler::onFinished()
                 {
                     promise_.set_value(item);
                 }
+                Trace::end_call(trace_call_);
                 deleteLater();
             }));
 }
@@ -23,8 +23,11 @@
 #include <QNetworkReply>
 #include <unity/storage/provider/ProviderBase.h>
 
+#include <cstdint>
 #include <memory>
 
+#include "dav_properties.h"
+
 class DavProvider;
 class RetrieveMetadataHandler;
 
@@ -33,6 +36,7 @@ class CreateFolderHandler : public QObject {
 public:
     CreateFolderHandler(std::shared_ptr<DavProvider> const& provider,
                         std::string const& parent_id, std::string const& name,
+                        PropertySet properties,
                         unity::storage::provider::Context const& ctx);
     ~CreateFolderHandler();
 
@@ -46,7 +50,11 @@ private:
 
     std::shared_ptr<DavProvider> const provider_;
     std::string const item_id_;
+    QUrl const base_url_;
+    PropertySet const properties_;
     unity::storage::provider::Context const context_;
+    // The D-Bus call this is the result of, for tracing.
+    uint64_t const trace_call_;
 
     std::unique_ptr<QNetworkReply> reply_;
     std::unique_ptr<RetrieveMetadataHandler> metadata_;
@@ -21,6 +21,10 @@
 #include "RetrieveMetadataHandler.h"
 #include "item_id.h"
 #include "http_error.h"
+#include "settings.h"
+
+#include <QDebug>
+#include <QTimer>
 
 #include <unity/storage/provider/Exceptions.h>
 
@@ -43,6 +47,10 @@ string make_download_id()
 }
 
 constexpr int CHUNK_SIZE = 64 * 1024;
+constexpr int64_t DEFAULT_RETRIES = 3;
+// Delay before the first attempt to resume, doubling for each
+// subsequent attempt.
+constexpr int RETRY_DELAY_MS = 500;
 
 }
 
@@ -51,18 +59,111 @@ DavDownloadJob::DavDownloadJob(shared_ptr<DavProvider> const& provider,
                                string const& match_etag,
                                Context const& ctx)
     : QObject(), DownloadJob(make_download_id()), provider_(provider),
-      item_id_(item_id)
+      item_id_(item_id), url_(id_to_url(item_id, provider->base_url(ctx))),
+      match_etag_(match_etag), context_(ctx),
+      max_retries_(get_setting("DAV_DOWNLOAD_RETRIES", DEFAULT_RETRIES)),
+      sink_(dup(write_socket()),
+            get_setting("DAV_DOWNLOAD_BUFFER_SIZE", 2 * CHUNK_SIZE),
+            get_setting("DAV_DOWNLOAD_BUFFER_LOW_WATERMARK", CHUNK_SIZE)),
+      account_(provider->session(ctx)->account())
+{
+    // Setting a larger maximum lets the buffer grow with throughput.
+    sink_.setMaxCapacity(get_setting("DAV_DOWNLOAD_BUFFER_MAX", 0));
+    connect(&sink_, &DownloadSink::writable,
+            this, &DavDownloadJob::onSinkWritable);
+
+    WriteBackQueue::Entry staged;
+    if (provider_->write_back().find(account_, item_id_, staged))
+    {
+        // Until the upload reaches the server, the staged data is the
+        // current content of the file.
+        cached_.file = provider_->write_back().open_data(staged);
+        cached_.etag = staged.provisional_etag;
+        cached_.size = staged.size;
+        serving_cache_ = true;
+        QTimer::singleShot(0, this, [this] {
+                if (finished_)
+                {
+                    return;
+                }
+                if (!match_etag_.empty() && match_etag_ != cached_.etag)
+                {
+                    handle_error(ConflictException(item_id_ + " has changed"));
+                }
+                else if (!cached_.file)
+                {
+                    handle_error(ResourceException(
+                        "Could not read staged upload of " + item_id_, 0));
+                }
+                else
+                {
+                    send_from_cache();
+                }
+            });
+        return;
+    }
+    if (provider_->content_cache().open(account_, item_id_, cached_))
+    {
+        // If recently retrieved metadata shows the cached copy is
+        // current, there is no need to ask the server.
+        Item item;
+        if ((match_etag_.empty() || match_etag_ == cached_.etag) &&
+            provider_->metadata_cache().get(account_, item_id_,
+                                            dav_property::required, item) &&
+            item.etag == cached_.etag)
+        {
+            serving_cache_ = true;
+            cache_offset_ = cached_.offset;
+            // The job hasn't been handed to the client yet.
+            QTimer::singleShot(0, this, [this] {
+                    if (!finished_)
+                    {
+                        send_from_cache();
+                    }
+                });
+            return;
+        }
+    }
+    send_request();
+}
+
+DavDownloadJob::~DavDownloadJob() = default;
+
+void DavDownloadJob::send_request()
 {
-    QUrl base_url = provider->base_url(ctx);
-    QNetworkRequest request(id_to_url(item_id, base_url));
-    if (!match_etag.empty())
+    QNetworkRequest request(url_);
+    if (!match_etag_.empty())
     {
         request.setRawHeader(QByteArrayLiteral("If-Match"),
-                             QByteArray::fromStdString(match_etag));
+                             QByteArray::fromStdString(match_etag_));
+    }
+    if (bytes_read_ > 0)
+    {
+        // Resume where the last attempt left off, provided the file
+        // hasn't changed in the mean time.
+        request.setRawHeader(QByteArrayLiteral("Range"),
+                             "bytes=" + QByteArray::number(qint64(bytes_read_)) + "-");
+        request.setRawHeader(QByteArrayLiteral("If-Range"), etag_);
+    }
+    else if (cached_.file)
+    {
+        // A 304 response means the cached copy can be sent.
+        request.setRawHeader(QByteArrayLiteral("If-None-Match"),
+                             QByteArray::fromStdString(cached_.etag));
     }
 
-    reply_.reset(provider->send_request(
-        request, QByteArrayLiteral("GET"), nullptr, ctx));
+    if (reply_)
+    {
+        reply_.release()->deleteLater();
+    }
+    seen_header_ = false;
+    is_error_ = false;
+    error_body_.clear();
+    DavProvider::set_request_priority(
+        request, RequestScheduler::Priority::transfer);
+    DavProvider::set_request_operation(request, QStringLiteral("download"));
+    reply_.reset(provider_->send_request(
+        request, QByteArrayLiteral("GET"), nullptr, context_));
     assert(reply_.get() != nullptr);
     reply_->setReadBufferSize(CHUNK_SIZE);
     connect(reply_.get(), &QNetworkReply::finished,
@@ -71,17 +172,97 @@ DavDownloadJob::DavDownloadJob(shared_ptr<DavProvider> const& provider,
             this, &DavDownloadJob::onReplyReadyRead);
     connect(reply_.get(), &QIODevice::readChannelFinished,
             this, &DavDownloadJob::onReplyReadChannelFinished);
-    writer_.setSocketDescriptor(
-        dup(write_socket()), QLocalSocket::ConnectedState, QIODevice::WriteOnly);
-    connect(&writer_, &QIODevice::bytesWritten,
-            this, &DavDownloadJob::onSocketBytesWritten);
 }
 
-DavDownloadJob::~DavDownloadJob() = default;
+bool DavDownloadJob::check_header()
+{
+    seen_header_ = true;
+    auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (bytes_read_ == 0)
+    {
+        if (status == 304 && cached_.file)
+        {
+            serving_cache_ = true;
+            cache_offset_ = cached_.offset;
+            send_from_cache();
+            return false;
+        }
+        if (status != 200)
+        {
+            is_error_ = true;
+        }
+        etag_ = reply_->rawHeader(QByteArrayLiteral("ETag"));
+        if (!is_error_)
+        {
+            // Our copy, if any, is out of date: save the new version
+            // as it is sent.
+            cached_ = ContentCache::CachedFile();
+            sink_.setCopy(nullptr);
+            QVariant const length = reply_->header(
+                QNetworkRequest::ContentLengthHeader);
+            cache_file_ = provider_->content_cache().begin_write(
+                account_, item_id_, etag_.toStdString(),
+                length.isValid() ? length.toLongLong() : -1);
+            sink_.setCopy(cache_file_.get());
+        }
+        return true;
+    }
+
+    // We are resuming a download.
+    if (status == 206 &&
+        reply_->rawHeader(QByteArrayLiteral("Content-Range")).startsWith(
+            "bytes " + QByteArray::number(qint64(bytes_read_)) + "-"))
+    {
+        return true;
+    }
+    if (status == 200)
+    {
+        // The If-Range check failed, so we've been sent a new
+        // version of the file.  We've already written out part of
+        // the old one, so can't continue.
+        handle_error(make_exception_ptr(ConflictException(
+            item_id_ + " changed while resuming download")));
+        return false;
+    }
+    if (status == 206)
+    {
+        handle_error(make_exception_ptr(RemoteCommsException(
+            "Unexpected Content-Range resuming download of " + item_id_)));
+        return false;
+    }
+    is_error_ = true;
+    return true;
+}
 
 void DavDownloadJob::onReplyFinished()
 {
-    if (!seen_header_ || is_error_)
+    if (finished_ || retry_pending_ || serving_cache_)
+    {
+        return;
+    }
+    if (reply_->error() != QNetworkReply::NoError &&
+        attempts_ < max_retries_ && is_transient_error(reply_.get()) &&
+        (bytes_read_ == 0 || (!etag_.isEmpty() && !etag_.startsWith("W/"))))
+    {
+        // The connection dropped: try again, picking up from the
+        // last byte we received.
+        int const delay = RETRY_DELAY_MS << attempts_;
+        attempts_++;
+        qWarning() << "Download of" << url_ << "interrupted after"
+                   << bytes_read_ << "bytes:" << reply_->errorString()
+                   << "- retrying in" << delay << "ms";
+        retry_pending_ = true;
+        QTimer::singleShot(delay, this, [this] {
+                if (retry_pending_)
+                {
+                    retry_pending_ = false;
+                    send_request();
+                }
+            });
+        return;
+    }
+    if (!seen_header_ || is_error_ ||
+        reply_->error() != QNetworkReply::NoError)
     {
         try
         {
@@ -97,14 +278,13 @@ void DavDownloadJob::onReplyFinished()
 
 void DavDownloadJob::onReplyReadyRead()
 {
-    if (!seen_header_)
+    if (finished_ || serving_cache_)
     {
-        seen_header_ = true;
-        auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-        if (status != 200)
-        {
-            is_error_ = true;
-        }
+        return;
+    }
+    if (!seen_header_ && !check_header())
+    {
+        return;
     }
 
     if (is_error_)
@@ -126,7 +306,20 @@ void DavDownloadJob::onReplyReadyRead()
 
 void DavDownloadJob::onReplyReadChannelFinished()
 {
-    if (is_error_)
+    if (finished_ || serving_cache_)
+    {
+        return;
+    }
+    // A response without a body, such as a 304, may not have been
+    // seen by onReplyReadyRead.
+    if (!seen_header_ && reply_->error() == QNetworkReply::NoError &&
+        !check_header())
+    {
+        return;
+    }
+    // If the connection dropped, onReplyFinished will decide whether
+    // to resume.
+    if (is_error_ || reply_->error() != QNetworkReply::NoError)
     {
         return;
     }
@@ -135,56 +328,93 @@ void DavDownloadJob::onReplyReadChannelFinished()
     maybe_send_chunk();
 }
 
-void DavDownloadJob::onSocketBytesWritten(int64_t bytes)
+void DavDownloadJob::onSinkWritable()
 {
-    if (is_error_)
+    if (finished_ || is_error_)
     {
         return;
     }
-
-    bytes_written_ += bytes;
-    maybe_send_chunk();
+    if (serving_cache_)
+    {
+        send_from_cache();
+    }
+    else
+    {
+        maybe_send_chunk();
+    }
 }
 
 void DavDownloadJob::maybe_send_chunk()
 {
-    assert(bytes_written_ <= bytes_read_);
-    // If there are outstanding writes, do nothing.
-    if (bytes_written_ < bytes_read_)
-    {
-        return;
-    }
-    // If there are no bytes available, return.
-    if (reply_->bytesAvailable() == 0)
+    // Read from the reply while earlier chunks are still being
+    // written, so the server isn't held up by a slow client.
+    for (;;)
     {
-        // If we've reached the end of the input, and all data has been
-        // written out, signal completion.
-        if (read_channel_finished_ && bytes_written_ == bytes_read_)
+        int64_t const n_read = sink_.fill(reply_.get());
+        if (n_read < 0)
         {
-            writer_.close();
-            report_complete();
+            handle_error(RemoteCommsException("Failed to read from server: " +
+                                              reply_->errorString().toStdString()));
+            return;
+        }
+        bytes_read_ += n_read;
+
+        int64_t const pending = sink_.pending();
+        if (!sink_.flush())
+        {
+            handle_error(ResourceException(
+                             "Error writing to socket: "
+                             + sink_.errorString().toStdString(), 0));
+            return;
+        }
+        // Stop once nothing more can be read or written.
+        if (sink_.pending() == pending &&
+            (n_read == 0 || !sink_.hasRoom()))
+        {
+            break;
         }
-        return;
     }
 
-    char buffer[CHUNK_SIZE];
-    int n_read = reply_->read(buffer, CHUNK_SIZE);
-    if (n_read < 0)
+    // If we've reached the end of the input, and all data has been
+    // written out, signal completion.
+    if (read_channel_finished_ && reply_->bytesAvailable() == 0 &&
+        sink_.pending() == 0)
     {
-        handle_error(RemoteCommsException("Failed to read from server: " +
-                                          reply_->errorString().toStdString()));
-        return;
+        finished_ = true;
+        sink_.close();
+        if (cache_file_)
+        {
+            sink_.setCopy(nullptr);
+            provider_->content_cache().commit(account_, item_id_,
+                                              move(cache_file_));
+        }
+        report_complete();
     }
-    bytes_read_ += n_read;
+}
 
-    int n_written = writer_.write(buffer, n_read);
-    if (n_written < 0)
+void DavDownloadJob::send_from_cache()
+{
+    int64_t const end = cached_.offset + cached_.size;
+    while (cache_offset_ < end)
     {
-        handle_error(ResourceException(
-                         "Error writing to socket: "
-                         + writer_.errorString().toStdString(), 0));
-        return;
+        int64_t const n = sink_.sendFile(cached_.file->handle(),
+                                         cache_offset_, end - cache_offset_);
+        if (n < 0)
+        {
+            handle_error(ResourceException(
+                             "Error writing to socket: "
+                             + sink_.errorString().toStdString(), 0));
+            return;
+        }
+        if (n == 0)
+        {
+            // Wait for the socket to drain.
+            return;
+        }
     }
+    finished_ = true;
+    sink_.close();
+    report_complete();
 }
 
 void DavDownloadJob::handle_error(StorageException const& exc)
@@ -195,16 +425,31 @@ void DavDownloadJob::handle_error(StorageException const& exc)
 void DavDownloadJob::handle_error(std::exception_ptr ep)
 {
     is_error_ = true;
-    reply_->close();
-    writer_.close();
+    finished_ = true;
+    retry_pending_ = false;
+    if (reply_)
+    {
+        reply_->close();
+    }
+    sink_.close();
+    sink_.setCopy(nullptr);
+    cache_file_.reset();
     report_error(ep);
 }
 
 
 boost::future<void> DavDownloadJob::cancel()
 {
-    reply_->abort();
-    writer_.close();
+    if (!finished_ && (retry_pending_ || serving_cache_))
+    {
+        handle_error(make_exception_ptr(
+                         CancelledException("download cancelled")));
+    }
+    if (reply_)
+    {
+        reply_->abort();
+    }
+    sink_.close();
     return boost::make_ready_future();
 }
 
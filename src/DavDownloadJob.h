@@ -18,10 +18,13 @@
 
 #pragma once
 
+#include "ContentCache.h"
+#include "DownloadSink.h"
+
 #include <QByteArray>
-#include <QLocalSocket>
 #include <QNetworkReply>
 #include <QObject>
+#include <QSaveFile>
 #include <QUrl>
 #include <unity/storage/provider/Exceptions.h>
 #include <unity/storage/provider/ProviderBase.h>
@@ -50,23 +53,46 @@ private Q_SLOTS:
     void onReplyReadyRead();
     void onReplyReadChannelFinished();
 
-    void onSocketBytesWritten(int64_t bytes);
+    void onSinkWritable();
 
 private:
+    void send_request();
+    bool check_header();
     void maybe_send_chunk();
+    void send_from_cache();
     void handle_error(unity::storage::provider::StorageException const& exc);
     void handle_error(std::exception_ptr ep);
 
     std::shared_ptr<DavProvider> const provider_;
     std::string const item_id_;
-    QLocalSocket writer_;
+    QUrl const url_;
+    std::string const match_etag_;
+    unity::storage::provider::Context const context_;
+    int const max_retries_;
+    DownloadSink sink_;
     std::unique_ptr<QNetworkReply> reply_;
 
+    std::string const account_;
+    // A previously downloaded copy of the file, served if it is known
+    // to be current or the server confirms it is.
+    ContentCache::CachedFile cached_;
+    bool serving_cache_ = false;
+    int64_t cache_offset_ = 0;
+    // A new copy being written as the file is downloaded.
+    std::unique_ptr<QSaveFile> cache_file_;
+
+    // The ETag of the file being downloaded, used to make sure a
+    // resumed request continues the same version of the file.
+    QByteArray etag_;
+    int attempts_ = 0;
+    bool retry_pending_ = false;
+
     bool seen_header_ = false;
     bool read_channel_finished_ = false;
     int64_t bytes_read_ = 0;
-    int64_t bytes_written_ = 0;
 
     bool is_error_ = false;
+    // Set once the job has reported completion or an error.
+    bool finished_ = false;
     QByteArray error_body_;
 };
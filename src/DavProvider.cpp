@@ -20,31 +20,192 @@
 #include "MultiStatusParser.h"
 #include "RootsHandler.h"
 #include "ListHandler.h"
-#include "LookupHandler.h"
-#include "MetadataHandler.h"
+#include "ListingSnapshot.h"
+#include "RetrieveMetadataHandler.h"
 #include "DavDownloadJob.h"
+#include "ParallelDownloadJob.h"
 #include "DavUploadJob.h"
+#include "ChunkedUploadJob.h"
+#include "BulkUploadJob.h"
 #include "CreateFolderHandler.h"
 #include "DeleteHandler.h"
 #include "CopyMoveHandler.h"
+#include "SessionReply.h"
+#include "StagedUploadJob.h"
+#include "StatsInterface.h"
+#include "SyncCollectionHandler.h"
+#include "Trace.h"
 #include "item_id.h"
+#include "settings.h"
 
 #include <QDateTime>
 #include <QDebug>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QPointer>
 #include <unity/storage/common.h>
 #include <unity/storage/provider/Exceptions.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
 using namespace std;
 using namespace unity::storage::provider;
 using namespace unity::storage::metadata;
 using unity::storage::ItemType;
 
+namespace
+{
+
+constexpr int64_t DEFAULT_METADATA_CACHE_SIZE = 10000;
+constexpr int64_t DEFAULT_METADATA_CACHE_TTL = 30;
+constexpr int64_t DEFAULT_LISTING_CACHE_SIZE = 100000;
+constexpr int64_t DEFAULT_LIST_PAGE_SIZE = 500;
+constexpr int64_t DEFAULT_CHUNKED_UPLOAD_THRESHOLD = 100 * 1024 * 1024;
+constexpr int64_t DEFAULT_PARALLEL_DOWNLOAD_THRESHOLD = 32 * 1024 * 1024;
+// The content cache is disabled unless given a budget.
+constexpr int64_t DEFAULT_CONTENT_CACHE_SIZE = 0;
+// Staging uploads on local disk is opt-in.
+constexpr int64_t DEFAULT_WRITE_BACK_MAX_SIZE = 64 * 1024 * 1024;
+constexpr int64_t DEFAULT_WRITE_BACK_PARALLEL = 2;
+// Uploads the server refused are kept for a week, for recovery.
+constexpr int64_t DEFAULT_WRITE_BACK_MAX_FAILED = 20;
+constexpr int64_t DEFAULT_WRITE_BACK_FAILED_TTL = 7 * 24 * 60 * 60;
+// Small uploads arriving within the window share a bulk upload.
+constexpr int64_t DEFAULT_BULK_UPLOAD_MAX_SIZE = 1024 * 1024;
+constexpr int64_t DEFAULT_BULK_UPLOAD_WINDOW_MS = 10;
+constexpr int64_t DEFAULT_BULK_UPLOAD_MAX_FILES = 100;
+// The number of partially consumed listings to keep around.  More
+// are kept while clients are still paging through them.
+constexpr size_t MAX_LISTING_SNAPSHOTS = 16;
+// Listings not paged through for this long can be evicted to stay
+// within the limit, and are dropped regardless after the TTL.
+constexpr chrono::seconds LISTING_SNAPSHOT_IDLE_TIME(30);
+constexpr chrono::minutes LISTING_SNAPSHOT_TTL(10);
+
+constexpr int64_t DEFAULT_MAX_REQUESTS_PER_HOST = 6;
+// With HTTP/2, requests are multiplexed over one connection, so many
+// more can usefully be in flight.
+constexpr int64_t DEFAULT_MAX_REQUESTS_PER_HOST_HTTP2 = 32;
+// Requests that wait longer than this for a slot are logged.
+constexpr chrono::seconds SLOW_QUEUE_WAIT(1);
+
+char const OC_NS[] = "http://owncloud.org/ns";
+
+// The request attribute holding a RequestScheduler::Priority.
+QNetworkRequest::Attribute const PRIORITY_ATTRIBUTE = QNetworkRequest::User;
+QNetworkRequest::Attribute const OPERATION_ATTRIBUTE =
+    static_cast<QNetworkRequest::Attribute>(QNetworkRequest::User + 1);
+
+QString content_cache_directory()
+{
+    QByteArray const dir = qgetenv("DAV_CONTENT_CACHE_DIR");
+    return dir.isEmpty() ? ContentCache::default_directory()
+                         : QString::fromLocal8Bit(dir);
+}
+
+QString write_back_directory()
+{
+    QByteArray const dir = qgetenv("DAV_WRITE_BACK_DIR");
+    return dir.isEmpty() ? WriteBackQueue::default_directory()
+                         : QString::fromLocal8Bit(dir);
+}
+
+// Requests are limited per server, irrespective of path.
+string host_key(QUrl const& url)
+{
+    return url.adjusted(QUrl::RemoveUserInfo | QUrl::RemovePath |
+                        QUrl::RemoveQuery | QUrl::RemoveFragment)
+        .toString().toStdString();
+}
+
+string request_key(string const& account, string const& item_id, int depth,
+                   PropertySet properties)
+{
+    return account + '\n' + item_id + '\n' + to_string(depth) + '\n' +
+        to_string(properties);
+}
+
+// The prefix shared by the request keys of an item and, for folders,
+// its descendants.
+string request_prefix(string const& account, string const& item_id)
+{
+    if (item_id == ".")
+    {
+        return account + '\n';
+    }
+    if (is_folder(item_id))
+    {
+        return account + '\n' + item_id;
+    }
+    return account + '\n' + item_id + '\n';
+}
+
+// A metadata request shared by several callers, which cleans up after
+// itself once finished.
+class SharedMetadataHandler : public RetrieveMetadataHandler
+{
+public:
+    using RetrieveMetadataHandler::RetrieveMetadataHandler;
+
+protected:
+    void finish() override
+    {
+        RetrieveMetadataHandler::finish();
+        deleteLater();
+    }
+};
+
+}
+
 DavProvider::DavProvider()
-    : network_(new QNetworkAccessManager)
+    : network_(new QNetworkAccessManager),
+      metadata_cache_(get_setting("DAV_METADATA_CACHE_SIZE",
+                                  DEFAULT_METADATA_CACHE_SIZE),
+                      chrono::seconds(get_setting("DAV_METADATA_CACHE_TTL",
+                                                  DEFAULT_METADATA_CACHE_TTL))),
+      listing_cache_(get_setting("DAV_LISTING_CACHE_SIZE",
+                                 DEFAULT_LISTING_CACHE_SIZE)),
+      content_cache_(content_cache_directory(),
+                     get_setting("DAV_CONTENT_CACHE_SIZE",
+                                 DEFAULT_CONTENT_CACHE_SIZE)),
+      list_page_size_(get_setting("DAV_LIST_PAGE_SIZE", DEFAULT_LIST_PAGE_SIZE)),
+      chunked_upload_threshold_(get_setting("DAV_CHUNKED_UPLOAD_THRESHOLD",
+                                            DEFAULT_CHUNKED_UPLOAD_THRESHOLD)),
+      write_back_max_size_(get_setting("DAV_WRITE_BACK_MAX_SIZE",
+                                       DEFAULT_WRITE_BACK_MAX_SIZE)),
+      bulk_upload_max_size_(get_setting("DAV_BULK_UPLOAD_MAX_SIZE",
+                                        DEFAULT_BULK_UPLOAD_MAX_SIZE)),
+      parallel_download_threshold_(get_setting("DAV_PARALLEL_DOWNLOAD_THRESHOLD",
+                                               DEFAULT_PARALLEL_DOWNLOAD_THRESHOLD)),
+      delta_sync_(get_setting_flag("DAV_DELTA_SYNC", true)),
+      session_cookies_(get_setting_flag("DAV_SESSION_COOKIES", true)),
+      http2_(get_setting_flag("DAV_HTTP2", false)),
+      scheduler_(get_setting("DAV_MAX_REQUESTS_PER_HOST",
+                             http2_ ? DEFAULT_MAX_REQUESTS_PER_HOST_HTTP2
+                                    : DEFAULT_MAX_REQUESTS_PER_HOST)),
+      stats_interface_(StatsInterface::publish(stats_)),
+      bulk_uploader_(*this, get_setting("DAV_BULK_UPLOAD_WINDOW",
+                                        DEFAULT_BULK_UPLOAD_WINDOW_MS),
+                     get_setting("DAV_BULK_UPLOAD_MAX_FILES",
+                                 DEFAULT_BULK_UPLOAD_MAX_FILES)),
+      write_back_(*this, write_back_directory(),
+                  get_setting_flag("DAV_WRITE_BACK", false),
+                  get_setting("DAV_WRITE_BACK_PARALLEL",
+                              DEFAULT_WRITE_BACK_PARALLEL),
+                  get_setting("DAV_WRITE_BACK_MAX_FAILED",
+                              DEFAULT_WRITE_BACK_MAX_FAILED),
+                  chrono::seconds(get_setting("DAV_WRITE_BACK_FAILED_TTL",
+                                              DEFAULT_WRITE_BACK_FAILED_TTL)))
 {
+#if QT_VERSION < QT_VERSION_CHECK(5, 8, 0)
+    if (http2_)
+    {
+        qWarning() << "DAV_HTTP2 is set, but HTTP/2 needs Qt 5.8 or later";
+    }
+#endif
 }
 
 DavProvider::~DavProvider() = default;
@@ -57,8 +218,9 @@ std::shared_ptr<DavProvider> DavProvider::shared_from_this()
 boost::future<ItemList> DavProvider::roots(
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
-    auto handler = new RootsHandler(shared_from_this(), ctx);
+    Trace::Call call("roots", ".");
+    auto handler = new RootsHandler(
+        shared_from_this(), properties_for_keys(metadata_keys), ctx);
     return handler->get_future();
 }
 
@@ -66,45 +228,145 @@ boost::future<tuple<ItemList,string>> DavProvider::list(
     string const& item_id, string const& page_token,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
+    Trace::Call call("list", item_id);
     if (!is_folder(item_id))
     {
         throw LogicException(item_id + " is not a folder");
     }
+    string const account = session(ctx)->account();
     if (!page_token.empty())
     {
-        throw InvalidArgumentException("Invalid paging token: " + page_token);
+        size_t offset = 0;
+        auto snapshot = find_snapshot(page_token, offset);
+        if (!snapshot || snapshot->account() != account ||
+            snapshot->folder_id() != item_id)
+        {
+            throw InvalidArgumentException("Invalid paging token: " + page_token);
+        }
+        auto page = snapshot->get_page(offset);
+        prune_snapshots();
+        return call.returning(move(page));
     }
-    auto handler = new ListHandler(shared_from_this(), item_id, ctx);
-    return handler->get_future();
+
+    // Share a listing of the same folder that is still in progress.
+    PropertySet const properties = properties_for_keys(metadata_keys);
+    string const key = request_key(account, item_id, 1, properties);
+    auto it = listing_requests_.find(key);
+    if (it != listing_requests_.end())
+    {
+        auto snapshot = it->second.lock();
+        if (snapshot && !snapshot->is_complete())
+        {
+            snapshot->add_consumer();
+            return call.returning(snapshot->get_page(0));
+        }
+        listing_requests_.erase(it);
+    }
+
+    auto snapshot = make_shared<ListingSnapshot>(
+        to_string(next_snapshot_id_++), account, item_id, list_page_size_);
+    auto handler = new ListHandler(shared_from_this(), item_id, properties,
+                                   snapshot, ctx);
+    auto page = handler->get_future();
+    snapshots_.push_back(snapshot);
+    listing_requests_[key] = snapshot;
+    prune_snapshots();
+    return call.returning(move(page));
 }
 
 boost::future<ItemList> DavProvider::lookup(
     string const& parent_id, string const& name,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
     string item_id = make_child_id(parent_id, name);
-    auto handler = new LookupHandler(shared_from_this(), item_id, ctx);
-    return handler->get_future();
+    Trace::Call call("lookup", item_id);
+    PropertySet const properties = properties_for_keys(metadata_keys);
+    auto const s = session(ctx);
+    Item item;
+    WriteBackQueue::Entry staged;
+    if (write_back_.find(s->account(), item_id, staged))
+    {
+        // The server doesn't have the staged data yet.
+        item = write_back_.provisional_item(staged, *s);
+    }
+    if (!item.item_id.empty() ||
+        metadata_cache_.get(s->account(), item_id, properties, item))
+    {
+        boost::promise<ItemList> p;
+        p.set_value(ItemList{move(item)});
+        return call.returning(p.get_future());
+    }
+    auto p = make_shared<boost::promise<ItemList>>();
+    auto future = p->get_future();
+    uint64_t const call_id = call.id();
+    retrieve_metadata(
+        item_id, properties, ctx,
+        [p, call_id](Item const& item, boost::exception_ptr const& error) {
+            if (error)
+            {
+                p->set_exception(error);
+            }
+            else
+            {
+                p->set_value(ItemList{item});
+            }
+            Trace::end_call(call_id);
+        });
+    return future;
 }
 
 boost::future<Item> DavProvider::metadata(
     string const& item_id, vector<string> const& metadata_keys,
     Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
-    auto handler = new MetadataHandler(shared_from_this(), item_id, ctx);
-    return handler->get_future();
+    Trace::Call call("metadata", item_id);
+    PropertySet const properties = properties_for_keys(metadata_keys);
+    auto const s = session(ctx);
+    Item item;
+    WriteBackQueue::Entry staged;
+    if (write_back_.find(s->account(), item_id, staged))
+    {
+        // The server doesn't have the staged data yet.
+        item = write_back_.provisional_item(staged, *s);
+    }
+    if (!item.item_id.empty() ||
+        metadata_cache_.get(s->account(), item_id, properties, item))
+    {
+        boost::promise<Item> p;
+        p.set_value(move(item));
+        return call.returning(p.get_future());
+    }
+    auto p = make_shared<boost::promise<Item>>();
+    auto future = p->get_future();
+    uint64_t const call_id = call.id();
+    retrieve_metadata(
+        item_id, properties, ctx,
+        [p, item_id, call_id](Item const& item, boost::exception_ptr const& error) {
+            if (error)
+            {
+                p->set_exception(error);
+            }
+            else if (item.item_id != item_id)
+            {
+                p->set_exception(RemoteCommsException("PROPFIND request returned data about the wrong item"));
+            }
+            else
+            {
+                p->set_value(item);
+            }
+            Trace::end_call(call_id);
+        });
+    return future;
 }
 
 boost::future<Item> DavProvider::create_folder(
     string const& parent_id, string const& name,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
+    Trace::Call call("create_folder", parent_id);
     auto handler = new CreateFolderHandler(
-        shared_from_this(), parent_id, name, ctx);
+        shared_from_this(), parent_id, name,
+        properties_for_keys(metadata_keys), ctx);
     return handler->get_future();
 }
 
@@ -113,39 +375,128 @@ boost::future<unique_ptr<UploadJob>> DavProvider::create_file(
     string const& content_type, bool allow_overwrite,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
     string item_id = make_child_id(parent_id, name);
+    Trace::Call call("create_file", item_id);
     boost::promise<unique_ptr<UploadJob>> p;
-    p.set_value(unique_ptr<UploadJob>(new DavUploadJob(
-        shared_from_this(), item_id, size, content_type, allow_overwrite,
-        string(), ctx)));
-    return p.get_future();
+    p.set_value(make_upload_job(item_id, size, content_type, allow_overwrite,
+                                string(), properties_for_keys(metadata_keys),
+                                ctx));
+    return call.returning(p.get_future());
 }
 
 boost::future<unique_ptr<UploadJob>> DavProvider::update(
     string const& item_id, int64_t size, string const& old_etag,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
+    Trace::Call call("update", item_id);
     boost::promise<unique_ptr<UploadJob>> p;
-    p.set_value(unique_ptr<UploadJob>(new DavUploadJob(
-        shared_from_this(), item_id, size, string(), true, old_etag, ctx)));
-    return p.get_future();
+    p.set_value(make_upload_job(item_id, size, string(), true, old_etag,
+                                properties_for_keys(metadata_keys), ctx));
+    return call.returning(p.get_future());
+}
+
+unique_ptr<UploadJob> DavProvider::make_upload_job(
+    string const& item_id, int64_t size, string const& content_type,
+    bool allow_overwrite, string const& client_etag, PropertySet properties,
+    Context const& ctx)
+{
+    string const old_etag = write_back_.resolve_etag(
+        session(ctx)->account(), item_id, client_etag);
+    if (write_back_.enabled() && size <= write_back_max_size_)
+    {
+        // Staged uploads are sent without preconditions, as the
+        // client has long been told they succeeded by the time the
+        // server could refuse them.  An update of a file that is
+        // still staged can be checked against the provisional ETag
+        // though, since nothing else will reach the server first.
+        bool unconditional = allow_overwrite && old_etag.empty();
+        WriteBackQueue::Entry staged;
+        if (allow_overwrite && !old_etag.empty() &&
+            write_back_.find(session(ctx)->account(), item_id, staged))
+        {
+            if (old_etag != staged.provisional_etag)
+            {
+                throw ConflictException(
+                    "Update of " + item_id + " does not match staged upload");
+            }
+            unconditional = true;
+        }
+        if (unconditional)
+        {
+            // The metadata of the provisional item is all there is
+            // until the upload reaches the server, so requested
+            // properties beyond it aren't available.
+            return unique_ptr<UploadJob>(new StagedUploadJob(
+                shared_from_this(), item_id, size, content_type, ctx));
+        }
+    }
+    // Bulk uploads always overwrite, so can't be used for updates
+    // or for files that mustn't replace an existing one.
+    if (allow_overwrite && old_etag.empty() && bulk_upload_max_size_ > 0 &&
+        size <= bulk_upload_max_size_ && bulk_uploader_.supported(*session(ctx)))
+    {
+        return unique_ptr<UploadJob>(new BulkUploadJob(
+            shared_from_this(), item_id, size, content_type, properties, ctx));
+    }
+    if (chunked_upload_threshold_ > 0 && size >= chunked_upload_threshold_)
+    {
+        QUrl collection = upload_collection_url(ctx);
+        if (collection.isValid())
+        {
+            return unique_ptr<UploadJob>(new ChunkedUploadJob(
+                shared_from_this(), collection, item_id, size, content_type,
+                allow_overwrite, old_etag, properties, ctx));
+        }
+    }
+    return unique_ptr<UploadJob>(new DavUploadJob(
+        shared_from_this(), item_id, size, content_type, allow_overwrite,
+        old_etag, properties, ctx));
 }
 
 boost::future<unique_ptr<DownloadJob>> DavProvider::download(
-    string const& item_id, string const& match_etag, Context const& ctx)
+    string const& item_id, string const& client_etag, Context const& ctx)
 {
+    Trace::Call call("download", item_id);
     boost::promise<unique_ptr<DownloadJob>> p;
+    // We only know the size of the file up front if we've seen its
+    // metadata recently.  Staged uploads are served from local disk.
+    string const account = session(ctx)->account();
+    string const match_etag = write_back_.resolve_etag(
+        account, item_id, client_etag);
+    Item item;
+    WriteBackQueue::Entry staged;
+    if (parallel_download_threshold_ > 0 &&
+        !write_back_.find(account, item_id, staged) &&
+        metadata_cache_.get(account, item_id,
+                            dav_property::required |
+                            dav_property::getcontentlength, item) &&
+        !item.etag.empty() &&
+        (match_etag.empty() || match_etag == item.etag))
+    {
+        auto it = item.metadata.find(SIZE_IN_BYTES);
+        int64_t const* size = it != item.metadata.end() ?
+            boost::get<int64_t>(&it->second) : nullptr;
+        if (size != nullptr && *size >= parallel_download_threshold_)
+        {
+            p.set_value(unique_ptr<DownloadJob>(new ParallelDownloadJob(
+                shared_from_this(), item_id, match_etag, item.etag,
+                *size, ctx)));
+            return call.returning(p.get_future());
+        }
+    }
     p.set_value(unique_ptr<DownloadJob>(new DavDownloadJob(
         shared_from_this(), item_id, match_etag, ctx)));
-    return p.get_future();
+    return call.returning(p.get_future());
 }
 
 boost::future<void> DavProvider::delete_item(
     string const& item_id, Context const& ctx)
 {
-    auto handler = new DeleteHandler(shared_from_this(), item_id, ctx);
+    Trace::Call call("delete_item", item_id);
+    // Staged uploads would recreate the item, and may be all there
+    // is of it so far.
+    bool const staged = write_back_.cancel(session(ctx)->account(), item_id);
+    auto handler = new DeleteHandler(shared_from_this(), item_id, staged, ctx);
     return handler->get_future();
 }
 
@@ -153,9 +504,11 @@ boost::future<Item> DavProvider::move(
     string const& item_id, string const& new_parent_id, string const& new_name,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
+    Trace::Call call("move", item_id);
+    check_not_staged(item_id, new_parent_id, new_name, ctx);
     auto handler = new CopyMoveHandler(
-        shared_from_this(), item_id, new_parent_id, new_name, false, ctx);
+        shared_from_this(), item_id, new_parent_id, new_name, false,
+        properties_for_keys(metadata_keys), ctx);
     return handler->get_future();
 }
 
@@ -163,17 +516,555 @@ boost::future<Item> DavProvider::copy(
     string const& item_id, string const& new_parent_id, string const& new_name,
     vector<string> const& metadata_keys, Context const& ctx)
 {
-    Q_UNUSED(metadata_keys);
+    Trace::Call call("copy", item_id);
+    check_not_staged(item_id, new_parent_id, new_name, ctx);
     auto handler = new CopyMoveHandler(
-        shared_from_this(), item_id, new_parent_id, new_name, true, ctx);
+        shared_from_this(), item_id, new_parent_id, new_name, true,
+        properties_for_keys(metadata_keys), ctx);
     return handler->get_future();
 }
 
-Item DavProvider::make_item(QUrl const& href, QUrl const& base_url,
+void DavProvider::check_not_staged(string const& item_id,
+                                   string const& new_parent_id,
+                                   string const& new_name,
+                                   Context const& ctx) const
+{
+    // The server doesn't have the staged data yet, and would have
+    // the destination overwritten once it arrives.
+    string const account = session(ctx)->account();
+    string const new_id = make_child_id(new_parent_id, new_name,
+                                        is_folder(item_id));
+    for (auto const& id : {item_id, new_id})
+    {
+        if (write_back_.busy(account, id))
+        {
+            throw ResourceException(
+                "Upload of " + id + " has not completed", EBUSY);
+        }
+    }
+}
+
+shared_ptr<ListingSnapshot> DavProvider::find_snapshot(
+    string const& page_token, size_t& offset) const
+{
+    string id;
+    if (!ListingSnapshot::parse_page_token(page_token, id, offset))
+    {
+        return nullptr;
+    }
+    for (auto const& snapshot : snapshots_)
+    {
+        if (snapshot->id() == id)
+        {
+            return snapshot;
+        }
+    }
+    return nullptr;
+}
+
+void DavProvider::prune_snapshots()
+{
+    auto const now = ListingSnapshot::Clock::now();
+    snapshots_.remove_if([now](shared_ptr<ListingSnapshot> const& snapshot) {
+            return snapshot->is_drained() ||
+                now - snapshot->last_used() > LISTING_SNAPSHOT_TTL;
+        });
+    // Evicting a listing a client is still paging through would
+    // invalidate its next page token, so only idle ones go.
+    while (snapshots_.size() > MAX_LISTING_SNAPSHOTS)
+    {
+        auto lru = min_element(
+            snapshots_.begin(), snapshots_.end(),
+            [](shared_ptr<ListingSnapshot> const& a,
+               shared_ptr<ListingSnapshot> const& b) {
+                return a->last_used() < b->last_used();
+            });
+        if (now - (*lru)->last_used() < LISTING_SNAPSHOT_IDLE_TIME)
+        {
+            break;
+        }
+        snapshots_.erase(lru);
+    }
+    for (auto it = listing_requests_.begin(); it != listing_requests_.end(); )
+    {
+        auto snapshot = it->second.lock();
+        if (!snapshot || snapshot->is_complete())
+        {
+            it = listing_requests_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+string DavProvider::account_key(QUrl const& base_url)
+{
+    return base_url.toEncoded().toStdString();
+}
+
+MetadataCache& DavProvider::metadata_cache()
+{
+    return metadata_cache_;
+}
+
+ListingCache& DavProvider::listing_cache()
+{
+    return listing_cache_;
+}
+
+ContentCache& DavProvider::content_cache()
+{
+    return content_cache_;
+}
+
+WriteBackQueue& DavProvider::write_back()
+{
+    return write_back_;
+}
+
+BulkUploader& DavProvider::bulk_uploader()
+{
+    return bulk_uploader_;
+}
+
+void DavProvider::retrieve_metadata(string const& item_id,
+                                    PropertySet properties, Context const& ctx,
+                                    Singleflight<Item>::Callback callback)
+{
+    string const key = request_key(session(ctx)->account(), item_id, 0,
+                                   properties);
+    uint64_t const flight = metadata_requests_.join(key, move(callback));
+    if (flight == 0)
+    {
+        return;
+    }
+    new SharedMetadataHandler(
+        shared_from_this(), item_id, properties, ctx,
+        [this, key, flight](Item const& item, boost::exception_ptr const& error) {
+            metadata_requests_.finish(key, flight, item, error);
+        });
+}
+
+void DavProvider::invalidate_cache(QUrl const& base_url, string const& item_id)
+{
+    string const account = account_key(base_url);
+    metadata_cache_.remove_tree(account, item_id);
+    listing_cache_.remove_tree(account, item_id);
+    content_cache_.remove(account, item_id);
+    forget_requests(request_prefix(account, item_id));
+    string const parent = parent_id(item_id);
+    if (!parent.empty())
+    {
+        metadata_cache_.remove(account, parent);
+        listing_cache_.remove(account, parent);
+        forget_requests(account + '\n' + parent + '\n');
+    }
+}
+
+void DavProvider::synchronize(Context const& ctx,
+                              Singleflight<bool>::Callback callback)
+{
+    string const account = session(ctx)->account();
+    auto const& state = sync_state_[account];
+    if (!delta_sync_ || state.unsupported)
+    {
+        callback(false, boost::exception_ptr());
+        return;
+    }
+    uint64_t const flight = sync_requests_.join(account, move(callback));
+    if (flight == 0)
+    {
+        return;
+    }
+    new SyncCollectionHandler(
+        shared_from_this(), state.token, ctx,
+        [this, account, flight](string const& token, bool delta,
+                                boost::exception_ptr const& error) {
+            auto& state = sync_state_[account];
+            state.generation++;
+            if (!error)
+            {
+                if (token.empty())
+                {
+                    qDebug() << "Server does not support sync-collection";
+                    state.unsupported = true;
+                }
+                else if (!delta)
+                {
+                    // Listings cached before the starting point may
+                    // already be out of date.
+                    listing_cache_.remove_tree(account, ".");
+                }
+                state.token = token;
+            }
+            sync_requests_.finish(account, flight, !error && delta, error);
+        });
+}
+
+bool DavProvider::needs_sync_baseline(string const& account) const
+{
+    if (!delta_sync_)
+    {
+        return false;
+    }
+    auto it = sync_state_.find(account);
+    return it == sync_state_.end() ||
+        (!it->second.unsupported && it->second.token.empty());
+}
+
+uint64_t DavProvider::sync_generation(string const& account) const
+{
+    auto it = sync_state_.find(account);
+    return it != sync_state_.end() ? it->second.generation : 0;
+}
+
+void DavProvider::apply_change(QUrl const& base_url, Item const& item,
+                               PropertySet properties)
+{
+    string const account = account_key(base_url);
+    metadata_cache_.put(account, item, properties);
+    if (is_folder(item.item_id))
+    {
+        listing_cache_.set_etag(account, item.item_id, item.etag);
+    }
+    string const parent = parent_id(item.item_id);
+    if (!parent.empty())
+    {
+        listing_cache_.update_item(account, parent, item, properties);
+    }
+}
+
+void DavProvider::apply_removal(QUrl const& base_url, string const& item_id)
+{
+    string const account = account_key(base_url);
+    metadata_cache_.remove_tree(account, item_id);
+    listing_cache_.remove_tree(account, item_id);
+    content_cache_.remove(account, item_id);
+    string const parent = parent_id(item_id);
+    if (!parent.empty())
+    {
+        listing_cache_.remove_item(account, parent, item_id);
+    }
+}
+
+void DavProvider::forget_requests(string const& prefix)
+{
+    // Requests started before a modification mustn't satisfy callers
+    // that arrive after it.
+    metadata_requests_.forget_prefix(prefix);
+    for (auto it = listing_requests_.begin(); it != listing_requests_.end(); )
+    {
+        if (it->first.compare(0, prefix.size(), prefix) == 0)
+        {
+            it = listing_requests_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+shared_ptr<DavSession const> DavProvider::session(Context const& ctx) const
+{
+    string identity, secret;
+    if (auto creds = boost::get<PasswordCredentials>(&ctx.credentials))
+    {
+        identity = creds->host + '\n' + creds->username;
+        secret = creds->password;
+    }
+
+    auto& entry = sessions_[identity];
+    if (!entry.session || entry.secret != secret)
+    {
+        entry.secret = secret;
+        entry.session = make_session(ctx);
+        // Uploads recovered from the journal wait for credentials.
+        write_back_.set_context(entry.session->account(), ctx);
+    }
+    return entry.session;
+}
+
+QUrl DavProvider::base_url(Context const& ctx) const
+{
+    return session(ctx)->base_url();
+}
+
+QUrl DavProvider::upload_collection_url(Context const& ctx) const
+{
+    auto const s = session(ctx);
+    if (chunked_unsupported_.find(s->account()) != chunked_unsupported_.end())
+    {
+        return QUrl();
+    }
+    return s->upload_collection_url();
+}
+
+void DavProvider::chunked_upload_unsupported(string const& account)
+{
+    chunked_unsupported_.insert(account);
+}
+
+QNetworkReply *DavProvider::send_request(
+    QNetworkRequest& request, QByteArray const& verb, QIODevice* data,
+    Context const& ctx) const
+{
+    auto const s = session(ctx);
+    if (http2_)
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+        request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+        request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+    }
+    if (session_cookies_)
+    {
+        // Cookies are tracked per session rather than in the network
+        // manager's shared jar.
+        request.setAttribute(QNetworkRequest::CookieLoadControlAttribute,
+                             QNetworkRequest::Manual);
+        request.setAttribute(QNetworkRequest::CookieSaveControlAttribute,
+                             QNetworkRequest::Manual);
+    }
+
+    auto const priority = request_priority(request);
+    auto reply = new SessionReply(request, verb);
+    QPointer<SessionReply> guard(reply);
+    auto const queued_at = RequestScheduler::Clock::now();
+    uint64_t const trace_id = trace_request(reply, request, verb);
+    uint64_t const ticket = scheduler_.submit(
+        host_key(request.url()), s->account(), priority,
+        [this, s, guard, request, verb, data, queued_at, trace_id]() {
+            if (!guard || guard->isFinished())
+            {
+                return;
+            }
+            Trace::step("request", "sent", trace_id);
+            auto const wait = RequestScheduler::Clock::now() - queued_at;
+            if (wait > SLOW_QUEUE_WAIT)
+            {
+                qDebug() << "Request for" << request.url().path()
+                         << "waited"
+                         << chrono::duration_cast<chrono::milliseconds>(wait).count()
+                         << "ms to be sent";
+            }
+            QNetworkRequest req = request;
+            start_request(guard.data(), req, verb, data, s);
+        });
+    // The slot is released when the reply finishes, or if it is
+    // destroyed first.  Connections are tied to the network manager
+    // so they don't outlive the scheduler.
+    auto release = [this, ticket]() { scheduler_.finish(ticket); };
+    QObject::connect(reply, &QNetworkReply::finished,
+                     network_.get(), release);
+    QObject::connect(reply, &QObject::destroyed, network_.get(), release);
+    record_stats(reply, request_operation(request, verb));
+    return reply;
+}
+
+uint64_t DavProvider::trace_request(QNetworkReply* reply,
+                                    QNetworkRequest const& request,
+                                    QByteArray const& verb) const
+{
+    if (!Trace::enabled())
+    {
+        return 0;
+    }
+    // The span covers the request from when it is queued until it
+    // finishes, with steps for when it is sent and when the response
+    // starts to arrive.
+    uint64_t const id = Trace::next_id();
+    Trace::begin("request", verb.constData(), id, {
+            {"url", request.url().toString().toStdString()},
+            {"operation", request_operation(request, verb).toStdString()},
+            {"call", to_string(Trace::current_call())},
+        });
+    auto seen_data = make_shared<bool>(false);
+    QObject::connect(reply, &QIODevice::readyRead, network_.get(),
+                     [id, seen_data]() {
+                         if (!*seen_data)
+                         {
+                             *seen_data = true;
+                             Trace::step("request", "first_read", id);
+                         }
+                     });
+    QObject::connect(
+        reply, &QNetworkReply::finished, network_.get(),
+        [reply, id]() {
+            int const status = reply->attribute(
+                QNetworkRequest::HttpStatusCodeAttribute).toInt();
+            Trace::end("request", "finished", id,
+                       {{"status", to_string(status)}});
+        });
+    return id;
+}
+
+void DavProvider::record_stats(QNetworkReply* reply,
+                               QString const& operation) const
+{
+    auto const started = OperationStats::Clock::now();
+    auto sample = make_shared<OperationStats::Sample>();
+    auto sent = make_shared<qint64>(0);
+    auto received = make_shared<qint64>(0);
+    QObject::connect(
+        reply, &QNetworkReply::metaDataChanged, network_.get(),
+        [sample, started]() {
+            if (!sample->responded)
+            {
+                sample->responded = true;
+                sample->time_to_first_byte =
+                    OperationStats::Clock::now() - started;
+            }
+        });
+    QObject::connect(reply, &QNetworkReply::uploadProgress, network_.get(),
+                     [sent](qint64 bytes, qint64) { *sent = bytes; });
+    QObject::connect(reply, &QNetworkReply::downloadProgress, network_.get(),
+                     [received](qint64 bytes, qint64) { *received = bytes; });
+    QObject::connect(
+        reply, &QNetworkReply::finished, network_.get(),
+        [this, reply, operation, started, sample, sent, received]() {
+            sample->latency = OperationStats::Clock::now() - started;
+            sample->status = reply->attribute(
+                QNetworkRequest::HttpStatusCodeAttribute).toInt();
+            sample->bytes = max<qint64>(*sent, 0) + max<qint64>(*received, 0);
+            stats_.record(operation.toStdString(), *sample);
+        });
+}
+
+void DavProvider::start_request(
+    SessionReply* reply, QNetworkRequest& request, QByteArray const& verb,
+    QIODevice* data, shared_ptr<DavSession const> const& s) const
+{
+    if (!session_cookies_)
+    {
+        if (!s->authorization().isEmpty())
+        {
+            request.setRawHeader(QByteArrayLiteral("Authorization"),
+                                 s->authorization());
+        }
+        QNetworkReply* r = network_->sendCustomRequest(request, verb, data);
+        QObject::connect(r, &QNetworkReply::metaDataChanged,
+                         [s, r]() { s->record_protocol(r); });
+        reply->attach(r);
+        return;
+    }
+
+    // The cookies are looked up when the request is sent, so requests
+    // that were queued pick up a session established in the meantime.
+    QByteArray const cookies = s->cookie_header(request.url());
+    if (!cookies.isEmpty())
+    {
+        request.setRawHeader(QByteArrayLiteral("Cookie"), cookies);
+    }
+
+    auto send = [this, s, verb, data](QNetworkRequest const& req) {
+        QNetworkReply* r = network_->sendCustomRequest(req, verb, data);
+        QObject::connect(r, &QNetworkReply::metaDataChanged,
+                         [s, r]() {
+                             s->record_protocol(r);
+                             s->save_cookies(r);
+                         });
+        return r;
+    };
+
+    // A request body can only be sent a second time if the device
+    // can seek back to where it started.
+    bool const replayable = data == nullptr || !data->isSequential();
+    if (s->authorization().isEmpty() ||
+        !replayable || !s->has_login_cookie(request.url()))
+    {
+        if (!s->authorization().isEmpty())
+        {
+            request.setRawHeader(QByteArrayLiteral("Authorization"),
+                                 s->authorization());
+        }
+        reply->attach(send(request));
+        return;
+    }
+
+    qint64 const start = data ? data->pos() : 0;
+    QNetworkRequest retry_request = request;
+    reply->attach(send(request), [=]() {
+        s->clear_cookies();
+        if (data)
+        {
+            data->seek(start);
+        }
+        QNetworkRequest req = retry_request;
+        req.setRawHeader(QByteArrayLiteral("Cookie"), QByteArray());
+        req.setRawHeader(QByteArrayLiteral("Authorization"),
+                         s->authorization());
+        return send(req);
+    });
+}
+
+void DavProvider::set_request_priority(QNetworkRequest& request,
+                                       RequestScheduler::Priority priority)
+{
+    request.setAttribute(PRIORITY_ATTRIBUTE, static_cast<int>(priority));
+    // Also let the network manager order requests it has queued for
+    // a connection.
+    switch (priority)
+    {
+    case RequestScheduler::Priority::interactive:
+        request.setPriority(QNetworkRequest::HighPriority);
+        break;
+    case RequestScheduler::Priority::transfer:
+        request.setPriority(QNetworkRequest::NormalPriority);
+        break;
+    case RequestScheduler::Priority::background:
+        request.setPriority(QNetworkRequest::LowPriority);
+        break;
+    }
+}
+
+RequestScheduler::Priority DavProvider::request_priority(
+    QNetworkRequest const& request)
+{
+    QVariant const value = request.attribute(PRIORITY_ATTRIBUTE);
+    if (!value.isValid())
+    {
+        return RequestScheduler::Priority::interactive;
+    }
+    return static_cast<RequestScheduler::Priority>(value.toInt());
+}
+
+RequestScheduler const& DavProvider::scheduler() const
+{
+    return scheduler_;
+}
+
+void DavProvider::set_request_operation(QNetworkRequest& request,
+                                        QString const& operation)
+{
+    request.setAttribute(OPERATION_ATTRIBUTE, operation);
+}
+
+QString DavProvider::request_operation(QNetworkRequest const& request,
+                                       QByteArray const& verb)
+{
+    QVariant const value = request.attribute(OPERATION_ATTRIBUTE);
+    if (!value.isValid())
+    {
+        return QString::fromLatin1(verb).toLower();
+    }
+    return value.toString();
+}
+
+OperationStats const& DavProvider::stats() const
+{
+    return stats_;
+}
+
+Item DavProvider::make_item(QUrl const& href, DavSession const& session,
                             vector<MultiStatusProperty> const& properties) const
 {
+    Trace::Scope trace("items", "make_item");
     Item item;
-    item.item_id = url_to_id(href, base_url);
+    item.item_id = session.url_to_id(href);
 
     QByteArray path = href.path(QUrl::FullyEncoded |
                                 QUrl::StripTrailingSlash).toUtf8();
@@ -181,9 +1072,9 @@ Item DavProvider::make_item(QUrl const& href, QUrl const& base_url,
     assert(pos >= 0);
     try
     {
-        item.parent_ids.emplace_back(url_to_id(
+        item.parent_ids.emplace_back(session.url_to_id(
             href.resolved(QUrl::fromEncoded(path.mid(0, pos+1),
-                                            QUrl::StrictMode)), base_url));
+                                            QUrl::StrictMode))));
     }
     catch (RemoteCommsException const&)
     {
@@ -237,10 +1128,43 @@ Item DavProvider::make_item(QUrl const& href, QUrl const& base_url,
                     item.metadata[LAST_MODIFIED_TIME] = date.toString(Qt::ISODate).toStdString();
                 }
             }
+            else if (prop.name == "quota-available-bytes")
+            {
+                bool ok;
+                int64_t bytes = prop.value.toLongLong(&ok);
+                if (ok && bytes >= 0)
+                {
+                    item.metadata[FREE_SPACE_BYTES] = bytes;
+                }
+            }
+            else if (prop.name == "quota-used-bytes")
+            {
+                bool ok;
+                int64_t bytes = prop.value.toLongLong(&ok);
+                if (ok && bytes >= 0)
+                {
+                    item.metadata[USED_SPACE_BYTES] = bytes;
+                }
+            }
+        }
+        else if (prop.ns == OC_NS)
+        {
+            if (prop.name == "size")
+            {
+                item.metadata["oc:size"] = static_cast<int64_t>(prop.value.toLongLong());
+            }
+            else if (prop.name == "fileid")
+            {
+                item.metadata["oc:fileid"] = prop.value.trimmed().toStdString();
+            }
+            else if (prop.name == "checksums")
+            {
+                item.metadata["oc:checksums"] = prop.value.simplified().toStdString();
+            }
         }
     }
 
-    if (href == base_url)
+    if (href == session.base_url())
     {
         item.type = ItemType::root;
         item.name = "Root";
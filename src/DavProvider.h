@@ -18,16 +18,36 @@
 
 #pragma once
 
+#include "BulkUploader.h"
+#include "ContentCache.h"
+#include "DavSession.h"
+#include "ListingCache.h"
+#include "MetadataCache.h"
+#include "OperationStats.h"
+#include "RequestScheduler.h"
+#include "Singleflight.h"
+#include "WriteBackQueue.h"
+#include "dav_properties.h"
+
 #include <unity/storage/provider/ProviderBase.h>
 
+#include <cstdint>
+#include <list>
+#include <map>
 #include <memory>
+#include <set>
+#include <string>
 
 class QByteArray;
 class QIODevice;
 class QNetworkAccessManager;
 class QNetworkReply;
 class QNetworkRequest;
+class QString;
 class QUrl;
+class ListingSnapshot;
+class SessionReply;
+class StatsInterface;
 struct MultiStatusProperty;
 
 class DavProvider : public unity::storage::provider::ProviderBase
@@ -85,18 +105,168 @@ public:
         std::vector<std::string> const& metadata_keys,
         unity::storage::provider::Context const& ctx) override;
 
-    virtual QUrl base_url(
-        unity::storage::provider::Context const& ctx) const = 0;
+    // The session for the account a request is made with.  Sessions
+    // are cached, and replaced when the account's credentials change.
+    std::shared_ptr<DavSession const> session(
+        unity::storage::provider::Context const& ctx) const;
+    QUrl base_url(unity::storage::provider::Context const& ctx) const;
+    // The collection chunked uploads are staged under, or an invalid
+    // URL if the account's server doesn't support them.
+    QUrl upload_collection_url(
+        unity::storage::provider::Context const& ctx) const;
+    // Record that the account's server rejected the creation of an
+    // upload collection, so later uploads are sent with a single PUT.
+    void chunked_upload_unsupported(std::string const& account);
+    // Send a request, authorized with the session's credentials.  The
+    // request is queued in the scheduler according to the priority set
+    // with set_request_priority(), which defaults to interactive.
     virtual QNetworkReply *send_request(
         QNetworkRequest& request, QByteArray const& verb, QIODevice* data,
-        unity::storage::provider::Context const& ctx) const = 0;
+        unity::storage::provider::Context const& ctx) const;
+    static void set_request_priority(QNetworkRequest& request,
+                                     RequestScheduler::Priority priority);
+    static RequestScheduler::Priority request_priority(
+        QNetworkRequest const& request);
+    RequestScheduler const& scheduler() const;
+    // Requests are recorded in the statistics under the operation set
+    // here, or else under their verb in lower case.
+    static void set_request_operation(QNetworkRequest& request,
+                                      QString const& operation);
+    static QString request_operation(QNetworkRequest const& request,
+                                     QByteArray const& verb);
+    OperationStats const& stats() const;
     virtual unity::storage::provider::Item make_item(
-        QUrl const& href, QUrl const& base_url,
+        QUrl const& href, DavSession const& session,
         std::vector<MultiStatusProperty> const& properties) const;
 
+    // A key identifying the account a base URL belongs to, used to
+    // partition the provider's caches.
+    static std::string account_key(QUrl const& base_url);
+    MetadataCache& metadata_cache();
+    ListingCache& listing_cache();
+    ContentCache& content_cache();
+    WriteBackQueue& write_back();
+    BulkUploader& bulk_uploader();
+    // Retrieve an item's metadata with a "Depth: 0" PROPFIND, sharing
+    // the request with any identical one already in flight.
+    void retrieve_metadata(
+        std::string const& item_id, PropertySet properties,
+        unity::storage::provider::Context const& ctx,
+        Singleflight<unity::storage::provider::Item>::Callback callback);
+    // Drop cached information about an item that is being modified,
+    // along with its parent folder.
+    void invalidate_cache(QUrl const& base_url, std::string const& item_id);
+
+    // Bring the account's caches up to date with the changes reported
+    // by a sync-collection REPORT.  The callback receives true if
+    // every change since the last synchronisation has been applied,
+    // so cached listings can be used without revalidation.
+    void synchronize(unity::storage::provider::Context const& ctx,
+                     Singleflight<bool>::Callback callback);
+    // True if the next synchronisation will only establish a starting
+    // point for later ones.
+    bool needs_sync_baseline(std::string const& account) const;
+    // Incremented each time synchronisation completes.  Listings
+    // retrieved across a synchronisation may miss changes, so
+    // shouldn't be cached.
+    uint64_t sync_generation(std::string const& account) const;
+    // Apply changes reported by the server to the caches.
+    void apply_change(QUrl const& base_url,
+                      unity::storage::provider::Item const& item,
+                      PropertySet properties);
+    void apply_removal(QUrl const& base_url, std::string const& item_id);
+
 protected:
+    // Create a session for the credentials in a request context.
+    virtual std::shared_ptr<DavSession> make_session(
+        unity::storage::provider::Context const& ctx) const = 0;
+
     std::unique_ptr<QNetworkAccessManager> const network_;
+    MetadataCache metadata_cache_;
+    ListingCache listing_cache_;
+    ContentCache content_cache_;
 
 private:
     inline std::shared_ptr<DavProvider> shared_from_this();
+    std::unique_ptr<unity::storage::provider::UploadJob> make_upload_job(
+        std::string const& item_id, int64_t size,
+        std::string const& content_type, bool allow_overwrite,
+        std::string const& old_etag, PropertySet properties,
+        unity::storage::provider::Context const& ctx);
+    // Refuse to move or copy while the source or destination has
+    // uploads staged.
+    void check_not_staged(std::string const& item_id,
+                          std::string const& new_parent_id,
+                          std::string const& new_name,
+                          unity::storage::provider::Context const& ctx) const;
+    std::shared_ptr<ListingSnapshot> find_snapshot(
+        std::string const& page_token, std::size_t& offset) const;
+    void prune_snapshots();
+    void forget_requests(std::string const& prefix);
+    void start_request(SessionReply* reply, QNetworkRequest& request,
+                       QByteArray const& verb, QIODevice* data,
+                       std::shared_ptr<DavSession const> const& session) const;
+    void record_stats(QNetworkReply* reply, QString const& operation) const;
+    uint64_t trace_request(QNetworkReply* reply, QNetworkRequest const& request,
+                           QByteArray const& verb) const;
+
+    std::size_t const list_page_size_;
+    // Uploads of at least this size use chunked uploads if possible.
+    int64_t const chunked_upload_threshold_;
+    // Accounts whose servers have turned out not to support chunked
+    // uploads.
+    std::set<std::string> chunked_unsupported_;
+    // Uploads up to this size are staged locally and sent in the
+    // background, if write-back is enabled.
+    int64_t const write_back_max_size_;
+    // Uploads up to this size that may overwrite an existing file are
+    // batched into bulk uploads where the server supports them.  Zero
+    // disables bulk uploads.
+    int64_t const bulk_upload_max_size_;
+    // Downloads of at least this size are split into parallel range
+    // requests.
+    int64_t const parallel_download_threshold_;
+    int64_t next_snapshot_id_ = 0;
+    // Listings with pages still to be handed out, oldest first.
+    std::list<std::shared_ptr<ListingSnapshot>> snapshots_;
+    // In-flight requests, keyed by account, item ID, depth and
+    // properties.
+    Singleflight<unity::storage::provider::Item> metadata_requests_;
+    std::map<std::string, std::weak_ptr<ListingSnapshot>> listing_requests_;
+
+    struct SyncState
+    {
+        std::string token;
+        bool unsupported = false;
+        uint64_t generation = 0;
+    };
+    bool const delta_sync_;
+    std::map<std::string, SyncState> sync_state_;
+    Singleflight<bool> sync_requests_;
+
+    struct SessionEntry
+    {
+        // The credentials the session was made with.
+        std::string secret;
+        std::shared_ptr<DavSession const> session;
+    };
+    // Sessions keyed by the identity part of the credentials.
+    mutable std::map<std::string, SessionEntry> sessions_;
+    // Authenticate with login session cookies where possible, rather
+    // than sending the password with every request.
+    bool const session_cookies_;
+    // Allow HTTP/2 to be negotiated with servers that support it, so
+    // requests are multiplexed over a single connection rather than
+    // queueing for one of six HTTP/1.1 connections.
+    bool const http2_;
+    // Limits the requests in flight to each server, so bulk transfers
+    // can't hold up interactive requests.
+    mutable RequestScheduler scheduler_;
+    // Published on D-Bus when running as a service.
+    mutable OperationStats stats_;
+    std::unique_ptr<StatsInterface> const stats_interface_;
+    // Declared last, so they are destroyed before the network and
+    // scheduler their uploads use.
+    BulkUploader bulk_uploader_;
+    mutable WriteBackQueue write_back_;
 };
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "DavSession.h"
+#include "DavProvider.h"
+#include "item_id.h"
+
+#include <QDebug>
+#include <QNetworkCookie>
+#include <QNetworkCookieJar>
+#include <QNetworkReply>
+
+using namespace std;
+
+namespace
+{
+
+// The cookies Nextcloud and ownCloud use for login sessions.
+bool is_login_cookie(QNetworkCookie const& cookie)
+{
+    auto const& name = cookie.name();
+    return name == "oc_sessionPassphrase" || name.startsWith("nc_session");
+}
+
+}
+
+class SessionCookieJar : public QNetworkCookieJar
+{
+public:
+    void clear()
+    {
+        setAllCookies(QList<QNetworkCookie>());
+    }
+};
+
+DavSession::DavSession(QUrl const& base_url, QUrl const& upload_collection_url,
+                       QByteArray const& authorization,
+                       QUrl const& bulk_upload_url)
+    : base_url_(base_url), encoded_base_url_(encode_base_url(base_url)),
+      account_(DavProvider::account_key(base_url)),
+      upload_collection_url_(upload_collection_url),
+      bulk_upload_url_(bulk_upload_url),
+      authorization_(authorization), cookies_(new SessionCookieJar)
+{
+}
+
+DavSession::~DavSession() = default;
+
+QUrl const& DavSession::base_url() const
+{
+    return base_url_;
+}
+
+string const& DavSession::account() const
+{
+    return account_;
+}
+
+QUrl const& DavSession::upload_collection_url() const
+{
+    return upload_collection_url_;
+}
+
+QUrl const& DavSession::bulk_upload_url() const
+{
+    return bulk_upload_url_;
+}
+
+QByteArray const& DavSession::authorization() const
+{
+    return authorization_;
+}
+
+QUrl DavSession::id_to_url(string const& item_id) const
+{
+    return ::id_to_url(item_id, base_url_, encoded_base_url_);
+}
+
+string DavSession::url_to_id(QUrl const& item_url) const
+{
+    return ::url_to_id(item_url, encoded_base_url_);
+}
+
+QByteArray DavSession::cookie_header(QUrl const& url) const
+{
+    QByteArray header;
+    for (auto const& cookie : cookies_->cookiesForUrl(url))
+    {
+        if (!header.isEmpty())
+        {
+            header += "; ";
+        }
+        header += cookie.toRawForm(QNetworkCookie::NameAndValueOnly);
+    }
+    return header;
+}
+
+bool DavSession::has_login_cookie(QUrl const& url) const
+{
+    for (auto const& cookie : cookies_->cookiesForUrl(url))
+    {
+        if (is_login_cookie(cookie))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DavSession::save_cookies(QNetworkReply* reply) const
+{
+    auto cookies = reply->header(QNetworkRequest::SetCookieHeader)
+        .value<QList<QNetworkCookie>>();
+    if (!cookies.isEmpty())
+    {
+        cookies_->setCookiesFromUrl(cookies, reply->url());
+    }
+}
+
+void DavSession::clear_cookies() const
+{
+    cookies_->clear();
+}
+
+QString DavSession::protocol() const
+{
+    return protocol_;
+}
+
+void DavSession::record_protocol(QNetworkReply* reply) const
+{
+    bool http2 = false;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    http2 = reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool();
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+    http2 = reply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool();
+#else
+    Q_UNUSED(reply);
+#endif
+    QString const protocol = http2 ? QStringLiteral("HTTP/2")
+                                   : QStringLiteral("HTTP/1.1");
+    if (protocol != protocol_)
+    {
+        qDebug() << "Using" << protocol << "for" << base_url_;
+        protocol_ = protocol;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QUrl>
+
+#include <memory>
+#include <string>
+
+class QNetworkReply;
+class SessionCookieJar;
+
+// The per-account details needed to talk to the server, derived
+// from the credentials of a request.
+//
+// Sessions are created once per set of credentials and shared by
+// every request made with them, so the work of resolving the base
+// URL and encoding the credentials isn't repeated for each request.
+class DavSession
+{
+public:
+    DavSession(QUrl const& base_url, QUrl const& upload_collection_url,
+               QByteArray const& authorization,
+               QUrl const& bulk_upload_url = QUrl());
+    ~DavSession();
+
+    DavSession(DavSession const&) = delete;
+    DavSession& operator=(DavSession const&) = delete;
+
+    QUrl const& base_url() const;
+    // The key identifying the account in the provider's caches.
+    std::string const& account() const;
+    // The collection under which chunked uploads can be staged, or
+    // an invalid URL if the server doesn't support them.
+    QUrl const& upload_collection_url() const;
+    // Nextcloud's endpoint for uploading several files in one
+    // multipart request, or an invalid URL if there isn't one.
+    QUrl const& bulk_upload_url() const;
+    // The value of the Authorization header, or an empty array if
+    // requests should be sent without one.
+    QByteArray const& authorization() const;
+
+    QUrl id_to_url(std::string const& item_id) const;
+    std::string url_to_id(QUrl const& item_url) const;
+
+    // Cookies set by the server for this account.  Once the server
+    // has handed out a login session, requests can present its
+    // cookies instead of the password, sparing the server from
+    // checking the password again.
+    QByteArray cookie_header(QUrl const& url) const;
+    bool has_login_cookie(QUrl const& url) const;
+    void save_cookies(QNetworkReply* reply) const;
+    // Forget the cookies after the server rejects them.
+    void clear_cookies() const;
+
+    // The HTTP version of the most recent response, "HTTP/1.1" or
+    // "HTTP/2", or an empty string before the first response.
+    QString protocol() const;
+    void record_protocol(QNetworkReply* reply) const;
+
+private:
+    QUrl const base_url_;
+    QByteArray const encoded_base_url_;
+    std::string const account_;
+    QUrl const upload_collection_url_;
+    QUrl const bulk_upload_url_;
+    QByteArray const authorization_;
+    std::unique_ptr<SessionCookieJar> const cookies_;
+    mutable QString protocol_;
+};
@@ -18,10 +18,11 @@
 
 #include "DavUploadJob.h"
 #include "DavProvider.h"
+#include "MultiStatusParser.h"
 #include "RetrieveMetadataHandler.h"
-#include "item_id.h"
 #include "http_error.h"
 
+#include <QDateTime>
 #include <unity/storage/provider/Exceptions.h>
 
 #include <unistd.h>
@@ -44,15 +45,102 @@ string make_upload_id()
 
 }
 
-DavUploadJob::DavUploadJob(shared_ptr<DavProvider> const& provider,
-                           string const& item_id, int64_t size,
-                           string const& content_type, bool allow_overwrite,
-                           string const& old_etag, Context const& ctx)
-    : QObject(), UploadJob(make_upload_id()), provider_(provider),
-      item_id_(item_id), base_url_(provider->base_url(ctx)), size_(size),
-      context_(ctx)
+Item make_uploaded_item(DavProvider const& provider, DavSession const& session,
+                        string const& item_id, QByteArray const& etag,
+                        QByteArray const& file_id, int64_t size, int64_t mtime,
+                        PropertySet& available)
+{
+    auto make_property = [](QString const& ns, QString const& name,
+                            QString const& value) {
+        MultiStatusProperty prop;
+        prop.ns = ns;
+        prop.name = name;
+        prop.value = value;
+        prop.status = 200;
+        return prop;
+    };
+    vector<MultiStatusProperty> properties{
+        make_property("DAV:", "resourcetype", QString()),
+        make_property("DAV:", "getetag", QString::fromUtf8(etag)),
+        make_property("DAV:", "getcontentlength", QString::number(size)),
+    };
+    available = dav_property::required | dav_property::getcontentlength;
+    if (mtime >= 0)
+    {
+        properties.emplace_back(
+            make_property("DAV:", "getlastmodified",
+                          QDateTime::fromTime_t(mtime, Qt::UTC).toString(Qt::RFC2822Date)));
+        available |= dav_property::getlastmodified;
+    }
+    if (!file_id.isEmpty())
+    {
+        properties.emplace_back(
+            make_property("http://owncloud.org/ns", "fileid",
+                          QString::fromUtf8(file_id)));
+        available |= dav_property::oc_fileid;
+    }
+    return provider.make_item(session.id_to_url(item_id), session, properties);
+}
+
+QByteArray upload_etag(QNetworkReply* reply)
+{
+    // ownCloud and Nextcloud send the new ETag.  Other servers may
+    // not, or only a weak one.
+    QByteArray etag = reply->rawHeader(QByteArrayLiteral("OC-ETag"));
+    if (etag.isEmpty())
+    {
+        etag = reply->rawHeader(QByteArrayLiteral("ETag"));
+    }
+    if (etag.startsWith("W/"))
+    {
+        etag.clear();
+    }
+    return etag;
+}
+
+bool item_from_upload_headers(DavProvider const& provider,
+                              DavSession const& session, QNetworkReply* reply,
+                              string const& item_id, int64_t size,
+                              Item& item, PropertySet& available)
 {
-    QNetworkRequest request(id_to_url(item_id, base_url_));
+    // Without an ETag we need to fall back to a PROPFIND.
+    QByteArray const etag = upload_etag(reply);
+    if (etag.isEmpty())
+    {
+        return false;
+    }
+    // The server gives the file its own modification time.  Few
+    // servers report it on PUT, but the response's Date comes from
+    // the same clock just after the file was stored, so stands in for
+    // it without being recorded as the real thing.
+    bool exact = true;
+    QDateTime mtime = reply->header(
+        QNetworkRequest::LastModifiedHeader).toDateTime();
+    if (!mtime.isValid())
+    {
+        exact = false;
+        mtime = QDateTime::fromString(
+            QString::fromLatin1(reply->rawHeader(QByteArrayLiteral("Date"))),
+            Qt::RFC2822Date);
+    }
+    item = make_uploaded_item(provider, session, item_id, etag,
+                              reply->rawHeader(QByteArrayLiteral("OC-FileId")),
+                              size, mtime.isValid() ? mtime.toTime_t() : -1,
+                              available);
+    if (!exact)
+    {
+        available &= ~dav_property::getlastmodified;
+    }
+    return true;
+}
+
+QNetworkRequest make_upload_request(DavSession const& session,
+                                    string const& item_id, int64_t size,
+                                    string const& content_type,
+                                    bool allow_overwrite,
+                                    string const& old_etag)
+{
+    QNetworkRequest request(session.id_to_url(item_id));
     if (!content_type.empty())
     {
         request.setHeader(QNetworkRequest::ContentTypeHeader,
@@ -68,20 +156,58 @@ DavUploadJob::DavUploadJob(shared_ptr<DavProvider> const& provider,
         request.setRawHeader(QByteArrayLiteral("If-Match"),
                              QByteArray::fromStdString(old_etag));
     }
-    request.setHeader(QNetworkRequest::ContentLengthHeader, QVariant::fromValue(size));
+    request.setHeader(QNetworkRequest::ContentLengthHeader,
+                      QVariant::fromValue(size));
     request.setAttribute(QNetworkRequest::DoNotBufferUploadDataAttribute, true);
+    DavProvider::set_request_priority(
+        request, RequestScheduler::Priority::transfer);
+    DavProvider::set_request_operation(request, QStringLiteral("upload"));
+    return request;
+}
+
+DavUploadJob::DavUploadJob(shared_ptr<DavProvider> const& provider,
+                           string const& item_id, int64_t size,
+                           string const& content_type, bool allow_overwrite,
+                           string const& old_etag, PropertySet properties,
+                           Context const& ctx)
+    : DavUploadJob(provider, item_id, size, content_type, allow_overwrite,
+                   old_etag, properties, ctx, true)
+{
+}
 
+DavUploadJob::DavUploadJob(shared_ptr<DavProvider> const& provider,
+                           string const& item_id, int64_t size,
+                           string const& content_type, bool allow_overwrite,
+                           string const& old_etag, PropertySet properties,
+                           Context const& ctx, bool send_now)
+    : QObject(), UploadJob(make_upload_id()), provider_(provider),
+      item_id_(item_id), session_(provider->session(ctx)), size_(size),
+      content_type_(content_type), allow_overwrite_(allow_overwrite),
+      old_etag_(old_etag), properties_(properties), context_(ctx)
+{
     reader_.setSocketDescriptor(
         dup(read_socket()), QLocalSocket::ConnectedState, QIODevice::ReadOnly);
-    reply_.reset(provider->send_request(
-        request, QByteArrayLiteral("PUT"), &reader_, ctx));
+    if (send_now)
+    {
+        send();
+    }
+}
+
+DavUploadJob::~DavUploadJob() = default;
+
+void DavUploadJob::send(unique_ptr<QIODevice> body)
+{
+    QNetworkRequest request = make_upload_request(
+        *session_, item_id_, size_, content_type_, allow_overwrite_, old_etag_);
+    body_ = move(body);
+    reply_.reset(provider_->send_request(
+        request, QByteArrayLiteral("PUT"),
+        body_ ? body_.get() : &reader_, context_));
     assert(reply_.get() != nullptr);
     connect(reply_.get(), &QNetworkReply::finished,
             this, &DavUploadJob::onReplyFinished);
 }
 
-DavUploadJob::~DavUploadJob() = default;
-
 void DavUploadJob::onReplyFinished()
 {
     if (promise_set_)
@@ -89,18 +215,47 @@ void DavUploadJob::onReplyFinished()
         return;
     }
     auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    provider_->invalidate_cache(session_->base_url(), item_id_);
     // Is this a success status code?
     if (status / 100 != 2)
     {
-        promise_.set_exception(
-            translate_http_error(reply_.get(), QByteArray(), item_id_));
+        fail(translate_http_error(reply_.get(), QByteArray(), item_id_));
+        return;
+    }
+    Item item;
+    PropertySet available = 0;
+    if (!item_from_upload_headers(*provider_, *session_, reply_.get(),
+                                  item_id_, size_, item, available))
+    {
+        available = 0;
+    }
+    complete(item, available);
+}
+
+void DavUploadJob::complete(Item const& item, PropertySet available)
+{
+    // An upload's response can't report the creation time, or in
+    // general the modification time the server assigned.  A client
+    // that didn't ask for particular metadata keys gets the item
+    // without waiting on a PROPFIND for them.  Only what was reported
+    // is cached, so the next lookup fetches the rest.
+    PropertySet wanted = properties_;
+    if (properties_ == dav_property::standard)
+    {
+        wanted &= ~(dav_property::creationdate | dav_property::getlastmodified);
+    }
+    if (available != 0 && covers(available, wanted))
+    {
+        provider_->metadata_cache().put(session_->account(),
+                                        item, available);
+        promise_.set_value(item);
         promise_set_ = true;
         return;
     }
     // Queue up a PROPFIND request to retrieve the metadata for the upload.
     metadata_.reset(
         new RetrieveMetadataHandler(
-            provider_, item_id_, context_,
+            provider_, item_id_, properties_, context_,
             [this](Item const& item, boost::exception_ptr const& error) {
                 if (promise_set_)
                 {
@@ -118,6 +273,17 @@ void DavUploadJob::onReplyFinished()
             }));
 }
 
+void DavUploadJob::fail(boost::exception_ptr const& error)
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    promise_.set_exception(error);
+    promise_set_ = true;
+    reader_.close();
+}
+
 boost::future<void> DavUploadJob::cancel()
 {
     if (!promise_set_)
@@ -126,10 +292,14 @@ boost::future<void> DavUploadJob::cancel()
         {
             metadata_->abort();
         }
-        else
+        else if (reply_)
         {
             reply_->abort();
         }
+        else
+        {
+            fail(boost::copy_exception(CancelledException("Upload cancelled")));
+        }
     }
     return boost::make_ready_future();
 }
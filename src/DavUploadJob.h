@@ -20,6 +20,7 @@
 
 #include <QLocalSocket>
 #include <QNetworkReply>
+#include <QNetworkRequest>
 #include <QObject>
 #include <QUrl>
 #include <unity/storage/provider/ProviderBase.h>
@@ -29,9 +30,37 @@
 #include <memory>
 #include <string>
 
+#include "dav_properties.h"
+
 class DavProvider;
+class DavSession;
 class RetrieveMetadataHandler;
 
+// Build the item for a file that has just been uploaded from the
+// ETag and file ID the server reported, along with its size and, if
+// known, the modification time it was given (or else -1).  available
+// is set to the properties the item has.
+unity::storage::provider::Item make_uploaded_item(
+    DavProvider const& provider, DavSession const& session,
+    std::string const& item_id, QByteArray const& etag,
+    QByteArray const& file_id, int64_t size, int64_t mtime,
+    PropertySet& available);
+// The PUT request uploading a file, with the preconditions it is
+// subject to.
+QNetworkRequest make_upload_request(
+    DavSession const& session, std::string const& item_id, int64_t size,
+    std::string const& content_type, bool allow_overwrite,
+    std::string const& old_etag);
+// The strong ETag the response to a PUT reports for the file, if any.
+QByteArray upload_etag(QNetworkReply* reply);
+// Build the item from the response headers of a PUT, if possible.
+// The modification time is filled in from the response's Date if the
+// server doesn't report it, but isn't then marked as available.
+bool item_from_upload_headers(
+    DavProvider const& provider, DavSession const& session,
+    QNetworkReply* reply, std::string const& item_id, int64_t size,
+    unity::storage::provider::Item& item, PropertySet& available);
+
 class DavUploadJob : public QObject, public unity::storage::provider::UploadJob
 {
     Q_OBJECT
@@ -39,27 +68,53 @@ public:
     DavUploadJob(std::shared_ptr<DavProvider> const& provider,
                  std::string const& item_id, int64_t size,
                  std::string const& content_type, bool allow_overwrite,
-                 std::string const& old_etag,
+                 std::string const& old_etag, PropertySet properties,
                  unity::storage::provider::Context const& ctx);
     ~DavUploadJob();
 
     boost::future<void> cancel() override;
     boost::future<unity::storage::provider::Item> finish() override;
 
-private Q_SLOTS:
-    void onReplyFinished();
+protected:
+    // For subclasses that decide how to send the data, and call
+    // send() if it is to be PUT after all.
+    DavUploadJob(std::shared_ptr<DavProvider> const& provider,
+                 std::string const& item_id, int64_t size,
+                 std::string const& content_type, bool allow_overwrite,
+                 std::string const& old_etag, PropertySet properties,
+                 unity::storage::provider::Context const& ctx,
+                 bool send_now);
+
+    // PUT the data from body, or else straight from the client's
+    // socket.
+    void send(std::unique_ptr<QIODevice> body = nullptr);
+    // Resolve the upload with the item, retrieving the metadata
+    // with a PROPFIND if it lacks any of the requested properties.
+    void complete(unity::storage::provider::Item const& item,
+                  PropertySet available);
+    void fail(boost::exception_ptr const& error);
 
-private:
     std::shared_ptr<DavProvider> const provider_;
     std::string const item_id_;
-    QUrl const base_url_;
+    std::shared_ptr<DavSession const> const session_;
     int64_t const size_;
+    std::string const content_type_;
+    bool const allow_overwrite_;
+    std::string const old_etag_;
+    PropertySet const properties_;
     unity::storage::provider::Context const context_;
     QLocalSocket reader_;
+    bool promise_set_ = false;
+
+private Q_SLOTS:
+    void onReplyFinished();
+
+private:
+    // Declared before the reply, which reads from it.
+    std::unique_ptr<QIODevice> body_;
     std::unique_ptr<QNetworkReply> reply_;
 
     std::unique_ptr<RetrieveMetadataHandler> metadata_;
 
-    bool promise_set_ = false;
     boost::promise<unity::storage::provider::Item> promise_;
 };
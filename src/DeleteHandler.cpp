@@ -18,6 +18,7 @@
 
 #include "DeleteHandler.h"
 #include "DavProvider.h"
+#include "Trace.h"
 #include "item_id.h"
 #include "http_error.h"
 
@@ -25,12 +26,13 @@ using namespace std;
 using namespace unity::storage::provider;
 
 DeleteHandler::DeleteHandler(shared_ptr<DavProvider> const& provider,
-                             string const& item_id,
+                             string const& item_id, bool missing_ok,
                              Context const& ctx)
-    : provider_(provider), item_id_(item_id)
+    : provider_(provider), item_id_(item_id),
+      base_url_(provider->base_url(ctx)), missing_ok_(missing_ok),
+      trace_call_(Trace::current_call())
 {
-    QUrl const base_url = provider->base_url(ctx);
-    QNetworkRequest request(id_to_url(item_id_, base_url));
+    QNetworkRequest request(id_to_url(item_id_, base_url_));
     reply_.reset(provider->send_request(request, QByteArrayLiteral("DELETE"),
                                         nullptr, ctx));
     connect(reply_.get(), &QNetworkReply::finished,
@@ -47,8 +49,9 @@ boost::future<void> DeleteHandler::get_future()
 void DeleteHandler::onFinished()
 {
     auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    provider_->invalidate_cache(base_url_, item_id_);
 
-    if (status / 100 == 2)
+    if (status / 100 == 2 || (missing_ok_ && status == 404))
     {
         promise_.set_value();
     }
@@ -57,6 +60,7 @@ void DeleteHandler::onFinished()
         promise_.set_exception(
             translate_http_error(reply_.get(), QByteArray(), item_id_));
     }
+    Trace::end_call(trace_call_);
 
     deleteLater();
 }
@@ -23,6 +23,7 @@
 #include <QNetworkReply>
 #include <unity/storage/provider/ProviderBase.h>
 
+#include <cstdint>
 #include <memory>
 
 class DavProvider;
@@ -30,8 +31,10 @@ class DavProvider;
 class DeleteHandler : public QObject {
     Q_OBJECT
 public:
+    // If the item may not have reached the server yet, it is
+    // enough that it no longer exists.
     DeleteHandler(std::shared_ptr<DavProvider> const& provider, std::string const& item_id,
-                  unity::storage::provider::Context const& ctx);
+                  bool missing_ok, unity::storage::provider::Context const& ctx);
     ~DeleteHandler();
 
     boost::future<void> get_future();
@@ -44,6 +47,10 @@ private:
 
     std::shared_ptr<DavProvider> const provider_;
     std::string const item_id_;
+    QUrl const base_url_;
+    bool const missing_ok_;
+    // The D-Bus call this is the result of, for tracing.
+    uint64_t const trace_call_;
 
     std::unique_ptr<QNetworkReply> reply_;
 };
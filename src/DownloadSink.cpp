@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "DownloadSink.h"
+
+#include <QIODevice>
+#include <QSocketNotifier>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+constexpr int MAX_IOVECS = 16;
+// Throughput is measured over windows of this length.
+constexpr auto WINDOW = chrono::milliseconds(100);
+// Adaptive sizing aims to queue this much of the throughput.
+constexpr int64_t TARGET_QUEUE_MS = 250;
+
+int64_t round_up(int64_t bytes)
+{
+    int64_t const chunks = (bytes + DownloadSink::BUFFER_SIZE - 1) /
+        DownloadSink::BUFFER_SIZE;
+    return max<int64_t>(1, chunks) * DownloadSink::BUFFER_SIZE;
+}
+
+int64_t round_down(int64_t bytes)
+{
+    return max<int64_t>(0, bytes / DownloadSink::BUFFER_SIZE) *
+        DownloadSink::BUFFER_SIZE;
+}
+
+// Block SIGPIPE for the current thread, so writing to a socket the
+// client has closed fails with EPIPE rather than killing the process.
+// send() can avoid the signal with MSG_NOSIGNAL, but sendfile() has
+// no such flag.
+class SigpipeBlocker
+{
+public:
+    SigpipeBlocker()
+    {
+        sigemptyset(&sigpipe_);
+        sigaddset(&sigpipe_, SIGPIPE);
+        sigset_t pending;
+        sigpending(&pending);
+        was_pending_ = sigismember(&pending, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe_, &old_mask_);
+    }
+
+    ~SigpipeBlocker()
+    {
+        int const saved_errno = errno;
+        if (!was_pending_)
+        {
+            // Discard the signal raised by a failed write, if any.
+            struct timespec const zero = {0, 0};
+            while (sigtimedwait(&sigpipe_, nullptr, &zero) > 0)
+            {
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old_mask_, nullptr);
+        errno = saved_errno;
+    }
+
+private:
+    sigset_t sigpipe_;
+    sigset_t old_mask_;
+    bool was_pending_;
+};
+
+}
+
+constexpr int DownloadSink::BUFFER_SIZE;
+
+DownloadSink::DownloadSink(int fd, int64_t high_watermark,
+                           int64_t low_watermark)
+    : fd_(fd), high_watermark_(round_up(high_watermark)),
+      low_watermark_(min(round_down(low_watermark),
+                         high_watermark_ - BUFFER_SIZE)),
+      max_capacity_(high_watermark_)
+{
+    int const flags = fcntl(fd_, F_GETFL);
+    if (flags >= 0)
+    {
+        fcntl(fd_, F_SETFL, flags | O_NONBLOCK);
+    }
+    notifier_.reset(new QSocketNotifier(fd_, QSocketNotifier::Write));
+    notifier_->setEnabled(false);
+    connect(notifier_.get(), &QSocketNotifier::activated,
+            this, &DownloadSink::onNotifierActivated);
+}
+
+DownloadSink::~DownloadSink()
+{
+    close();
+}
+
+void DownloadSink::setMaxCapacity(int64_t max_capacity)
+{
+    max_capacity_ = max(high_watermark_, round_up(max_capacity));
+}
+
+int64_t DownloadSink::highWatermark() const
+{
+    return high_watermark_;
+}
+
+int64_t DownloadSink::lowWatermark() const
+{
+    return low_watermark_;
+}
+
+void DownloadSink::setCopy(QIODevice* copy)
+{
+    copy_ = copy;
+}
+
+bool DownloadSink::hasRoom() const
+{
+    return filling_ && pending_ < high_watermark_;
+}
+
+int64_t DownloadSink::pending() const
+{
+    return pending_;
+}
+
+int64_t DownloadSink::fill(QIODevice* source)
+{
+    int64_t total = 0;
+    while (hasRoom())
+    {
+        if (chunks_.empty() || chunks_.back().size == BUFFER_SIZE)
+        {
+            if (spare_.empty())
+            {
+                chunks_.emplace_back();
+                chunks_.back().data.reset(new char[BUFFER_SIZE]);
+            }
+            else
+            {
+                chunks_.emplace_back(move(spare_.back()));
+                spare_.pop_back();
+            }
+        }
+        Chunk& chunk = chunks_.back();
+        qint64 const n = source->read(
+            chunk.data.get() + chunk.size,
+            min<int64_t>(BUFFER_SIZE - chunk.size,
+                         high_watermark_ - pending_));
+        if (n <= 0)
+        {
+            if (chunk.size == 0)
+            {
+                spare_.emplace_back(move(chunk));
+                chunks_.pop_back();
+            }
+            if (n < 0)
+            {
+                return -1;
+            }
+            break;
+        }
+        if (copy_ != nullptr)
+        {
+            copy_->write(chunk.data.get() + chunk.size, n);
+        }
+        chunk.size += n;
+        pending_ += n;
+        total += n;
+        updateFilling();
+    }
+    return total;
+}
+
+bool DownloadSink::flush()
+{
+    if (fd_ < 0)
+    {
+        return pending_ == 0;
+    }
+    while (pending_ > 0)
+    {
+        struct iovec iov[MAX_IOVECS];
+        int n_iov = 0;
+        for (auto const& chunk : chunks_)
+        {
+            if (n_iov == MAX_IOVECS)
+            {
+                break;
+            }
+            iov[n_iov].iov_base = chunk.data.get() + chunk.offset;
+            iov[n_iov].iov_len = chunk.size - chunk.offset;
+            n_iov++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n_iov;
+        ssize_t n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                waitWritable();
+                return true;
+            }
+            setError("sendmsg", errno);
+            return false;
+        }
+        pending_ -= n;
+        recordSent(n);
+        while (n > 0)
+        {
+            Chunk& chunk = chunks_.front();
+            int const consumed = min<int64_t>(n, chunk.size - chunk.offset);
+            chunk.offset += consumed;
+            n -= consumed;
+            if (chunk.offset == chunk.size)
+            {
+                chunk.size = 0;
+                chunk.offset = 0;
+                spare_.emplace_back(move(chunk));
+                chunks_.pop_front();
+            }
+        }
+        updateFilling();
+    }
+    return true;
+}
+
+int64_t DownloadSink::sendFile(int file_fd, int64_t& offset, int64_t count)
+{
+    assert(pending_ == 0);
+    if (fd_ < 0)
+    {
+        setError("sendfile", EBADF);
+        return -1;
+    }
+    off_t off = offset;
+    ssize_t n;
+    {
+        SigpipeBlocker blocker;
+        do
+        {
+            n = sendfile(fd_, file_fd, &off, count);
+        } while (n < 0 && errno == EINTR);
+    }
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            waitWritable();
+            return 0;
+        }
+        setError("sendfile", errno);
+        return -1;
+    }
+    offset = off;
+    if (n < count)
+    {
+        waitWritable();
+    }
+    return n;
+}
+
+void DownloadSink::close()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    notifier_->setEnabled(false);
+    notifier_.reset();
+    ::close(fd_);
+    fd_ = -1;
+}
+
+QString const& DownloadSink::errorString() const
+{
+    return error_string_;
+}
+
+void DownloadSink::onNotifierActivated()
+{
+    notifier_->setEnabled(false);
+    Q_EMIT writable();
+}
+
+void DownloadSink::updateFilling()
+{
+    if (pending_ >= high_watermark_)
+    {
+        if (filling_)
+        {
+            window_filled_ = true;
+        }
+        filling_ = false;
+    }
+    else if (!filling_ && pending_ <= low_watermark_)
+    {
+        filling_ = true;
+    }
+}
+
+void DownloadSink::recordSent(int64_t bytes)
+{
+    auto const now = Clock::now();
+    if (window_bytes_ == 0)
+    {
+        window_start_ = now;
+    }
+    window_bytes_ += bytes;
+    auto const elapsed = now - window_start_;
+    if (elapsed < WINDOW)
+    {
+        return;
+    }
+
+    // If the queue filled up during the window, let it hold more,
+    // in proportion to the rate the client is reading at.
+    if (window_filled_ && high_watermark_ < max_capacity_)
+    {
+        int64_t const elapsed_ms = chrono::duration_cast<
+            chrono::milliseconds>(elapsed).count();
+        int64_t const target = round_up(
+            window_bytes_ * TARGET_QUEUE_MS / elapsed_ms);
+        int64_t const high = min(max_capacity_,
+                                 min(target, 2 * high_watermark_));
+        if (high > high_watermark_)
+        {
+            low_watermark_ = round_down(
+                low_watermark_ * high / high_watermark_);
+            high_watermark_ = high;
+            updateFilling();
+        }
+    }
+    window_bytes_ = 0;
+    window_filled_ = false;
+}
+
+void DownloadSink::waitWritable()
+{
+    if (notifier_)
+    {
+        notifier_->setEnabled(true);
+    }
+}
+
+void DownloadSink::setError(char const* operation, int error)
+{
+    error_string_ = QStringLiteral("%1: %2").arg(
+        operation, QString::fromLocal8Bit(strerror(error)));
+}
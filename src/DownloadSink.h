@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QString>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class QIODevice;
+class QSocketNotifier;
+
+// Writes a download's data to the socket the client reads it from.
+//
+// Data read from a QIODevice such as a network reply is queued in a
+// ring of fixed size chunks, so the source can be drained while
+// earlier chunks are still being written.  Once the data queued
+// reaches the high watermark, no more is accepted until it has drained
+// to the low watermark, so reads happen in bursts rather than a chunk
+// at a time.  Queued chunks are handed to the socket with a single
+// sendmsg() call, rather than going through a QLocalSocket's write
+// buffer.
+//
+// If adaptive sizing is enabled, the high watermark is raised to hold
+// a quarter second of the observed throughput whenever the queue
+// fills, up to a memory cap.
+//
+// Data in a file is instead passed to sendfile(), so it goes from the
+// page cache to the socket without being copied through user space.
+class DownloadSink : public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr int BUFFER_SIZE = 64 * 1024;
+
+    // Takes ownership of the socket.  The watermarks are rounded to
+    // whole chunks.  By default, two chunks are queued: one being
+    // written while the next is read.
+    explicit DownloadSink(int fd, int64_t high_watermark = 2 * BUFFER_SIZE,
+                          int64_t low_watermark = BUFFER_SIZE);
+    ~DownloadSink();
+
+    // Let the high watermark grow up to max_capacity bytes.
+    void setMaxCapacity(int64_t max_capacity);
+    int64_t highWatermark() const;
+    int64_t lowWatermark() const;
+    // Also write data read by fill() to the device, if not null.
+    void setCopy(QIODevice* copy);
+
+    // True if there is space to read more data.
+    bool hasRoom() const;
+    // Bytes accepted but not yet written to the socket.
+    int64_t pending() const;
+    // Read as much from the source as will fit below the high
+    // watermark.  Returns the number of bytes read, or -1 on error.
+    int64_t fill(QIODevice* source);
+    // Write queued data until the socket would block, in which case
+    // writable() is emitted once it has room.  Returns false on error.
+    bool flush();
+    // Send up to count bytes of a file from offset, which is advanced
+    // past the bytes sent, without copying them through user space.
+    // Queued data must be flushed first.  Returns the number of bytes
+    // sent, which is zero if the socket is full, or -1 on error.
+    int64_t sendFile(int file_fd, int64_t& offset, int64_t count);
+    void close();
+
+    QString const& errorString() const;
+
+Q_SIGNALS:
+    void writable();
+
+private Q_SLOTS:
+    void onNotifierActivated();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        int size = 0;
+        int offset = 0;
+    };
+
+    void updateFilling();
+    void recordSent(int64_t bytes);
+    void waitWritable();
+    void setError(char const* operation, int error);
+
+    int fd_;
+    std::unique_ptr<QSocketNotifier> notifier_;
+    // Chunks in the order they will be written.  Only the last may be
+    // partially filled.
+    std::deque<Chunk> chunks_;
+    // Written chunks kept for reuse.
+    std::vector<Chunk> spare_;
+    int64_t pending_ = 0;
+    QIODevice* copy_ = nullptr;
+    int64_t high_watermark_;
+    int64_t low_watermark_;
+    int64_t max_capacity_;
+    // Cleared on reaching the high watermark, and set again once the
+    // queue drains to the low watermark.
+    bool filling_ = true;
+
+    // Throughput over the current measurement window.
+    Clock::time_point window_start_;
+    int64_t window_bytes_ = 0;
+    bool window_filled_ = false;
+
+    QString error_string_;
+};
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+
+// Values below 2^EXACT_BITS are counted exactly, and each power of
+// two range above that is split into 2^(EXACT_BITS - 1) buckets.
+int const EXACT_BITS = 7;
+uint64_t const EXACT_LIMIT = uint64_t(1) << EXACT_BITS;
+uint64_t const SUB_BUCKETS = EXACT_LIMIT / 2;
+
+int highest_bit(uint64_t value)
+{
+    int bit = 0;
+    while (value >>= 1)
+    {
+        bit++;
+    }
+    return bit;
+}
+
+}
+
+Histogram::Histogram() = default;
+
+Histogram::~Histogram() = default;
+
+size_t Histogram::bucket_index(uint64_t value)
+{
+    if (value < EXACT_LIMIT)
+    {
+        return value;
+    }
+    // Keep the top EXACT_BITS - 1 bits after the leading one.
+    int const shift = highest_bit(value) - (EXACT_BITS - 1);
+    uint64_t const sub_bucket = (value >> shift) - SUB_BUCKETS;
+    return EXACT_LIMIT + (shift - 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t Histogram::bucket_limit(size_t index)
+{
+    if (index < EXACT_LIMIT)
+    {
+        return index;
+    }
+    size_t const offset = index - EXACT_LIMIT;
+    int const shift = offset / SUB_BUCKETS + 1;
+    uint64_t const leading = SUB_BUCKETS + offset % SUB_BUCKETS;
+    return ((leading + 1) << shift) - 1;
+}
+
+void Histogram::record(int64_t value)
+{
+    value = std::max<int64_t>(value, 0);
+    size_t const index = bucket_index(value);
+    if (index >= counts_.size())
+    {
+        counts_.resize(index + 1, 0);
+    }
+    counts_[index]++;
+    if (count_ == 0 || value < min_)
+    {
+        min_ = value;
+    }
+    if (count_ == 0 || value > max_)
+    {
+        max_ = value;
+    }
+    count_++;
+    sum_ += value;
+}
+
+void Histogram::reset()
+{
+    counts_.clear();
+    count_ = 0;
+    min_ = 0;
+    max_ = 0;
+    sum_ = 0;
+}
+
+uint64_t Histogram::count() const
+{
+    return count_;
+}
+
+int64_t Histogram::min() const
+{
+    return min_;
+}
+
+int64_t Histogram::max() const
+{
+    return max_;
+}
+
+double Histogram::mean() const
+{
+    return count_ == 0 ? 0 : sum_ / count_;
+}
+
+int64_t Histogram::percentile(double p) const
+{
+    if (count_ == 0)
+    {
+        return 0;
+    }
+    p = std::min(std::max(p, 0.0), 1.0);
+    uint64_t const rank = std::max<uint64_t>(
+        static_cast<uint64_t>(ceil(p * count_)), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++)
+    {
+        seen += counts_[i];
+        if (seen >= rank)
+        {
+            int64_t const limit = bucket_limit(i);
+            return std::min(std::max(limit, min_), max_);
+        }
+    }
+    return max_;
+}
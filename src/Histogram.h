@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A histogram of non-negative integers in the style of HdrHistogram.
+//
+// Values below 128 are counted exactly.  Above that, each power of
+// two range is split into 64 equal buckets, so a value is known to
+// within 1/64 (about 1.6%) of its magnitude, while the memory used
+// only grows with the logarithm of the largest value recorded.
+class Histogram
+{
+public:
+    Histogram();
+    ~Histogram();
+
+    // Negative values are counted as zero.
+    void record(int64_t value);
+    void reset();
+
+    uint64_t count() const;
+    int64_t min() const;
+    int64_t max() const;
+    double mean() const;
+    // The smallest value that at least the fraction p of recorded
+    // values are less than or equal to, to within a bucket.
+    int64_t percentile(double p) const;
+
+private:
+    static std::size_t bucket_index(uint64_t value);
+    static uint64_t bucket_limit(std::size_t index);
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    int64_t min_ = 0;
+    int64_t max_ = 0;
+    double sum_ = 0;
+};
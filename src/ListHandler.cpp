@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2016 Canonical Ltd.
+ * Copyright (C) 2017 Canonical Ltd.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 3 as
@@ -17,43 +17,120 @@
  */
 
 #include "ListHandler.h"
+#include "DavProvider.h"
+#include "ListingSnapshot.h"
+#include "RetrieveListingHandler.h"
 
 #include <unity/storage/provider/Exceptions.h>
 
-#include <algorithm>
-#include <cassert>
-
 using namespace std;
 using namespace unity::storage::provider;
 
 ListHandler::ListHandler(std::shared_ptr<DavProvider> const& provider,
-                         string const& parent_id, Context const& ctx)
-    : PropFindHandler(provider, parent_id, 1, ctx)
+                         string const& parent_id, PropertySet properties,
+                         shared_ptr<ListingSnapshot> const& snapshot,
+                         Context const& ctx)
+    : provider_(provider), parent_id_(parent_id),
+      account_(snapshot->account()), properties_(properties),
+      snapshot_(snapshot), context_(ctx)
 {
+    string etag;
+    if (!provider_->listing_cache().get_etag(account_, parent_id_, etag) &&
+        !provider_->needs_sync_baseline(account_))
+    {
+        provider_->listing_cache().record_miss();
+        fetch();
+        return;
+    }
+
+    // Apply the changes the server reports before using the cache.
+    provider_->synchronize(
+        context_,
+        [this](bool const& up_to_date, boost::exception_ptr const&) {
+            ItemList items;
+            string etag;
+            if (up_to_date &&
+                provider_->listing_cache().get_etag(
+                    account_, parent_id_, etag) &&
+                provider_->listing_cache().get(
+                    account_, parent_id_, etag, properties_, items))
+            {
+                use_cached(items);
+                return;
+            }
+            // Synchronisation errors are reported if fetching the
+            // listing also fails.
+            revalidate();
+        });
 }
 
 ListHandler::~ListHandler() = default;
 
 boost::future<tuple<ItemList,string>> ListHandler::get_future()
 {
-    return promise_.get_future();
+    return snapshot_->get_page(0);
 }
 
-void ListHandler::finish()
+void ListHandler::revalidate()
 {
-    deleteLater();
-
-    if (error_)
+    string etag;
+    if (!provider_->listing_cache().get_etag(account_, parent_id_, etag))
     {
-        promise_.set_exception(error_);
+        provider_->listing_cache().record_miss();
+        fetch();
         return;
     }
-    // A "Depth: 1" PROPFIND will also return data for the parent URL
-    // itself, so remove it from the list.
-    items_.erase(remove_if(items_.begin(), items_.end(),
-                           [&](Item const& item) -> bool {
-                               return item.item_id == item_id_;
-                           }), items_.end());
-
-    promise_.set_value(make_tuple(move(items_), string()));
+
+    // Check whether the folder has changed since we listed it.
+    provider_->retrieve_metadata(
+        parent_id_, dav_property::required, context_,
+        [this](Item const& folder, boost::exception_ptr const& error) {
+            ItemList items;
+            // On error, a blank ETag forces the listing to be
+            // discarded.  Fetching it again will report the error
+            // properly.
+            string const etag = error ? string() : folder.etag;
+            if (provider_->listing_cache().get(
+                    account_, parent_id_, etag, properties_, items))
+            {
+                use_cached(items);
+                return;
+            }
+            fetch();
+        });
+}
+
+void ListHandler::use_cached(ItemList const& items)
+{
+    snapshot_->add(items);
+    snapshot_->finish();
+    deleteLater();
+}
+
+void ListHandler::fetch()
+{
+    uint64_t const generation = provider_->sync_generation(account_);
+    listing_.reset(
+        new RetrieveListingHandler(
+            provider_, parent_id_, properties_, context_,
+            [this](Item const& item) {
+                snapshot_->add(item);
+            },
+            [this, generation](Item const& folder, boost::exception_ptr const& error) {
+                if (error)
+                {
+                    snapshot_->fail(error);
+                }
+                else
+                {
+                    if (provider_->sync_generation(account_) == generation)
+                    {
+                        provider_->listing_cache().put(
+                            account_, parent_id_, folder.etag, properties_,
+                            snapshot_->items());
+                    }
+                    snapshot_->finish();
+                }
+                deleteLater();
+            }));
 }
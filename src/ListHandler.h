@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2016 Canonical Ltd.
+ * Copyright (C) 2017 Canonical Ltd.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 3 as
@@ -19,25 +19,45 @@
 #pragma once
 
 #include <QObject>
+#include <unity/storage/provider/ProviderBase.h>
 
 #include <memory>
+#include <string>
 #include <tuple>
 
-#include "PropFindHandler.h"
+#include "dav_properties.h"
 
-class ListHandler : public PropFindHandler {
+class DavProvider;
+class ListingSnapshot;
+class RetrieveListingHandler;
+
+// Lists a folder into a snapshot, reusing a cached listing if the
+// server's sync-collection changes have been applied to it, or if a
+// "Depth: 0" PROPFIND shows that the folder's ETag has not changed
+// since it was fetched.
+class ListHandler : public QObject {
     Q_OBJECT
 public:
     ListHandler(std::shared_ptr<DavProvider> const& provider,
-                std::string const& parent_id,
+                std::string const& parent_id, PropertySet properties,
+                std::shared_ptr<ListingSnapshot> const& snapshot,
                 unity::storage::provider::Context const& ctx);
     ~ListHandler();
 
+    // Returns the first page of the listing.
     boost::future<std::tuple<unity::storage::provider::ItemList,std::string>> get_future();
 
 private:
-    boost::promise<std::tuple<unity::storage::provider::ItemList,std::string>> promise_;
-
-protected:
-    void finish() override;
+    void revalidate();
+    void use_cached(unity::storage::provider::ItemList const& items);
+    void fetch();
+
+    std::shared_ptr<DavProvider> const provider_;
+    std::string const parent_id_;
+    std::string const account_;
+    PropertySet const properties_;
+    std::shared_ptr<ListingSnapshot> const snapshot_;
+    unity::storage::provider::Context const context_;
+
+    std::unique_ptr<RetrieveListingHandler> listing_;
 };
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "ListingCache.h"
+#include "item_id.h"
+
+using namespace std;
+using namespace unity::storage::provider;
+
+ListingCache::ListingCache(size_t capacity)
+    : capacity_(capacity)
+{
+}
+
+ListingCache::~ListingCache() = default;
+
+void ListingCache::set_capacity(size_t capacity)
+{
+    capacity_ = capacity;
+    evict();
+}
+
+string ListingCache::make_key(string const& account, string const& folder_id)
+{
+    // Item IDs are percent encoded, so can not contain a newline.
+    return account + '\n' + folder_id;
+}
+
+bool ListingCache::get_etag(string const& account, string const& folder_id,
+                            string& etag) const
+{
+    auto it = index_.find(make_key(account, folder_id));
+    if (it == index_.end())
+    {
+        return false;
+    }
+    etag = it->second->etag;
+    return true;
+}
+
+bool ListingCache::get(string const& account, string const& folder_id,
+                       string const& etag, PropertySet properties,
+                       ItemList& items)
+{
+    auto it = index_.find(make_key(account, folder_id));
+    if (it == index_.end())
+    {
+        misses_++;
+        return false;
+    }
+    auto entry = it->second;
+    if (etag.empty() || entry->etag != etag)
+    {
+        // The folder has changed, so the listing is useless.
+        erase(entry);
+        misses_++;
+        return false;
+    }
+    if (!covers(entry->properties, properties))
+    {
+        misses_++;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, entry);
+    items = entry->items;
+    hits_++;
+    return true;
+}
+
+void ListingCache::put(string const& account, string const& folder_id,
+                       string const& etag, PropertySet properties,
+                       ItemList const& items)
+{
+    string key = make_key(account, folder_id);
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+        erase(it->second);
+    }
+    // Without an ETag we have no way to revalidate the listing.
+    if (etag.empty() || items.size() > capacity_)
+    {
+        return;
+    }
+    lru_.push_front(Entry{key, etag, properties, items});
+    index_.emplace(move(key), lru_.begin());
+    item_count_ += items.size();
+    evict();
+}
+
+void ListingCache::set_etag(string const& account, string const& folder_id,
+                            string const& etag)
+{
+    auto it = index_.find(make_key(account, folder_id));
+    if (it == index_.end())
+    {
+        return;
+    }
+    if (etag.empty())
+    {
+        erase(it->second);
+        return;
+    }
+    it->second->etag = etag;
+}
+
+void ListingCache::update_item(string const& account, string const& folder_id,
+                               Item const& item, PropertySet properties)
+{
+    auto it = index_.find(make_key(account, folder_id));
+    if (it == index_.end())
+    {
+        return;
+    }
+    // The listing now only has the properties every item has.
+    it->second->properties &= properties;
+    auto& items = it->second->items;
+    for (auto& existing : items)
+    {
+        if (existing.item_id == item.item_id)
+        {
+            existing = item;
+            return;
+        }
+    }
+    items.push_back(item);
+    item_count_++;
+    evict();
+}
+
+void ListingCache::remove_item(string const& account, string const& folder_id,
+                               string const& item_id)
+{
+    auto it = index_.find(make_key(account, folder_id));
+    if (it == index_.end())
+    {
+        return;
+    }
+    auto& items = it->second->items;
+    for (auto item = items.begin(); item != items.end(); ++item)
+    {
+        if (item->item_id == item_id)
+        {
+            items.erase(item);
+            item_count_--;
+            return;
+        }
+    }
+}
+
+void ListingCache::remove(string const& account, string const& folder_id)
+{
+    auto it = index_.find(make_key(account, folder_id));
+    if (it != index_.end())
+    {
+        erase(it->second);
+    }
+}
+
+void ListingCache::remove_tree(string const& account, string const& item_id)
+{
+    remove(account, item_id);
+    if (!is_folder(item_id))
+    {
+        return;
+    }
+    string const prefix = item_id == "." ? make_key(account, string())
+                                         : make_key(account, item_id);
+    for (auto entry = lru_.begin(); entry != lru_.end();)
+    {
+        auto next = entry;
+        ++next;
+        if (entry->key.compare(0, prefix.size(), prefix) == 0)
+        {
+            erase(entry);
+        }
+        entry = next;
+    }
+}
+
+void ListingCache::clear()
+{
+    index_.clear();
+    lru_.clear();
+    item_count_ = 0;
+}
+
+size_t ListingCache::size() const
+{
+    return lru_.size();
+}
+
+int64_t ListingCache::hits() const
+{
+    return hits_;
+}
+
+int64_t ListingCache::misses() const
+{
+    return misses_;
+}
+
+void ListingCache::record_miss()
+{
+    misses_++;
+}
+
+void ListingCache::erase(list<Entry>::iterator entry)
+{
+    item_count_ -= entry->items.size();
+    index_.erase(entry->key);
+    lru_.erase(entry);
+}
+
+void ListingCache::evict()
+{
+    while (item_count_ > capacity_ && !lru_.empty())
+    {
+        erase(--lru_.end());
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include "dav_properties.h"
+
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Cache of folder listings, keyed by account and folder ID.
+//
+// Each listing is stored along with the ETag the folder had when it
+// was retrieved.  A cached listing is only handed out when the caller
+// can show the folder still has that ETag, so the cache never needs
+// to expire entries by age.  The capacity is measured in the total
+// number of cached items, and the least recently used listings are
+// dropped first.
+class ListingCache
+{
+public:
+    explicit ListingCache(std::size_t capacity);
+    ~ListingCache();
+
+    ListingCache(ListingCache const&) = delete;
+    ListingCache& operator=(ListingCache const&) = delete;
+
+    void set_capacity(std::size_t capacity);
+
+    // Return the folder ETag associated with a cached listing.
+    bool get_etag(std::string const& account, std::string const& folder_id,
+                  std::string& etag) const;
+    // Retrieve the listing if it was cached with the given ETag, and
+    // its items have at least the given properties.  Updates the hit
+    // and miss counters.
+    bool get(std::string const& account, std::string const& folder_id,
+             std::string const& etag, PropertySet properties,
+             unity::storage::provider::ItemList& items);
+    void put(std::string const& account, std::string const& folder_id,
+             std::string const& etag, PropertySet properties,
+             unity::storage::provider::ItemList const& items);
+
+    // Patch a cached listing to reflect a change reported by the
+    // server.  These do nothing if the folder's listing isn't cached.
+    void set_etag(std::string const& account, std::string const& folder_id,
+                  std::string const& etag);
+    void update_item(std::string const& account, std::string const& folder_id,
+                     unity::storage::provider::Item const& item,
+                     PropertySet properties);
+    void remove_item(std::string const& account, std::string const& folder_id,
+                     std::string const& item_id);
+
+    void remove(std::string const& account, std::string const& folder_id);
+    // Remove the listing for the folder and all its descendants.
+    void remove_tree(std::string const& account, std::string const& item_id);
+    void clear();
+
+    std::size_t size() const;
+    int64_t hits() const;
+    int64_t misses() const;
+    // Record a listing that had to be fetched without consulting the
+    // cache.
+    void record_miss();
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string etag;
+        PropertySet properties;
+        unity::storage::provider::ItemList items;
+    };
+
+    static std::string make_key(std::string const& account,
+                                std::string const& folder_id);
+    void erase(std::list<Entry>::iterator entry);
+    void evict();
+
+    std::size_t capacity_;
+    std::size_t item_count_ = 0;
+    int64_t hits_ = 0;
+    int64_t misses_ = 0;
+    // Most recently used entries are at the front of the list.
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "ListingSnapshot.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+ListingSnapshot::ListingSnapshot(string const& id, string const& account,
+                                 string const& folder_id, size_t page_size)
+    : id_(id), account_(account), folder_id_(folder_id),
+      page_size_(max<size_t>(page_size, 1)), last_used_(Clock::now())
+{
+}
+
+ListingSnapshot::~ListingSnapshot() = default;
+
+string const& ListingSnapshot::id() const
+{
+    return id_;
+}
+
+string const& ListingSnapshot::account() const
+{
+    return account_;
+}
+
+string const& ListingSnapshot::folder_id() const
+{
+    return folder_id_;
+}
+
+void ListingSnapshot::add_consumer()
+{
+    consumers_++;
+    last_used_ = Clock::now();
+}
+
+void ListingSnapshot::add(Item const& item)
+{
+    items_.push_back(item);
+    // Only wake waiters when a page boundary is crossed.
+    if (!waiters_.empty() && items_.size() % page_size_ == 0)
+    {
+        process_waiters();
+    }
+}
+
+void ListingSnapshot::add(ItemList const& items)
+{
+    items_.insert(items_.end(), items.begin(), items.end());
+    process_waiters();
+}
+
+void ListingSnapshot::finish()
+{
+    complete_ = true;
+    process_waiters();
+}
+
+void ListingSnapshot::fail(boost::exception_ptr const& error)
+{
+    complete_ = true;
+    error_ = error;
+    process_waiters();
+}
+
+bool ListingSnapshot::is_complete() const
+{
+    return complete_;
+}
+
+bool ListingSnapshot::is_drained() const
+{
+    return drained_;
+}
+
+ListingSnapshot::Clock::time_point ListingSnapshot::last_used() const
+{
+    return last_used_;
+}
+
+ItemList const& ListingSnapshot::items() const
+{
+    return items_;
+}
+
+boost::future<ListingSnapshot::Page> ListingSnapshot::get_page(size_t offset)
+{
+    last_used_ = Clock::now();
+    boost::promise<Page> p;
+    auto f = p.get_future();
+    waiters_.push_back(Waiter{offset, std::move(p), Trace::current_call()});
+    process_waiters();
+    return f;
+}
+
+string ListingSnapshot::make_page_token(size_t offset) const
+{
+    return id_ + ':' + to_string(offset);
+}
+
+bool ListingSnapshot::parse_page_token(string const& token, string& id,
+                                       size_t& offset)
+{
+    auto pos = token.rfind(':');
+    if (pos == string::npos || pos == 0 || pos+1 == token.size())
+    {
+        return false;
+    }
+    string const number = token.substr(pos+1);
+    if (number.find_first_not_of("0123456789") != string::npos)
+    {
+        return false;
+    }
+    try
+    {
+        offset = stoul(number);
+    }
+    catch (std::exception const&)
+    {
+        return false;
+    }
+    id = token.substr(0, pos);
+    return true;
+}
+
+bool ListingSnapshot::page_ready(size_t offset) const
+{
+    return complete_ || items_.size() >= offset + page_size_;
+}
+
+ListingSnapshot::Page ListingSnapshot::make_page(size_t offset)
+{
+    size_t const begin = min(offset, items_.size());
+    size_t const end = min(offset + page_size_, items_.size());
+    ItemList page(items_.begin() + begin, items_.begin() + end);
+
+    string token;
+    if (!complete_ || end < items_.size())
+    {
+        token = make_page_token(end);
+    }
+    else if (++final_pages_ >= consumers_)
+    {
+        drained_ = true;
+    }
+    return make_tuple(move(page), move(token));
+}
+
+void ListingSnapshot::process_waiters()
+{
+    for (auto it = waiters_.begin(); it != waiters_.end();)
+    {
+        if (!page_ready(it->offset))
+        {
+            ++it;
+            continue;
+        }
+        if (error_)
+        {
+            it->promise.set_exception(error_);
+        }
+        else
+        {
+            it->promise.set_value(make_page(it->offset));
+        }
+        Trace::end_call(it->call);
+        it = waiters_.erase(it);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// The results of a single folder listing, handed out to the client
+// one page at a time.
+//
+// Items are appended as the Multi-Status response is parsed, so
+// early pages can be returned before the full listing has been
+// received.  Page tokens take the form "<snapshot id>:<offset>".
+class ListingSnapshot
+{
+public:
+    typedef std::tuple<unity::storage::provider::ItemList,std::string> Page;
+    typedef std::chrono::steady_clock Clock;
+
+    ListingSnapshot(std::string const& id, std::string const& account,
+                    std::string const& folder_id, std::size_t page_size);
+    ~ListingSnapshot();
+
+    ListingSnapshot(ListingSnapshot const&) = delete;
+    ListingSnapshot& operator=(ListingSnapshot const&) = delete;
+
+    std::string const& id() const;
+    std::string const& account() const;
+    std::string const& folder_id() const;
+
+    // Another client is reading the same listing.  The snapshot is
+    // only drained once every consumer has received the last page.
+    void add_consumer();
+
+    void add(unity::storage::provider::Item const& item);
+    void add(unity::storage::provider::ItemList const& items);
+    void finish();
+    void fail(boost::exception_ptr const& error);
+
+    bool is_complete() const;
+    // True once the complete listing has been handed out.
+    bool is_drained() const;
+    // When a consumer last asked for a page.
+    Clock::time_point last_used() const;
+    unity::storage::provider::ItemList const& items() const;
+
+    boost::future<Page> get_page(std::size_t offset);
+
+    std::string make_page_token(std::size_t offset) const;
+    // Split a page token into snapshot ID and offset.  Returns false
+    // if the token is malformed.
+    static bool parse_page_token(std::string const& token, std::string& id,
+                                 std::size_t& offset);
+
+private:
+    void process_waiters();
+    bool page_ready(std::size_t offset) const;
+    Page make_page(std::size_t offset);
+
+    std::string const id_;
+    std::string const account_;
+    std::string const folder_id_;
+    std::size_t const page_size_;
+
+    unity::storage::provider::ItemList items_;
+    bool complete_ = false;
+    bool drained_ = false;
+    std::size_t consumers_ = 1;
+    std::size_t final_pages_ = 0;
+    Clock::time_point last_used_;
+    boost::exception_ptr error_;
+    struct Waiter
+    {
+        std::size_t offset;
+        boost::promise<Page> promise;
+        // The D-Bus call waiting for the page, for tracing.
+        uint64_t call;
+    };
+    std::vector<Waiter> waiters_;
+};
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "MetadataCache.h"
+#include "item_id.h"
+
+using namespace std;
+using namespace unity::storage::provider;
+
+MetadataCache::MetadataCache(size_t capacity, Clock::duration ttl)
+    : capacity_(capacity), ttl_(ttl)
+{
+}
+
+MetadataCache::~MetadataCache() = default;
+
+void MetadataCache::set_capacity(size_t capacity)
+{
+    capacity_ = capacity;
+    evict();
+}
+
+void MetadataCache::set_ttl(Clock::duration ttl)
+{
+    ttl_ = ttl;
+    if (ttl_ <= Clock::duration::zero())
+    {
+        clear();
+    }
+}
+
+string MetadataCache::make_key(string const& account, string const& item_id)
+{
+    // Item IDs are percent encoded, so can not contain a newline.
+    return account + '\n' + item_id;
+}
+
+bool MetadataCache::get(string const& account, string const& item_id,
+                        PropertySet properties, Item& item)
+{
+    auto it = index_.find(make_key(account, item_id));
+    if (it == index_.end())
+    {
+        return false;
+    }
+    auto entry = it->second;
+    if (entry->expires <= Clock::now())
+    {
+        index_.erase(it);
+        lru_.erase(entry);
+        return false;
+    }
+    if (!covers(entry->properties, properties))
+    {
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, entry);
+    item = entry->item;
+    return true;
+}
+
+void MetadataCache::put(string const& account, Item const& item,
+                        PropertySet properties)
+{
+    if (capacity_ == 0 || ttl_ <= Clock::duration::zero())
+    {
+        return;
+    }
+    auto const expires = Clock::now() + ttl_;
+    string key = make_key(account, item.item_id);
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+        auto entry = it->second;
+        entry->item = item;
+        entry->properties = properties;
+        entry->expires = expires;
+        lru_.splice(lru_.begin(), lru_, entry);
+        return;
+    }
+    lru_.push_front(Entry{key, item, properties, expires});
+    index_.emplace(move(key), lru_.begin());
+    evict();
+}
+
+void MetadataCache::remove(string const& account, string const& item_id)
+{
+    auto it = index_.find(make_key(account, item_id));
+    if (it != index_.end())
+    {
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+}
+
+void MetadataCache::remove_tree(string const& account, string const& item_id)
+{
+    remove(account, item_id);
+    if (!is_folder(item_id))
+    {
+        return;
+    }
+    // Drop any descendants of the folder too.
+    string const prefix = item_id == "." ? make_key(account, string())
+                                         : make_key(account, item_id);
+    for (auto entry = lru_.begin(); entry != lru_.end();)
+    {
+        if (entry->key.compare(0, prefix.size(), prefix) == 0)
+        {
+            index_.erase(entry->key);
+            entry = lru_.erase(entry);
+        }
+        else
+        {
+            ++entry;
+        }
+    }
+}
+
+void MetadataCache::clear()
+{
+    index_.clear();
+    lru_.clear();
+}
+
+size_t MetadataCache::size() const
+{
+    return lru_.size();
+}
+
+void MetadataCache::evict()
+{
+    while (lru_.size() > capacity_)
+    {
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include "dav_properties.h"
+
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// A bounded LRU cache of item metadata, keyed by account and item ID.
+//
+// Entries are refreshed whenever a PROPFIND response mentions an
+// item, so the cached ETag always reflects the most recent server
+// response we have seen.  Entries older than the TTL are discarded
+// on lookup.  Like the rest of the provider, this is only accessed
+// from the event loop thread.
+class MetadataCache
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    MetadataCache(std::size_t capacity, Clock::duration ttl);
+    ~MetadataCache();
+
+    MetadataCache(MetadataCache const&) = delete;
+    MetadataCache& operator=(MetadataCache const&) = delete;
+
+    void set_capacity(std::size_t capacity);
+    void set_ttl(Clock::duration ttl);
+
+    // Only returns the item if it was retrieved with at least the
+    // given properties.
+    bool get(std::string const& account, std::string const& item_id,
+             PropertySet properties, unity::storage::provider::Item& item);
+    void put(std::string const& account,
+             unity::storage::provider::Item const& item,
+             PropertySet properties);
+
+    void remove(std::string const& account, std::string const& item_id);
+    // Remove the item, and if it is a folder everything below it.
+    void remove_tree(std::string const& account, std::string const& item_id);
+    void clear();
+
+    std::size_t size() const;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        unity::storage::provider::Item item;
+        PropertySet properties;
+        Clock::time_point expires;
+    };
+
+    static std::string make_key(std::string const& account,
+                                std::string const& item_id);
+    void evict();
+
+    std::size_t capacity_;
+    Clock::duration ttl_;
+    // Most recently used entries are at the front of the list.
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
@@ -0,0 +1,782 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "MultiStatusByteParser.h"
+
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+
+char const DAV_NS[] = "DAV:";
+char const OC_NS[] = "http://owncloud.org/ns";
+
+// Namespaces and property names seen in typical responses from
+// ownCloud and Nextcloud.  Matching names share a single QString,
+// rather than converting each occurrence from UTF-8.
+char const* const KNOWN_NAMES[] = {
+    "DAV:",
+    "http://owncloud.org/ns",
+    "http://nextcloud.org/ns",
+    "http://sabredav.org/ns",
+    "creationdate",
+    "displayname",
+    "getcontentlength",
+    "getcontenttype",
+    "getetag",
+    "getlastmodified",
+    "resourcetype",
+    "quota-available-bytes",
+    "quota-used-bytes",
+    "checksums",
+    "favorite",
+    "fileid",
+    "has-preview",
+    "id",
+    "permissions",
+    "size",
+};
+
+struct InternedName
+{
+    QByteArray bytes;
+    QString string;
+};
+
+vector<InternedName> const& interned_names()
+{
+    static vector<InternedName> const names = [] {
+        vector<InternedName> names;
+        for (auto name : KNOWN_NAMES)
+        {
+            names.push_back({QByteArray(name), QString::fromUtf8(name)});
+        }
+        return names;
+    }();
+    return names;
+}
+
+QString intern(char const* data, int size)
+{
+    for (auto const& name : interned_names())
+    {
+        if (name.bytes.size() == size &&
+            memcmp(name.bytes.constData(), data, size) == 0)
+        {
+            return name.string;
+        }
+    }
+    return QString::fromUtf8(data, size);
+}
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Parse the status code from a "HTTP/1.1 200 OK" style status line.
+int parse_status(QByteArray const& line)
+{
+    char const* p = line.constData();
+    char const* const end = p + line.size();
+    if (line.size() < 5 || memcmp(p, "HTTP/", 5) != 0)
+    {
+        return 0;
+    }
+    p += 5;
+    // Protocol version: digits '.' digits
+    char const* start = p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    if (p == start || p == end || *p != '.')
+    {
+        return 0;
+    }
+    p++;
+    start = p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    if (p == start || p == end || *p != ' ')
+    {
+        return 0;
+    }
+    p++;
+    // Three digit status code, followed by a space
+    if (end - p < 4 || p[3] != ' ')
+    {
+        return 0;
+    }
+    int status = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (p[i] < '0' || p[i] > '9')
+        {
+            return 0;
+        }
+        status = status * 10 + (p[i] - '0');
+    }
+    return status;
+}
+
+void append_utf8(QByteArray& out, uint code_point)
+{
+    if (code_point < 0x80)
+    {
+        out.append(char(code_point));
+    }
+    else if (code_point < 0x800)
+    {
+        out.append(char(0xC0 | (code_point >> 6)));
+        out.append(char(0x80 | (code_point & 0x3F)));
+    }
+    else if (code_point < 0x10000)
+    {
+        out.append(char(0xE0 | (code_point >> 12)));
+        out.append(char(0x80 | ((code_point >> 6) & 0x3F)));
+        out.append(char(0x80 | (code_point & 0x3F)));
+    }
+    else
+    {
+        out.append(char(0xF0 | (code_point >> 18)));
+        out.append(char(0x80 | ((code_point >> 12) & 0x3F)));
+        out.append(char(0x80 | ((code_point >> 6) & 0x3F)));
+        out.append(char(0x80 | (code_point & 0x3F)));
+    }
+}
+
+}
+
+MultiStatusByteParser::MultiStatusByteParser(MultiStatusParser* parser)
+    : parser_(parser)
+{
+}
+
+MultiStatusByteParser::~MultiStatusByteParser() = default;
+
+bool MultiStatusByteParser::atEnd() const
+{
+    return at_end_;
+}
+
+bool MultiStatusByteParser::feed(QByteArray const& data)
+{
+    if (failed_)
+    {
+        return false;
+    }
+    buffer_.append(data);
+    bool ok = parse(false);
+    buffer_.remove(0, pos_);
+    pos_ = 0;
+    return ok;
+}
+
+bool MultiStatusByteParser::finish()
+{
+    if (failed_)
+    {
+        return false;
+    }
+    if (!parse(true))
+    {
+        return false;
+    }
+    buffer_.clear();
+    pos_ = 0;
+    if (seen_root_ && !elements_.empty())
+    {
+        return fail(QStringLiteral("unexpected end of file"));
+    }
+    return true;
+}
+
+bool MultiStatusByteParser::fail(QString const& message)
+{
+    failed_ = true;
+    parser_->error_string_ = message;
+    return false;
+}
+
+bool MultiStatusByteParser::parse(bool at_eof)
+{
+    int const size = buffer_.size();
+    char const* const data = buffer_.constData();
+
+    while (pos_ < size)
+    {
+        char const* const p = data + pos_;
+        int const remaining = size - pos_;
+
+        if (*p != '<')
+        {
+            int end = buffer_.indexOf('<', pos_);
+            if (end < 0)
+            {
+                // Wait for the rest of the text, so we don't split
+                // entity references.
+                if (!at_eof)
+                {
+                    break;
+                }
+                end = size;
+            }
+            if (!text(p, data + end))
+            {
+                return false;
+            }
+            pos_ = end;
+            continue;
+        }
+
+        if (remaining < 2)
+        {
+            break;
+        }
+        if (p[1] == '?')
+        {
+            // Processing instruction or XML declaration
+            int end = buffer_.indexOf("?>", pos_ + 2);
+            if (end < 0)
+            {
+                break;
+            }
+            pos_ = end + 2;
+        }
+        else if (p[1] == '!')
+        {
+            static char const COMMENT[] = "<!--";
+            static char const CDATA[] = "<![CDATA[";
+            int const cdata_length = sizeof(CDATA) - 1;
+            if (remaining < 4)
+            {
+                break;
+            }
+            if (memcmp(p, COMMENT, 4) == 0)
+            {
+                int end = buffer_.indexOf("-->", pos_ + 4);
+                if (end < 0)
+                {
+                    break;
+                }
+                pos_ = end + 3;
+            }
+            else if (memcmp(p, CDATA, min(remaining, cdata_length)) == 0)
+            {
+                if (remaining < cdata_length)
+                {
+                    break;
+                }
+                int end = buffer_.indexOf("]]>", pos_ + cdata_length);
+                if (end < 0)
+                {
+                    break;
+                }
+                if (elements_.empty())
+                {
+                    return fail(QStringLiteral("error occurred while parsing element"));
+                }
+                if (collectingText())
+                {
+                    char_data_.append(p + cdata_length,
+                                      end - pos_ - cdata_length);
+                }
+                pos_ = end + 3;
+            }
+            else
+            {
+                return fail(QStringLiteral("document type declarations are not supported"));
+            }
+        }
+        else if (p[1] == '/')
+        {
+            int end = buffer_.indexOf('>', pos_ + 2);
+            if (end < 0)
+            {
+                break;
+            }
+            if (!parseEndTag(p + 2, data + end))
+            {
+                return false;
+            }
+            pos_ = end + 1;
+        }
+        else
+        {
+            // Find the end of the start tag, skipping over quoted
+            // attribute values.
+            int end = -1;
+            char quote = '\0';
+            for (int i = pos_ + 1; i < size; i++)
+            {
+                char const c = data[i];
+                if (quote != '\0')
+                {
+                    if (c == quote)
+                    {
+                        quote = '\0';
+                    }
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    quote = c;
+                }
+                else if (c == '>')
+                {
+                    end = i;
+                    break;
+                }
+            }
+            if (end < 0)
+            {
+                break;
+            }
+            if (!parseStartTag(p + 1, data + end))
+            {
+                return false;
+            }
+            pos_ = end + 1;
+        }
+    }
+
+    if (at_eof && pos_ < size)
+    {
+        return fail(QStringLiteral("unexpected end of file"));
+    }
+    return true;
+}
+
+bool MultiStatusByteParser::parseStartTag(char const* begin, char const* end)
+{
+    if (at_end_)
+    {
+        return fail(QStringLiteral("extra content at end of document"));
+    }
+    bool self_closing = false;
+    if (end > begin && end[-1] == '/')
+    {
+        self_closing = true;
+        end--;
+    }
+
+    char const* p = begin;
+    while (p < end && !is_space(*p)) p++;
+    if (p == begin)
+    {
+        return fail(QStringLiteral("error occurred while parsing element"));
+    }
+    QByteArray qname(begin, p - begin);
+
+    // Process namespace declarations.  Other attributes are ignored.
+    int n_bindings = 0;
+    while (true)
+    {
+        while (p < end && is_space(*p)) p++;
+        if (p == end)
+        {
+            break;
+        }
+        char const* const attr = p;
+        while (p < end && *p != '=' && !is_space(*p)) p++;
+        int const attr_size = p - attr;
+        while (p < end && is_space(*p)) p++;
+        if (attr_size == 0 || p == end || *p != '=')
+        {
+            return fail(QStringLiteral("error occurred while parsing attribute"));
+        }
+        p++;
+        while (p < end && is_space(*p)) p++;
+        if (p == end || (*p != '"' && *p != '\''))
+        {
+            return fail(QStringLiteral("error occurred while parsing attribute"));
+        }
+        char const quote = *p++;
+        char const* const value = p;
+        while (p < end && *p != quote) p++;
+        if (p == end)
+        {
+            return fail(QStringLiteral("error occurred while parsing attribute"));
+        }
+        char const* const value_end = p++;
+
+        if (attr_size >= 5 && memcmp(attr, "xmlns", 5) == 0 &&
+            (attr_size == 5 || attr[5] == ':'))
+        {
+            Binding binding;
+            if (attr_size > 6)
+            {
+                binding.prefix = QByteArray(attr + 6, attr_size - 6);
+            }
+            if (!decodeText(value, value_end, binding.uri))
+            {
+                return false;
+            }
+            bindings_.push_back(move(binding));
+            n_bindings++;
+        }
+    }
+
+    // Resolve the element's namespace
+    int const colon = qname.indexOf(':');
+    Name prefix{qname.constData(), colon < 0 ? 0 : colon};
+    Name local_name{qname.constData() + colon + 1, qname.size() - colon - 1};
+    QByteArray const* ns = nullptr;
+    for (auto it = bindings_.rbegin(); it != bindings_.rend(); ++it)
+    {
+        if (it->prefix.size() == prefix.size &&
+            memcmp(it->prefix.constData(), prefix.data, prefix.size) == 0)
+        {
+            ns = &it->uri;
+            break;
+        }
+    }
+    if (ns == nullptr && prefix.size != 0)
+    {
+        return fail(QStringLiteral("undeclared namespace prefix"));
+    }
+
+    seen_root_ = true;
+    elements_.push_back({qname, n_bindings});
+    startElement(ns != nullptr ? *ns : QByteArray(), local_name);
+    if (self_closing)
+    {
+        return endElement();
+    }
+    return true;
+}
+
+bool MultiStatusByteParser::parseEndTag(char const* begin, char const* end)
+{
+    while (end > begin && is_space(end[-1])) end--;
+    if (elements_.empty())
+    {
+        return fail(QStringLiteral("tag mismatch"));
+    }
+    QByteArray const& qname = elements_.back().qname;
+    if (qname.size() != end - begin ||
+        memcmp(qname.constData(), begin, qname.size()) != 0)
+    {
+        return fail(QStringLiteral("tag mismatch"));
+    }
+    return endElement();
+}
+
+bool MultiStatusByteParser::text(char const* begin, char const* end)
+{
+    if (elements_.empty())
+    {
+        // Only whitespace is allowed outside of the root element.
+        for (char const* p = begin; p < end; p++)
+        {
+            if (!is_space(*p))
+            {
+                return fail(QStringLiteral("error occurred while parsing element"));
+            }
+        }
+        return true;
+    }
+    if (!collectingText())
+    {
+        return true;
+    }
+    return decodeText(begin, end, char_data_);
+}
+
+bool MultiStatusByteParser::decodeText(char const* begin, char const* end,
+                                       QByteArray& out)
+{
+    while (begin < end)
+    {
+        auto amp = static_cast<char const*>(memchr(begin, '&', end - begin));
+        if (amp == nullptr)
+        {
+            out.append(begin, end - begin);
+            break;
+        }
+        out.append(begin, amp - begin);
+        auto semi = static_cast<char const*>(memchr(amp, ';', end - amp));
+        if (semi == nullptr)
+        {
+            return fail(QStringLiteral("unterminated entity reference"));
+        }
+        Name entity{amp + 1, int(semi - amp - 1)};
+        if (entity == "lt")
+        {
+            out.append('<');
+        }
+        else if (entity == "gt")
+        {
+            out.append('>');
+        }
+        else if (entity == "amp")
+        {
+            out.append('&');
+        }
+        else if (entity == "quot")
+        {
+            out.append('"');
+        }
+        else if (entity == "apos")
+        {
+            out.append('\'');
+        }
+        else if (entity.size > 1 && entity.data[0] == '#')
+        {
+            bool ok = false;
+            uint code_point;
+            if (entity.data[1] == 'x')
+            {
+                code_point = QByteArray(entity.data + 2, entity.size - 2).toUInt(&ok, 16);
+            }
+            else
+            {
+                code_point = QByteArray(entity.data + 1, entity.size - 1).toUInt(&ok, 10);
+            }
+            if (!ok || code_point == 0 || code_point > 0x10FFFF ||
+                (code_point >= 0xD800 && code_point <= 0xDFFF))
+            {
+                return fail(QStringLiteral("invalid character reference"));
+            }
+            append_utf8(out, code_point);
+        }
+        else
+        {
+            return fail(QStringLiteral("undefined entity"));
+        }
+        begin = semi + 1;
+    }
+    return true;
+}
+
+bool MultiStatusByteParser::collectingText() const
+{
+    if (unknown_depth_ > 0)
+    {
+        return nested_text_ && unknown_depth_ == 1;
+    }
+    // We only collect character data in certain states
+    switch (state_)
+    {
+    case ParseState::href:
+    case ParseState::property:
+    case ParseState::propstat_status:
+    case ParseState::response_status:
+    case ParseState::sync_token:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void MultiStatusByteParser::startElement(QByteArray const& ns, Name local_name)
+{
+    // Are we processing an unknown element?
+    if (unknown_depth_ > 0)
+    {
+        unknown_depth_++;
+        return;
+    }
+    bool const is_dav = ns == DAV_NS;
+    switch (state_)
+    {
+    case ParseState::start:
+        if (is_dav && local_name == "multistatus")
+        {
+            state_ = ParseState::multistatus;
+        }
+        else
+        {
+            unknown_depth_++;
+        }
+        break;
+    case ParseState::multistatus:
+        if (is_dav && local_name == "response")
+        {
+            state_ = ParseState::response;
+            current_href_.clear();
+            current_response_status_ = 0;
+            current_properties_.clear();
+        }
+        else if (is_dav && local_name == "sync-token")
+        {
+            state_ = ParseState::sync_token;
+            char_data_.clear();
+        }
+        else
+        {
+            unknown_depth_++;
+        }
+        break;
+    case ParseState::response:
+        if (is_dav && local_name == "href")
+        {
+            state_ = ParseState::href;
+            current_href_.clear();
+            char_data_.clear();
+        }
+        else if (is_dav && local_name == "status")
+        {
+            state_ = ParseState::response_status;
+            current_response_status_ = 0;
+            char_data_.clear();
+        }
+        else if (is_dav && local_name == "propstat")
+        {
+            state_ = ParseState::propstat;
+            current_propstat_.clear();
+            current_propstat_status_ = 0;
+        }
+        else
+        {
+            unknown_depth_++;
+        }
+        break;
+    case ParseState::propstat:
+        if (is_dav && local_name == "prop")
+        {
+            state_ = ParseState::prop;
+        }
+        else if (is_dav && local_name == "status")
+        {
+            state_ = ParseState::propstat_status;
+            current_propstat_status_ = 0;
+            char_data_.clear();
+        }
+        else
+        {
+            unknown_depth_++;
+        }
+        break;
+    case ParseState::prop:
+        // Any element at this level represents a property
+        state_ = ParseState::property;
+        current_prop_namespace_ = intern(ns.constData(), ns.size());
+        current_prop_name_ = intern(local_name.data, local_name.size);
+        char_data_.clear();
+        break;
+    case ParseState::property:
+        // We don't handle extra elements within a property, but need
+        // to handle DAV:resourcetype, so special case DAV:collection
+        // here.
+        if (is_dav && local_name == "collection")
+        {
+            char_data_ += "DAV:collection";
+        }
+        // oc:checksums wraps its value in oc:checksum elements.
+        else if (ns == OC_NS && local_name == "checksum")
+        {
+            if (!char_data_.trimmed().isEmpty())
+            {
+                char_data_ += ' ';
+            }
+            nested_text_ = true;
+        }
+        unknown_depth_++;
+        break;
+    case ParseState::href:
+    case ParseState::propstat_status:
+    case ParseState::response_status:
+    case ParseState::sync_token:
+        unknown_depth_++;
+        break;
+    }
+}
+
+bool MultiStatusByteParser::endElement()
+{
+    assert(!elements_.empty());
+    bindings_.resize(bindings_.size() - elements_.back().n_bindings);
+    elements_.pop_back();
+    if (elements_.empty())
+    {
+        at_end_ = true;
+    }
+
+    // Are we processing an unknown element?
+    if (unknown_depth_ > 0)
+    {
+        unknown_depth_--;
+        if (unknown_depth_ == 0)
+        {
+            nested_text_ = false;
+        }
+        return true;
+    }
+
+    switch (state_)
+    {
+    case ParseState::start:
+        // We should never see an end tag in this state.
+        assert(false);
+        break;
+    case ParseState::multistatus:
+        state_ = ParseState::start;
+        break;
+    case ParseState::response:
+        Q_EMIT parser_->response(current_href_, current_properties_,
+                                 current_response_status_);
+        state_ = ParseState::multistatus;
+        break;
+    case ParseState::href:
+    {
+        QByteArray const href = char_data_.trimmed();
+        QUrl relative(QString::fromUtf8(href), QUrl::StrictMode);
+        if (!relative.isValid()) {
+            return fail(QStringLiteral("Invalid URL: ") + QString::fromUtf8(char_data_));
+        }
+        current_href_ = parser_->base_url_.resolved(relative);
+        state_ = ParseState::response;
+        break;
+    }
+    case ParseState::propstat:
+        for (auto& prop : current_propstat_)
+        {
+            prop.status = current_propstat_status_;
+            current_properties_.emplace_back(move(prop));
+        }
+        current_propstat_.clear();
+        state_ = ParseState::response;
+        break;
+    case ParseState::prop:
+        state_ = ParseState::propstat;
+        break;
+    case ParseState::property:
+        current_propstat_.push_back({
+                current_prop_namespace_,
+                current_prop_name_,
+                QString::fromUtf8(char_data_.trimmed()),
+                0,
+                QString()
+            });
+        state_ = ParseState::prop;
+        break;
+    case ParseState::propstat_status:
+        current_propstat_status_ = parse_status(char_data_.trimmed());
+        state_ = ParseState::propstat;
+        break;
+    case ParseState::response_status:
+        current_response_status_ = parse_status(char_data_.trimmed());
+        state_ = ParseState::response;
+        break;
+    case ParseState::sync_token:
+        parser_->sync_token_ = QString::fromUtf8(char_data_.trimmed());
+        state_ = ParseState::multistatus;
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include "MultiStatusParser.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QUrl>
+
+#include <cstring>
+#include <vector>
+
+// A Multi-Status parser that works directly on the UTF-8 encoded
+// response body, avoiding conversion of element names to QString.
+//
+// It implements the subset of XML needed for WebDAV responses:
+// namespaces, character and entity references, CDATA sections,
+// comments and processing instructions.  Document type declarations
+// are rejected.
+class MultiStatusByteParser
+{
+public:
+    explicit MultiStatusByteParser(MultiStatusParser* parser);
+    ~MultiStatusByteParser();
+
+    // Parse another chunk of input.  Returns false on error.
+    bool feed(QByteArray const& data);
+    // Process any remaining input at the end of the document.
+    // Returns false on error.
+    bool finish();
+    bool atEnd() const;
+
+private:
+    typedef MultiStatusParser::ParseState ParseState;
+
+    // A reference to a name within the input buffer.
+    struct Name
+    {
+        char const* data;
+        int size;
+
+        template <int N>
+        bool operator==(char const (&other)[N]) const
+        {
+            return size == N-1 && memcmp(data, other, N-1) == 0;
+        }
+    };
+
+    struct Element
+    {
+        QByteArray qname;
+        int n_bindings;
+    };
+
+    struct Binding
+    {
+        QByteArray prefix;
+        QByteArray uri;
+    };
+
+    bool parse(bool at_eof);
+    bool parseStartTag(char const* begin, char const* end);
+    bool parseEndTag(char const* begin, char const* end);
+    bool text(char const* begin, char const* end);
+    bool decodeText(char const* begin, char const* end, QByteArray& out);
+    bool fail(QString const& message);
+    bool collectingText() const;
+
+    void startElement(QByteArray const& ns, Name local_name);
+    bool endElement();
+
+    MultiStatusParser* const parser_;
+
+    QByteArray buffer_;
+    int pos_ = 0;
+    bool failed_ = false;
+    bool seen_root_ = false;
+    bool at_end_ = false;
+    std::vector<Element> elements_;
+    std::vector<Binding> bindings_;
+
+    // Current state
+    ParseState state_ = ParseState::start;
+    int unknown_depth_ = 0;
+    // Collecting the text of an element nested within a property.
+    bool nested_text_ = false;
+
+    QByteArray char_data_;
+    QUrl current_href_;
+    int current_response_status_ = 0;
+    // All properties for the given href
+    std::vector<MultiStatusProperty> current_properties_;
+    // Properties within the current <D:propstat>
+    std::vector<MultiStatusProperty> current_propstat_;
+    int current_propstat_status_ = 0;
+    // The property currently being processed
+    QString current_prop_namespace_;
+    QString current_prop_name_;
+};
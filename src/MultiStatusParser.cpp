@@ -17,11 +17,16 @@
  */
 
 #include "MultiStatusParser.h"
+#include "MultiStatusByteParser.h"
+#include "Trace.h"
 
 #include <QDebug>
 #include <QRegularExpression>
 
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 using namespace std;
 
@@ -29,18 +34,7 @@ namespace
 {
 
 char const DAV_NS[] = "DAV:";
-
-enum class ParseState {
-    start,           // Starting state
-    multistatus,     // Inside <D:multistatus>
-    response,        // Inside <D:response>
-    href,            // Inside <D:href>
-    propstat,        // Inside <D:propstat>
-    prop,            // Inside <D:prop>
-    property,        // Inside a property
-    propstat_status, // Inside <D:status> within <D:propstat>
-    response_status, // Inside <D:status> within <D:response>
-};
+char const OC_NS[] = "http://owncloud.org/ns";
 
 }
 
@@ -67,6 +61,8 @@ private:
     // Current state
     ParseState state_ = ParseState::start;
     int unknown_depth_ = 0;
+    // Collecting the text of an element nested within a property.
+    bool nested_text_ = false;
     bool at_end_ = false;
 
     QString char_data_;
@@ -83,8 +79,9 @@ private:
 };
 
 
-MultiStatusParser::MultiStatusParser(QUrl const& base_url, QIODevice* input)
-    : base_url_(base_url), input_(input), xmlinput_(input),
+MultiStatusParser::MultiStatusParser(QUrl const& base_url, QIODevice* input,
+                                     Engine engine)
+    : base_url_(base_url), engine_(engine), input_(input), xmlinput_(input),
       handler_(new MultiStatusParser::Handler(this))
 {
     assert(input->isReadable());
@@ -93,12 +90,41 @@ MultiStatusParser::MultiStatusParser(QUrl const& base_url, QIODevice* input)
             this, &MultiStatusParser::onReadyRead);
     connect(input, &QIODevice::readChannelFinished,
             this, &MultiStatusParser::onReadChannelFinished);
-    reader_.setContentHandler(handler_.get());
-    reader_.setErrorHandler(handler_.get());
+    if (engine_ == Engine::bytes)
+    {
+        byte_parser_.reset(new MultiStatusByteParser(this));
+    }
+    else
+    {
+        reader_.setContentHandler(handler_.get());
+        reader_.setErrorHandler(handler_.get());
+    }
 }
 
 MultiStatusParser::~MultiStatusParser() = default;
 
+MultiStatusParser::Engine MultiStatusParser::default_engine()
+{
+    static Engine const engine = [] {
+        char const* name = getenv("DAV_MULTISTATUS_PARSER");
+        if (name != nullptr && strcmp(name, "qxml") == 0)
+        {
+            return Engine::qxml;
+        }
+        return Engine::bytes;
+    }();
+    return engine;
+}
+
+bool MultiStatusParser::atEnd() const
+{
+    if (byte_parser_)
+    {
+        return byte_parser_->atEnd();
+    }
+    return handler_->atEnd();
+}
+
 void MultiStatusParser::startParsing()
 {
     if (input_->bytesAvailable() > 0)
@@ -112,14 +138,27 @@ QString const& MultiStatusParser::errorString() const
     return error_string_;
 }
 
+QString const& MultiStatusParser::syncToken() const
+{
+    return sync_token_;
+}
+
 void MultiStatusParser::onReadyRead()
 {
     if (finished_)
     {
         return;
     }
+    Trace::Scope trace("parse", "multistatus_chunk");
     bool ok;
-    if (!started_)
+    if (byte_parser_)
+    {
+        started_ = true;
+        QByteArray const data = input_->readAll();
+        trace.arg("bytes", to_string(data.size()));
+        ok = byte_parser_->feed(data);
+    }
+    else if (!started_)
     {
         started_ = true;
         ok = reader_.parse(&xmlinput_, true);
@@ -145,7 +184,11 @@ void MultiStatusParser::onReadChannelFinished()
     {
         return;
     }
-    if (started_)
+    if (byte_parser_)
+    {
+        byte_parser_->finish();
+    }
+    else if (started_)
     {
         // Drain the remaining data from the input channel
         while (reader_.parseContinue())
@@ -156,7 +199,7 @@ void MultiStatusParser::onReadChannelFinished()
             }
         }
     }
-    if (error_string_.isEmpty() && !handler_->atEnd())
+    if (error_string_.isEmpty() && !atEnd())
     {
         error_string_ = "Unexpectedly reached end of input";
     }
@@ -204,6 +247,11 @@ bool MultiStatusParser::Handler::startElement(QString const& namespace_uri,
             current_response_status_ = 0;
             current_properties_.clear();
         }
+        else if (namespace_uri == DAV_NS && local_name == "sync-token")
+        {
+            state_ = ParseState::sync_token;
+            char_data_.clear();
+        }
         else
         {
             unknown_depth_++;
@@ -281,6 +329,15 @@ bool MultiStatusParser::Handler::startElement(QString const& namespace_uri,
         {
             char_data_ += "DAV:collection";
         }
+        // oc:checksums wraps its value in oc:checksum elements.
+        else if (namespace_uri == OC_NS && local_name == "checksum")
+        {
+            if (!char_data_.trimmed().isEmpty())
+            {
+                char_data_ += ' ';
+            }
+            nested_text_ = true;
+        }
         unknown_depth_++;
         break;
     case ParseState::propstat_status:
@@ -289,6 +346,9 @@ bool MultiStatusParser::Handler::startElement(QString const& namespace_uri,
     case ParseState::response_status:
         unknown_depth_++;
         break;
+    case ParseState::sync_token:
+        unknown_depth_++;
+        break;
     }
     return true;
 }
@@ -305,6 +365,10 @@ bool MultiStatusParser::Handler::endElement(QString const& namespace_uri,
     if (unknown_depth_ > 0)
     {
         unknown_depth_--;
+        if (unknown_depth_ == 0)
+        {
+            nested_text_ = false;
+        }
         return true;
     }
 
@@ -376,6 +440,10 @@ bool MultiStatusParser::Handler::endElement(QString const& namespace_uri,
         }
         state_ = ParseState::response;
         break;
+    case ParseState::sync_token:
+        parser_->sync_token_ = char_data_.trimmed();
+        state_ = ParseState::multistatus;
+        break;
     }
     return true;
 }
@@ -384,6 +452,10 @@ bool MultiStatusParser::Handler::characters(QString const& data)
 {
     if (unknown_depth_ > 0)
     {
+        if (nested_text_ && unknown_depth_ == 1)
+        {
+            char_data_ += data;
+        }
         return true;
     }
     // We only collect character data in certain states
@@ -393,6 +465,7 @@ bool MultiStatusParser::Handler::characters(QString const& data)
     case ParseState::property:
     case ParseState::propstat_status:
     case ParseState::response_status:
+    case ParseState::sync_token:
         char_data_ += data;
         break;
     default:
@@ -36,15 +36,33 @@ struct MultiStatusProperty {
     QString responsedescription;
 };
 
+class MultiStatusByteParser;
+
 class MultiStatusParser : public QObject
 {
     Q_OBJECT
 public:
-    MultiStatusParser(QUrl const& base_url, QIODevice* input);
+    // The XML parser used to process the response.  The "bytes"
+    // engine works directly on the UTF-8 input, while "qxml" uses
+    // QXmlSimpleReader.
+    enum class Engine {
+        qxml,
+        bytes,
+    };
+
+    MultiStatusParser(QUrl const& base_url, QIODevice* input,
+                      Engine engine=default_engine());
     virtual ~MultiStatusParser();
 
+    // The engine selected by the DAV_MULTISTATUS_PARSER environment
+    // variable, defaulting to "bytes".
+    static Engine default_engine();
+
     void startParsing();
     QString const& errorString() const;
+    // The <D:sync-token> of a sync-collection REPORT response, or an
+    // empty string if there was none.
+    QString const& syncToken() const;
 
 Q_SIGNALS:
     void response(QUrl const& href, std::vector<MultiStatusProperty> const& properties, int status);
@@ -57,8 +75,25 @@ private Q_SLOTS:
 private:
     class Handler;
     friend class Handler;
+    friend class MultiStatusByteParser;
+
+    enum class ParseState {
+        start,           // Starting state
+        multistatus,     // Inside <D:multistatus>
+        response,        // Inside <D:response>
+        href,            // Inside <D:href>
+        propstat,        // Inside <D:propstat>
+        prop,            // Inside <D:prop>
+        property,        // Inside a property
+        propstat_status, // Inside <D:status> within <D:propstat>
+        response_status, // Inside <D:status> within <D:response>
+        sync_token,      // Inside <D:sync-token> within <D:multistatus>
+    };
+
+    bool atEnd() const;
 
     QUrl const base_url_;
+    Engine const engine_;
 
     // These two represent the same input: we need to keep the
     // QIODevice around to access bytesAvailable() method.
@@ -67,7 +102,9 @@ private:
 
     QXmlSimpleReader reader_;
     std::unique_ptr<Handler> handler_;
+    std::unique_ptr<MultiStatusByteParser> byte_parser_;
     QString error_string_;
+    QString sync_token_;
     bool started_ = false;
     bool finished_ = false;
 };
@@ -18,8 +18,7 @@
 
 #include "NextcloudProvider.h"
 
-#include <QNetworkAccessManager>
-#include <QNetworkRequest>
+#include <QRegExp>
 #include <QUrl>
 
 using namespace std;
@@ -31,23 +30,17 @@ NextcloudProvider::NextcloudProvider()
 
 NextcloudProvider::~NextcloudProvider() = default;
 
-QUrl NextcloudProvider::base_url(Context const& ctx) const
+shared_ptr<DavSession> NextcloudProvider::make_session(Context const& ctx) const
 {
     const auto& creds = boost::get<PasswordCredentials>(ctx.credentials);
     // get the host, removing any '/' at the end
     auto host = QString::fromStdString(creds.host).remove(QRegExp("/*$"));
-    return QUrl(QStringLiteral("%1/remote.php/dav/files/%2/").arg(host).arg(QString::fromStdString(creds.username)));
-}
-
-QNetworkReply *NextcloudProvider::send_request(
-    QNetworkRequest& request, QByteArray const& verb, QIODevice* data,
-    Context const& ctx) const
-{
-    const auto& creds = boost::get<PasswordCredentials>(ctx.credentials);
+    auto user = QString::fromStdString(creds.username);
     const auto credentials = QByteArray::fromStdString(creds.username + ":" +
                                                        creds.password);
-    request.setRawHeader(QByteArrayLiteral("Authorization"),
-                         QByteArrayLiteral("Basic ") + credentials.toBase64());
-    QNetworkReply *reply = network_->sendCustomRequest(request, verb, data);
-    return reply;
+    return make_shared<DavSession>(
+        QUrl(QStringLiteral("%1/remote.php/dav/files/%2/").arg(host).arg(user)),
+        QUrl(QStringLiteral("%1/remote.php/dav/uploads/%2/").arg(host).arg(user)),
+        QByteArrayLiteral("Basic ") + credentials.toBase64(),
+        QUrl(QStringLiteral("%1/remote.php/dav/bulk").arg(host)));
 }
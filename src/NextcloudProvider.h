@@ -26,9 +26,7 @@ public:
     NextcloudProvider();
     virtual ~NextcloudProvider();
 
-    QUrl base_url(
-        unity::storage::provider::Context const& ctx) const override;
-    QNetworkReply *send_request(
-        QNetworkRequest& request, QByteArray const& verb, QIODevice* data,
+protected:
+    std::shared_ptr<DavSession> make_session(
         unity::storage::provider::Context const& ctx) const override;
 };
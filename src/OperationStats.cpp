@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "OperationStats.h"
+
+using namespace std;
+
+namespace
+{
+
+int64_t microseconds(OperationStats::Clock::duration d)
+{
+    return chrono::duration_cast<chrono::microseconds>(d).count();
+}
+
+}
+
+OperationStats::OperationStats() = default;
+
+OperationStats::~OperationStats() = default;
+
+void OperationStats::record(string const& operation, Sample const& sample)
+{
+    Operation& op = operations_[operation];
+    if (sample.responded)
+    {
+        op.time_to_first_byte.record(microseconds(sample.time_to_first_byte));
+    }
+    op.latency.record(microseconds(sample.latency));
+    op.bytes.record(sample.bytes);
+    op.statuses[sample.status]++;
+}
+
+void OperationStats::reset()
+{
+    operations_.clear();
+}
+
+map<string, OperationStats::Operation> const& OperationStats::operations() const
+{
+    return operations_;
+}
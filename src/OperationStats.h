@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include "Histogram.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Statistics for the requests the provider sends, grouped by the
+// operation they were made for, such as "list" or "download".
+//
+// Times are measured from when the request is handed to the provider
+// to be sent, so include any time spent waiting in the scheduler.
+class OperationStats
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Sample
+    {
+        // The HTTP status of the response, or zero if there was none.
+        int status = 0;
+        // Whether the response headers arrived, and when.
+        bool responded = false;
+        Clock::duration time_to_first_byte = Clock::duration::zero();
+        Clock::duration latency = Clock::duration::zero();
+        // Request and response bodies.
+        int64_t bytes = 0;
+    };
+
+    struct Operation
+    {
+        // In microseconds.
+        Histogram time_to_first_byte;
+        Histogram latency;
+        Histogram bytes;
+        // Request counts by HTTP status.  Requests that failed before
+        // a response was received are counted under zero.
+        std::map<int, uint64_t> statuses;
+    };
+
+    OperationStats();
+    ~OperationStats();
+
+    OperationStats(OperationStats const&) = delete;
+    OperationStats& operator=(OperationStats const&) = delete;
+
+    void record(std::string const& operation, Sample const& sample);
+    void reset();
+
+    std::map<std::string, Operation> const& operations() const;
+
+private:
+    std::map<std::string, Operation> operations_;
+};
@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "ParallelDownloadJob.h"
+#include "DavProvider.h"
+#include "item_id.h"
+#include "http_error.h"
+#include "settings.h"
+
+#include <QNetworkRequest>
+
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+string make_download_id()
+{
+    static int counter = 0;
+    return "parallel-" + to_string(counter++);
+}
+
+constexpr int CHUNK_SIZE = 64 * 1024;
+constexpr int64_t DEFAULT_RANGE_SIZE = 4 * 1024 * 1024;
+constexpr int64_t DEFAULT_PARALLEL_RANGES = 4;
+
+}
+
+ParallelDownloadJob::ParallelDownloadJob(shared_ptr<DavProvider> const& provider,
+                                         string const& item_id,
+                                         string const& match_etag,
+                                         string const& etag, int64_t size,
+                                         Context const& ctx)
+    : QObject(), DownloadJob(make_download_id()), provider_(provider),
+      item_id_(item_id), url_(id_to_url(item_id, provider->base_url(ctx))),
+      match_etag_(match_etag), etag_(etag), size_(size), context_(ctx),
+      range_size_(max<int64_t>(CHUNK_SIZE, get_setting("DAV_DOWNLOAD_RANGE_SIZE",
+                                                       DEFAULT_RANGE_SIZE))),
+      max_parallel_(max<int64_t>(1, get_setting("DAV_DOWNLOAD_PARALLEL_RANGES",
+                                                DEFAULT_PARALLEL_RANGES)))
+{
+    assert(size_ > 0);
+    writer_.setSocketDescriptor(
+        dup(write_socket()), QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+    connect(&writer_, &QIODevice::bytesWritten,
+            this, &ParallelDownloadJob::onSocketBytesWritten);
+    start_ranges();
+}
+
+ParallelDownloadJob::~ParallelDownloadJob() = default;
+
+void ParallelDownloadJob::start_ranges()
+{
+    while (!single_stream_ && int(ranges_.size()) < max_parallel_ &&
+           next_start_ < size_)
+    {
+        unique_ptr<Range> range(new Range);
+        range->start = next_start_;
+        range->end = min(next_start_ + range_size_, size_) - 1;
+        next_start_ = range->end + 1;
+
+        QNetworkRequest request(url_);
+        request.setRawHeader(QByteArrayLiteral("Range"),
+                             "bytes=" + QByteArray::number(qint64(range->start)) +
+                             "-" + QByteArray::number(qint64(range->end)));
+        // If the file has changed since we learned its size, the
+        // server will send the entire new file instead.
+        request.setRawHeader(QByteArrayLiteral("If-Range"),
+                             QByteArray::fromStdString(etag_));
+        if (!match_etag_.empty())
+        {
+            request.setRawHeader(QByteArrayLiteral("If-Match"),
+                                 QByteArray::fromStdString(match_etag_));
+        }
+
+        DavProvider::set_request_priority(
+            request, RequestScheduler::Priority::transfer);
+        DavProvider::set_request_operation(request, QStringLiteral("download"));
+        range->reply.reset(provider_->send_request(
+            request, QByteArrayLiteral("GET"), nullptr, context_));
+        assert(range->reply.get() != nullptr);
+        range->reply->setReadBufferSize(CHUNK_SIZE);
+        Range* r = range.get();
+        connect(r->reply.get(), &QIODevice::readyRead,
+                this, [this, r] { onRangeReadyRead(r); });
+        connect(r->reply.get(), &QNetworkReply::finished,
+                this, [this, r] { onRangeFinished(r); });
+        ranges_.push_back(move(range));
+    }
+}
+
+bool ParallelDownloadJob::check_header(Range* range)
+{
+    range->seen_header = true;
+    auto status = range->reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 206)
+    {
+        QByteArray const expected = "bytes " +
+            QByteArray::number(qint64(range->start)) + "-" +
+            QByteArray::number(qint64(range->end)) + "/";
+        if (!range->reply->rawHeader(QByteArrayLiteral("Content-Range")).startsWith(expected))
+        {
+            handle_error(make_exception_ptr(RemoteCommsException(
+                             "Unexpected Content-Range in response for " + item_id_)));
+            return false;
+        }
+        if (range->start == 0)
+        {
+            first_range_partial_ = true;
+            if (any_of(ranges_.begin(), ranges_.end(),
+                       [](unique_ptr<Range> const& r) { return r->deferred; }))
+            {
+                handle_error(make_exception_ptr(ConflictException(
+                                 item_id_ + " changed during download")));
+                return false;
+            }
+        }
+        return true;
+    }
+    if (status == 200)
+    {
+        if (range->start != 0)
+        {
+            if (first_range_partial_)
+            {
+                // The first range was fine, so the file must have
+                // changed part way through the download.
+                handle_error(make_exception_ptr(ConflictException(
+                                 item_id_ + " changed during download")));
+                return false;
+            }
+            // Responses arrive in any order.  Whether the server
+            // ignores ranges or the file has changed is settled by
+            // the first range's response.
+            range->deferred = true;
+            return false;
+        }
+        // The server ignored the range, or the file has changed: the
+        // response holds the whole current file, so stream it and
+        // drop the other ranges.
+        single_stream_ = true;
+        while (ranges_.size() > 1)
+        {
+            QNetworkReply* reply = ranges_.back()->reply.release();
+            reply->disconnect(this);
+            reply->abort();
+            reply->deleteLater();
+            ranges_.pop_back();
+        }
+        return true;
+    }
+    range->is_error = true;
+    return true;
+}
+
+void ParallelDownloadJob::onRangeReadyRead(Range* range)
+{
+    if (is_error_ || range->deferred)
+    {
+        return;
+    }
+    if (!range->seen_header && !check_header(range))
+    {
+        return;
+    }
+
+    if (range->is_error)
+    {
+        if (range->data.size() < MAX_ERROR_BODY_LENGTH)
+        {
+            range->data.append(range->reply->readAll());
+        }
+        else
+        {
+            range->reply->close();
+        }
+    }
+    else if (range == ranges_.front().get())
+    {
+        // The front range is read at the rate the socket accepts it.
+        maybe_send_data();
+    }
+    else
+    {
+        // Later ranges are buffered so their connections keep
+        // running at full speed.
+        QByteArray data = range->reply->readAll();
+        range->received += data.size();
+        range->data.append(data);
+        if (range->received > range->end - range->start + 1)
+        {
+            handle_error(make_exception_ptr(RemoteCommsException(
+                             "Server sent more data than requested for " + item_id_)));
+        }
+    }
+}
+
+void ParallelDownloadJob::onRangeFinished(Range* range)
+{
+    if (is_error_ || range->deferred)
+    {
+        return;
+    }
+    if (!range->seen_header && !check_header(range))
+    {
+        return;
+    }
+    if (range->is_error || range->reply->error() != QNetworkReply::NoError)
+    {
+        if (range->is_error)
+        {
+            range->data.append(range->reply->readAll());
+        }
+        try
+        {
+            boost::rethrow_exception(
+                translate_http_error(range->reply.get(), range->data, item_id_));
+        }
+        catch (...)
+        {
+            handle_error(std::current_exception());
+        }
+        return;
+    }
+    range->finished = true;
+    if (range != ranges_.front().get())
+    {
+        QByteArray data = range->reply->readAll();
+        range->received += data.size();
+        range->data.append(data);
+    }
+    maybe_send_data();
+}
+
+void ParallelDownloadJob::onSocketBytesWritten(int64_t bytes)
+{
+    if (is_error_)
+    {
+        return;
+    }
+
+    bytes_written_ += bytes;
+    maybe_send_data();
+}
+
+void ParallelDownloadJob::maybe_send_data()
+{
+    assert(bytes_written_ <= bytes_sent_);
+    while (!is_error_ && !complete_)
+    {
+        // If there are outstanding writes, do nothing.
+        if (bytes_written_ < bytes_sent_)
+        {
+            return;
+        }
+
+        if (ranges_.empty())
+        {
+            // All ranges have been written out.
+            complete_ = true;
+            writer_.close();
+            report_complete();
+            return;
+        }
+
+        Range* range = ranges_.front().get();
+        if (!range->seen_header || range->is_error)
+        {
+            return;
+        }
+
+        QByteArray chunk;
+        if (range->offset < range->data.size())
+        {
+            chunk = range->data.mid(range->offset, CHUNK_SIZE);
+            range->offset += chunk.size();
+            if (range->offset == range->data.size())
+            {
+                range->data.clear();
+                range->offset = 0;
+            }
+        }
+        else if (range->reply->bytesAvailable() > 0)
+        {
+            chunk = range->reply->read(CHUNK_SIZE);
+            range->received += chunk.size();
+        }
+        else if (range->finished)
+        {
+            if (!single_stream_ &&
+                range->received != range->end - range->start + 1)
+            {
+                handle_error(make_exception_ptr(RemoteCommsException(
+                                 "Short read from server for " + item_id_)));
+                return;
+            }
+            range->reply.release()->deleteLater();
+            ranges_.pop_front();
+            start_ranges();
+            continue;
+        }
+        else
+        {
+            return;
+        }
+
+        bytes_sent_ += chunk.size();
+        if (writer_.write(chunk) < 0)
+        {
+            handle_error(make_exception_ptr(ResourceException(
+                             "Error writing to socket: "
+                             + writer_.errorString().toStdString(), 0)));
+            return;
+        }
+    }
+}
+
+void ParallelDownloadJob::handle_error(std::exception_ptr ep)
+{
+    is_error_ = true;
+    for (auto& range : ranges_)
+    {
+        if (range->reply)
+        {
+            range->reply->abort();
+        }
+    }
+    writer_.close();
+    report_error(ep);
+}
+
+boost::future<void> ParallelDownloadJob::cancel()
+{
+    for (auto& range : ranges_)
+    {
+        range->reply->abort();
+    }
+    writer_.close();
+    return boost::make_ready_future();
+}
+
+boost::future<void> ParallelDownloadJob::finish()
+{
+    return boost::make_exceptional_future<void>(
+        LogicException("finish called before all data sent"));
+}
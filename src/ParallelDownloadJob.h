@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QLocalSocket>
+#include <QNetworkReply>
+#include <QObject>
+#include <QUrl>
+#include <unity/storage/provider/Exceptions.h>
+#include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/DownloadJob.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+class DavProvider;
+
+// Download a large file as a series of byte ranges fetched by
+// concurrent GET requests, reassembled in order on the job's socket.
+// Only a fixed window of ranges is in flight at a time, bounding the
+// memory used to hold data that arrives ahead of its turn.
+class ParallelDownloadJob : public QObject, public unity::storage::provider::DownloadJob
+{
+    Q_OBJECT
+public:
+    ParallelDownloadJob(std::shared_ptr<DavProvider> const& provider,
+                        std::string const& item_id,
+                        std::string const& match_etag,
+                        std::string const& etag, int64_t size,
+                        unity::storage::provider::Context const& ctx);
+    ~ParallelDownloadJob();
+
+    boost::future<void> cancel() override;
+    boost::future<void> finish() override;
+
+private Q_SLOTS:
+    void onSocketBytesWritten(int64_t bytes);
+
+private:
+    struct Range
+    {
+        int64_t start;
+        int64_t end;  // inclusive
+        // Data received before this range reached the front of the
+        // queue, and how much of it has been written out.
+        QByteArray data;
+        int offset = 0;
+        int64_t received = 0;
+        std::unique_ptr<QNetworkReply> reply;
+        bool seen_header = false;
+        bool finished = false;
+        bool is_error = false;
+        // The whole file was sent instead of the range, and is left
+        // unread until the first range's response shows why.
+        bool deferred = false;
+    };
+
+    void start_ranges();
+    bool check_header(Range* range);
+    void onRangeReadyRead(Range* range);
+    void onRangeFinished(Range* range);
+    void maybe_send_data();
+    void handle_error(std::exception_ptr ep);
+
+    std::shared_ptr<DavProvider> const provider_;
+    std::string const item_id_;
+    QUrl const url_;
+    std::string const match_etag_;
+    std::string const etag_;
+    int64_t size_;
+    unity::storage::provider::Context const context_;
+    int64_t const range_size_;
+    int const max_parallel_;
+
+    QLocalSocket writer_;
+    // Ranges in flight, in file order.  The front range is the one
+    // currently being written to the socket.
+    std::deque<std::unique_ptr<Range>> ranges_;
+    int64_t next_start_ = 0;
+    // The server ignored the Range header and is sending the whole
+    // file in the first response.
+    bool single_stream_ = false;
+    // The first range was honoured, so a later whole-file response
+    // means the file changed.
+    bool first_range_partial_ = false;
+
+    int64_t bytes_sent_ = 0;
+    int64_t bytes_written_ = 0;
+    bool is_error_ = false;
+    bool complete_ = false;
+};
@@ -17,7 +17,6 @@
  */
 
 #include "PropFindHandler.h"
-#include "item_id.h"
 #include "http_error.h"
 
 #include <cassert>
@@ -25,33 +24,23 @@
 using namespace std;
 using namespace unity::storage::provider;
 
-namespace
-{
-const auto PROPFIND_BODY = QByteArrayLiteral(
-R"(<?xml version="1.0" encoding="utf-8" ?>
-<D:propfind xmlns:D="DAV:">
-  <D:prop>
-    <D:getetag/>
-    <D:resourcetype/>
-    <D:getcontentlength/>
-    <D:creationdate/>
-    <D:getlastmodified/>
-  </D:prop>
-</D:propfind>)");
-}
-
 PropFindHandler::PropFindHandler(shared_ptr<DavProvider> const& provider,
                                  string const& item_id, int depth,
-                                 Context const& ctx)
-    : provider_(provider), base_url_(provider->base_url(ctx)), item_id_(item_id)
+                                 PropertySet properties, Context const& ctx)
+    : provider_(provider), session_(provider->session(ctx)),
+      account_(session_->account()), properties_(properties),
+      item_id_(item_id)
 {
-    QNetworkRequest request(id_to_url(item_id_, base_url_));
+    QByteArray const& body = propfind_body(properties_);
+    QNetworkRequest request(session_->id_to_url(item_id_));
     request.setRawHeader(QByteArrayLiteral("Depth"), QByteArray::number(depth));
     request.setHeader(QNetworkRequest::ContentTypeHeader,
                       QStringLiteral("application/xml; charset=\"utf-8\""));
-    request.setHeader(QNetworkRequest::ContentLengthHeader, PROPFIND_BODY.size());
-    request_body_.setData(PROPFIND_BODY);
+    request.setHeader(QNetworkRequest::ContentLengthHeader, body.size());
+    request_body_.setData(body);
     request_body_.open(QIODevice::ReadOnly);
+    DavProvider::set_request_operation(
+        request, depth == 0 ? QStringLiteral("metadata") : QStringLiteral("list"));
 
     reply_.reset(provider->send_request(request, QByteArrayLiteral("PROPFIND"),
                                         &request_body_, ctx));
@@ -156,8 +145,9 @@ void PropFindHandler::onParserResponse(QUrl const& href, vector<MultiStatusPrope
     }
     try
     {
-        Item item = provider_->make_item(href, base_url_, properties);
-        items_.emplace_back(move(item));
+        Item item = provider_->make_item(href, *session_, properties);
+        provider_->metadata_cache().put(account_, item, properties_);
+        addItem(move(item));
     }
     catch (StorageException const& error)
     {
@@ -169,6 +159,11 @@ void PropFindHandler::onParserResponse(QUrl const& href, vector<MultiStatusPrope
     }
 }
 
+void PropFindHandler::addItem(Item&& item)
+{
+    items_.emplace_back(move(item));
+}
+
 void PropFindHandler::onParserFinished()
 {
     if (parser_->errorString().isEmpty())
@@ -27,12 +27,14 @@
 
 #include "DavProvider.h"
 #include "MultiStatusParser.h"
+#include "dav_properties.h"
 
 class PropFindHandler : public QObject {
     Q_OBJECT
 public:
     PropFindHandler(std::shared_ptr<DavProvider> const& provider,
                     std::string const& item_id, int depth,
+                    PropertySet properties,
                     unity::storage::provider::Context const& ctx);
     ~PropFindHandler();
 
@@ -58,7 +60,9 @@ private:
     boost::promise<unity::storage::provider::ItemList> promise_;
 
     std::shared_ptr<DavProvider> const provider_;
-    QUrl base_url_;
+    std::shared_ptr<DavSession const> const session_;
+    std::string const account_;
+    PropertySet const properties_;
     QBuffer request_body_;
     std::unique_ptr<QNetworkReply> reply_;
     std::unique_ptr<MultiStatusParser> parser_;
@@ -66,6 +70,9 @@ private:
 
 protected:
     virtual void finish() = 0;
+    // Called for each item in the response.  By default, the item
+    // is appended to items_.
+    virtual void addItem(unity::storage::provider::Item&& item);
 
     std::string const item_id_;
     unity::storage::provider::ItemList items_;
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "RequestScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace
+{
+
+// How many requests each class may start in a row while others wait.
+constexpr int WEIGHTS[RequestScheduler::N_PRIORITIES] = {8, 2, 1};
+
+}
+
+RequestScheduler::RequestScheduler(int max_per_host)
+    : max_per_host_(max(1, max_per_host))
+{
+}
+
+RequestScheduler::~RequestScheduler() = default;
+
+uint64_t RequestScheduler::submit(string const& host, string const& account,
+                                  Priority priority, Start start)
+{
+    uint64_t const ticket = ++last_ticket_;
+    tickets_.emplace(ticket, Ticket{host, account, priority, false});
+    stats_[static_cast<int>(priority)].requests++;
+
+    HostQueue& queue = hosts_[host];
+    ClassQueue& cq = queue.classes[static_cast<int>(priority)];
+    if (cq.empty())
+    {
+        // A class that was idle joins the current round, rather than
+        // waiting for the busy classes to use up their turns.
+        cq.credit = WEIGHTS[static_cast<int>(priority)];
+    }
+    auto& pending = cq.accounts[account];
+    if (pending.empty())
+    {
+        cq.turns.push_back(account);
+    }
+    pending.push_back(Pending{ticket, Clock::now(), move(start)});
+    queue.queued++;
+
+    dispatch(host);
+
+    auto it = tickets_.find(ticket);
+    if (it != tickets_.end() && !it->second.active)
+    {
+        stats_[static_cast<int>(priority)].queued++;
+    }
+    return ticket;
+}
+
+void RequestScheduler::finish(uint64_t ticket)
+{
+    auto it = tickets_.find(ticket);
+    if (it == tickets_.end())
+    {
+        return;
+    }
+    Ticket const t = move(it->second);
+    tickets_.erase(it);
+
+    auto host_it = hosts_.find(t.host);
+    assert(host_it != hosts_.end());
+    HostQueue& queue = host_it->second;
+    if (t.active)
+    {
+        queue.active--;
+        if (t.priority != Priority::interactive)
+        {
+            queue.active_bulk--;
+        }
+        dispatch(t.host);
+        return;
+    }
+
+    ClassQueue& cq = queue.classes[static_cast<int>(t.priority)];
+    auto account_it = cq.accounts.find(t.account);
+    assert(account_it != cq.accounts.end());
+    auto& pending = account_it->second;
+    pending.erase(find_if(pending.begin(), pending.end(),
+                          [ticket](Pending const& p) {
+                              return p.ticket == ticket;
+                          }));
+    if (pending.empty())
+    {
+        cq.accounts.erase(account_it);
+        cq.turns.erase(find(cq.turns.begin(), cq.turns.end(), t.account));
+    }
+    queue.queued--;
+
+    if (!queue.dispatching && queue.active == 0 && queue.queued == 0)
+    {
+        hosts_.erase(host_it);
+    }
+}
+
+int RequestScheduler::active(string const& host) const
+{
+    auto it = hosts_.find(host);
+    return it != hosts_.end() ? it->second.active : 0;
+}
+
+int RequestScheduler::queued(string const& host) const
+{
+    auto it = hosts_.find(host);
+    return it != hosts_.end() ? it->second.queued : 0;
+}
+
+RequestScheduler::QueueStats const& RequestScheduler::stats(Priority priority) const
+{
+    return stats_[static_cast<int>(priority)];
+}
+
+bool RequestScheduler::has_slot(HostQueue const& queue, Priority priority) const
+{
+    if (queue.active >= max_per_host_)
+    {
+        return false;
+    }
+    // Keep a slot free for interactive requests.
+    if (priority != Priority::interactive && max_per_host_ > 1 &&
+        queue.active_bulk >= max_per_host_ - 1)
+    {
+        return false;
+    }
+    return true;
+}
+
+bool RequestScheduler::pop_next(HostQueue& queue, Pending& pending,
+                                Priority& priority)
+{
+    // Weighted round robin: each class with requests waiting and a
+    // slot available gets WEIGHTS[class] turns, highest priority
+    // first, before the credits are topped up again.
+    for (int round = 0; round < 2; round++)
+    {
+        for (int p = 0; p < N_PRIORITIES; p++)
+        {
+            ClassQueue& cq = queue.classes[p];
+            if (cq.empty() || cq.credit <= 0 ||
+                !has_slot(queue, static_cast<Priority>(p)))
+            {
+                continue;
+            }
+            cq.credit--;
+
+            // Round robin between accounts within the class.
+            string const account = move(cq.turns.front());
+            cq.turns.pop_front();
+            auto account_it = cq.accounts.find(account);
+            pending = move(account_it->second.front());
+            account_it->second.pop_front();
+            if (account_it->second.empty())
+            {
+                cq.accounts.erase(account_it);
+            }
+            else
+            {
+                cq.turns.push_back(account);
+            }
+            queue.queued--;
+            priority = static_cast<Priority>(p);
+            return true;
+        }
+
+        bool eligible = false;
+        for (int p = 0; p < N_PRIORITIES; p++)
+        {
+            ClassQueue& cq = queue.classes[p];
+            if (!cq.empty() && has_slot(queue, static_cast<Priority>(p)))
+            {
+                cq.credit = WEIGHTS[p];
+                eligible = true;
+            }
+        }
+        if (!eligible)
+        {
+            break;
+        }
+    }
+    return false;
+}
+
+void RequestScheduler::start(HostQueue& queue, Pending&& pending,
+                             Priority priority)
+{
+    auto it = tickets_.find(pending.ticket);
+    assert(it != tickets_.end());
+    it->second.active = true;
+    queue.active++;
+    if (priority != Priority::interactive)
+    {
+        queue.active_bulk++;
+    }
+
+    auto const wait = Clock::now() - pending.queued_at;
+    QueueStats& stats = stats_[static_cast<int>(priority)];
+    stats.total_wait += wait;
+    stats.max_wait = max(stats.max_wait, wait);
+
+    Start start = move(pending.start);
+    start();
+}
+
+void RequestScheduler::dispatch(string const& host)
+{
+    auto host_it = hosts_.find(host);
+    if (host_it == hosts_.end() || host_it->second.dispatching)
+    {
+        // Requests started by an outer dispatch() finishing
+        // immediately: the outer loop picks up the freed slots.
+        return;
+    }
+    HostQueue& queue = host_it->second;
+    queue.dispatching = true;
+    Pending pending;
+    Priority priority;
+    while (pop_next(queue, pending, priority))
+    {
+        start(queue, move(pending), priority);
+    }
+    queue.dispatching = false;
+    if (queue.active == 0 && queue.queued == 0)
+    {
+        hosts_.erase(host_it);
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+// Decides when requests are sent, so that bulk transfers can't starve
+// the interactive requests the user is waiting on.
+//
+// Requests are queued per host, and at most max_per_host are active
+// at a time.  One of those slots is kept back for interactive
+// requests.  When a slot frees up, the next request is picked by
+// weighted round robin between the priority classes, so lower
+// classes are slowed but never starved, and by round robin between
+// the accounts queueing requests in that class.
+//
+// The scheduler is not thread safe: like the rest of the provider, it
+// is only used from the event loop thread.
+class RequestScheduler
+{
+public:
+    enum class Priority
+    {
+        // Metadata requests that a client is blocked on.
+        interactive,
+        // Uploads and downloads started by the user.
+        transfer,
+        // Requests nobody is waiting on, such as prefetching or
+        // cleaning up after a failed upload.
+        background,
+    };
+    static constexpr int N_PRIORITIES = 3;
+
+    typedef std::function<void()> Start;
+    typedef std::chrono::steady_clock Clock;
+
+    struct QueueStats
+    {
+        uint64_t requests = 0;
+        // Requests that had to wait for a slot.
+        uint64_t queued = 0;
+        Clock::duration total_wait = Clock::duration::zero();
+        Clock::duration max_wait = Clock::duration::zero();
+    };
+
+    explicit RequestScheduler(int max_per_host);
+    ~RequestScheduler();
+
+    RequestScheduler(RequestScheduler const&) = delete;
+    RequestScheduler& operator=(RequestScheduler const&) = delete;
+
+    // Queue a request.  start is called once the request may be sent,
+    // which may be before submit() returns.  Returns a ticket to pass
+    // to finish().
+    uint64_t submit(std::string const& host, std::string const& account,
+                    Priority priority, Start start);
+    // The request has completed, or was abandoned.  Its slot is
+    // handed to the next queued request.  Finishing a ticket more
+    // than once is harmless.
+    void finish(uint64_t ticket);
+
+    int active(std::string const& host) const;
+    int queued(std::string const& host) const;
+    QueueStats const& stats(Priority priority) const;
+
+private:
+    struct Pending
+    {
+        uint64_t ticket;
+        Clock::time_point queued_at;
+        Start start;
+    };
+    struct ClassQueue
+    {
+        // Requests waiting per account, and the order in which
+        // accounts take turns.
+        std::map<std::string, std::deque<Pending>> accounts;
+        std::deque<std::string> turns;
+        int credit = 0;
+        bool empty() const { return turns.empty(); }
+    };
+    struct HostQueue
+    {
+        int active = 0;
+        int active_bulk = 0;
+        int queued = 0;
+        bool dispatching = false;
+        std::array<ClassQueue, N_PRIORITIES> classes;
+    };
+    struct Ticket
+    {
+        std::string host;
+        std::string account;
+        Priority priority;
+        bool active;
+    };
+
+    bool has_slot(HostQueue const& queue, Priority priority) const;
+    void start(HostQueue& queue, Pending&& pending, Priority priority);
+    bool pop_next(HostQueue& queue, Pending& pending, Priority& priority);
+    void dispatch(std::string const& host);
+
+    int const max_per_host_;
+    uint64_t last_ticket_ = 0;
+    std::map<std::string, HostQueue> hosts_;
+    std::map<uint64_t, Ticket> tickets_;
+    std::array<QueueStats, N_PRIORITIES> stats_;
+    bool dispatching_ = false;
+};
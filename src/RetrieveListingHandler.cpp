@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "RetrieveListingHandler.h"
+
+using namespace std;
+using namespace unity::storage::provider;
+
+RetrieveListingHandler::RetrieveListingHandler(shared_ptr<DavProvider> const& provider,
+                                               string const& folder_id,
+                                               PropertySet properties,
+                                               Context const& ctx,
+                                               ItemCallback item_callback,
+                                               Callback callback)
+    : PropFindHandler(provider, folder_id, 1, properties, ctx),
+      item_callback_(item_callback), callback_(callback)
+{
+}
+
+RetrieveListingHandler::~RetrieveListingHandler() = default;
+
+void RetrieveListingHandler::addItem(Item&& item)
+{
+    // A "Depth: 1" PROPFIND will also return data for the parent URL
+    // itself, so separate it from the list of children.
+    if (item.item_id == item_id_)
+    {
+        folder_ = move(item);
+    }
+    else
+    {
+        item_callback_(item);
+    }
+}
+
+void RetrieveListingHandler::finish()
+{
+    callback_(folder_, error_);
+}
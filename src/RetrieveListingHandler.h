@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QObject>
+
+#include <functional>
+#include <memory>
+
+#include "PropFindHandler.h"
+
+// Performs a "Depth: 1" PROPFIND on a folder.  Children are passed to
+// the item callback as they are parsed, while the folder's own
+// metadata is passed to the final callback.
+class RetrieveListingHandler : public PropFindHandler {
+    Q_OBJECT
+public:
+    typedef std::function<void(unity::storage::provider::Item const& item)> ItemCallback;
+    typedef std::function<void(unity::storage::provider::Item const& folder,
+                               boost::exception_ptr const& error)> Callback;
+
+    RetrieveListingHandler(std::shared_ptr<DavProvider> const& provider,
+                           std::string const& folder_id,
+                           PropertySet properties,
+                           unity::storage::provider::Context const& ctx,
+                           ItemCallback item_callback, Callback callback);
+    ~RetrieveListingHandler();
+
+private:
+    ItemCallback const item_callback_;
+    Callback const callback_;
+    unity::storage::provider::Item folder_;
+
+protected:
+    void finish() override;
+    void addItem(unity::storage::provider::Item&& item) override;
+};
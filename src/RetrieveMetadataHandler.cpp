@@ -27,9 +27,11 @@ using namespace unity::storage::provider;
 
 RetrieveMetadataHandler::RetrieveMetadataHandler(shared_ptr<DavProvider> const& provider,
                                                  string const& item_id,
+                                                 PropertySet properties,
                                                  Context const& ctx,
                                                  Callback callback)
-    : PropFindHandler(provider, item_id, 0, ctx), callback_(callback)
+    : PropFindHandler(provider, item_id, 0, properties, ctx),
+      callback_(callback)
 {
 }
 
@@ -40,11 +42,11 @@ void RetrieveMetadataHandler::finish()
     Item item;
     boost::exception_ptr ex = error_;
 
-    if (items_.size() != 1)
+    if (!ex && items_.size() != 1)
     {
         ex = boost::copy_exception(RemoteCommsException("Unexpectedly received " + to_string(items_.size()) + " items from PROPFIND request"));
     }
-    else
+    if (!ex)
     {
         item = items_[0];
     }
@@ -33,6 +33,7 @@ public:
 
     RetrieveMetadataHandler(std::shared_ptr<DavProvider> const& provider,
                             std::string const& item_id,
+                            PropertySet properties,
                             unity::storage::provider::Context const& ctx,
                             Callback callback);
     ~RetrieveMetadataHandler();
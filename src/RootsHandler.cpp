@@ -17,6 +17,7 @@
  */
 
 #include "RootsHandler.h"
+#include "Trace.h"
 
 #include <cassert>
 
@@ -24,8 +25,9 @@ using namespace std;
 using namespace unity::storage::provider;
 
 RootsHandler::RootsHandler(shared_ptr<DavProvider> const& provider,
-                           Context const& ctx)
-    : PropFindHandler(provider, ".", 0, ctx)
+                           PropertySet properties, Context const& ctx)
+    : PropFindHandler(provider, ".", 0, properties, ctx),
+      trace_call_(Trace::current_call())
 {
 }
 
@@ -39,6 +41,7 @@ boost::future<ItemList> RootsHandler::get_future()
 void RootsHandler::finish()
 {
     deleteLater();
+    Trace::end_call(trace_call_);
 
     if (error_)
     {
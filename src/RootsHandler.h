@@ -20,6 +20,7 @@
 
 #include <QObject>
 
+#include <cstdint>
 #include <memory>
 
 #include "PropFindHandler.h"
@@ -28,6 +29,7 @@ class RootsHandler : public PropFindHandler {
     Q_OBJECT
 public:
     RootsHandler(std::shared_ptr<DavProvider> const& provider,
+                 PropertySet properties,
                  unity::storage::provider::Context const& ctx);
     ~RootsHandler();
 
@@ -35,6 +37,8 @@ public:
 
 private:
     boost::promise<unity::storage::provider::ItemList> promise_;
+    // The D-Bus call this is the result of, for tracing.
+    uint64_t const trace_call_;
 
 protected:
     void finish() override;
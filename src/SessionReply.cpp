@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "SessionReply.h"
+
+#include <QNetworkAccessManager>
+
+#include <cassert>
+
+SessionReply::SessionReply(QNetworkRequest const& request,
+                           QByteArray const& verb)
+{
+    // Like the network manager's replies, record the verb in the
+    // request, where error handling looks for it.
+    QNetworkRequest req = request;
+    req.setAttribute(QNetworkRequest::CustomVerbAttribute, verb);
+    setRequest(req);
+    setUrl(request.url());
+    setOperation(QNetworkAccessManager::CustomOperation);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+SessionReply::~SessionReply() = default;
+
+void SessionReply::attach(QNetworkReply* reply, Retry const& retry)
+{
+    assert(reply != nullptr);
+    assert(!reply_ && !isFinished());
+    reply_.reset(reply);
+    retry_ = retry;
+    connectReply();
+}
+
+bool SessionReply::isSent() const
+{
+    return bool(reply_);
+}
+
+void SessionReply::abort()
+{
+    retry_ = nullptr;
+    if (reply_)
+    {
+        reply_->abort();
+    }
+    else if (!isFinished())
+    {
+        setError(QNetworkReply::OperationCanceledError,
+                 QStringLiteral("Operation canceled"));
+        setFinished(true);
+        Q_EMIT readChannelFinished();
+        Q_EMIT finished();
+    }
+}
+
+void SessionReply::close()
+{
+    if (!reply_)
+    {
+        abort();
+    }
+    retry_ = nullptr;
+    if (reply_)
+    {
+        reply_->close();
+    }
+    QNetworkReply::close();
+}
+
+qint64 SessionReply::bytesAvailable() const
+{
+    qint64 available = QNetworkReply::bytesAvailable();
+    if (reply_ && !unauthorized())
+    {
+        available += reply_->bytesAvailable();
+    }
+    return available;
+}
+
+void SessionReply::setReadBufferSize(qint64 size)
+{
+    QNetworkReply::setReadBufferSize(size);
+    if (reply_)
+    {
+        reply_->setReadBufferSize(size);
+    }
+}
+
+qint64 SessionReply::readData(char* data, qint64 max_size)
+{
+    if (!reply_ || unauthorized())
+    {
+        return isFinished() ? -1 : 0;
+    }
+    qint64 n = reply_->read(data, max_size);
+    if (n == 0 && isFinished())
+    {
+        return -1;
+    }
+    return n;
+}
+
+void SessionReply::connectReply()
+{
+    reply_->setReadBufferSize(readBufferSize());
+    connect(reply_.get(), &QNetworkReply::metaDataChanged,
+            this, &SessionReply::onReplyMetaDataChanged);
+    connect(reply_.get(), &QIODevice::readyRead,
+            this, &SessionReply::onReplyReadyRead);
+    connect(reply_.get(), &QNetworkReply::finished,
+            this, &SessionReply::onReplyFinished);
+    connect(reply_.get(), &QNetworkReply::uploadProgress,
+            this, &QNetworkReply::uploadProgress);
+    connect(reply_.get(), &QNetworkReply::downloadProgress,
+            this, &QNetworkReply::downloadProgress);
+}
+
+bool SessionReply::unauthorized() const
+{
+    return retry_ && reply_->attribute(
+        QNetworkRequest::HttpStatusCodeAttribute).toInt() == 401;
+}
+
+void SessionReply::copyMetaData()
+{
+    for (auto attr : {QNetworkRequest::HttpStatusCodeAttribute,
+                QNetworkRequest::HttpReasonPhraseAttribute,
+                QNetworkRequest::RedirectionTargetAttribute,
+                QNetworkRequest::ConnectionEncryptedAttribute,
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+                QNetworkRequest::Http2WasUsedAttribute,
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+                QNetworkRequest::HTTP2WasUsedAttribute,
+#endif
+                })
+    {
+        setAttribute(attr, reply_->attribute(attr));
+    }
+    for (auto const& header : reply_->rawHeaderPairs())
+    {
+        setRawHeader(header.first, header.second);
+    }
+    setUrl(reply_->url());
+}
+
+void SessionReply::onReplyMetaDataChanged()
+{
+    if (unauthorized())
+    {
+        return;
+    }
+    copyMetaData();
+    Q_EMIT metaDataChanged();
+}
+
+void SessionReply::onReplyReadyRead()
+{
+    if (unauthorized())
+    {
+        // Discard the body of the rejected response.
+        reply_->readAll();
+        return;
+    }
+    Q_EMIT readyRead();
+}
+
+void SessionReply::onReplyFinished()
+{
+    if (unauthorized())
+    {
+        Retry retry = std::move(retry_);
+        retry_ = nullptr;
+        reply_.release()->deleteLater();
+        reply_.reset(retry());
+        connectReply();
+        return;
+    }
+    copyMetaData();
+    if (reply_->error() != QNetworkReply::NoError)
+    {
+        setError(reply_->error(), reply_->errorString());
+    }
+    setFinished(true);
+    Q_EMIT readChannelFinished();
+    Q_EMIT finished();
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QNetworkReply>
+
+#include <functional>
+#include <memory>
+
+// The reply handed to handlers for requests sent through a session.
+//
+// The reply is created before the request is sent, since the request
+// may have to wait its turn in the RequestScheduler.  The underlying
+// reply is attached once it is sent, and its data and signals passed
+// through.  Aborting a reply that hasn't been sent yet finishes it
+// with OperationCanceledError.
+//
+// If the request was authenticated only by the session cookies, a
+// retry function can be given.  Then if the server has forgotten the
+// session and answers "401 Unauthorized", the response is swallowed
+// and the request is repeated with the account's credentials, so
+// handlers only see the outcome of the second attempt.
+class SessionReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    typedef std::function<QNetworkReply*()> Retry;
+
+    SessionReply(QNetworkRequest const& request, QByteArray const& verb);
+    ~SessionReply();
+
+    // Pass through the reply to the request, once sent.
+    void attach(QNetworkReply* reply, Retry const& retry = Retry());
+    bool isSent() const;
+
+    void abort() override;
+    void close() override;
+    qint64 bytesAvailable() const override;
+    void setReadBufferSize(qint64 size) override;
+
+protected:
+    qint64 readData(char* data, qint64 max_size) override;
+
+private Q_SLOTS:
+    void onReplyMetaDataChanged();
+    void onReplyReadyRead();
+    void onReplyFinished();
+
+private:
+    void connectReply();
+    bool unauthorized() const;
+    void copyMetaData();
+
+    std::unique_ptr<QNetworkReply> reply_;
+    Retry retry_;
+};
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <boost/thread.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Coalesces concurrent identical requests.  The first caller to join
+// a key performs the request, and every caller that joins the key
+// before it finishes receives the same result.
+template <typename T>
+class Singleflight
+{
+public:
+    typedef std::function<void(T const& value,
+                               boost::exception_ptr const& error)> Callback;
+
+    Singleflight() = default;
+    Singleflight(Singleflight const&) = delete;
+    Singleflight& operator=(Singleflight const&) = delete;
+
+    // Wait for the result of the request identified by key.  If no
+    // such request is in flight, returns the ID of a new flight: the
+    // caller should start the request and pass the ID to finish().
+    // Otherwise returns 0.
+    uint64_t join(std::string const& key, Callback callback)
+    {
+        auto it = flights_.find(key);
+        if (it != flights_.end())
+        {
+            it->second.waiters.emplace_back(std::move(callback));
+            return 0;
+        }
+        Flight& flight = flights_[key];
+        flight.id = ++last_id_;
+        flight.waiters.emplace_back(std::move(callback));
+        return flight.id;
+    }
+
+    // Deliver the result of a flight to its waiters.
+    void finish(std::string const& key, uint64_t id, T const& value,
+                boost::exception_ptr const& error)
+    {
+        std::vector<Callback> waiters;
+        auto it = flights_.find(key);
+        if (it != flights_.end() && it->second.id == id)
+        {
+            waiters = std::move(it->second.waiters);
+            flights_.erase(it);
+        }
+        else
+        {
+            auto detached = detached_.find(id);
+            if (detached == detached_.end())
+            {
+                return;
+            }
+            waiters = std::move(detached->second);
+            detached_.erase(detached);
+        }
+        // Waiters may join new flights, so only call them once our
+        // own state is consistent.
+        for (auto const& callback : waiters)
+        {
+            callback(value, error);
+        }
+    }
+
+    // Stop sharing the in-flight requests for keys starting with
+    // prefix, e.g. because the resource has been modified.  Existing
+    // waiters still get the result, but later callers will start a
+    // fresh request.
+    void forget_prefix(std::string const& prefix)
+    {
+        for (auto it = flights_.begin(); it != flights_.end(); )
+        {
+            if (it->first.compare(0, prefix.size(), prefix) == 0)
+            {
+                detached_.emplace(it->second.id, std::move(it->second.waiters));
+                it = flights_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    std::size_t size() const
+    {
+        return flights_.size() + detached_.size();
+    }
+
+private:
+    struct Flight
+    {
+        uint64_t id = 0;
+        std::vector<Callback> waiters;
+    };
+
+    std::unordered_map<std::string, Flight> flights_;
+    std::map<uint64_t, std::vector<Callback>> detached_;
+    uint64_t last_id_ = 0;
+};
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "StagedUploadJob.h"
+#include "DavProvider.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <unistd.h>
+#include <string>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+string make_upload_id()
+{
+    static int counter = 0;
+    return "staged-" + to_string(counter++);
+}
+
+}
+
+StagedUploadJob::StagedUploadJob(shared_ptr<DavProvider> const& provider,
+                                 string const& item_id, int64_t size,
+                                 string const& content_type,
+                                 Context const& ctx)
+    : QObject(), UploadJob(make_upload_id()), provider_(provider),
+      session_(provider->session(ctx)), context_(ctx)
+{
+    entry_.account = session_->account();
+    entry_.item_id = item_id;
+    entry_.content_type = content_type;
+    entry_.allow_overwrite = true;
+    entry_.size = size;
+    entry_.mtime = QDateTime::currentDateTimeUtc().toTime_t();
+
+    reader_.setSocketDescriptor(
+        dup(read_socket()), QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+    connect(&reader_, &QIODevice::readyRead,
+            this, &StagedUploadJob::onReadyRead);
+    connect(&reader_, &QIODevice::readChannelFinished,
+            this, &StagedUploadJob::onReadChannelFinished);
+
+    data_ = provider_->write_back().create_data_file(entry_);
+    if (!data_)
+    {
+        fail(boost::copy_exception(
+                 ResourceException("Could not stage upload", 0)));
+        return;
+    }
+    entry_.provisional_etag = "\"staged-" + entry_.id + '"';
+    if (size == 0)
+    {
+        complete();
+    }
+}
+
+StagedUploadJob::~StagedUploadJob()
+{
+    if (!promise_set_ && data_)
+    {
+        data_.reset();
+        provider_->write_back().discard(entry_.id);
+    }
+}
+
+void StagedUploadJob::onReadyRead()
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    QByteArray const data = reader_.readAll();
+    bytes_read_ += data.size();
+    if (bytes_read_ > entry_.size)
+    {
+        fail(boost::copy_exception(
+                 LogicException("Upload is larger than the declared size")));
+        return;
+    }
+    if (data_->write(data) != data.size())
+    {
+        fail(boost::copy_exception(
+                 ResourceException("Could not stage upload: " +
+                                   data_->errorString().toStdString(), 0)));
+        return;
+    }
+    if (bytes_read_ == entry_.size)
+    {
+        complete();
+    }
+    else if (read_channel_finished_ && reader_.bytesAvailable() == 0)
+    {
+        fail(boost::copy_exception(
+                 LogicException("Upload is smaller than the declared size")));
+    }
+}
+
+void StagedUploadJob::onReadChannelFinished()
+{
+    read_channel_finished_ = true;
+    onReadyRead();
+}
+
+void StagedUploadJob::complete()
+{
+    reader_.close();
+    data_->close();
+    if (data_->error() != QFile::NoError ||
+        !provider_->write_back().add(entry_, context_))
+    {
+        fail(boost::copy_exception(
+                 ResourceException("Could not stage upload", 0)));
+        return;
+    }
+    data_.reset();
+    provider_->invalidate_cache(session_->base_url(), entry_.item_id);
+    promise_.set_value(
+        provider_->write_back().provisional_item(entry_, *session_));
+    promise_set_ = true;
+}
+
+void StagedUploadJob::fail(boost::exception_ptr const& error)
+{
+    if (promise_set_)
+    {
+        return;
+    }
+    promise_.set_exception(error);
+    promise_set_ = true;
+
+    reader_.close();
+    if (data_)
+    {
+        data_.reset();
+        provider_->write_back().discard(entry_.id);
+    }
+}
+
+boost::future<void> StagedUploadJob::cancel()
+{
+    fail(boost::copy_exception(CancelledException("Upload cancelled")));
+    return boost::make_ready_future();
+}
+
+boost::future<Item> StagedUploadJob::finish()
+{
+    return promise_.get_future();
+}
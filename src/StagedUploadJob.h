@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QLocalSocket>
+#include <QObject>
+#include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/UploadJob.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "WriteBackQueue.h"
+
+class DavProvider;
+class DavSession;
+class QFile;
+
+// Stage an upload on local disk and hand it to the write-back queue,
+// completing as soon as the data is safely stored.  The client gets a
+// provisional item, whose ETag changes once the upload reaches the
+// server.  The upload replaces whatever the server has, so is only
+// used when the client didn't ask for a precondition.
+class StagedUploadJob : public QObject, public unity::storage::provider::UploadJob
+{
+    Q_OBJECT
+public:
+    StagedUploadJob(std::shared_ptr<DavProvider> const& provider,
+                    std::string const& item_id, int64_t size,
+                    std::string const& content_type,
+                    unity::storage::provider::Context const& ctx);
+    ~StagedUploadJob();
+
+    boost::future<void> cancel() override;
+    boost::future<unity::storage::provider::Item> finish() override;
+
+private Q_SLOTS:
+    void onReadyRead();
+    void onReadChannelFinished();
+
+private:
+    void complete();
+    void fail(boost::exception_ptr const& error);
+
+    std::shared_ptr<DavProvider> const provider_;
+    std::shared_ptr<DavSession const> const session_;
+    unity::storage::provider::Context const context_;
+    WriteBackQueue::Entry entry_;
+    QLocalSocket reader_;
+    std::unique_ptr<QFile> data_;
+    int64_t bytes_read_ = 0;
+    bool read_channel_finished_ = false;
+
+    bool promise_set_ = false;
+    boost::promise<unity::storage::provider::Item> promise_;
+};
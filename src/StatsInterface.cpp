@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "StatsInterface.h"
+#include "OperationStats.h"
+
+#include <QDBusError>
+#include <QDebug>
+
+using namespace std;
+
+namespace
+{
+
+string stats_bus_name;
+
+QVariantMap summarize(Histogram const& h)
+{
+    return QVariantMap{
+        {"count", static_cast<qulonglong>(h.count())},
+        {"min", static_cast<qlonglong>(h.min())},
+        {"max", static_cast<qlonglong>(h.max())},
+        {"mean", h.mean()},
+        {"p50", static_cast<qlonglong>(h.percentile(0.50))},
+        {"p90", static_cast<qlonglong>(h.percentile(0.90))},
+        {"p99", static_cast<qlonglong>(h.percentile(0.99))},
+        {"p999", static_cast<qlonglong>(h.percentile(0.999))},
+    };
+}
+
+}
+
+char const StatsInterface::OBJECT_PATH[] =
+    "/com/canonical/StorageFramework/Provider/Stats";
+
+StatsInterface::StatsInterface(OperationStats& stats, QObject* parent)
+    : QObject(parent), stats_(stats)
+{
+}
+
+StatsInterface::~StatsInterface()
+{
+    if (connection_)
+    {
+        connection_->unregisterObject(OBJECT_PATH);
+        if (!bus_name_.isEmpty())
+        {
+            connection_->unregisterService(bus_name_);
+        }
+    }
+}
+
+void StatsInterface::set_bus_name(string const& bus_name)
+{
+    stats_bus_name = bus_name;
+}
+
+unique_ptr<StatsInterface> StatsInterface::publish(OperationStats& stats)
+{
+    if (stats_bus_name.empty())
+    {
+        return nullptr;
+    }
+    unique_ptr<StatsInterface> iface(new StatsInterface(stats));
+    if (!iface->registerOn(QDBusConnection::sessionBus(),
+                           QString::fromStdString(stats_bus_name)))
+    {
+        return nullptr;
+    }
+    return iface;
+}
+
+bool StatsInterface::registerOn(QDBusConnection const& connection,
+                                QString const& bus_name)
+{
+    unique_ptr<QDBusConnection> conn(new QDBusConnection(connection));
+    if (!conn->registerObject(OBJECT_PATH, this,
+                              QDBusConnection::ExportAllSlots))
+    {
+        qWarning() << "Could not export statistics:"
+                   << conn->lastError().message();
+        return false;
+    }
+    if (!bus_name.isEmpty() && !conn->registerService(bus_name))
+    {
+        qWarning() << "Could not claim" << bus_name << ":"
+                   << conn->lastError().message();
+        conn->unregisterObject(OBJECT_PATH);
+        return false;
+    }
+    connection_ = move(conn);
+    bus_name_ = bus_name;
+    return true;
+}
+
+QVariantMap StatsInterface::GetStats() const
+{
+    QVariantMap result;
+    for (auto const& pair : stats_.operations())
+    {
+        auto const& op = pair.second;
+        QVariantMap statuses;
+        for (auto const& status : op.statuses)
+        {
+            statuses.insert(QString::number(status.first),
+                            static_cast<qulonglong>(status.second));
+        }
+        result.insert(QString::fromStdString(pair.first), QVariantMap{
+                {"time_to_first_byte_us", summarize(op.time_to_first_byte)},
+                {"latency_us", summarize(op.latency)},
+                {"bytes", summarize(op.bytes)},
+                {"statuses", statuses},
+            });
+    }
+    return result;
+}
+
+void StatsInterface::Reset()
+{
+    stats_.reset();
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QDBusConnection>
+#include <QObject>
+#include <QString>
+#include <QVariantMap>
+
+#include <memory>
+#include <string>
+
+class OperationStats;
+
+// Exports a provider's OperationStats on D-Bus, so they can be
+// scraped by monitoring.
+//
+// The statistics are published on the session bus under a name next
+// to the provider's own, e.g. for the Nextcloud provider:
+//
+//   com.canonical.StorageFramework.Provider.Nextcloud.Stats
+//
+// at OBJECT_PATH.  GetStats() returns a map from operation name to
+// its statistics:
+//
+//   time_to_first_byte_us, latency_us, bytes:
+//       maps of count, min, max, mean, p50, p90, p99 and p999
+//   statuses:
+//       a map from HTTP status (as a string) to request count, with
+//       "0" counting requests that received no response
+class StatsInterface : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "com.canonical.StorageFramework.Provider.Stats")
+public:
+    static char const OBJECT_PATH[];
+
+    StatsInterface(OperationStats& stats, QObject* parent = nullptr);
+    ~StatsInterface();
+
+    // Set the bus name that providers created after this call publish
+    // their statistics under.  Called by the provider executables.
+    static void set_bus_name(std::string const& bus_name);
+    // Publish the statistics on the session bus, if a bus name has
+    // been set.
+    static std::unique_ptr<StatsInterface> publish(OperationStats& stats);
+
+    // Export the object on a connection, and claim the bus name if
+    // it isn't empty.
+    bool registerOn(QDBusConnection const& connection,
+                    QString const& bus_name = QString());
+
+public Q_SLOTS:
+    QVariantMap GetStats() const;
+    void Reset();
+
+private:
+    OperationStats& stats_;
+    std::unique_ptr<QDBusConnection> connection_;
+    QString bus_name_;
+};
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "SyncCollectionHandler.h"
+#include "DavProvider.h"
+#include "MultiStatusParser.h"
+#include "dav_properties.h"
+#include "http_error.h"
+
+#include <QBuffer>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <cassert>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+const auto SYNC_TOKEN_BODY = QByteArrayLiteral(
+R"(<?xml version="1.0" encoding="utf-8" ?>
+<D:propfind xmlns:D="DAV:">
+  <D:prop>
+    <D:sync-token/>
+  </D:prop>
+</D:propfind>)");
+
+// The properties fetched for changed items.
+constexpr PropertySet SYNC_PROPERTIES = dav_property::standard;
+
+const auto SYNC_COLLECTION_BODY_START = QByteArrayLiteral(
+R"(<?xml version="1.0" encoding="utf-8" ?>
+<D:sync-collection xmlns:D="DAV:" xmlns:oc="http://owncloud.org/ns">
+  <D:sync-token>)");
+const auto SYNC_COLLECTION_BODY_END = QByteArrayLiteral(
+R"(</D:sync-token>
+  <D:sync-level>infinite</D:sync-level>
+)");
+
+QByteArray xml_escape(string const& text)
+{
+    return QString::fromStdString(text).toHtmlEscaped().toUtf8();
+}
+
+}
+
+SyncCollectionHandler::SyncCollectionHandler(shared_ptr<DavProvider> const& provider,
+                                             string const& sync_token,
+                                             Context const& ctx,
+                                             Callback callback)
+    : provider_(provider), context_(ctx), session_(provider->session(ctx)),
+      callback_(callback), sync_token_(sync_token),
+      delta_(!sync_token.empty())
+{
+    sendRequest();
+}
+
+SyncCollectionHandler::~SyncCollectionHandler() = default;
+
+void SyncCollectionHandler::sendRequest()
+{
+    if (reply_)
+    {
+        // Restarting from within the previous reply's signal handlers.
+        reply_.release()->deleteLater();
+        request_body_.release()->deleteLater();
+    }
+    if (parser_)
+    {
+        parser_.release()->deleteLater();
+    }
+    seen_headers_ = false;
+    is_error_ = false;
+    truncated_ = false;
+    baseline_token_.clear();
+    error_body_.clear();
+
+    QByteArray verb;
+    QByteArray body;
+    if (sync_token_.empty())
+    {
+        verb = QByteArrayLiteral("PROPFIND");
+        body = SYNC_TOKEN_BODY;
+    }
+    else
+    {
+        verb = QByteArrayLiteral("REPORT");
+        body = SYNC_COLLECTION_BODY_START + xml_escape(sync_token_) +
+            SYNC_COLLECTION_BODY_END + prop_element(SYNC_PROPERTIES) +
+            QByteArrayLiteral("</D:sync-collection>");
+    }
+
+    QNetworkRequest request(session_->id_to_url("."));
+    request.setRawHeader(QByteArrayLiteral("Depth"), QByteArrayLiteral("0"));
+    request.setHeader(QNetworkRequest::ContentTypeHeader,
+                      QStringLiteral("application/xml; charset=\"utf-8\""));
+    request.setHeader(QNetworkRequest::ContentLengthHeader, body.size());
+    request_body_.reset(new QBuffer);
+    request_body_->setData(body);
+    request_body_->open(QIODevice::ReadOnly);
+    DavProvider::set_request_operation(request, QStringLiteral("sync"));
+
+    reply_.reset(provider_->send_request(request, verb, request_body_.get(),
+                                         context_));
+    assert(reply_.get() != nullptr);
+
+    connect(reply_.get(), &QIODevice::readyRead,
+            this, &SyncCollectionHandler::onReplyReadyRead);
+    connect(reply_.get(), &QNetworkReply::finished,
+            this, &SyncCollectionHandler::onReplyFinished);
+}
+
+void SyncCollectionHandler::finish(string const& sync_token,
+                                   boost::exception_ptr const& error)
+{
+    if (finished_)
+    {
+        return;
+    }
+    finished_ = true;
+    deleteLater();
+    callback_(sync_token, delta_, error);
+}
+
+void SyncCollectionHandler::onReplyReadyRead()
+{
+    if (!seen_headers_)
+    {
+        seen_headers_ = true;
+        auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (status == 207)
+        {
+            disconnect(reply_.get(), &QIODevice::readyRead,
+                       this, &SyncCollectionHandler::onReplyReadyRead);
+            parser_.reset(new MultiStatusParser(reply_->request().url(), reply_.get()));
+            connect(parser_.get(), &MultiStatusParser::response,
+                    this, &SyncCollectionHandler::onParserResponse);
+            connect(parser_.get(), &MultiStatusParser::finished,
+                    this, &SyncCollectionHandler::onParserFinished);
+        }
+        else
+        {
+            is_error_ = true;
+        }
+    }
+    if (is_error_)
+    {
+        if (error_body_.size() < MAX_ERROR_BODY_LENGTH)
+        {
+            error_body_.append(reply_->readAll());
+        }
+        else
+        {
+            reply_->close();
+        }
+    }
+}
+
+void SyncCollectionHandler::onReplyFinished()
+{
+    if (seen_headers_ && !is_error_)
+    {
+        return;
+    }
+
+    auto status = reply_->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!sync_token_.empty() && (status == 403 || status == 409) &&
+        error_body_.contains("valid-sync-token"))
+    {
+        // The server no longer knows the token, so we can't tell
+        // what changed.  Start again from the current state.
+        sync_token_.clear();
+        delta_ = false;
+        sendRequest();
+        return;
+    }
+    if (status >= 400 && status < 500 && status != 401 && status != 407)
+    {
+        // The server doesn't implement the REPORT, or doesn't allow
+        // it on this collection.
+        finish(string(), boost::exception_ptr());
+        return;
+    }
+    finish(string(), translate_http_error(reply_.get(), error_body_, "."));
+}
+
+void SyncCollectionHandler::onParserResponse(QUrl const& href, vector<MultiStatusProperty> const& properties, int status)
+{
+    if (finished_)
+    {
+        return;
+    }
+    if (sync_token_.empty())
+    {
+        for (auto const& prop : properties)
+        {
+            if (prop.ns == "DAV:" && prop.name == "sync-token" &&
+                (prop.status == 0 || prop.status == 200))
+            {
+                baseline_token_ = prop.value.toStdString();
+            }
+        }
+        return;
+    }
+
+    try
+    {
+        string const item_id = session_->url_to_id(href);
+        if (item_id == "." && status == 507)
+        {
+            truncated_ = true;
+        }
+        else if (status == 0 || status == 200)
+        {
+            provider_->apply_change(
+                session_->base_url(),
+                provider_->make_item(href, *session_, properties),
+                SYNC_PROPERTIES);
+        }
+        else
+        {
+            // Removed, or something we don't understand: either way,
+            // forget what we knew about the item.
+            provider_->apply_removal(session_->base_url(), item_id);
+        }
+    }
+    catch (StorageException const& error)
+    {
+        finish(string(), boost::copy_exception(error));
+    }
+    catch (exception const& error)
+    {
+        finish(string(), boost::copy_exception(RemoteCommsException(string("Error creating item: ") + error.what())));
+    }
+}
+
+void SyncCollectionHandler::onParserFinished()
+{
+    if (finished_)
+    {
+        return;
+    }
+    if (!parser_->errorString().isEmpty())
+    {
+        finish(string(), boost::copy_exception(RemoteCommsException("Error parsing Multi-Status response: " + parser_->errorString().toStdString())));
+        return;
+    }
+    if (sync_token_.empty())
+    {
+        // An empty token means the collection doesn't support
+        // sync-collection.
+        finish(baseline_token_, boost::exception_ptr());
+        return;
+    }
+
+    string const new_token = parser_->syncToken().toStdString();
+    if (new_token.empty())
+    {
+        finish(string(), boost::copy_exception(RemoteCommsException("sync-collection response did not include a sync token")));
+        return;
+    }
+    sync_token_ = new_token;
+    if (truncated_)
+    {
+        sendRequest();
+        return;
+    }
+    finish(sync_token_, boost::exception_ptr());
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QUrl>
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class DavProvider;
+class DavSession;
+class MultiStatusParser;
+struct MultiStatusProperty;
+class QBuffer;
+class QNetworkReply;
+
+// Fetches the changes made to an account since a sync token was
+// issued, using the RFC 6578 sync-collection REPORT, and applies them
+// to the provider's caches.
+//
+// Without a sync token (or if the server rejects the token), the
+// handler only retrieves the collection's current token with a
+// PROPFIND, establishing a starting point for later calls.
+class SyncCollectionHandler : public QObject {
+    Q_OBJECT
+public:
+    // Called with the new sync token, and whether the changes since
+    // the old token were applied.  An empty token without an error
+    // means the server doesn't support sync-collection.
+    typedef std::function<void(std::string const& sync_token, bool delta,
+                               boost::exception_ptr const& error)> Callback;
+
+    SyncCollectionHandler(std::shared_ptr<DavProvider> const& provider,
+                          std::string const& sync_token,
+                          unity::storage::provider::Context const& ctx,
+                          Callback callback);
+    ~SyncCollectionHandler();
+
+private Q_SLOTS:
+    // From QNetworkReply
+    void onReplyReadyRead();
+    void onReplyFinished();
+
+    // From MultiStatusParser
+    void onParserResponse(QUrl const& href, std::vector<MultiStatusProperty> const& properties, int status);
+    void onParserFinished();
+
+private:
+    void sendRequest();
+    void finish(std::string const& sync_token,
+                boost::exception_ptr const& error);
+
+    std::shared_ptr<DavProvider> const provider_;
+    unity::storage::provider::Context const context_;
+    std::shared_ptr<DavSession const> const session_;
+    Callback const callback_;
+
+    std::string sync_token_;
+    bool delta_;
+    // The server truncated the results, so we need to ask again.
+    bool truncated_ = false;
+    std::string baseline_token_;
+
+    bool seen_headers_ = false;
+    bool is_error_ = false;
+    bool finished_ = false;
+    std::unique_ptr<QBuffer> request_body_;
+    std::unique_ptr<QNetworkReply> reply_;
+    std::unique_ptr<MultiStatusParser> parser_;
+    QByteArray error_body_;
+};
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+// The buffer is written out when it grows past this size, or when
+// an event is added this long after the last write.
+size_t const FLUSH_SIZE = 1024 * 1024;
+chrono::seconds const FLUSH_INTERVAL(1);
+
+typedef chrono::steady_clock Clock;
+
+class Writer
+{
+public:
+    Writer(FILE* file)
+        : file_(file), pid_(getpid()), last_flush_(Clock::now())
+    {
+        buffer_.reserve(FLUSH_SIZE + 4096);
+        buffer_ += "[\n";
+    }
+
+    ~Writer()
+    {
+        // Name the process, and close the array.
+        buffer_ += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":";
+        buffer_ += to_string(pid_);
+        buffer_ += ",\"args\":{\"name\":\"storage-provider-webdav\"}}\n]\n";
+        flush();
+        fclose(file_);
+    }
+
+    void add(char phase, char const* category, char const* name,
+             int64_t ts, int64_t dur, uint64_t id, Trace::Args const& args)
+    {
+        static thread_local long const tid = syscall(SYS_gettid);
+
+        buffer_ += "{\"ph\":\"";
+        buffer_ += phase;
+        buffer_ += "\",\"cat\":";
+        append_string(category);
+        buffer_ += ",\"name\":";
+        append_string(name);
+        buffer_ += ",\"ts\":";
+        buffer_ += to_string(ts);
+        if (phase == 'X')
+        {
+            buffer_ += ",\"dur\":";
+            buffer_ += to_string(dur);
+        }
+        if (id != 0)
+        {
+            buffer_ += ",\"id\":";
+            buffer_ += to_string(id);
+        }
+        buffer_ += ",\"pid\":";
+        buffer_ += to_string(pid_);
+        buffer_ += ",\"tid\":";
+        buffer_ += to_string(tid);
+        if (!args.empty())
+        {
+            buffer_ += ",\"args\":{";
+            bool first = true;
+            for (auto const& arg : args)
+            {
+                if (!first)
+                {
+                    buffer_ += ',';
+                }
+                first = false;
+                append_string(arg.first);
+                buffer_ += ':';
+                append_string(arg.second);
+            }
+            buffer_ += '}';
+        }
+        buffer_ += "},\n";
+
+        auto const now = Clock::now();
+        if (buffer_.size() >= FLUSH_SIZE ||
+            now - last_flush_ >= FLUSH_INTERVAL)
+        {
+            flush();
+            last_flush_ = now;
+        }
+    }
+
+private:
+    void append_string(string const& s)
+    {
+        static char const hex[] = "0123456789abcdef";
+        buffer_ += '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                buffer_ += '\\';
+                buffer_ += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                buffer_ += "\\u00";
+                buffer_ += hex[(c >> 4) & 0xf];
+                buffer_ += hex[c & 0xf];
+            }
+            else
+            {
+                buffer_ += c;
+            }
+        }
+        buffer_ += '"';
+    }
+
+    void flush()
+    {
+        fwrite(buffer_.data(), 1, buffer_.size(), file_);
+        fflush(file_);
+        buffer_.clear();
+    }
+
+    FILE* const file_;
+    int const pid_;
+    string buffer_;
+    Clock::time_point last_flush_;
+};
+
+Clock::time_point const epoch = Clock::now();
+mutex writer_mutex;
+unique_ptr<Writer> writer;
+atomic<bool> active(false);
+atomic<uint64_t> last_id(0);
+thread_local uint64_t current_call_id = 0;
+
+bool start_from_environment()
+{
+    char const* path = getenv("DAV_TRACE_FILE");
+    if (path == nullptr || path[0] == '\0')
+    {
+        return false;
+    }
+    string p(path);
+    auto pos = p.find("%p");
+    if (pos != string::npos)
+    {
+        p.replace(pos, 2, to_string(getpid()));
+    }
+    if (!Trace::start(p))
+    {
+        fprintf(stderr, "Could not open trace file %s\n", p.c_str());
+        return false;
+    }
+    // Close the trace cleanly on a normal exit.
+    atexit(Trace::stop);
+    return true;
+}
+
+void add(char phase, char const* category, char const* name, int64_t ts,
+         int64_t dur, uint64_t id, Trace::Args const& args)
+{
+    lock_guard<mutex> lock(writer_mutex);
+    if (writer)
+    {
+        writer->add(phase, category, name, ts, dur, id, args);
+    }
+}
+
+}
+
+bool Trace::enabled()
+{
+    static bool const from_environment = start_from_environment();
+    (void)from_environment;
+    return active.load(memory_order_relaxed);
+}
+
+bool Trace::start(string const& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    lock_guard<mutex> lock(writer_mutex);
+    writer.reset(new Writer(file));
+    active = true;
+    return true;
+}
+
+void Trace::stop()
+{
+    lock_guard<mutex> lock(writer_mutex);
+    active = false;
+    writer.reset();
+}
+
+int64_t Trace::now()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+        Clock::now() - epoch).count();
+}
+
+void Trace::complete(char const* category, char const* name, int64_t start,
+                     Args const& args)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    add('X', category, name, start, now() - start, 0, args);
+}
+
+uint64_t Trace::next_id()
+{
+    return ++last_id;
+}
+
+void Trace::begin(char const* category, char const* name, uint64_t id,
+                  Args const& args)
+{
+    if (!enabled() || id == 0)
+    {
+        return;
+    }
+    add('b', category, name, now(), 0, id, args);
+}
+
+void Trace::step(char const* category, char const* name, uint64_t id,
+                 Args const& args)
+{
+    if (!enabled() || id == 0)
+    {
+        return;
+    }
+    add('n', category, name, now(), 0, id, args);
+}
+
+void Trace::end(char const* category, char const* name, uint64_t id,
+                Args const& args)
+{
+    if (!enabled() || id == 0)
+    {
+        return;
+    }
+    add('e', category, name, now(), 0, id, args);
+}
+
+Trace::Scope::Scope(char const* category, char const* name)
+    : category_(category), name_(name), enabled_(enabled()),
+      start_(enabled_ ? now() : 0)
+{
+}
+
+Trace::Scope::~Scope()
+{
+    if (enabled_)
+    {
+        complete(category_, name_, start_, args_);
+    }
+}
+
+void Trace::Scope::arg(char const* key, string const& value)
+{
+    if (enabled_)
+    {
+        args_.emplace_back(key, value);
+    }
+}
+
+Trace::Call::Call(char const* method, string const& item_id)
+    : id_(enabled() ? next_id() : 0), outer_(current_call_id)
+{
+    if (id_ != 0)
+    {
+        begin("dbus", method, id_, {{"item_id", item_id}});
+        current_call_id = id_;
+    }
+}
+
+Trace::Call::~Call()
+{
+    if (id_ != 0)
+    {
+        current_call_id = outer_;
+        // A method that throws has no result to wait for.
+        if (uncaught_exception())
+        {
+            end_call(id_);
+        }
+    }
+}
+
+uint64_t Trace::Call::id() const
+{
+    return id_;
+}
+
+uint64_t Trace::current_call()
+{
+    return current_call_id;
+}
+
+void Trace::end_call(uint64_t id)
+{
+    end("dbus", "call", id);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Optional tracing of the work done for each request, written as
+// Chrome trace events that can be loaded into chrome://tracing or
+// https://ui.perfetto.dev.
+//
+// Tracing is enabled by setting DAV_TRACE_FILE to the file to write,
+// where "%p" is replaced by the process ID.  Events are formatted
+// into a memory buffer and appended to the file in batches, so
+// leaving tracing on costs little more than the formatting.  The
+// JSON array is closed when tracing stops, but trace viewers accept
+// files cut short if the provider is killed.
+//
+// With tracing disabled, each trace point costs a flag check.
+class Trace
+{
+public:
+    typedef std::vector<std::pair<char const*, std::string>> Args;
+
+    static bool enabled();
+    // Start writing events to the given file, or stop and close it.
+    // Tracing is normally started from DAV_TRACE_FILE.
+    static bool start(std::string const& path);
+    static void stop();
+
+    // Microseconds on the trace clock.
+    static int64_t now();
+    // A span timed by the caller, on the current thread.
+    static void complete(char const* category, char const* name,
+                         int64_t start, Args const& args = Args());
+
+    // Spans that cross event loop iterations, identified by category
+    // and an ID from next_id().  Steps mark points within the span.
+    static uint64_t next_id();
+    static void begin(char const* category, char const* name, uint64_t id,
+                      Args const& args = Args());
+    static void step(char const* category, char const* name, uint64_t id,
+                     Args const& args = Args());
+    static void end(char const* category, char const* name, uint64_t id,
+                    Args const& args = Args());
+
+    // Times the enclosing scope.
+    class Scope
+    {
+    public:
+        Scope(char const* category, char const* name);
+        ~Scope();
+
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+
+        void arg(char const* key, std::string const& value);
+
+    private:
+        char const* const category_;
+        char const* const name_;
+        bool const enabled_;
+        int64_t const start_;
+        Args args_;
+    };
+
+    // A provider method called over D-Bus.  The span begins with the
+    // call and lasts until end_call() reports its result is ready.
+    // While the method runs, current_call() identifies it, so the
+    // handlers and requests it creates can be attributed to it.
+    class Call
+    {
+    public:
+        Call(char const* method, std::string const& item_id);
+        ~Call();
+
+        Call(Call const&) = delete;
+        Call& operator=(Call const&) = delete;
+
+        uint64_t id() const;
+
+        // Ends the span if the future's result is already available.
+        template <typename Future>
+        Future returning(Future future) const
+        {
+            if (future.is_ready())
+            {
+                end_call(id_);
+            }
+            return future;
+        }
+
+    private:
+        uint64_t const id_;
+        uint64_t const outer_;
+    };
+    // The call being made on this thread, or zero.
+    static uint64_t current_call();
+    static void end_call(uint64_t id);
+};
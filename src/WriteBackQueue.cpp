@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "WriteBackQueue.h"
+#include "DavProvider.h"
+#include "DavUploadJob.h"
+#include "MultiStatusParser.h"
+#include "http_error.h"
+#include "item_id.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUuid>
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+constexpr int RETRY_DELAY_MS = 1000;
+constexpr int MAX_RETRY_DELAY_MS = 5 * 60 * 1000;
+// Completed uploads whose provisional ETag is remembered.
+constexpr size_t MAX_COMPLETED = 10000;
+
+QString const RECORD_SUFFIX = QStringLiteral(".json");
+QString const DATA_SUFFIX = QStringLiteral(".data");
+
+QJsonObject to_json(WriteBackQueue::Entry const& entry)
+{
+    return QJsonObject{
+        {"id", QString::fromStdString(entry.id)},
+        {"account", QString::fromStdString(entry.account)},
+        {"item_id", QString::fromStdString(entry.item_id)},
+        {"content_type", QString::fromStdString(entry.content_type)},
+        {"allow_overwrite", entry.allow_overwrite},
+        {"old_etag", QString::fromStdString(entry.old_etag)},
+        {"size", double(entry.size)},
+        {"mtime", double(entry.mtime)},
+        {"provisional_etag", QString::fromStdString(entry.provisional_etag)},
+        {"created", double(entry.created)},
+        {"attempts", entry.attempts},
+        {"failed", entry.failed},
+        {"failed_at", double(entry.failed_at)},
+    };
+}
+
+bool from_json(QJsonObject const& json, WriteBackQueue::Entry& entry)
+{
+    entry.id = json["id"].toString().toStdString();
+    entry.account = json["account"].toString().toStdString();
+    entry.item_id = json["item_id"].toString().toStdString();
+    entry.content_type = json["content_type"].toString().toStdString();
+    entry.allow_overwrite = json["allow_overwrite"].toBool();
+    entry.old_etag = json["old_etag"].toString().toStdString();
+    entry.size = int64_t(json["size"].toDouble(-1));
+    entry.mtime = int64_t(json["mtime"].toDouble());
+    entry.provisional_etag = json["provisional_etag"].toString().toStdString();
+    entry.created = int64_t(json["created"].toDouble());
+    entry.attempts = json["attempts"].toInt();
+    entry.failed = json["failed"].toBool();
+    entry.failed_at = int64_t(json["failed_at"].toDouble(entry.created));
+    return !entry.id.empty() && !entry.account.empty() &&
+        !entry.item_id.empty() && entry.size >= 0;
+}
+
+// Whether an entry uploads the item, or something in the folder.
+bool is_within(WriteBackQueue::Entry const& entry, string const& account,
+               string const& item_id)
+{
+    if (entry.account != account)
+    {
+        return false;
+    }
+    if (entry.item_id == item_id || item_id == ".")
+    {
+        return true;
+    }
+    return is_folder(item_id) &&
+        entry.item_id.compare(0, item_id.size(), item_id) == 0;
+}
+
+// Make a rename or removal in the directory durable.
+void sync_directory(QString const& directory)
+{
+    int fd = open(QFile::encodeName(directory).constData(),
+                  O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+}
+
+WriteBackQueue::WriteBackQueue(DavProvider& provider, QString const& directory,
+                               bool enabled, int max_parallel, int max_failed,
+                               chrono::seconds failed_ttl)
+    : provider_(provider), directory_(directory), enabled_(enabled),
+      max_parallel_(max(1, max_parallel)), max_failed_(max(0, max_failed)),
+      failed_ttl_(failed_ttl)
+{
+    retry_timer_.setSingleShot(true);
+    connect(&retry_timer_, &QTimer::timeout, this, [this] { schedule(); });
+    if (enabled_)
+    {
+        load();
+    }
+}
+
+WriteBackQueue::~WriteBackQueue()
+{
+    // Interrupted uploads are resumed from the journal next time.
+    for (auto& pair : pending_)
+    {
+        if (pair.second.reply)
+        {
+            pair.second.reply->disconnect(this);
+            pair.second.reply->abort();
+        }
+    }
+}
+
+QString WriteBackQueue::default_directory()
+{
+    return QStandardPaths::writableLocation(
+        QStandardPaths::GenericDataLocation) +
+        QStringLiteral("/storage-provider-webdav/uploads");
+}
+
+bool WriteBackQueue::enabled() const
+{
+    return enabled_;
+}
+
+QString const& WriteBackQueue::directory() const
+{
+    return directory_;
+}
+
+QString WriteBackQueue::data_path(string const& id) const
+{
+    return directory_ + '/' + QString::fromStdString(id) + DATA_SUFFIX;
+}
+
+QString WriteBackQueue::record_path(string const& id) const
+{
+    return directory_ + '/' + QString::fromStdString(id) + RECORD_SUFFIX;
+}
+
+void WriteBackQueue::load()
+{
+    QDir dir(directory_);
+    if (!dir.mkpath(QStringLiteral(".")))
+    {
+        qWarning() << "Could not create upload staging directory" << directory_;
+        return;
+    }
+    set<QString> referenced;
+    for (auto const& info : dir.entryInfoList({"*" + RECORD_SUFFIX}, QDir::Files))
+    {
+        QFile file(info.filePath());
+        Entry entry;
+        if (!file.open(QIODevice::ReadOnly) ||
+            !from_json(QJsonDocument::fromJson(file.readAll()).object(), entry) ||
+            QFileInfo(data_path(entry.id)).size() != entry.size)
+        {
+            qWarning() << "Discarding invalid staged upload" << info.filePath();
+            file.remove();
+            continue;
+        }
+        referenced.insert(QString::fromStdString(entry.id) + RECORD_SUFFIX);
+        referenced.insert(QString::fromStdString(entry.id) + DATA_SUFFIX);
+        Pending pending;
+        pending.entry = entry;
+        pending_.emplace(make_pair(entry.created, entry.id), move(pending));
+    }
+    // Remove data staged by uploads that never completed, and
+    // records left over from interrupted writes.
+    for (auto const& name : dir.entryList(QDir::Files))
+    {
+        if (referenced.find(name) == referenced.end())
+        {
+            dir.remove(name);
+        }
+    }
+    prune_failed();
+    for (auto const& pair : pending_)
+    {
+        Entry const& entry = pair.second.entry;
+        if (entry.failed)
+        {
+            qCritical() << "Staged upload of"
+                        << QString::fromStdString(entry.item_id) << "for"
+                        << QString::fromStdString(entry.account)
+                        << "was rejected - its data is kept in"
+                        << data_path(entry.id);
+        }
+    }
+    if (!pending_.empty())
+    {
+        qDebug() << pending_.size() << "staged uploads waiting to be sent";
+    }
+}
+
+unique_ptr<QFile> WriteBackQueue::create_data_file(Entry& entry)
+{
+    entry.id = QUuid::createUuid().toRfc4122().toHex().toStdString();
+    unique_ptr<QFile> file(new QFile(data_path(entry.id)));
+    if (!QDir().mkpath(directory_) ||
+        !file->open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Could not stage upload in" << file->fileName() << ":"
+                   << file->errorString();
+        return nullptr;
+    }
+    return file;
+}
+
+bool WriteBackQueue::add(Entry entry, Context const& ctx)
+{
+    // The data must be on disk before the record refers to it.
+    QFile data(data_path(entry.id));
+    if (!data.open(QIODevice::ReadOnly) || fdatasync(data.handle()) < 0)
+    {
+        return false;
+    }
+    data.close();
+    entry.created = QDateTime::currentMSecsSinceEpoch();
+    if (!save(entry))
+    {
+        return false;
+    }
+    contexts_[entry.account] = ctx;
+    Pending pending;
+    pending.entry = entry;
+    pending_.emplace(make_pair(entry.created, entry.id), move(pending));
+    schedule();
+    return true;
+}
+
+void WriteBackQueue::discard(string const& id)
+{
+    QFile::remove(data_path(id));
+}
+
+bool WriteBackQueue::save(Entry const& entry) const
+{
+    // QSaveFile syncs the new record before renaming it into place.
+    QSaveFile file(record_path(entry.id));
+    if (!file.open(QIODevice::WriteOnly) ||
+        file.write(QJsonDocument(to_json(entry)).toJson()) < 0 ||
+        !file.commit())
+    {
+        qWarning() << "Could not write staged upload record" << file.fileName()
+                   << ":" << file.errorString();
+        return false;
+    }
+    sync_directory(directory_);
+    return true;
+}
+
+void WriteBackQueue::remove(string const& id)
+{
+    QFile::remove(record_path(id));
+    QFile::remove(data_path(id));
+    sync_directory(directory_);
+}
+
+void WriteBackQueue::set_context(string const& account, Context const& ctx)
+{
+    if (!enabled_)
+    {
+        return;
+    }
+    contexts_[account] = ctx;
+    // This is called while a session is being set up, so don't send
+    // requests from here.
+    schedule_later();
+}
+
+bool WriteBackQueue::find(string const& account, string const& item_id,
+                          Entry& entry) const
+{
+    bool found = false;
+    for (auto const& pair : pending_)
+    {
+        Entry const& e = pair.second.entry;
+        if (!e.failed && e.account == account && e.item_id == item_id)
+        {
+            entry = e;
+            found = true;
+        }
+    }
+    return found;
+}
+
+vector<WriteBackQueue::Entry> WriteBackQueue::entries() const
+{
+    vector<Entry> result;
+    for (auto const& pair : pending_)
+    {
+        result.push_back(pair.second.entry);
+    }
+    return result;
+}
+
+Item WriteBackQueue::provisional_item(Entry const& entry,
+                                      DavSession const& session) const
+{
+    auto make_property = [](QString const& name, QString const& value) {
+        MultiStatusProperty prop;
+        prop.ns = QStringLiteral("DAV:");
+        prop.name = name;
+        prop.value = value;
+        prop.status = 200;
+        return prop;
+    };
+    vector<MultiStatusProperty> const properties{
+        make_property("resourcetype", QString()),
+        make_property("getetag", QString::fromStdString(entry.provisional_etag)),
+        make_property("getcontentlength", QString::number(entry.size)),
+        make_property("getlastmodified",
+                      QDateTime::fromTime_t(entry.mtime, Qt::UTC).toString(Qt::RFC2822Date)),
+    };
+    return provider_.make_item(session.id_to_url(entry.item_id), session,
+                               properties);
+}
+
+string WriteBackQueue::resolve_etag(string const& account,
+                                   string const& item_id,
+                                   string const& etag) const
+{
+    if (etag.empty())
+    {
+        return etag;
+    }
+    auto it = completed_.find(account + '\n' + item_id);
+    if (it == completed_.end() || it->second.provisional_etag != etag)
+    {
+        return etag;
+    }
+    return it->second.etag;
+}
+
+unique_ptr<QFile> WriteBackQueue::open_data(Entry const& entry) const
+{
+    unique_ptr<QFile> file(new QFile(data_path(entry.id)));
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Could not open staged upload" << file->fileName()
+                   << ":" << file->errorString();
+        return nullptr;
+    }
+    return file;
+}
+
+bool WriteBackQueue::busy(string const& account, string const& item_id) const
+{
+    for (auto const& pair : pending_)
+    {
+        Entry const& entry = pair.second.entry;
+        if (!entry.failed && is_within(entry, account, item_id))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WriteBackQueue::cancel(string const& account, string const& item_id)
+{
+    bool found = false;
+    for (auto it = pending_.begin(); it != pending_.end(); )
+    {
+        Pending& pending = it->second;
+        if (!is_within(pending.entry, account, item_id))
+        {
+            ++it;
+            continue;
+        }
+        if (pending.reply)
+        {
+            QNetworkReply* reply = pending.reply.release();
+            reply->disconnect(this);
+            reply->abort();
+            reply->deleteLater();
+            in_flight_--;
+        }
+        remove(pending.entry.id);
+        it = pending_.erase(it);
+        found = true;
+    }
+    if (found)
+    {
+        // Aborted uploads may have made room for others.
+        schedule_later();
+    }
+    return found;
+}
+
+void WriteBackQueue::schedule_later()
+{
+    if (schedule_pending_)
+    {
+        return;
+    }
+    schedule_pending_ = true;
+    QTimer::singleShot(0, this, [this] { schedule(); });
+}
+
+void WriteBackQueue::schedule()
+{
+    schedule_pending_ = false;
+    prune_failed();
+    auto const now = Clock::now();
+    auto next_retry = Clock::time_point::max();
+    // Items with an earlier upload still to complete.
+    set<string> busy;
+    for (auto& pair : pending_)
+    {
+        Pending& pending = pair.second;
+        Entry const& entry = pending.entry;
+        if (entry.failed)
+        {
+            continue;
+        }
+        if (!busy.insert(entry.account + '\n' + entry.item_id).second ||
+            pending.reply)
+        {
+            continue;
+        }
+        if (in_flight_ >= max_parallel_)
+        {
+            break;
+        }
+        if (contexts_.find(entry.account) == contexts_.end())
+        {
+            continue;
+        }
+        if (pending.next_attempt > now)
+        {
+            next_retry = min(next_retry, pending.next_attempt);
+            continue;
+        }
+        start(pending);
+    }
+    if (next_retry != Clock::time_point::max())
+    {
+        retry_timer_.start(int(chrono::duration_cast<chrono::milliseconds>(
+                                   next_retry - now).count()) + 1);
+    }
+}
+
+void WriteBackQueue::start(Pending& pending)
+{
+    Entry const& entry = pending.entry;
+    Context const& ctx = contexts_.at(entry.account);
+    auto const session = provider_.session(ctx);
+
+    auto request = make_upload_request(
+        *session, entry.item_id, entry.size, entry.content_type,
+        entry.allow_overwrite, entry.old_etag);
+    DavProvider::set_request_priority(
+        request, RequestScheduler::Priority::background);
+
+    auto data = open_data(entry).release();
+    if (!data)
+    {
+        fail(pending, QStringLiteral("could not read staged data"));
+        return;
+    }
+    pending.reply.reset(provider_.send_request(
+        request, QByteArrayLiteral("PUT"), data, ctx));
+    data->setParent(pending.reply.get());
+    in_flight_++;
+    string const id = entry.id;
+    connect(pending.reply.get(), &QNetworkReply::finished,
+            this, [this, id] { on_upload_finished(id); });
+}
+
+void WriteBackQueue::on_upload_finished(string const& id)
+{
+    auto it = pending_.begin();
+    while (it != pending_.end() && it->second.entry.id != id)
+    {
+        ++it;
+    }
+    if (it == pending_.end() || !it->second.reply)
+    {
+        return;
+    }
+    Pending& pending = it->second;
+    Entry& entry = pending.entry;
+    QNetworkReply* reply = pending.reply.release();
+    reply->deleteLater();
+    in_flight_--;
+
+    auto const session = provider_.session(contexts_.at(entry.account));
+    provider_.invalidate_cache(session->base_url(), entry.item_id);
+    QString const item_id = QString::fromStdString(entry.item_id);
+    auto const status = reply->attribute(
+        QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status / 100 == 2)
+    {
+        Completed& completed = completed_[entry.account + '\n' + entry.item_id];
+        completed.provisional_etag = entry.provisional_etag;
+        completed.etag = upload_etag(reply).toStdString();
+        completed.completed = QDateTime::currentMSecsSinceEpoch();
+        if (completed_.size() > MAX_COMPLETED)
+        {
+            completed_.erase(min_element(
+                completed_.begin(), completed_.end(),
+                [](pair<string const, Completed> const& a,
+                   pair<string const, Completed> const& b) {
+                    return a.second.completed < b.second.completed;
+                }));
+        }
+        remove(id);
+        pending_.erase(it);
+    }
+    else if (is_transient_error(reply))
+    {
+        int const delay = min<int64_t>(
+            MAX_RETRY_DELAY_MS, int64_t(RETRY_DELAY_MS) << min(entry.attempts, 16));
+        entry.attempts++;
+        qWarning() << "Upload of" << item_id << "failed:" << reply->errorString()
+                   << "- retrying in" << delay << "ms";
+        pending.next_attempt = Clock::now() + chrono::milliseconds(delay);
+        save(entry);
+    }
+    else
+    {
+        fail(pending, reply->errorString());
+    }
+    schedule();
+}
+
+void WriteBackQueue::fail(Pending& pending, QString const& reason)
+{
+    Entry& entry = pending.entry;
+    entry.failed = true;
+    entry.failed_at = QDateTime::currentMSecsSinceEpoch();
+    save(entry);
+    // The client was told the upload succeeded, so this is the only
+    // record of the lost change.  The entry is pruned on the next
+    // pass through the queue, as the caller may still be iterating
+    // over it.
+    qCritical() << "Staged upload of" << QString::fromStdString(entry.item_id)
+                << "for" << QString::fromStdString(entry.account)
+                << "was rejected:" << reason << "- its data is kept in"
+                << data_path(entry.id) << "until"
+                << QDateTime::fromMSecsSinceEpoch(
+                       entry.failed_at + chrono::duration_cast<chrono::milliseconds>(
+                           failed_ttl_).count()).toString(Qt::ISODate);
+}
+
+void WriteBackQueue::prune_failed()
+{
+    vector<PendingMap::iterator> failed;
+    for (auto it = pending_.begin(); it != pending_.end(); ++it)
+    {
+        if (it->second.entry.failed)
+        {
+            failed.push_back(it);
+        }
+    }
+    // Keep the most recent failures, up to the limit.
+    sort(failed.begin(), failed.end(),
+         [](PendingMap::iterator const& a, PendingMap::iterator const& b) {
+             return a->second.entry.failed_at > b->second.entry.failed_at;
+         });
+    int64_t const expiry = QDateTime::currentMSecsSinceEpoch() -
+        chrono::duration_cast<chrono::milliseconds>(failed_ttl_).count();
+    int kept = 0;
+    for (auto const& it : failed)
+    {
+        Entry const& entry = it->second.entry;
+        if (kept < max_failed_ && entry.failed_at > expiry)
+        {
+            kept++;
+            continue;
+        }
+        qWarning() << "Discarding failed upload of"
+                   << QString::fromStdString(entry.item_id);
+        remove(entry.id);
+        pending_.erase(it);
+    }
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <unity/storage/provider/ProviderBase.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class DavProvider;
+class DavSession;
+class QFile;
+class QNetworkReply;
+
+// Uploads staged on local disk, sent to the server in the background.
+//
+// Each staged upload is recorded in a journal directory as a data
+// file plus a JSON record, written and synced before the upload is
+// acknowledged, so pending uploads survive a restart of the provider.
+// Uploads are sent in the order they were staged, with at most one
+// in flight per item, and retried with exponential backoff after a
+// transient failure.
+//
+// An upload the server rejects outright has already been acknowledged
+// to the client, and the file reverts to the server's version.  The
+// failure is logged as critical, naming the data file, which is kept
+// in the journal for recovery by hand until it expires or is pushed
+// out by newer failures.
+//
+// Uploads need credentials, which are not stored: those recovered
+// from the journal wait until the account makes its next request.
+class WriteBackQueue : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry
+    {
+        std::string id;
+        std::string account;
+        std::string item_id;
+        std::string content_type;
+        bool allow_overwrite = false;
+        // Sent with If-Match, if not empty.
+        std::string old_etag;
+        int64_t size = 0;
+        // Modification time of the provisional item, in seconds since
+        // the epoch.  The server sets its own once the upload arrives.
+        int64_t mtime = 0;
+        // The ETag of the provisional item handed to the client.
+        std::string provisional_etag;
+        // For ordering, in milliseconds since the epoch.
+        int64_t created = 0;
+        int attempts = 0;
+        bool failed = false;
+        // When the upload failed, in milliseconds since the epoch.
+        int64_t failed_at = 0;
+    };
+
+    WriteBackQueue(DavProvider& provider, QString const& directory,
+                   bool enabled, int max_parallel, int max_failed,
+                   std::chrono::seconds failed_ttl);
+    ~WriteBackQueue();
+
+    // A directory under $XDG_DATA_HOME.
+    static QString default_directory();
+
+    bool enabled() const;
+    QString const& directory() const;
+
+    // Create the file an upload's data is staged in, filling in the
+    // entry's ID.
+    std::unique_ptr<QFile> create_data_file(Entry& entry);
+    // Record a staged upload in the journal, and queue it.  The data
+    // file must have been closed.
+    bool add(Entry entry, unity::storage::provider::Context const& ctx);
+    // Remove the data file of an upload that wasn't added.
+    void discard(std::string const& id);
+
+    // Provide the credentials to upload an account's files with.
+    void set_context(std::string const& account,
+                     unity::storage::provider::Context const& ctx);
+
+    // The most recently staged upload of an item that hasn't reached
+    // the server yet.
+    bool find(std::string const& account, std::string const& item_id,
+              Entry& entry) const;
+    std::vector<Entry> entries() const;
+    // The item the client sees until the upload completes.
+    unity::storage::provider::Item provisional_item(
+        Entry const& entry, DavSession const& session) const;
+    // The ETag to check a client's ETag for the item against.  The
+    // provisional ETag of the last upload of the item to reach the
+    // server stands for the ETag the server gave it, or for any ETag
+    // if the server didn't report one.  Other ETags are unchanged.
+    std::string resolve_etag(std::string const& account,
+                             std::string const& item_id,
+                             std::string const& etag) const;
+    // The staged data, which stays readable while open even if the
+    // upload completes in the mean time.
+    std::unique_ptr<QFile> open_data(Entry const& entry) const;
+
+    // Whether an upload of the item, or of anything in the folder,
+    // has yet to reach the server.
+    bool busy(std::string const& account, std::string const& item_id) const;
+    // Drop the uploads of the item, or of anything in the folder,
+    // aborting any under way.  Returns whether there were any.
+    bool cancel(std::string const& account, std::string const& item_id);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending
+    {
+        Entry entry;
+        Clock::time_point next_attempt;
+        std::unique_ptr<QNetworkReply> reply;
+    };
+    // Keyed by creation time and ID, so iteration follows the order
+    // uploads were staged in.
+    typedef std::map<std::pair<int64_t, std::string>, Pending> PendingMap;
+
+    struct Completed
+    {
+        std::string provisional_etag;
+        std::string etag;
+        int64_t completed = 0;
+    };
+
+    QString data_path(std::string const& id) const;
+    QString record_path(std::string const& id) const;
+    void load();
+    bool save(Entry const& entry) const;
+    void remove(std::string const& id);
+    void schedule();
+    void schedule_later();
+    void fail(Pending& pending, QString const& reason);
+    void prune_failed();
+    void start(Pending& pending);
+    void on_upload_finished(std::string const& id);
+
+    DavProvider& provider_;
+    QString const directory_;
+    bool const enabled_;
+    int const max_parallel_;
+    int const max_failed_;
+    std::chrono::seconds const failed_ttl_;
+    PendingMap pending_;
+    // The last staged upload of each item to reach the server, keyed
+    // by account and item ID, so clients can go on using the
+    // provisional ETag they were given.
+    std::map<std::string, Completed> completed_;
+    std::map<std::string, unity::storage::provider::Context> contexts_;
+    int in_flight_ = 0;
+    bool schedule_pending_ = false;
+    QTimer retry_timer_;
+};
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "dav_properties.h"
+
+#include <unity/storage/common.h>
+
+#include <map>
+
+using namespace std;
+using namespace unity::storage::metadata;
+
+namespace
+{
+
+struct PropertyName
+{
+    PropertySet property;
+    char const* element;
+};
+
+PropertyName const PROPERTY_NAMES[] = {
+    {dav_property::getetag, "D:getetag"},
+    {dav_property::resourcetype, "D:resourcetype"},
+    {dav_property::getcontentlength, "D:getcontentlength"},
+    {dav_property::creationdate, "D:creationdate"},
+    {dav_property::getlastmodified, "D:getlastmodified"},
+    {dav_property::quota_available_bytes, "D:quota-available-bytes"},
+    {dav_property::quota_used_bytes, "D:quota-used-bytes"},
+    {dav_property::oc_size, "oc:size"},
+    {dav_property::oc_fileid, "oc:fileid"},
+    {dav_property::oc_checksums, "oc:checksums"},
+};
+
+struct KeyProperties
+{
+    char const* key;
+    PropertySet properties;
+};
+
+KeyProperties const KEY_PROPERTIES[] = {
+    {SIZE_IN_BYTES, dav_property::getcontentlength},
+    {CREATION_TIME, dav_property::creationdate},
+    {LAST_MODIFIED_TIME, dav_property::getlastmodified},
+    {FREE_SPACE_BYTES, dav_property::quota_available_bytes},
+    {USED_SPACE_BYTES, dav_property::quota_used_bytes},
+    {"oc:size", dav_property::oc_size},
+    {"oc:fileid", dav_property::oc_fileid},
+    {"oc:checksums", dav_property::oc_checksums},
+};
+
+// The storage framework's wildcard metadata key.
+char const ALL_KEYS[] = "__ALL__";
+
+QByteArray make_propfind_body(PropertySet properties)
+{
+    QByteArray body = QByteArrayLiteral(
+        "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+        "<D:propfind xmlns:D=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n");
+    body += prop_element(properties);
+    body += QByteArrayLiteral("</D:propfind>");
+    return body;
+}
+
+}
+
+PropertySet properties_for_keys(vector<string> const& metadata_keys)
+{
+    if (metadata_keys.empty())
+    {
+        return dav_property::standard;
+    }
+    PropertySet properties = dav_property::required;
+    for (auto const& key : metadata_keys)
+    {
+        if (key == ALL_KEYS)
+        {
+            return dav_property::all;
+        }
+        for (auto const& entry : KEY_PROPERTIES)
+        {
+            if (key == entry.key)
+            {
+                properties |= entry.properties;
+                break;
+            }
+        }
+    }
+    return properties;
+}
+
+QByteArray const& propfind_body(PropertySet properties)
+{
+    // Bodies for the sets every client uses are built up front, and
+    // others on first use.  Like the rest of the provider, this is
+    // only called from the event loop thread.
+    static map<PropertySet,QByteArray> bodies = [] {
+        map<PropertySet,QByteArray> bodies;
+        for (auto set : {dav_property::required, dav_property::standard,
+                    dav_property::all})
+        {
+            bodies.emplace(set, make_propfind_body(set));
+        }
+        return bodies;
+    }();
+
+    auto it = bodies.find(properties);
+    if (it == bodies.end())
+    {
+        it = bodies.emplace(properties, make_propfind_body(properties)).first;
+    }
+    return it->second;
+}
+
+QByteArray prop_element(PropertySet properties)
+{
+    QByteArray prop = QByteArrayLiteral("  <D:prop>\n");
+    for (auto const& name : PROPERTY_NAMES)
+    {
+        if (properties & name.property)
+        {
+            prop += "    <";
+            prop += name.element;
+            prop += "/>\n";
+        }
+    }
+    prop += QByteArrayLiteral("  </D:prop>\n");
+    return prop;
+}
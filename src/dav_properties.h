@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A set of WebDAV properties to request from the server, as bit
+// flags.  Cached items remember the set they were retrieved with, so
+// they are only reused for requests the set covers.
+typedef uint32_t PropertySet;
+
+namespace dav_property
+{
+constexpr PropertySet resourcetype = 1 << 0;
+constexpr PropertySet getetag = 1 << 1;
+constexpr PropertySet getcontentlength = 1 << 2;
+constexpr PropertySet creationdate = 1 << 3;
+constexpr PropertySet getlastmodified = 1 << 4;
+constexpr PropertySet quota_available_bytes = 1 << 5;
+constexpr PropertySet quota_used_bytes = 1 << 6;
+constexpr PropertySet oc_size = 1 << 7;
+constexpr PropertySet oc_fileid = 1 << 8;
+constexpr PropertySet oc_checksums = 1 << 9;
+
+// Every item needs its type and ETag.
+constexpr PropertySet required = resourcetype | getetag;
+// Used when the client doesn't ask for any metadata keys.
+constexpr PropertySet standard = required | getcontentlength |
+    creationdate | getlastmodified;
+constexpr PropertySet all = (1 << 10) - 1;
+}
+
+// The properties needed to fill in the given metadata keys.  Besides
+// the storage framework's standard keys, "oc:size", "oc:fileid" and
+// "oc:checksums" request the ownCloud properties of the same name.
+PropertySet properties_for_keys(std::vector<std::string> const& metadata_keys);
+
+// True if every property in wanted is in available.
+inline bool covers(PropertySet available, PropertySet wanted)
+{
+    return (available & wanted) == wanted;
+}
+
+// A PROPFIND request body asking for the given properties.
+QByteArray const& propfind_body(PropertySet properties);
+// The <D:prop> element naming the given properties, for use in other
+// request bodies.  The "D" and "oc" namespace prefixes must be bound.
+QByteArray prop_element(PropertySet properties);
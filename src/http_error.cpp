@@ -179,3 +179,22 @@ boost::exception_ptr translate_http_error(QNetworkReply *reply,
     return boost::copy_exception(
         UnknownException("HTTP " + to_string(status) + ": " + message));
 }
+
+bool is_transient_error(QNetworkReply* reply)
+{
+    switch (reply->error())
+    {
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyConnectionClosedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+        return true;
+    default:
+        break;
+    }
+    auto status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return status / 100 == 5;
+}
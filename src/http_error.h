@@ -28,3 +28,7 @@ static constexpr int MAX_ERROR_BODY_LENGTH = 64 * 1024;
 boost::exception_ptr translate_http_error(QNetworkReply *reply,
                                           QByteArray const& body,
                                           std::string const& item_id={});
+
+// Whether a failed request might succeed if retried: a dropped
+// connection, a timeout or a 5xx server error.
+bool is_transient_error(QNetworkReply *reply);
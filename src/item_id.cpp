@@ -25,7 +25,23 @@ using namespace unity::storage::provider;
 
 static const auto URL_FORMAT = QUrl::FullyEncoded | QUrl::NormalizePathSegments;
 
+QByteArray encode_base_url(QUrl const& base_url)
+{
+    return base_url.toEncoded(URL_FORMAT);
+}
+
 QUrl id_to_url(string const& item_id, QUrl const& base_url)
+{
+    return id_to_url(item_id, base_url, encode_base_url(base_url));
+}
+
+string url_to_id(QUrl const& item_url, QUrl const& base_url)
+{
+    return url_to_id(item_url, encode_base_url(base_url));
+}
+
+QUrl id_to_url(string const& item_id, QUrl const& base_url,
+               QByteArray const& encoded_base_url)
 {
     QUrl item_url(QString::fromStdString(item_id), QUrl::StrictMode);
     if (!item_url.isValid())
@@ -35,9 +51,8 @@ QUrl id_to_url(string const& item_id, QUrl const& base_url)
 
     item_url = base_url.resolved(item_url);
 
-    QByteArray base_url_bytes = base_url.toEncoded(URL_FORMAT);
     QByteArray item_url_bytes = item_url.toEncoded(URL_FORMAT);
-    if (!item_url_bytes.startsWith(base_url_bytes))
+    if (!item_url_bytes.startsWith(encoded_base_url))
     {
         throw InvalidArgumentException("Invalid item ID: " + item_id);
     }
@@ -45,16 +60,15 @@ QUrl id_to_url(string const& item_id, QUrl const& base_url)
     return item_url;
 }
 
-string url_to_id(QUrl const& item_url, QUrl const& base_url)
+string url_to_id(QUrl const& item_url, QByteArray const& encoded_base_url)
 {
-    QByteArray base_url_bytes = base_url.toEncoded(URL_FORMAT);
     QByteArray item_url_bytes = item_url.toEncoded(URL_FORMAT);
-    if (!item_url_bytes.startsWith(base_url_bytes))
+    if (!item_url_bytes.startsWith(encoded_base_url))
     {
         throw RemoteCommsException("Url is outside of base URL: " + item_url_bytes.toStdString());
     }
 
-    string item_id(item_url_bytes.begin() + base_url_bytes.size(),
+    string item_id(item_url_bytes.begin() + encoded_base_url.size(),
                    item_url_bytes.end());
     if (item_id.empty())
     {
@@ -90,6 +104,25 @@ string make_child_id(string const& parent_id, string const& name, bool is_folder
     return item_id;
 }
 
+string parent_id(string const& item_id)
+{
+    if (item_id == ".")
+    {
+        return string();
+    }
+    auto end = item_id.size();
+    if (end > 0 && item_id[end-1] == '/')
+    {
+        end--;
+    }
+    auto pos = item_id.rfind('/', end == 0 ? 0 : end-1);
+    if (pos == string::npos || end == 0)
+    {
+        return ".";
+    }
+    return item_id.substr(0, pos+1);
+}
+
 bool is_folder(string const& item_id)
 {
     auto size = item_id.size();
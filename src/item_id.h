@@ -25,7 +25,19 @@
 QUrl id_to_url(std::string const& item_id, QUrl const& base_url);
 std::string url_to_id(QUrl const& item_url, QUrl const& base_url);
 
+// The form of the base URL that item URLs are compared against.
+// Callers converting many IDs against the same base URL can encode it
+// once and use the overloads below.
+QByteArray encode_base_url(QUrl const& base_url);
+QUrl id_to_url(std::string const& item_id, QUrl const& base_url,
+               QByteArray const& encoded_base_url);
+std::string url_to_id(QUrl const& item_url,
+                      QByteArray const& encoded_base_url);
+
 std::string make_child_id(std::string const& parent_id, std::string const& name,
                           bool is_folder=false);
+// Return the ID of the folder containing the given item, or an empty
+// string for the root.
+std::string parent_id(std::string const& item_id);
 
 bool is_folder(std::string const& item_id);
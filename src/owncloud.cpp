@@ -19,6 +19,7 @@
 #include <unity/storage/provider/Server.h>
 
 #include "NextcloudProvider.h"
+#include "StatsInterface.h"
 
 using namespace std;
 using namespace unity::storage::provider;
@@ -28,6 +29,7 @@ int main(int argc, char **argv)
     string const bus_name = "com.canonical.StorageFramework.Provider.OwnCloud";
     string const account_service_id = "storage-provider-owncloud";
 
+    StatsInterface::set_bus_name(bus_name + ".Stats");
     Server<NextcloudProvider> server(bus_name, account_service_id);
     server.init(argc, argv);
     server.run();
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "settings.h"
+
+#include <QByteArray>
+#include <QDebug>
+
+#include <cstdlib>
+
+int64_t get_setting(char const* name, int64_t default_value)
+{
+    char const* value = getenv(name);
+    if (value == nullptr || value[0] == '\0')
+    {
+        return default_value;
+    }
+    bool ok = false;
+    int64_t result = QByteArray(value).toLongLong(&ok);
+    if (!ok)
+    {
+        qWarning() << "Ignoring invalid value for" << name << ":" << value;
+        return default_value;
+    }
+    return result;
+}
+
+bool get_setting_flag(char const* name, bool default_value)
+{
+    return get_setting(name, default_value ? 1 : 0) != 0;
+}
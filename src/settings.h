@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2016 Canonical Ltd.
+ * Copyright (C) 2017 Canonical Ltd.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 3 as
@@ -18,25 +18,9 @@
 
 #pragma once
 
-#include <QObject>
+#include <cstdint>
 
-#include <memory>
-
-#include "PropFindHandler.h"
-
-class LookupHandler : public PropFindHandler {
-    Q_OBJECT
-public:
-    LookupHandler(std::shared_ptr<DavProvider> const& provider,
-                  std::string const& item_id,
-                  unity::storage::provider::Context const& ctx);
-    ~LookupHandler();
-
-    boost::future<unity::storage::provider::ItemList> get_future();
-
-private:
-    boost::promise<unity::storage::provider::ItemList> promise_;
-
-protected:
-    void finish() override;
-};
+// Tunables are read from the environment, so they can be set in the
+// systemd unit or D-Bus activation file for the provider.
+int64_t get_setting(char const* name, int64_t default_value);
+bool get_setting_flag(char const* name, bool default_value);
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+// Throughput benchmark for the buffering between a download's network
+// reply and the client's socket.
+//
+// A stand-in reply produces data at a fixed rate, but like a reply
+// limited with setReadBufferSize() it stops when its buffer is full.
+// The client reads a block at a time, pausing between blocks as if
+// handing each one on.  The data DownloadSink can queue while the
+// client is paused decides whether the reply keeps streaming.  One
+// JSON object is printed per buffer size, plus one for adaptive
+// sizing, e.g.:
+//
+//   download_bench --rate 200 --client-block 1024 --client-delay 10
+
+#include "../../src/DownloadSink.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+// Matches the read buffer size DavDownloadJob sets on its replies.
+constexpr int64_t READ_BUFFER_SIZE = 64 * 1024;
+
+class ThrottledSource : public QIODevice
+{
+public:
+    ThrottledSource(int64_t size, double bytes_per_ms)
+        : size_(size), bytes_per_ms_(bytes_per_ms)
+    {
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+        timer_.setTimerType(Qt::PreciseTimer);
+        timer_.setInterval(1);
+        connect(&timer_, &QTimer::timeout, this, &ThrottledSource::onTick);
+        clock_.start();
+        timer_.start();
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const override
+    {
+        return available_ + QIODevice::bytesAvailable();
+    }
+
+    bool finished() const
+    {
+        return produced_ == size_ && available_ == 0;
+    }
+
+protected:
+    qint64 readData(char* data, qint64 max_size) override
+    {
+        qint64 const n = min<qint64>(max_size, available_);
+        memset(data, 'x', n);
+        available_ -= n;
+        return n;
+    }
+
+    qint64 writeData(char const*, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    void onTick()
+    {
+        double const now = clock_.nsecsElapsed() / 1e6;
+        // Data that doesn't fit in the buffer is never sent: the
+        // server is held up by flow control instead.
+        int64_t const credit = (now - last_tick_) * bytes_per_ms_;
+        last_tick_ = now;
+        int64_t const n = min(min(credit, READ_BUFFER_SIZE - available_),
+                              size_ - produced_);
+        if (n <= 0)
+        {
+            return;
+        }
+        available_ += n;
+        produced_ += n;
+        Q_EMIT readyRead();
+    }
+
+    int64_t const size_;
+    double const bytes_per_ms_;
+    QTimer timer_;
+    QElapsedTimer clock_;
+    double last_tick_ = 0;
+    int64_t available_ = 0;
+    int64_t produced_ = 0;
+};
+
+struct RunResult
+{
+    double seconds;
+    int64_t final_buffer;
+};
+
+RunResult run(int64_t size, double rate, int64_t buffer, int64_t max_buffer,
+              int64_t client_block, chrono::milliseconds client_delay)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+
+    atomic<bool> client_done(false);
+    thread client([&] {
+            vector<char> data(client_block);
+            int64_t received = 0;
+            int64_t block = 0;
+            for (;;)
+            {
+                ssize_t const n = read(fds[0], data.data(),
+                                       min<int64_t>(data.size(),
+                                                    client_block - block));
+                if (n <= 0)
+                {
+                    break;
+                }
+                received += n;
+                block += n;
+                if (block == client_block)
+                {
+                    block = 0;
+                    this_thread::sleep_for(client_delay);
+                }
+            }
+            if (received != size)
+            {
+                fprintf(stderr, "Client received %lld of %lld bytes\n",
+                        (long long)received, (long long)size);
+            }
+            close(fds[0]);
+            client_done = true;
+        });
+
+    QElapsedTimer timer;
+    timer.start();
+    ThrottledSource source(size, rate * 1e6 / 1e3);
+    DownloadSink sink(fds[1], buffer, buffer / 2);
+    sink.setMaxCapacity(max_buffer);
+
+    // The same loop as DavDownloadJob::maybe_send_chunk().
+    auto pump = [&] {
+        for (;;)
+        {
+            int64_t const n_read = sink.fill(&source);
+            int64_t const pending = sink.pending();
+            if (n_read < 0 || !sink.flush())
+            {
+                fprintf(stderr, "Error: %s\n", qPrintable(sink.errorString()));
+                exit(1);
+            }
+            if (sink.pending() == pending && (n_read == 0 || !sink.hasRoom()))
+            {
+                break;
+            }
+        }
+        if (source.finished() && sink.pending() == 0)
+        {
+            sink.close();
+        }
+    };
+    QObject::connect(&source, &QIODevice::readyRead, pump);
+    QObject::connect(&sink, &DownloadSink::writable, pump);
+
+    while (!client_done)
+    {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    client.join();
+    return {timer.nsecsElapsed() / 1e9, sink.highWatermark()};
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser options;
+    options.setApplicationDescription(
+        "Benchmark download throughput against the socket buffer size");
+    options.addHelpOption();
+    options.addOption({"size", "Data downloaded per run, in MiB", "mib", "128"});
+    options.addOption({"rate", "Rate the server sends at, in MB/s", "mbps",
+                "200"});
+    options.addOption({"client-block",
+                "Data the client reads before pausing, in KiB", "kib", "1024"});
+    options.addOption({"client-delay",
+                "Client's pause after each block, in milliseconds", "ms", "5"});
+    options.addOption({"buffer-sizes",
+                "Comma separated list of buffer sizes to try, in KiB", "kib",
+                "64,128,256,512,1024,2048,4096"});
+    options.addOption({"adaptive-max",
+                "Memory cap for the adaptive run, in KiB (0 to skip it)",
+                "kib", "4096"});
+    options.process(app);
+
+    int64_t const size = max(1, options.value("size").toInt()) * 1024 * 1024LL;
+    double const rate = max(1.0, options.value("rate").toDouble());
+    int64_t const client_block =
+        max(1, options.value("client-block").toInt()) * 1024LL;
+    chrono::milliseconds const client_delay(
+        max(0, options.value("client-delay").toInt()));
+
+    struct Config
+    {
+        int64_t buffer;
+        int64_t max_buffer;
+    };
+    vector<Config> configs;
+    for (auto const& kib : options.value("buffer-sizes").split(','))
+    {
+        int64_t const buffer = kib.toInt() * 1024LL;
+        configs.push_back({buffer, buffer});
+    }
+    int64_t const adaptive_max = options.value("adaptive-max").toInt() * 1024LL;
+    if (adaptive_max > 0)
+    {
+        configs.push_back({2 * DownloadSink::BUFFER_SIZE, adaptive_max});
+    }
+
+    QTextStream out(stdout);
+    for (auto const& config : configs)
+    {
+        RunResult const r = run(size, rate, config.buffer, config.max_buffer,
+                                client_block, client_delay);
+        QJsonObject record{
+            {"benchmark", "download_buffer"},
+            {"buffer_kb", double(config.buffer / 1024)},
+            {"adaptive", config.max_buffer > config.buffer},
+            {"final_buffer_kb", double(r.final_buffer / 1024)},
+            {"seconds", r.seconds},
+            {"mb_per_second", size / r.seconds / 1e6},
+        };
+        out << QJsonDocument(record).toJson(QJsonDocument::Compact) << endl;
+    }
+    return 0;
+}
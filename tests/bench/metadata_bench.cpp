@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+// Latency benchmark for concurrent DavProvider::metadata() calls.
+//
+// A batch of small files is created on the server, then metadata()
+// is called for all of them at once with a freshly created provider,
+// so every call needs its own PROPFIND.  The batch is repeated for
+// each protocol, allowing HTTP/1.1 (limited to six connections per
+// host) to be compared with HTTP/2 (multiplexed over one).  One JSON
+// object is printed per run, e.g.:
+//
+//   tests/bench/tls-standin.sh /tmp/davroot 8443 &
+//   metadata_bench --url https://127.0.0.1:8443/ --insecure
+//
+// Qt only negotiates HTTP/2 over TLS, hence the stand-in server.
+
+#include "../../src/DavProvider.h"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSslError>
+#include <QTextStream>
+#include <QUrl>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+char const BENCH_FOLDER[] = "metadata-bench/";
+
+class BenchProvider : public DavProvider
+{
+public:
+    BenchProvider(QUrl const& base_url, bool insecure)
+        : base_url_(base_url)
+    {
+        if (insecure)
+        {
+            QObject::connect(
+                network_.get(), &QNetworkAccessManager::sslErrors,
+                [](QNetworkReply* reply, QList<QSslError> const&) {
+                    reply->ignoreSslErrors();
+                });
+        }
+    }
+
+protected:
+    shared_ptr<DavSession> make_session(Context const& ctx) const override
+    {
+        QByteArray authorization;
+        if (auto creds = boost::get<PasswordCredentials>(&ctx.credentials))
+        {
+            authorization = QByteArrayLiteral("Basic ") + QByteArray::fromStdString(
+                creds->username + ":" + creds->password).toBase64();
+        }
+        return make_shared<DavSession>(base_url_, QUrl(), authorization);
+    }
+
+private:
+    QUrl const base_url_;
+};
+
+string item_id(int i)
+{
+    return BENCH_FOLDER + to_string(i) + ".txt";
+}
+
+// Send a request through the provider and wait for it to finish.
+bool send_and_wait(DavProvider& provider, Context const& ctx,
+                   QByteArray const& verb, string const& id,
+                   QByteArray const& body = QByteArray())
+{
+    auto session = provider.session(ctx);
+    QNetworkRequest request(session->id_to_url(id));
+    QBuffer data;
+    data.setData(body);
+    data.open(QIODevice::ReadOnly);
+    unique_ptr<QNetworkReply> reply(
+        provider.send_request(request, verb, &data, ctx));
+    QEventLoop loop;
+    QObject::connect(reply.get(), &QNetworkReply::finished,
+                     &loop, &QEventLoop::quit);
+    loop.exec();
+    int const status = reply->attribute(
+        QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return status >= 200 && status < 300;
+}
+
+double percentile(vector<double> const& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[min(index, sorted.size() - 1)];
+}
+
+struct RunResult
+{
+    double seconds;
+    vector<double> latencies_ms;
+    int errors;
+    QString protocol;
+};
+
+RunResult run(QUrl const& url, bool insecure, bool http2, int calls,
+              Context const& ctx)
+{
+    qputenv("DAV_HTTP2", http2 ? "1" : "0");
+    auto provider = make_shared<BenchProvider>(url, insecure);
+
+    vector<boost::future<Item>> futures;
+    vector<bool> done(calls, false);
+    RunResult result{0, {}, 0, QString()};
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < calls; i++)
+    {
+        futures.emplace_back(provider->metadata(item_id(i), {}, ctx));
+    }
+    int remaining = calls;
+    while (remaining > 0)
+    {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        double const now = timer.nsecsElapsed() / 1e6;
+        for (int i = 0; i < calls; i++)
+        {
+            if (done[i] || !futures[i].is_ready())
+            {
+                continue;
+            }
+            done[i] = true;
+            remaining--;
+            result.latencies_ms.push_back(now);
+            if (futures[i].has_exception())
+            {
+                result.errors++;
+            }
+        }
+    }
+    result.seconds = timer.nsecsElapsed() / 1e9;
+    result.protocol = provider->session(ctx)->protocol();
+    sort(result.latencies_ms.begin(), result.latencies_ms.end());
+    return result;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser options;
+    options.setApplicationDescription(
+        "Benchmark concurrent metadata() calls over HTTP/1.1 and HTTP/2");
+    options.addHelpOption();
+    options.addOption({"url", "WebDAV base URL of the server", "url",
+                "https://127.0.0.1:8443/"});
+    options.addOption({"user", "User name", "name", "username"});
+    options.addOption({"password", "Password", "password", "password"});
+    options.addOption({"calls", "Concurrent metadata() calls", "n", "200"});
+    options.addOption({"protocols",
+                "Comma separated list of protocols to allow (http1, http2)",
+                "protocols", "http1,http2"});
+    options.addOption({"iterations",
+                "Runs per protocol; the fastest is reported", "n", "3"});
+    options.addOption({"insecure", "Accept self-signed certificates"});
+    options.process(app);
+
+    QUrl const url(options.value("url"));
+    bool const insecure = options.isSet("insecure");
+    int const calls = max(1, options.value("calls").toInt());
+    int const iterations = max(1, options.value("iterations").toInt());
+
+    PasswordCredentials credentials;
+    credentials.username = options.value("user").toStdString();
+    credentials.password = options.value("password").toStdString();
+    credentials.host = url.toString().toStdString();
+    Context ctx;
+    ctx.uid = 0;
+    ctx.pid = 0;
+    ctx.credentials = credentials;
+
+    // Create the files to look up.
+    {
+        qputenv("DAV_HTTP2", "0");
+        BenchProvider setup(url, insecure);
+        send_and_wait(setup, ctx, "MKCOL", BENCH_FOLDER);
+        for (int i = 0; i < calls; i++)
+        {
+            if (!send_and_wait(setup, ctx, "PUT", item_id(i), "x"))
+            {
+                fprintf(stderr, "Could not create %s\n", item_id(i).c_str());
+                return 1;
+            }
+        }
+    }
+
+    QTextStream out(stdout);
+    int status = 0;
+    for (auto const& protocol : options.value("protocols").split(','))
+    {
+        if (protocol != "http1" && protocol != "http2")
+        {
+            fprintf(stderr, "Unknown protocol: %s\n", qPrintable(protocol));
+            return 1;
+        }
+        RunResult best{0, {}, 0, QString()};
+        for (int i = 0; i < iterations; i++)
+        {
+            RunResult r = run(url, insecure, protocol == "http2", calls, ctx);
+            if (i == 0 || r.seconds < best.seconds)
+            {
+                best = move(r);
+            }
+        }
+        if (best.errors != 0)
+        {
+            fprintf(stderr, "%s: %d of %d calls failed\n",
+                    qPrintable(protocol), best.errors, calls);
+            status = 1;
+        }
+
+        QJsonObject record{
+            {"benchmark", "metadata"},
+            {"requested", protocol},
+            {"negotiated", best.protocol},
+            {"calls", calls},
+            {"errors", best.errors},
+            {"seconds", best.seconds},
+            {"p50_ms", percentile(best.latencies_ms, 0.50)},
+            {"p95_ms", percentile(best.latencies_ms, 0.95)},
+            {"p99_ms", percentile(best.latencies_ms, 0.99)},
+            {"max_ms", percentile(best.latencies_ms, 1.0)},
+        };
+        out << QJsonDocument(record).toJson(QJsonDocument::Compact) << endl;
+    }
+    return status;
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+// Microbenchmark for the Multi-Status parser and DavProvider::make_item.
+//
+// A synthetic PROPFIND response is generated for each combination of
+// response count and property mix, and fed to MultiStatusParser in
+// fixed size chunks to mimic data arriving from the network.  One
+// JSON object is printed per run so results can be compared between
+// releases, e.g.:
+//
+//   multistatus_bench --responses 1000,10000 --chunk-size 4096
+
+#include "../../src/DavProvider.h"
+#include "../../src/MultiStatusParser.h"
+
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QUrl>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace unity::storage::provider;
+
+namespace
+{
+
+char const BASE_URL[] = "http://bench.example.com/remote.php/webdav/";
+
+// A read-only device that exposes a document a chunk at a time, the
+// way a QNetworkReply does as data arrives.
+class ChunkedDevice : public QIODevice
+{
+public:
+    explicit ChunkedDevice(QByteArray const& data)
+        : data_(data)
+    {
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const override
+    {
+        return (available_ - pos_) + QIODevice::bytesAvailable();
+    }
+
+    // Make the next chunk readable.  Returns false once the whole
+    // document has been delivered.
+    bool deliver(int chunk_size)
+    {
+        if (available_ >= data_.size())
+        {
+            return false;
+        }
+        available_ = min(available_ + chunk_size, data_.size());
+        Q_EMIT readyRead();
+        return true;
+    }
+
+protected:
+    qint64 readData(char* data, qint64 maxlen) override
+    {
+        qint64 n = min<qint64>(maxlen, available_ - pos_);
+        memcpy(data, data_.constData() + pos_, n);
+        pos_ += n;
+        return n;
+    }
+
+    qint64 writeData(char const*, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    QByteArray const data_;
+    int available_ = 0;
+    int pos_ = 0;
+};
+
+class BenchProvider : public DavProvider
+{
+public:
+    QNetworkReply *send_request(QNetworkRequest&, QByteArray const&,
+                                QIODevice*, Context const&) const override
+    {
+        return nullptr;
+    }
+
+protected:
+    shared_ptr<DavSession> make_session(Context const&) const override
+    {
+        return make_shared<DavSession>(QUrl(BASE_URL), QUrl(), QByteArray());
+    }
+};
+
+void append_propstat(QByteArray& doc, int i, QString const& mix)
+{
+    bool const folder = (i % 10 == 0);
+    doc += "<d:propstat><d:prop>";
+    if (folder)
+    {
+        doc += "<d:resourcetype><d:collection/></d:resourcetype>";
+    }
+    else
+    {
+        doc += "<d:resourcetype/>";
+    }
+    doc += "<d:getetag>&quot;5a1f" + QByteArray::number(i, 16) + "e0c&quot;</d:getetag>";
+    if (mix != "minimal")
+    {
+        doc += "<d:getlastmodified>Tue, 14 Feb 2017 08:31:17 GMT</d:getlastmodified>";
+        if (!folder)
+        {
+            doc += "<d:getcontentlength>" + QByteArray::number(i * 137) + "</d:getcontentlength>";
+            doc += "<d:getcontenttype>text/plain</d:getcontenttype>";
+        }
+    }
+    if (mix == "nextcloud")
+    {
+        doc += "<oc:id>" + QByteArray::number(i).rightJustified(8, '0') + "ocnca</oc:id>";
+        doc += "<oc:fileid>" + QByteArray::number(i) + "</oc:fileid>";
+        doc += "<oc:permissions>RDNVW</oc:permissions>";
+        doc += "<oc:size>" + QByteArray::number(i * 137) + "</oc:size>";
+        doc += "<nc:has-preview>false</nc:has-preview>";
+    }
+    doc += "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat>";
+
+    if (mix == "nextcloud")
+    {
+        // Properties the server doesn't know about come back in a
+        // separate 404 propstat.
+        doc += "<d:propstat><d:prop><d:creationdate/><oc:checksums/>"
+            "</d:prop><d:status>HTTP/1.1 404 Not Found</d:status></d:propstat>";
+    }
+}
+
+QByteArray make_document(int responses, QString const& mix)
+{
+    QByteArray doc;
+    doc += "<?xml version=\"1.0\"?>\n"
+        "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\""
+        " xmlns:oc=\"http://owncloud.org/ns\""
+        " xmlns:nc=\"http://nextcloud.org/ns\">";
+    doc += "<d:response><d:href>/remote.php/webdav/folder/</d:href>";
+    append_propstat(doc, 0, mix);
+    doc += "</d:response>";
+    for (int i = 1; i < responses; i++)
+    {
+        doc += "<d:response><d:href>/remote.php/webdav/folder/";
+        if (i % 10 == 0)
+        {
+            doc += "subfolder%20" + QByteArray::number(i) + "/";
+        }
+        else
+        {
+            doc += "file%20" + QByteArray::number(i) + ".txt";
+        }
+        doc += "</d:href>";
+        append_propstat(doc, i, mix);
+        doc += "</d:response>";
+    }
+    doc += "</d:multistatus>\n";
+    return doc;
+}
+
+// Reset the peak RSS counter, so each run reports its own high water
+// mark rather than that of the largest run so far.
+void reset_peak_rss()
+{
+    QFile clear_refs("/proc/self/clear_refs");
+    if (clear_refs.open(QIODevice::WriteOnly))
+    {
+        clear_refs.write("5");
+    }
+}
+
+qint64 peak_rss_kb()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+    {
+        return -1;
+    }
+    for (QByteArray line = status.readLine(); !line.isEmpty();
+         line = status.readLine())
+    {
+        if (line.startsWith("VmHWM:"))
+        {
+            return line.mid(6).trimmed().split(' ')[0].toLongLong();
+        }
+    }
+    return -1;
+}
+
+struct RunResult
+{
+    double seconds;
+    int responses;
+    qint64 peak_rss_kb;
+    QString error;
+};
+
+RunResult run(QByteArray const& doc, MultiStatusParser::Engine engine,
+              int chunk_size, bool make_items, BenchProvider const& provider)
+{
+    QUrl const base_url(BASE_URL);
+    auto const session = provider.session(Context());
+    RunResult result{0, 0, -1, QString()};
+    vector<Item> items;
+
+    reset_peak_rss();
+    QElapsedTimer timer;
+    timer.start();
+    {
+        ChunkedDevice input(doc);
+        MultiStatusParser parser(base_url, &input, engine);
+        QObject::connect(
+            &parser, &MultiStatusParser::response,
+            [&](QUrl const& href, vector<MultiStatusProperty> const& properties, int) {
+                result.responses++;
+                if (make_items)
+                {
+                    items.emplace_back(
+                        provider.make_item(href, *session, properties));
+                }
+            });
+        QObject::connect(
+            &parser, &MultiStatusParser::finished,
+            [&]() {
+                result.error = parser.errorString();
+            });
+
+        parser.startParsing();
+        while (input.deliver(chunk_size))
+        {
+        }
+        Q_EMIT input.readChannelFinished();
+    }
+    result.seconds = timer.nsecsElapsed() / 1e9;
+    result.peak_rss_kb = peak_rss_kb();
+    return result;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser options;
+    options.setApplicationDescription(
+        "Benchmark Multi-Status parsing and item construction");
+    options.addHelpOption();
+    options.addOption({"responses",
+                "Comma separated list of response counts", "counts",
+                "1000,10000,100000"});
+    options.addOption({"properties",
+                "Comma separated list of property mixes (minimal, standard, nextcloud)",
+                "mixes", "minimal,standard,nextcloud"});
+    options.addOption({"engines",
+                "Comma separated list of parser engines (bytes, qxml)",
+                "engines", "bytes,qxml"});
+    options.addOption({"chunk-size",
+                "Bytes made available to the parser at a time", "bytes",
+                "16384"});
+    options.addOption({"iterations",
+                "Runs per configuration; the fastest is reported", "n", "3"});
+    options.addOption({"parse-only",
+                "Don't convert responses to items with make_item"});
+    options.process(app);
+
+    int const chunk_size = max(1, options.value("chunk-size").toInt());
+    int const iterations = max(1, options.value("iterations").toInt());
+    bool const make_items = !options.isSet("parse-only");
+
+    BenchProvider provider;
+    QTextStream out(stdout);
+    int status = 0;
+
+    for (auto const& mix : options.value("properties").split(','))
+    {
+        for (auto const& count : options.value("responses").split(','))
+        {
+            int const responses = count.toInt();
+            QByteArray const doc = make_document(responses, mix);
+
+            for (auto const& engine_name : options.value("engines").split(','))
+            {
+                MultiStatusParser::Engine engine;
+                if (engine_name == "bytes")
+                {
+                    engine = MultiStatusParser::Engine::bytes;
+                }
+                else if (engine_name == "qxml")
+                {
+                    engine = MultiStatusParser::Engine::qxml;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown engine: %s\n", qPrintable(engine_name));
+                    return 1;
+                }
+
+                RunResult best{0, 0, -1, QString()};
+                for (int i = 0; i < iterations; i++)
+                {
+                    RunResult r = run(doc, engine, chunk_size, make_items, provider);
+                    if (i == 0 || r.seconds < best.seconds)
+                    {
+                        best = r;
+                    }
+                }
+                if (!best.error.isEmpty() || best.responses != responses)
+                {
+                    fprintf(stderr, "%s/%s/%d: parse failed after %d responses: %s\n",
+                            qPrintable(engine_name), qPrintable(mix), responses,
+                            best.responses, qPrintable(best.error));
+                    status = 1;
+                }
+
+                QJsonObject record{
+                    {"benchmark", "multistatus"},
+                    {"engine", engine_name},
+                    {"properties", mix},
+                    {"responses", responses},
+                    {"make_item", make_items},
+                    {"chunk_size", chunk_size},
+                    {"bytes", doc.size()},
+                    {"seconds", best.seconds},
+                    {"mb_per_sec", doc.size() / best.seconds / 1e6},
+                    {"responses_per_sec", responses / best.seconds},
+                    {"peak_rss_kb", best.peak_rss_kb},
+                };
+                out << QJsonDocument(record).toJson(QJsonDocument::Compact) << endl;
+            }
+        }
+    }
+    return status;
+}
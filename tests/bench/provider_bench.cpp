@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+// End-to-end benchmark for DavProvider.
+//
+// The provider is exported on a private D-Bus session bus and driven
+// through the storage-framework client API, as an application would,
+// against LocalDavServer serving a scratch directory.  The scenarios
+// are:
+//
+//   list       list a folder of 50,000 entries
+//   metadata   1000 concurrent metadata lookups
+//   upload     500 1 MB uploads, then one 4 GB upload
+//   download   500 1 MB downloads, then one 4 GB download
+//   copy-move  concurrent copies of 200 files, then moves of the copies
+//
+// One JSON object is printed per measurement, giving latency
+// percentiles, throughput and the process's resident set size after
+// the measurement.  The server runs within the same process, so the
+// RSS figures include its memory use.  For example:
+//
+//   provider_bench --scenarios list,metadata --latency 20
+//
+// Files the scenarios start from are created directly on disk, and
+// are not included in the measurements.
+
+#include "../../src/DavProvider.h"
+#include <utils/LocalDavServer.h>
+#include <utils/ProviderEnvironment.h>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <unity/storage/qt/Account.h>
+#include <unity/storage/qt/Downloader.h>
+#include <unity/storage/qt/Item.h>
+#include <unity/storage/qt/ItemJob.h>
+#include <unity/storage/qt/ItemListJob.h>
+#include <unity/storage/qt/StorageError.h>
+#include <unity/storage/qt/Uploader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace unity::storage::qt;
+namespace provider = unity::storage::provider;
+
+namespace
+{
+
+// Data is written to uploads in blocks of this size, keeping at most
+// WRITE_AHEAD bytes queued on the socket.
+int const BLOCK_SIZE = 64 * 1024;
+int64_t const WRITE_AHEAD = 1024 * 1024;
+
+class BenchProvider : public DavProvider
+{
+public:
+    BenchProvider(QUrl const& base_url)
+        : base_url_(base_url)
+    {
+    }
+
+protected:
+    shared_ptr<DavSession> make_session(
+        provider::Context const& ctx) const override
+    {
+        Q_UNUSED(ctx);
+        auto const credentials = QByteArrayLiteral("username:password");
+        // LocalDavServer assembles chunked uploads anywhere.
+        return make_shared<DavSession>(
+            base_url_, base_url_,
+            QByteArrayLiteral("Basic ") + credentials.toBase64());
+    }
+
+private:
+    QUrl const base_url_;
+};
+
+double percentile(vector<double> const& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[min(index, sorted.size() - 1)];
+}
+
+// Read a field such as "VmRSS" from /proc/self/status, in kB.
+int64_t proc_status_kb(char const* field)
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+    {
+        return -1;
+    }
+    QByteArray const prefix = QByteArray(field) + ':';
+    for (auto const& line : status.readAll().split('\n'))
+    {
+        if (line.startsWith(prefix))
+        {
+            return line.mid(prefix.size()).trimmed().split(' ')
+                .at(0).toLongLong();
+        }
+    }
+    return -1;
+}
+
+struct Measurement
+{
+    double seconds = 0;
+    vector<double> latencies_ms;
+    int errors = 0;
+    int64_t bytes = 0;
+};
+
+// Called with true when an operation succeeds.
+typedef function<void(bool ok)> Done;
+// Starts the operation with the given index.
+typedef function<void(int index, Done const& done)> Operation;
+
+// Run count operations, keeping up to concurrency of them in flight,
+// and measure how long each takes to complete.
+Measurement run_operations(int count, int concurrency, Operation const& op)
+{
+    Measurement m;
+    int next = 0;
+    int running = 0;
+    int finished = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    auto start_more = [&] {
+        while (running < concurrency && next < count)
+        {
+            int const index = next++;
+            qint64 const started = timer.nsecsElapsed();
+            running++;
+            op(index, [&, started](bool ok) {
+                    m.latencies_ms.push_back(
+                        (timer.nsecsElapsed() - started) / 1e6);
+                    if (!ok)
+                    {
+                        m.errors++;
+                    }
+                    running--;
+                    finished++;
+                });
+        }
+    };
+    start_more();
+    while (finished < count)
+    {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        start_more();
+    }
+    m.seconds = timer.nsecsElapsed() / 1e9;
+    sort(m.latencies_ms.begin(), m.latencies_ms.end());
+    return m;
+}
+
+bool pending(ItemJob* job)
+{
+    return job->status() == ItemJob::Loading;
+}
+
+bool pending(ItemListJob* job)
+{
+    return job->status() == ItemListJob::Loading;
+}
+
+bool pending(Uploader* job)
+{
+    return job->status() == Uploader::Loading ||
+        job->status() == Uploader::Ready;
+}
+
+bool pending(Downloader* job)
+{
+    return job->status() == Downloader::Loading ||
+        job->status() == Downloader::Ready;
+}
+
+// Call done once the job completes, then delete the job.  The
+// callback receives the job so results can be collected.
+template <typename Job>
+void when_done(Job* job, function<void(Job*)> const& done)
+{
+    auto called = make_shared<bool>(false);
+    auto check = [job, done, called] {
+        if (*called || pending(job))
+        {
+            return;
+        }
+        *called = true;
+        job->deleteLater();
+        done(job);
+    };
+    QObject::connect(job, &Job::statusChanged, check);
+    check();
+}
+
+template <typename Job>
+bool succeeded(Job* job)
+{
+    if (job->status() != Job::Finished)
+    {
+        qWarning() << job->error().errorString();
+        return false;
+    }
+    return true;
+}
+
+// Run a single job to completion.
+Item get_item(Account const& account, QString const& id)
+{
+    Item item;
+    QString error;
+    run_operations(1, 1, [&](int, Done const& done) {
+            when_done<ItemJob>(account.get(id), [&](ItemJob* job) {
+                    if (job->status() == ItemJob::Finished)
+                    {
+                        item = job->item();
+                    }
+                    else
+                    {
+                        error = job->error().errorString();
+                    }
+                    done(item.isValid());
+                });
+        });
+    if (!item.isValid())
+    {
+        throw runtime_error("get(" + id.toStdString() + "): " +
+                            error.toStdString());
+    }
+    return item;
+}
+
+// Create a folder and count files in it, each of the given size.
+// Sizes are set with truncate, so the files are sparse.
+void make_files(QDir const& root, QString const& folder, int count,
+                int64_t size)
+{
+    if (!root.mkpath(folder))
+    {
+        throw runtime_error("Could not create " + folder.toStdString());
+    }
+    for (int i = 0; i < count; i++)
+    {
+        QFile file(root.filePath(folder + "/" + QString::number(i)));
+        if (!file.open(QIODevice::WriteOnly) || !file.resize(size))
+        {
+            throw runtime_error("Could not create " +
+                                file.fileName().toStdString());
+        }
+    }
+}
+
+QString file_id(QString const& folder, int i)
+{
+    return folder + "/" + QString::number(i);
+}
+
+class Benchmark
+{
+public:
+    Benchmark(QDir const& root, Account const& account, int concurrency)
+        : root_(root), account_(account), concurrency_(concurrency),
+          out_(stdout)
+    {
+    }
+
+    void list(int entries, int iterations);
+    void metadata(int calls);
+    void upload(QString const& name, int count, int64_t size);
+    void download(QString const& name, int count, int64_t size);
+    void copy_move(int count);
+
+    int errors() const
+    {
+        return errors_;
+    }
+
+private:
+    void report(QString const& scenario, Measurement const& m,
+                QJsonObject extra = QJsonObject());
+
+    QDir const root_;
+    Account const account_;
+    int const concurrency_;
+    QTextStream out_;
+    int errors_ = 0;
+};
+
+void Benchmark::report(QString const& scenario, Measurement const& m,
+                       QJsonObject extra)
+{
+    int const operations = m.latencies_ms.size();
+    if (m.errors != 0)
+    {
+        fprintf(stderr, "%s: %d of %d operations failed\n",
+                qPrintable(scenario), m.errors, operations);
+        errors_ += m.errors;
+    }
+    QJsonObject record{
+        {"benchmark", "provider"},
+        {"scenario", scenario},
+        {"operations", operations},
+        {"errors", m.errors},
+        {"seconds", m.seconds},
+        {"ops_per_second", m.seconds > 0 ? operations / m.seconds : 0},
+        {"mb_per_second",
+                m.seconds > 0 ? m.bytes / m.seconds / 1e6 : 0},
+        {"p50_ms", percentile(m.latencies_ms, 0.50)},
+        {"p95_ms", percentile(m.latencies_ms, 0.95)},
+        {"p99_ms", percentile(m.latencies_ms, 0.99)},
+        {"max_ms", percentile(m.latencies_ms, 1.0)},
+        {"rss_kb", static_cast<double>(proc_status_kb("VmRSS"))},
+        {"peak_rss_kb", static_cast<double>(proc_status_kb("VmHWM"))},
+    };
+    for (auto it = extra.begin(); it != extra.end(); ++it)
+    {
+        record.insert(it.key(), it.value());
+    }
+    out_ << QJsonDocument(record).toJson(QJsonDocument::Compact) << endl;
+}
+
+void Benchmark::list(int entries, int iterations)
+{
+    make_files(root_, "list", entries, 0);
+    Item const folder = get_item(account_, "list/");
+
+    // The first listing has to fetch everything from the server,
+    // while later ones may be answered from the listing cache.
+    for (int i = 0; i < iterations; i++)
+    {
+        int items = 0;
+        Measurement m = run_operations(1, 1, [&](int, Done const& done) {
+                auto job = folder.list();
+                QObject::connect(job, &ItemListJob::itemsReady,
+                                 [&](QList<Item> const& page) {
+                                     items += page.size();
+                                 });
+                when_done<ItemListJob>(job, [&, done](ItemListJob* j) {
+                        done(succeeded(j) && items == entries);
+                    });
+            });
+        report("list", m, {{"iteration", i}, {"items", items}});
+    }
+}
+
+void Benchmark::metadata(int calls)
+{
+    make_files(root_, "metadata", calls, 1);
+    Measurement m = run_operations(calls, calls, [&](int i, Done const& done) {
+            when_done<ItemJob>(account_.get(file_id("metadata", i)),
+                               [done](ItemJob* job) {
+                                   done(succeeded(job));
+                               });
+        });
+    report("metadata", m, {{"calls", calls}});
+}
+
+void Benchmark::upload(QString const& name, int count, int64_t size)
+{
+    root_.mkpath(name);
+    Item const folder = get_item(account_, name + "/");
+    QByteArray const block(BLOCK_SIZE, 'x');
+
+    struct Progress
+    {
+        int64_t written = 0;
+        bool closed = false;
+    };
+    int64_t bytes = 0;
+    Measurement m = run_operations(
+        count, concurrency_, [&](int i, Done const& done) {
+            auto uploader = folder.createFile(
+                QString::number(i), Item::IgnoreConflict, size,
+                "application/octet-stream");
+            auto progress = make_shared<Progress>();
+            auto write_more = [uploader, progress, size, &block] {
+                if (uploader->status() != Uploader::Ready || progress->closed)
+                {
+                    return;
+                }
+                while (progress->written < size &&
+                       uploader->bytesToWrite() < WRITE_AHEAD)
+                {
+                    int64_t const n = min<int64_t>(block.size(),
+                                                   size - progress->written);
+                    int64_t const w = uploader->write(block.constData(), n);
+                    if (w <= 0)
+                    {
+                        return;
+                    }
+                    progress->written += w;
+                }
+                if (progress->written == size)
+                {
+                    progress->closed = true;
+                    uploader->close();
+                }
+            };
+            QObject::connect(uploader, &Uploader::statusChanged, write_more);
+            QObject::connect(uploader, &QIODevice::bytesWritten, write_more);
+            when_done<Uploader>(uploader, [&, size, done](Uploader* job) {
+                    bool const ok = succeeded(job);
+                    if (ok)
+                    {
+                        bytes += size;
+                    }
+                    done(ok);
+                });
+            write_more();
+        });
+    m.bytes = bytes;
+    report("upload", m, {{"files", count},
+                         {"file_size", static_cast<double>(size)}});
+
+    // Don't leave large files behind for later scenarios.
+    QDir(root_.filePath(name)).removeRecursively();
+}
+
+void Benchmark::download(QString const& name, int count, int64_t size)
+{
+    make_files(root_, name, count, size);
+    vector<Item> files(count);
+    Measurement setup = run_operations(
+        count, concurrency_, [&](int i, Done const& done) {
+            when_done<ItemJob>(account_.get(file_id(name, i)),
+                               [&, i, done](ItemJob* job) {
+                                   bool const ok = succeeded(job);
+                                   if (ok)
+                                   {
+                                       files[i] = job->item();
+                                   }
+                                   done(ok);
+                               });
+        });
+    if (setup.errors != 0)
+    {
+        throw runtime_error("Could not look up files to download");
+    }
+
+    int64_t bytes = 0;
+    Measurement m = run_operations(
+        count, concurrency_, [&](int i, Done const& done) {
+            auto downloader = files[i].createDownloader(
+                Item::ErrorIfConflict);
+            auto received = make_shared<int64_t>(0);
+            QObject::connect(downloader, &QIODevice::readyRead,
+                             [downloader, received] {
+                                 *received += downloader->readAll().size();
+                             });
+            QObject::connect(downloader, &QIODevice::readChannelFinished,
+                             [downloader, received] {
+                                 *received += downloader->readAll().size();
+                                 downloader->close();
+                             });
+            when_done<Downloader>(downloader,
+                                  [&, received, done](Downloader* job) {
+                                      bytes += *received;
+                                      done(succeeded(job) &&
+                                           *received == size);
+                                  });
+        });
+    m.bytes = bytes;
+    report("download", m, {{"files", count},
+                           {"file_size", static_cast<double>(size)}});
+
+    files.clear();
+    QDir(root_.filePath(name)).removeRecursively();
+}
+
+void Benchmark::copy_move(int count)
+{
+    make_files(root_, "storm", count, 1024);
+    root_.mkpath("storm-copies");
+    root_.mkpath("storm-moved");
+    Item const copies = get_item(account_, "storm-copies/");
+    Item const moved = get_item(account_, "storm-moved/");
+
+    vector<Item> files(count);
+    run_operations(count, count, [&](int i, Done const& done) {
+            when_done<ItemJob>(account_.get(file_id("storm", i)),
+                               [&, i, done](ItemJob* job) {
+                                   bool const ok = succeeded(job);
+                                   if (ok)
+                                   {
+                                       files[i] = job->item();
+                                   }
+                                   done(ok);
+                               });
+        });
+
+    Measurement m = run_operations(count, count, [&](int i, Done const& done) {
+            when_done<ItemJob>(files[i].copy(copies, QString::number(i)),
+                               [&, i, done](ItemJob* job) {
+                                   bool const ok = succeeded(job);
+                                   if (ok)
+                                   {
+                                       files[i] = job->item();
+                                   }
+                                   done(ok);
+                               });
+        });
+    report("copy", m, {{"files", count}});
+
+    m = run_operations(count, count, [&](int i, Done const& done) {
+            when_done<ItemJob>(files[i].move(moved, QString::number(i)),
+                               [done](ItemJob* job) {
+                                   done(succeeded(job));
+                               });
+        });
+    report("move", m, {{"files", count}});
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser options;
+    options.setApplicationDescription(
+        "Benchmark DavProvider through the storage-framework client API");
+    options.addHelpOption();
+    options.addOption({"scenarios",
+                "Comma separated list of scenarios to run (list, metadata, "
+                "upload, download, copy-move)", "scenarios",
+                "list,metadata,upload,download,copy-move"});
+    options.addOption({"dir",
+                "Directory to serve; a temporary directory by default",
+                "dir"});
+    options.addOption({"latency", "Server response latency", "ms", "0"});
+    options.addOption({"bandwidth",
+                "Server bandwidth per connection; 0 is unlimited",
+                "bytes/s", "0"});
+    options.addOption({"concurrency", "Concurrent transfers", "n", "16"});
+    options.addOption({"list-entries", "Entries in the listed folder",
+                "n", "50000"});
+    options.addOption({"iterations", "Listings of the folder", "n", "3"});
+    options.addOption({"metadata-calls", "Concurrent metadata calls",
+                "n", "1000"});
+    options.addOption({"small-count", "Number of small transfers",
+                "n", "500"});
+    options.addOption({"small-size", "Size of small transfers",
+                "KiB", "1024"});
+    options.addOption({"large-count", "Number of large transfers",
+                "n", "1"});
+    options.addOption({"large-size", "Size of large transfers",
+                "MiB", "4096"});
+    options.addOption({"storm-files", "Files copied and moved at once",
+                "n", "200"});
+    options.process(app);
+
+    QStringList const scenarios = options.value("scenarios").split(',');
+    for (auto const& scenario : scenarios)
+    {
+        if (scenario != "list" && scenario != "metadata" &&
+            scenario != "upload" && scenario != "download" &&
+            scenario != "copy-move")
+        {
+            fprintf(stderr, "Unknown scenario: %s\n", qPrintable(scenario));
+            return 1;
+        }
+    }
+
+    QTemporaryDir tmp_dir;
+    QString root_dir = options.value("dir");
+    if (root_dir.isEmpty())
+    {
+        if (!tmp_dir.isValid())
+        {
+            fprintf(stderr, "Could not create temporary directory\n");
+            return 1;
+        }
+        root_dir = tmp_dir.path();
+    }
+
+    LocalDavServer server(root_dir);
+    server.set_latency(
+        chrono::milliseconds(options.value("latency").toInt()));
+    server.set_bandwidth(options.value("bandwidth").toLongLong());
+
+    auto provider = make_shared<BenchProvider>(server.base_url());
+    ProviderEnvironment env(provider);
+    Benchmark bench(QDir(root_dir), env.get_client(),
+                    max(1, options.value("concurrency").toInt()));
+
+    int64_t const small_size = options.value("small-size").toLongLong() * 1024;
+    int64_t const large_size =
+        options.value("large-size").toLongLong() * 1024 * 1024;
+    try
+    {
+        for (auto const& scenario : scenarios)
+        {
+            if (scenario == "list")
+            {
+                bench.list(options.value("list-entries").toInt(),
+                           max(1, options.value("iterations").toInt()));
+            }
+            else if (scenario == "metadata")
+            {
+                bench.metadata(options.value("metadata-calls").toInt());
+            }
+            else if (scenario == "upload")
+            {
+                bench.upload("upload-small",
+                             options.value("small-count").toInt(),
+                             small_size);
+                bench.upload("upload-large",
+                             options.value("large-count").toInt(),
+                             large_size);
+            }
+            else if (scenario == "download")
+            {
+                bench.download("download-small",
+                               options.value("small-count").toInt(),
+                               small_size);
+                bench.download("download-large",
+                               options.value("large-count").toInt(),
+                               large_size);
+            }
+            else if (scenario == "copy-move")
+            {
+                bench.copy_move(options.value("storm-files").toInt());
+            }
+        }
+    }
+    catch (exception const& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return bench.errors() == 0 ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Serve a directory with the SabreDAV test server behind a TLS proxy
+# that offers both HTTP/2 and HTTP/1.1, for use with metadata_bench:
+#
+#   tests/bench/tls-standin.sh /tmp/davroot 8443
+#   metadata_bench --url https://127.0.0.1:8443/ --insecure
+#
+# Needs php, openssl and nghttpx (from nghttp2).  The certificate is
+# self-signed and generated afresh on each run.
+set -e
+
+root=${1:?usage: $0 <directory> [port]}
+port=${2:-8443}
+backend_port=$((port + 1))
+utils=$(cd "$(dirname "$0")/../utils" && pwd)
+work=$(mktemp -d)
+
+cleanup() {
+    [ -n "$php_pid" ] && kill "$php_pid" 2>/dev/null
+    rm -rf "$work"
+}
+trap cleanup EXIT INT TERM
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=127.0.0.1 \
+    -keyout "$work/key.pem" -out "$work/cert.pem" 2>/dev/null
+
+# PHP's built in server handles one request at a time unless told to
+# fork workers, which would hide any difference between protocols.
+mkdir -p "$root"
+(cd "$root" && PHP_CLI_SERVER_WORKERS=${PHP_CLI_SERVER_WORKERS:-16} \
+    exec php -S "127.0.0.1:$backend_port" "$utils/sabredav-server.php") &
+php_pid=$!
+
+nghttpx --frontend="127.0.0.1,$port" --backend="127.0.0.1,$backend_port" \
+    --workers=1 --no-ocsp "$work/key.pem" "$work/cert.pem"
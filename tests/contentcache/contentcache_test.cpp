@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/ContentCache.h"
+
+#include <gtest/gtest.h>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QTemporaryDir>
+
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+#include <utime.h>
+
+using namespace std;
+
+namespace
+{
+
+bool store(ContentCache& cache, string const& item_id, string const& etag,
+           string const& contents)
+{
+    auto file = cache.begin_write("account", item_id, etag, contents.size());
+    if (!file)
+    {
+        return false;
+    }
+    file->write(contents.data(), contents.size());
+    return cache.commit("account", item_id, move(file));
+}
+
+string read_contents(ContentCache::CachedFile& cached)
+{
+    cached.file->seek(cached.offset);
+    return cached.file->read(cached.size).toStdString();
+}
+
+}
+
+TEST(ContentCache, disabled)
+{
+    QTemporaryDir dir;
+    ContentCache cache(dir.path(), 0);
+    EXPECT_FALSE(cache.enabled());
+    EXPECT_EQ(nullptr, cache.begin_write("account", "foo.txt", "\"etag\"", 5));
+    ContentCache::CachedFile cached;
+    EXPECT_FALSE(cache.open("account", "foo.txt", cached));
+}
+
+TEST(ContentCache, store_and_open)
+{
+    QTemporaryDir dir;
+    ContentCache cache(dir.path(), 1000);
+    ASSERT_TRUE(cache.enabled());
+
+    ASSERT_TRUE(store(cache, "foo.txt", "\"etag1\"", "hello"));
+    ContentCache::CachedFile cached;
+    ASSERT_TRUE(cache.open("account", "foo.txt", cached));
+    EXPECT_EQ("\"etag1\"", cached.etag);
+    EXPECT_EQ(5, cached.size);
+    EXPECT_EQ("hello", read_contents(cached));
+
+    // Accounts are kept separate.
+    ContentCache::CachedFile other;
+    EXPECT_FALSE(cache.open("other", "foo.txt", other));
+
+    // A new version replaces the old one.
+    ASSERT_TRUE(store(cache, "foo.txt", "\"etag2\"", "goodbye"));
+    ASSERT_TRUE(cache.open("account", "foo.txt", cached));
+    EXPECT_EQ("\"etag2\"", cached.etag);
+    EXPECT_EQ("goodbye", read_contents(cached));
+    EXPECT_EQ(int64_t(string("\"etag2\"\ngoodbye").size()), cache.size());
+
+    cache.remove("account", "foo.txt");
+    EXPECT_FALSE(cache.open("account", "foo.txt", cached));
+    EXPECT_EQ(0, cache.size());
+    EXPECT_EQ(0u, QDir(dir.path()).entryList(QDir::Files).size());
+}
+
+TEST(ContentCache, uncommitted_write_discarded)
+{
+    QTemporaryDir dir;
+    ContentCache cache(dir.path(), 1000);
+    {
+        // The length isn't always known up front.
+        auto file = cache.begin_write("account", "foo.txt", "\"etag\"", -1);
+        ASSERT_NE(nullptr, file);
+        file->write("partial");
+    }
+    ContentCache::CachedFile cached;
+    EXPECT_FALSE(cache.open("account", "foo.txt", cached));
+    EXPECT_EQ(0u, QDir(dir.path()).entryList(QDir::Files).size());
+}
+
+TEST(ContentCache, lru_eviction)
+{
+    QTemporaryDir dir;
+    // Each entry takes 100 bytes with its header.
+    string const contents(91, 'x');
+    ContentCache cache(dir.path(), 300);
+    ASSERT_TRUE(store(cache, "a", "\"etag-a\"", contents));
+    ASSERT_TRUE(store(cache, "b", "\"etag-b\"", contents));
+    ASSERT_TRUE(store(cache, "c", "\"etag-c\"", contents));
+    EXPECT_EQ(300, cache.size());
+
+    // Using "a" makes "b" the least recently used.
+    ContentCache::CachedFile cached;
+    ASSERT_TRUE(cache.open("account", "a", cached));
+    ASSERT_TRUE(store(cache, "d", "\"etag-d\"", contents));
+    EXPECT_EQ(300, cache.size());
+    EXPECT_TRUE(cache.open("account", "a", cached));
+    EXPECT_FALSE(cache.open("account", "b", cached));
+    EXPECT_TRUE(cache.open("account", "c", cached));
+    EXPECT_TRUE(cache.open("account", "d", cached));
+
+    // Files larger than the budget aren't kept.
+    EXPECT_FALSE(store(cache, "e", "\"etag-e\"", string(400, 'x')));
+    EXPECT_FALSE(cache.open("account", "e", cached));
+    EXPECT_EQ(300, cache.size());
+    // Including when their length wasn't known up front.
+    auto file = cache.begin_write("account", "e", "\"etag-e\"", -1);
+    ASSERT_NE(nullptr, file);
+    file->write(string(400, 'x').c_str());
+    EXPECT_FALSE(cache.commit("account", "e", move(file)));
+    EXPECT_EQ(300, cache.size());
+}
+
+TEST(ContentCache, reload)
+{
+    QTemporaryDir dir;
+    string const contents(91, 'x');
+    {
+        ContentCache cache(dir.path(), 1000);
+        ASSERT_TRUE(store(cache, "a", "\"etag-a\"", contents));
+        ASSERT_TRUE(store(cache, "b", "\"etag-b\"", contents));
+        ASSERT_TRUE(store(cache, "c", "\"etag-c\"", contents));
+    }
+    // Make "a" the most recently used, and "b" the least.
+    for (auto const& info : QDir(dir.path()).entryInfoList(QDir::Files))
+    {
+        struct utimbuf times;
+        times.actime = times.modtime = 1000;
+        ASSERT_EQ(0, utime(QFile::encodeName(info.filePath()).constData(), &times));
+    }
+    {
+        ContentCache cache(dir.path(), 1000);
+        ContentCache::CachedFile cached;
+        ASSERT_TRUE(cache.open("account", "c", cached));
+        ASSERT_TRUE(cache.open("account", "a", cached));
+    }
+    // Leftovers from interrupted writes are removed.
+    {
+        QFile stray(dir.path() + "/0123.tmp");
+        ASSERT_TRUE(stray.open(QIODevice::WriteOnly));
+    }
+
+    // Reopening with a smaller budget evicts the least recently used.
+    ContentCache cache(dir.path(), 200);
+    EXPECT_EQ(200, cache.size());
+    ContentCache::CachedFile cached;
+    EXPECT_TRUE(cache.open("account", "a", cached));
+    EXPECT_FALSE(cache.open("account", "b", cached));
+    EXPECT_TRUE(cache.open("account", "c", cached));
+    EXPECT_EQ("\"etag-c\"", cached.etag);
+    EXPECT_EQ(2u, QDir(dir.path()).entryList(QDir::Files).size());
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
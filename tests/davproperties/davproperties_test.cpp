@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/dav_properties.h"
+
+#include <gtest/gtest.h>
+#include <unity/storage/common.h>
+
+using namespace std;
+using namespace unity::storage::metadata;
+
+TEST(DavProperties, keys)
+{
+    EXPECT_EQ(dav_property::standard, properties_for_keys({}));
+    EXPECT_EQ(dav_property::all, properties_for_keys({"__ALL__"}));
+    EXPECT_EQ(dav_property::required | dav_property::getcontentlength,
+              properties_for_keys({SIZE_IN_BYTES}));
+    EXPECT_EQ(dav_property::required | dav_property::quota_available_bytes |
+              dav_property::oc_fileid,
+              properties_for_keys({FREE_SPACE_BYTES, "oc:fileid"}));
+    // Unknown keys only need the properties every item has.
+    EXPECT_EQ(dav_property::required, properties_for_keys({"no-such-key"}));
+}
+
+TEST(DavProperties, covers)
+{
+    EXPECT_TRUE(covers(dav_property::all, dav_property::standard));
+    EXPECT_TRUE(covers(dav_property::standard, dav_property::required));
+    EXPECT_FALSE(covers(dav_property::standard, dav_property::required |
+                        dav_property::oc_fileid));
+}
+
+TEST(DavProperties, propfind_body)
+{
+    QByteArray const& body = propfind_body(dav_property::required);
+    EXPECT_NE(-1, body.indexOf("<D:propfind xmlns:D=\"DAV:\""));
+    EXPECT_NE(-1, body.indexOf("<D:getetag/>"));
+    EXPECT_NE(-1, body.indexOf("<D:resourcetype/>"));
+    EXPECT_EQ(-1, body.indexOf("<D:getcontentlength/>"));
+
+    PropertySet const custom = dav_property::required |
+        dav_property::oc_checksums;
+    QByteArray const& custom_body = propfind_body(custom);
+    EXPECT_NE(-1, custom_body.indexOf("<oc:checksums/>"));
+    // Bodies are built once and reused.
+    EXPECT_EQ(&custom_body, &propfind_body(custom));
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -18,15 +18,20 @@
 
 #include "../../src/DavProvider.h"
 #include <utils/DavEnvironment.h>
+#include <utils/LocalDavServer.h>
 #include <utils/ProviderEnvironment.h>
+#include <utils/ScopedEnv.h>
 #include <testsetup.h>
 
 #include <gtest/gtest.h>
 #include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QSignalSpy>
 #include <QTemporaryDir>
+#include <QTest>
 #include <QTimer>
 #include <unity/storage/qt/Account.h>
 #include <unity/storage/qt/Downloader.h>
@@ -43,6 +48,12 @@
 #include <unistd.h>
 #include <utime.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
 
 using namespace std;
 using namespace unity::storage::qt;
@@ -77,45 +88,67 @@ public:
     {
     }
 
-    QUrl base_url(provider::Context const& ctx) const override
+    QNetworkReply *send_request(
+        QNetworkRequest& request, QByteArray const& verb, QIODevice* data,
+        provider::Context const& ctx) const override
     {
-        Q_UNUSED(ctx);
-        return base_url_;
+        request_count_++;
+        return DavProvider::send_request(request, verb, data, ctx);
     }
 
-    QNetworkReply *send_request(
-        QNetworkRequest& request, QByteArray const& verb, QIODevice* data,
+    int request_count() const
+    {
+        return request_count_;
+    }
+
+protected:
+    std::shared_ptr<DavSession> make_session(
         provider::Context const& ctx) const override
     {
         Q_UNUSED(ctx);
         const auto credentials = QByteArrayLiteral("username:password");
-        request.setRawHeader(QByteArrayLiteral("Authorization"),
-                             QByteArrayLiteral("Basic ") + credentials.toBase64());
-        return network_->sendCustomRequest(request, verb, data);
+        // The test server stages chunked uploads anywhere.  The local
+        // server takes bulk uploads at any URL, while the PHP server
+        // rejects them.
+        return std::make_shared<DavSession>(
+            base_url_, base_url_,
+            QByteArrayLiteral("Basic ") + credentials.toBase64(),
+            base_url_.resolved(QUrl(QStringLiteral("bulk"))));
     }
 
 private:
     QUrl const base_url_;
+    mutable std::atomic<int> request_count_{0};
 };
 
 class DavProviderTests : public ::testing::Test
 {
 protected:
+    // Environment variables the provider and server are set up with,
+    // overridden by fixtures that test particular settings.
+    virtual ScopedEnv::Settings settings() const
+    {
+        return {};
+    }
+
     void SetUp() override
     {
+        env_.reset(new ScopedEnv(settings()));
         tmp_dir_.reset(new QTemporaryDir(TEST_BIN_DIR "/dav-test.XXXXXX"));
         ASSERT_TRUE(tmp_dir_->isValid());
 
         dav_env_.reset(new DavEnvironment(tmp_dir_->path()));
-        provider_env_.reset(new ProviderEnvironment(
-                                make_shared<TestDavProvider>(dav_env_->base_url())));
+        provider_ = make_shared<TestDavProvider>(dav_env_->base_url());
+        provider_env_.reset(new ProviderEnvironment(provider_));
     }
 
     void TearDown() override
     {
         provider_env_.reset();
+        provider_.reset();
         dav_env_.reset();
         tmp_dir_.reset();
+        env_.reset();
     }
 
     Account get_client() const
@@ -159,12 +192,232 @@ protected:
         ASSERT_EQ(0, utime(full_path.c_str(), &times));
     }
 
+    // Requests sent for an operation, by status.
+    map<int, uint64_t> statuses(string const& operation) const
+    {
+        auto const& operations = provider_->stats().operations();
+        auto it = operations.find(operation);
+        return it != operations.end() ? it->second.statuses : map<int, uint64_t>();
+    }
+
+    std::shared_ptr<TestDavProvider> provider_;
+    std::unique_ptr<DavEnvironment> dav_env_;
+
 private:
+    std::unique_ptr<ScopedEnv> env_;
     std::unique_ptr<QTemporaryDir> tmp_dir_;
-    std::unique_ptr<DavEnvironment> dav_env_;
     std::unique_ptr<ProviderEnvironment> provider_env_;
 };
 
+class DavProviderPagingTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_LIST_PAGE_SIZE", "2"}};
+    }
+};
+
+class DavProviderChunkedUploadTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_CHUNKED_UPLOAD_THRESHOLD", "1"},
+                {"DAV_UPLOAD_CHUNK_SIZE", "1000"}};
+    }
+};
+
+class DavProviderParallelDownloadTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_PARALLEL_DOWNLOAD_THRESHOLD", "1"},
+                {"DAV_DOWNLOAD_RANGE_SIZE", "65536"}};
+    }
+};
+
+class DavProviderNoDeltaSyncTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_DELTA_SYNC", "0"}};
+    }
+};
+
+class DavProviderHttp2Tests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_HTTP2", "1"}};
+    }
+};
+
+class DavProviderSchedulerTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_MAX_REQUESTS_PER_HOST", "1"}};
+    }
+};
+
+// Tests that need the in-process server, to slow it down or make it
+// misbehave.
+class DavProviderLocalServerTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_TEST_SERVER", "local"}};
+    }
+
+    LocalDavServer& server()
+    {
+        return *dav_env_->local_server();
+    }
+};
+
+class DavProviderLocalParallelDownloadTests : public DavProviderLocalServerTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        auto settings = DavProviderLocalServerTests::settings();
+        settings.emplace_back("DAV_PARALLEL_DOWNLOAD_THRESHOLD", "1");
+        settings.emplace_back("DAV_DOWNLOAD_RANGE_SIZE", "65536");
+        return settings;
+    }
+};
+
+class DavProviderLocalChunkedUploadTests : public DavProviderLocalServerTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        auto settings = DavProviderLocalServerTests::settings();
+        settings.emplace_back("DAV_CHUNKED_UPLOAD_THRESHOLD", "1");
+        settings.emplace_back("DAV_UPLOAD_CHUNK_SIZE", "1000");
+        return settings;
+    }
+};
+
+class DavProviderBulkUploadTests : public DavProviderLocalServerTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        auto settings = DavProviderLocalServerTests::settings();
+        // Long enough for all of a test's uploads to share a batch.
+        settings.emplace_back("DAV_BULK_UPLOAD_WINDOW", "500");
+        return settings;
+    }
+};
+
+class DavProviderContentCacheTests : public DavProviderTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        return {{"DAV_CONTENT_CACHE_DIR", cache_dir_.path().toStdString()},
+                {"DAV_CONTENT_CACHE_SIZE", "10000000"}};
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(cache_dir_.isValid());
+        DavProviderTests::SetUp();
+    }
+
+    void write_file(string const& path, string const& contents)
+    {
+        string const full_path = local_file(path);
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(contents.size()), write(fd, contents.data(), contents.size())) << strerror(errno);
+        ASSERT_EQ(0, close(fd));
+    }
+
+    // Responses to download requests, by status.
+    map<int, uint64_t> download_statuses() const
+    {
+        return statuses("download");
+    }
+
+private:
+    QTemporaryDir cache_dir_{TEST_BIN_DIR "/dav-cache.XXXXXX"};
+};
+
+class DavProviderWriteBackTests : public DavProviderLocalServerTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        auto settings = DavProviderLocalServerTests::settings();
+        settings.emplace_back("DAV_WRITE_BACK", "1");
+        settings.emplace_back("DAV_WRITE_BACK_DIR", staging_dir_.path().toStdString());
+        return settings;
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(staging_dir_.isValid());
+        DavProviderLocalServerTests::SetUp();
+    }
+
+    // Files in the staging directory.
+    int staged_files() const
+    {
+        return QDir(staging_dir_.path()).entryList(QDir::Files).size();
+    }
+
+    // Keep staged uploads from reaching the server, by having every
+    // attempt fail in a way that is retried.
+    void hold_uploads()
+    {
+        server().inject_fault(LocalDavServer::Fault::disconnect, 1000, "PUT");
+    }
+
+    // Wait until every staged upload has reached the server or
+    // failed.
+    bool wait_for_write_back()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        for (;;)
+        {
+            auto const entries = provider_->write_back().entries();
+            if (all_of(entries.begin(), entries.end(),
+                       [](WriteBackQueue::Entry const& e) { return e.failed; }))
+            {
+                return true;
+            }
+            if (timer.elapsed() > SIGNAL_WAIT_TIME)
+            {
+                return false;
+            }
+            QTest::qWait(10);
+        }
+    }
+
+private:
+    QTemporaryDir staging_dir_{TEST_BIN_DIR "/dav-staging.XXXXXX"};
+};
+
+class DavProviderWriteBackFailureTests : public DavProviderWriteBackTests
+{
+protected:
+    ScopedEnv::Settings settings() const override
+    {
+        auto settings = DavProviderWriteBackTests::settings();
+        settings.emplace_back("DAV_WRITE_BACK_MAX_FAILED", "1");
+        return settings;
+    }
+};
+
 namespace
 {
 
@@ -215,6 +468,38 @@ Item get_root(Account const& account)
     return roots.at(0);
 }
 
+string download_contents(Item const& file)
+{
+    unique_ptr<Downloader> downloader(
+        file.createDownloader(Item::ErrorIfConflict));
+    string contents;
+    QObject::connect(downloader.get(), &QIODevice::readyRead,
+                     [&]() {
+                         contents += downloader->readAll().toStdString();
+                     });
+    QSignalSpy read_finished_spy(
+        downloader.get(), &QIODevice::readChannelFinished);
+    if (!read_finished_spy.wait(SIGNAL_WAIT_TIME))
+    {
+        throw runtime_error("Wait for readChannelFinished timed out");
+    }
+    QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+    downloader->close();
+    while (downloader->status() == Downloader::Ready)
+    {
+        if (!status_spy.wait(SIGNAL_WAIT_TIME))
+        {
+            throw runtime_error("Wait for statusChanged signal timed out");
+        }
+    }
+    if (downloader->status() != Downloader::Finished)
+    {
+        throw runtime_error("Downloader: " +
+                            downloader->error().errorString().toStdString());
+    }
+    return contents;
+}
+
 }
 
 TEST_F(DavProviderTests, roots)
@@ -277,6 +562,146 @@ TEST_F(DavProviderTests, list)
     EXPECT_EQ(Item::File, items[3].type());
 }
 
+TEST_F(DavProviderNoDeltaSyncTests, list_cached)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+    make_dir("folder");
+
+    Item root = get_root(account);
+    auto const& cache = provider_->listing_cache();
+
+    unique_ptr<ItemListJob> job(root.list());
+    QList<Item> items = get_items(job.get());
+    ASSERT_EQ(ItemListJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(2, items.size());
+    EXPECT_EQ(0, cache.hits());
+    EXPECT_EQ(1, cache.misses());
+
+    // Nothing has changed, so the folder ETag still matches.
+    job.reset(root.list());
+    items = get_items(job.get());
+    ASSERT_EQ(ItemListJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(2, items.size());
+    EXPECT_EQ(1, cache.hits());
+    EXPECT_EQ(1, cache.misses());
+
+    // Changing the folder contents changes its ETag.
+    make_file("bar.txt");
+    job.reset(root.list());
+    items = get_items(job.get());
+    ASSERT_EQ(ItemListJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(3, items.size());
+    EXPECT_EQ(1, cache.hits());
+    EXPECT_EQ(2, cache.misses());
+}
+
+TEST_F(DavProviderTests, list_delta_sync)
+{
+    auto account = get_client();
+    make_dir("folder");
+    make_file("folder/a.txt");
+    make_file("folder/b.txt");
+
+    unique_ptr<ItemJob> folder_job(account.get("folder/"));
+    wait_for(folder_job.get());
+    ASSERT_EQ(ItemJob::Finished, folder_job->status())
+        << folder_job->error().errorString().toStdString();
+    Item folder = folder_job->item();
+    auto const& cache = provider_->listing_cache();
+
+    unique_ptr<ItemListJob> job(folder.list());
+    QList<Item> items = get_items(job.get());
+    ASSERT_EQ(ItemListJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(2, items.size());
+    EXPECT_EQ(0, cache.hits());
+
+    // The changes are applied to the cached listing, with a single
+    // sync-collection REPORT.
+    ASSERT_EQ(0, unlink(local_file("folder/a.txt").c_str()));
+    make_file("folder/c.txt");
+    int const requests = provider_->request_count();
+    job.reset(folder.list());
+    items = get_items(job.get());
+    ASSERT_EQ(ItemListJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(requests + 1, provider_->request_count());
+    EXPECT_EQ(1, cache.hits());
+
+    ASSERT_EQ(2, items.size());
+    sort(items.begin(), items.end(),
+         [](Item const& a, Item const& b) -> bool {
+             return a.itemId() < b.itemId();
+         });
+    EXPECT_EQ("folder/b.txt", items[0].itemId());
+    EXPECT_EQ("folder/c.txt", items[1].itemId());
+}
+
+TEST_F(DavProviderPagingTests, list_paged)
+{
+    auto account = get_client();
+    for (int i = 0; i < 5; i++)
+    {
+        make_file("file" + to_string(i));
+    }
+
+    Item root = get_root(account);
+
+    unique_ptr<ItemListJob> job(root.list());
+    QSignalSpy pages_spy(job.get(), &ItemListJob::itemsReady);
+    QList<Item> items = get_items(job.get());
+    ASSERT_EQ(ItemListJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    EXPECT_EQ(5, items.size());
+    EXPECT_EQ(3, pages_spy.count());
+}
+
+TEST_F(DavProviderPagingTests, list_paged_many_listings)
+{
+    for (int i = 0; i < 5; i++)
+    {
+        make_file("file" + to_string(i));
+    }
+
+    // Talk to the provider directly, so listings can be left part
+    // way through.
+    provider::Context ctx;
+    auto get_page = [&](string const& page_token) {
+        auto f = provider_->list(".", page_token, {}, ctx);
+        while (!f.is_ready())
+        {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+        return f.get();
+    };
+
+    auto page = get_page("");
+    provider::ItemList items = std::get<0>(page);
+    string page_token = std::get<1>(page);
+    ASSERT_FALSE(page_token.empty());
+
+    // Start more listings than are normally kept.
+    for (int i = 0; i < 20; i++)
+    {
+        EXPECT_FALSE(std::get<1>(get_page("")).empty());
+    }
+
+    // The first listing is still in use, so hasn't been evicted.
+    while (!page_token.empty())
+    {
+        page = get_page(page_token);
+        items.insert(items.end(), std::get<0>(page).begin(),
+                     std::get<0>(page).end());
+        page_token = std::get<1>(page);
+    }
+    EXPECT_EQ(5u, items.size());
+}
+
 TEST_F(DavProviderTests, list_on_file_fails)
 {
     auto account = get_client();
@@ -349,49 +774,253 @@ TEST_F(DavProviderTests, metadata)
     EXPECT_EQ(Item::File, item.type());
 }
 
-TEST_F(DavProviderTests, metadata_not_found)
+TEST_F(DavProviderTests, metadata_concurrent)
 {
     auto account = get_client();
+    make_file("foo.txt");
 
-    unique_ptr<ItemJob> job(account.get("foo.txt"));
-    wait_for(job.get());
-    ASSERT_EQ(ItemJob::Error, job->status());
-
-    auto error = job->error();
-    EXPECT_EQ(StorageError::NotExists, error.type());
-    EXPECT_TRUE(error.message().startsWith("Sabre\\DAV\\Exception\\NotFound: "))
-        << error.message().toStdString();
+    // Identical requests share a single PROPFIND.
+    int const requests = provider_->request_count();
+    unique_ptr<ItemJob> job1(account.get("foo.txt"));
+    unique_ptr<ItemJob> job2(account.get("foo.txt"));
+    wait_for(job1.get());
+    wait_for(job2.get());
+    ASSERT_EQ(ItemJob::Finished, job1->status())
+        << job1->error().errorString().toStdString();
+    ASSERT_EQ(ItemJob::Finished, job2->status())
+        << job2->error().errorString().toStdString();
+    EXPECT_EQ("foo.txt", job1->item().itemId());
+    EXPECT_EQ("foo.txt", job2->item().itemId());
+    EXPECT_EQ(requests + 1, provider_->request_count());
 }
 
-TEST_F(DavProviderTests, create_folder)
+TEST_F(DavProviderTests, metadata_stats)
 {
     auto account = get_client();
+    make_file("foo.txt");
 
-    Item root = get_root(account);
-    unique_ptr<ItemJob> job(root.createFolder("folder"));
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
     wait_for(job.get());
     ASSERT_EQ(ItemJob::Finished, job->status())
         << job->error().errorString().toStdString();
+    job.reset(account.get("missing.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
 
-    Item folder = job->item();
-    EXPECT_EQ("folder/", folder.itemId());
-    EXPECT_EQ(".", folder.parentIds().at(0));
-    EXPECT_EQ("folder", folder.name());
-    EXPECT_EQ(Item::Folder, folder.type());
+    auto const& operations = provider_->stats().operations();
+    ASSERT_NE(operations.end(), operations.find("metadata"));
+    auto const& metadata = operations.at("metadata");
+    EXPECT_EQ(1u, metadata.statuses.at(207));
+    EXPECT_EQ(1u, metadata.statuses.at(404));
+    EXPECT_EQ(2u, metadata.latency.count());
+    EXPECT_EQ(2u, metadata.time_to_first_byte.count());
+    EXPECT_LE(metadata.time_to_first_byte.min(), metadata.latency.max());
+    EXPECT_GT(metadata.bytes.max(), 0);
 }
 
-TEST_F(DavProviderTests, create_folder_reserved_chars)
+TEST_F(DavProviderSchedulerTests, metadata_queued)
 {
     auto account = get_client();
+    make_file("foo.txt");
+    make_file("bar.txt");
+    make_file("baz.txt");
 
-    Item root = get_root(account);
-    unique_ptr<ItemJob> job(root.createFolder("14:19"));
-    wait_for(job.get());
-    ASSERT_EQ(ItemJob::Finished, job->status())
-        << job->error().errorString().toStdString();
-
-    Item folder = job->item();
-    EXPECT_EQ("14:19/", folder.itemId());
+    // With one request allowed at a time, the requests queue and are
+    // sent in turn as each finishes.
+    vector<unique_ptr<ItemJob>> jobs;
+    for (auto const& name : {"foo.txt", "bar.txt", "baz.txt"})
+    {
+        jobs.emplace_back(account.get(name));
+    }
+    for (auto const& job : jobs)
+    {
+        wait_for(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status())
+            << job->error().errorString().toStdString();
+    }
+    EXPECT_EQ("foo.txt", jobs[0]->item().itemId());
+    EXPECT_EQ("bar.txt", jobs[1]->item().itemId());
+    EXPECT_EQ("baz.txt", jobs[2]->item().itemId());
+}
+
+TEST_F(DavProviderTests, metadata_session_cookies)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+    make_file("bar.txt");
+    make_file("baz.txt");
+
+    // Only the first request sends the password: later ones present
+    // the login session cookie.
+    for (auto const& id : {"foo.txt", "bar.txt"})
+    {
+        unique_ptr<ItemJob> job(account.get(id));
+        wait_for(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status())
+            << job->error().errorString().toStdString();
+    }
+    EXPECT_EQ(1, dav_env_->auth_count());
+
+    // If the server forgets the session, the request is repeated
+    // with the password.
+    dav_env_->expire_sessions();
+    unique_ptr<ItemJob> job(account.get("baz.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ("baz.txt", job->item().name());
+    EXPECT_EQ(2, dav_env_->auth_count());
+}
+
+TEST_F(DavProviderHttp2Tests, metadata)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+
+    // The test server doesn't speak HTTP/2, so allowing it must fall
+    // back to HTTP/1.1.
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ("foo.txt", job->item().name());
+    // Test accounts carry no credentials, so an empty context finds
+    // the session the request was made with.
+    EXPECT_EQ("HTTP/1.1",
+              provider_->session(provider::Context())->protocol().toStdString());
+}
+
+TEST_F(DavProviderLocalServerTests, metadata_latency)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+
+    server().set_latency(chrono::milliseconds(300));
+    QElapsedTimer timer;
+    timer.start();
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_GE(timer.elapsed(), 300);
+}
+
+TEST_F(DavProviderLocalServerTests, create_file_from_headers)
+{
+    auto account = get_client();
+    Item root = get_root(account);
+    auto const metadata_requests = statuses("metadata");
+
+    unique_ptr<Uploader> uploader(
+        root.createFile("filename.txt", Item::ErrorIfConflict,
+                        file_contents.size(), "text/plain"));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    uploader->write(&file_contents[0], file_contents.size());
+    uploader->close();
+    while (uploader->status() == Uploader::Loading ||
+           uploader->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Uploader::Finished, uploader->status())
+        << uploader->error().errorString().toStdString();
+
+    // The item is built from the response, without a PROPFIND.
+    auto file = uploader->item();
+    EXPECT_NE(0, file.etag().size());
+    EXPECT_EQ(int64_t(file_contents.size()), file.sizeInBytes());
+    EXPECT_TRUE(file.lastModifiedTime().isValid());
+    EXPECT_EQ(metadata_requests, statuses("metadata"));
+}
+
+TEST_F(DavProviderLocalServerTests, metadata_server_error)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+
+    server().inject_fault(LocalDavServer::Fault::error_status, 1,
+                          "PROPFIND", 503);
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
+    EXPECT_TRUE(job->error().message().startsWith("HTTP 503: "))
+        << job->error().message().toStdString();
+}
+
+TEST_F(DavProviderTests, metadata_not_found)
+{
+    auto account = get_client();
+
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
+
+    auto error = job->error();
+    EXPECT_EQ(StorageError::NotExists, error.type());
+    EXPECT_TRUE(error.message().startsWith("Sabre\\DAV\\Exception\\NotFound: "))
+        << error.message().toStdString();
+}
+
+TEST_F(DavProviderTests, metadata_cached)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    Item item = job->item();
+
+    // The second lookup is answered from the cache, so doesn't
+    // notice that the file has been removed behind our back.
+    ASSERT_EQ(0, unlink(local_file("foo.txt").c_str()));
+    job.reset(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(item.etag(), job->item().etag());
+
+    // Modifying the item through the provider invalidates the cache.
+    unique_ptr<VoidJob> delete_job(item.deleteItem());
+    wait_for(delete_job.get());
+    ASSERT_EQ(VoidJob::Error, delete_job->status());
+
+    job.reset(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
+    EXPECT_EQ(StorageError::NotExists, job->error().type());
+}
+
+TEST_F(DavProviderTests, create_folder)
+{
+    auto account = get_client();
+
+    Item root = get_root(account);
+    unique_ptr<ItemJob> job(root.createFolder("folder"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    Item folder = job->item();
+    EXPECT_EQ("folder/", folder.itemId());
+    EXPECT_EQ(".", folder.parentIds().at(0));
+    EXPECT_EQ("folder", folder.name());
+    EXPECT_EQ(Item::Folder, folder.type());
+}
+
+TEST_F(DavProviderTests, create_folder_reserved_chars)
+{
+    auto account = get_client();
+
+    Item root = get_root(account);
+    unique_ptr<ItemJob> job(root.createFolder("14:19"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    Item folder = job->item();
+    EXPECT_EQ("14:19/", folder.itemId());
     EXPECT_EQ(".", folder.parentIds().at(0));
     EXPECT_EQ("14:19", folder.name());
     EXPECT_EQ(Item::Folder, folder.type());
@@ -474,6 +1103,136 @@ TEST_F(DavProviderTests, create_file)
     struct stat buf;
     ASSERT_EQ(0, stat(full_path.c_str(), &buf));
     EXPECT_EQ(off_t(file_contents.size() * segments), buf.st_size);
+    // The server chose the modification time, and the response's
+    // Date stands in for it, to within a second.
+    EXPECT_LE(std::abs(int64_t(buf.st_mtime) -
+                       file.lastModifiedTime().toMSecsSinceEpoch() / 1000), 1);
+}
+
+TEST_F(DavProviderChunkedUploadTests, create_file)
+{
+    int const segments = 50;
+
+    auto account = get_client();
+    Item root = get_root(account);
+
+    unique_ptr<Uploader> uploader(
+        root.createFile("filename.txt", Item::ErrorIfConflict,
+                        file_contents.size() * segments, "text/plain"));
+
+    int count = 0;
+    QTimer timer;
+    timer.setSingleShot(false);
+    timer.setInterval(10);
+    QObject::connect(&timer, &QTimer::timeout, [&] {
+            uploader->write(&file_contents[0], file_contents.size());
+            count++;
+            if (count == segments)
+            {
+                uploader->close();
+            }
+        });
+
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    timer.start();
+    while (uploader->status() == Uploader::Loading ||
+           uploader->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Uploader::Finished, uploader->status())
+        << uploader->error().errorString().toStdString();
+
+    auto file = uploader->item();
+    EXPECT_EQ("filename.txt", file.itemId());
+    EXPECT_EQ(int64_t(file_contents.size() * segments), file.sizeInBytes());
+
+    string full_path = local_file("filename.txt");
+    string contents;
+    {
+        FILE* fp = fopen(full_path.c_str(), "rb");
+        ASSERT_NE(nullptr, fp);
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        {
+            contents.append(buf, n);
+        }
+        fclose(fp);
+    }
+    string expected;
+    for (int i = 0; i < segments; i++)
+    {
+        expected += file_contents;
+    }
+    EXPECT_EQ(expected, contents);
+
+    // The staging collection has been cleaned up.
+    unique_ptr<ItemListJob> job(root.list());
+    QList<Item> items = get_items(job.get());
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ("filename.txt", items[0].itemId());
+}
+
+TEST_F(DavProviderChunkedUploadTests, create_file_over_existing_file)
+{
+    auto account = get_client();
+    make_file("foo.txt");
+    Item root = get_root(account);
+
+    unique_ptr<Uploader> uploader(
+        root.createFile("foo.txt", Item::ErrorIfConflict,
+                        file_contents.size(), "text/plain"));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    while (uploader->status() == Uploader::Loading)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    uploader->write(&file_contents[0], file_contents.size());
+    uploader->close();
+    while (uploader->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Uploader::Error, uploader->status());
+    EXPECT_EQ(StorageError::Conflict, uploader->error().type());
+}
+
+TEST_F(DavProviderLocalChunkedUploadTests, create_file_unsupported)
+{
+    server().inject_fault(LocalDavServer::Fault::error_status, 1, "MKCOL", 501);
+    auto account = get_client();
+    Item root = get_root(account);
+
+    auto upload = [&](QString const& name) {
+        unique_ptr<Uploader> uploader(
+            root.createFile(name, Item::ErrorIfConflict,
+                            file_contents.size(), "text/plain"));
+        uploader->write(&file_contents[0], file_contents.size());
+        uploader->close();
+        QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+        while (uploader->status() == Uploader::Loading ||
+               uploader->status() == Uploader::Ready)
+        {
+            ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+        }
+        ASSERT_EQ(Uploader::Finished, uploader->status())
+            << uploader->error().errorString().toStdString();
+        EXPECT_EQ(int64_t(file_contents.size()), uploader->item().sizeInBytes());
+    };
+
+    // The file is sent with a single PUT instead.
+    upload("file1.txt");
+    EXPECT_EQ(1u, statuses("upload")[501]);
+    EXPECT_EQ(1u, statuses("upload")[201]);
+    struct stat buf;
+    ASSERT_EQ(0, stat(local_file("file1.txt").c_str(), &buf));
+    EXPECT_EQ(off_t(file_contents.size()), buf.st_size);
+
+    // Chunked uploads aren't tried again.
+    upload("file2.txt");
+    EXPECT_EQ(1u, statuses("upload")[501]);
+    EXPECT_EQ(2u, statuses("upload")[201]);
 }
 
 TEST_F(DavProviderTests, create_file_over_existing_file)
@@ -714,17 +1473,20 @@ TEST_F(DavProviderTests, download)
     EXPECT_EQ(int64_t(large_contents.size()), n_read);
 }
 
-TEST_F(DavProviderTests, download_short_read)
+TEST_F(DavProviderParallelDownloadTests, download)
 {
     int const segments = 1000;
+    string large_contents;
+    large_contents.reserve(file_contents.size() * segments);
+    for (int i = 0; i < segments; i++)
+    {
+        large_contents += file_contents;
+    }
+    string const full_path = local_file("foo.txt");
     {
-        string full_path = local_file("foo.txt");
         int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
         ASSERT_GT(fd, 0);
-        for (int i = 0; i < segments; i++)
-        {
-            ASSERT_EQ(ssize_t(file_contents.size()), write(fd, &file_contents[0], file_contents.size())) << strerror(errno);
-        }
+        ASSERT_EQ(ssize_t(large_contents.size()), write(fd, &large_contents[0], large_contents.size())) << strerror(errno);
         ASSERT_EQ(0, close(fd));
     }
 
@@ -736,23 +1498,200 @@ TEST_F(DavProviderTests, download_short_read)
         << job->error().errorString().toStdString();
 
     auto file = job->item();
+
     unique_ptr<Downloader> downloader(
         file.createDownloader(Item::ErrorIfConflict));
 
-    QSignalSpy spy(downloader.get(), &Downloader::statusChanged);
-    while (downloader->status() == Downloader::Loading)
-    {
-        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
-    }
+    int64_t n_read = 0;
+    QObject::connect(downloader.get(), &QIODevice::readyRead,
+                     [&]() {
+                         auto bytes = downloader->readAll();
+                         string const expected = large_contents.substr(
+                             n_read, bytes.size());
+                         EXPECT_EQ(expected, bytes.toStdString());
+                         n_read += bytes.size();
+                     });
+    QSignalSpy read_finished_spy(
+        downloader.get(), &QIODevice::readChannelFinished);
+    ASSERT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
 
+    QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
     downloader->close();
     while (downloader->status() == Downloader::Ready)
     {
-        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+        ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
     }
-    ASSERT_EQ(Downloader::Error, downloader->status());
+    ASSERT_EQ(Downloader::Finished, downloader->status())
+        << downloader->error().errorString().toStdString();
 
-    auto error = downloader->error();
+    EXPECT_EQ(int64_t(large_contents.size()), n_read);
+}
+
+TEST_F(DavProviderParallelDownloadTests, download_changed_file)
+{
+    string const full_path = local_file("foo.txt");
+    {
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        for (int i = 0; i < 1000; i++)
+        {
+            ASSERT_EQ(ssize_t(file_contents.size()), write(fd, &file_contents[0], file_contents.size())) << strerror(errno);
+        }
+        ASSERT_EQ(0, close(fd));
+    }
+    offset_mtime("foo.txt", -10);
+
+    auto account = get_client();
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    auto file = job->item();
+
+    // Replace the file behind the provider's back: the stale ETag
+    // sent with If-Range should get us the new contents.
+    {
+        int fd = open(full_path.c_str(), O_WRONLY | O_TRUNC);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(file_contents.size()), write(fd, &file_contents[0], file_contents.size())) << strerror(errno);
+        ASSERT_EQ(0, close(fd));
+    }
+
+    unique_ptr<Downloader> downloader(
+        file.createDownloader(Item::IgnoreConflict));
+    string contents;
+    QObject::connect(downloader.get(), &QIODevice::readyRead,
+                     [&]() {
+                         contents += downloader->readAll().toStdString();
+                     });
+    QSignalSpy read_finished_spy(
+        downloader.get(), &QIODevice::readChannelFinished);
+    ASSERT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
+
+    QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+    downloader->close();
+    while (downloader->status() == Downloader::Ready)
+    {
+        ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Downloader::Finished, downloader->status())
+        << downloader->error().errorString().toStdString();
+    EXPECT_EQ(file_contents, contents);
+}
+
+TEST_F(DavProviderLocalParallelDownloadTests, download_ranges_ignored)
+{
+    string large_contents;
+    for (int i = 0; i < 1000; i++)
+    {
+        large_contents += file_contents;
+    }
+    {
+        string const full_path = local_file("foo.txt");
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(large_contents.size()), write(fd, &large_contents[0], large_contents.size())) << strerror(errno);
+        ASSERT_EQ(0, close(fd));
+    }
+
+    auto account = get_client();
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    // Every range gets the whole file, in whatever order the
+    // responses arrive, so the first one is streamed on its own.
+    server().set_ranges_supported(false);
+    EXPECT_EQ(large_contents, download_contents(job->item()));
+}
+
+TEST_F(DavProviderLocalServerTests, download_resumes_after_disconnect)
+{
+    int const segments = 1000;
+    string large_contents;
+    for (int i = 0; i < segments; i++)
+    {
+        large_contents += file_contents;
+    }
+    {
+        string const full_path = local_file("foo.txt");
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        ASSERT_EQ(ssize_t(large_contents.size()), write(fd, &large_contents[0], large_contents.size())) << strerror(errno);
+        ASSERT_EQ(0, close(fd));
+    }
+
+    auto account = get_client();
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    // The first response is cut short, so the rest is fetched with a
+    // range request.
+    server().inject_fault(LocalDavServer::Fault::truncate_body, 1, "GET");
+    unique_ptr<Downloader> downloader(
+        job->item().createDownloader(Item::ErrorIfConflict));
+    string contents;
+    QObject::connect(downloader.get(), &QIODevice::readyRead,
+                     [&]() {
+                         contents += downloader->readAll().toStdString();
+                     });
+    QSignalSpy read_finished_spy(
+        downloader.get(), &QIODevice::readChannelFinished);
+    ASSERT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
+
+    QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+    downloader->close();
+    while (downloader->status() == Downloader::Ready)
+    {
+        ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Downloader::Finished, downloader->status())
+        << downloader->error().errorString().toStdString();
+    EXPECT_EQ(large_contents, contents);
+}
+
+TEST_F(DavProviderTests, download_short_read)
+{
+    int const segments = 1000;
+    {
+        string full_path = local_file("foo.txt");
+        int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0);
+        for (int i = 0; i < segments; i++)
+        {
+            ASSERT_EQ(ssize_t(file_contents.size()), write(fd, &file_contents[0], file_contents.size())) << strerror(errno);
+        }
+        ASSERT_EQ(0, close(fd));
+    }
+
+    auto account = get_client();
+
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    auto file = job->item();
+    unique_ptr<Downloader> downloader(
+        file.createDownloader(Item::ErrorIfConflict));
+
+    QSignalSpy spy(downloader.get(), &Downloader::statusChanged);
+    while (downloader->status() == Downloader::Loading)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+
+    downloader->close();
+    while (downloader->status() == Downloader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Downloader::Error, downloader->status());
+
+    auto error = downloader->error();
     EXPECT_EQ(StorageError::LogicError, error.type());
     EXPECT_EQ("finish called before all data sent", error.message());
 }
@@ -796,6 +1735,440 @@ TEST_F(DavProviderTests, download_not_found)
         << error.message().toStdString();
 }
 
+TEST_F(DavProviderContentCacheTests, download_cached)
+{
+    string const contents = "Hello from the content cache";
+    write_file("foo.txt", contents);
+    auto account = get_client();
+
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    auto file = job->item();
+
+    EXPECT_EQ(contents, download_contents(file));
+    EXPECT_EQ(1u, download_statuses()[200]);
+    EXPECT_EQ(int64_t(contents.size()), provider_->content_cache().size() -
+              int64_t(file.etag().size()) - 1);
+
+    // The metadata cache shows the cached copy is current, so it is
+    // sent without asking the server.
+    EXPECT_EQ(contents, download_contents(file));
+    EXPECT_EQ(1u, download_statuses()[200]);
+    EXPECT_EQ(0u, download_statuses()[304]);
+}
+
+TEST_F(DavProviderContentCacheTests, download_revalidated)
+{
+    string const contents = "Hello from the content cache";
+    write_file("foo.txt", contents);
+    auto account = get_client();
+
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    auto file = job->item();
+    EXPECT_EQ(contents, download_contents(file));
+
+    // Without current metadata, the server confirms the cached copy
+    // is still good.
+    provider_->metadata_cache().clear();
+    EXPECT_EQ(contents, download_contents(file));
+    EXPECT_EQ(1u, download_statuses()[200]);
+    EXPECT_EQ(1u, download_statuses()[304]);
+}
+
+TEST_F(DavProviderContentCacheTests, download_changed)
+{
+    write_file("foo.txt", "Old contents");
+    auto account = get_client();
+
+    unique_ptr<ItemJob> job(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ("Old contents", download_contents(job->item()));
+
+    string const contents = "New, longer contents";
+    write_file("foo.txt", contents);
+    offset_mtime("foo.txt", 10);
+    provider_->metadata_cache().clear();
+    job.reset(account.get("foo.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+
+    EXPECT_EQ(contents, download_contents(job->item()));
+    EXPECT_EQ(2u, download_statuses()[200]);
+    EXPECT_EQ(0u, download_statuses()[304]);
+
+    // The new version replaced the old one in the cache.
+    EXPECT_EQ(contents, download_contents(job->item()));
+    EXPECT_EQ(2u, download_statuses()[200]);
+}
+
+TEST_F(DavProviderWriteBackTests, create_file)
+{
+    auto account = get_client();
+    Item root = get_root(account);
+
+    unique_ptr<Uploader> uploader(
+        root.createFile("filename.txt", Item::IgnoreConflict,
+                        file_contents.size(), "text/plain"));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    uploader->write(&file_contents[0], file_contents.size());
+    uploader->close();
+    while (uploader->status() == Uploader::Loading ||
+           uploader->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Uploader::Finished, uploader->status())
+        << uploader->error().errorString().toStdString();
+
+    // The client gets a provisional item once the data is staged.
+    auto file = uploader->item();
+    EXPECT_EQ("filename.txt", file.itemId());
+    EXPECT_EQ(Item::File, file.type());
+    EXPECT_EQ(int64_t(file_contents.size()), file.sizeInBytes());
+    EXPECT_TRUE(file.etag().startsWith("\"staged-")) << file.etag().toStdString();
+
+    if (!provider_->write_back().entries().empty())
+    {
+        // Until the upload completes, the provisional item is
+        // reported for the file.
+        unique_ptr<ItemJob> job(account.get("filename.txt"));
+        wait_for(job.get());
+        ASSERT_EQ(ItemJob::Finished, job->status())
+            << job->error().errorString().toStdString();
+        if (!provider_->write_back().entries().empty())
+        {
+            EXPECT_EQ(file.etag(), job->item().etag());
+        }
+    }
+    ASSERT_TRUE(wait_for_write_back());
+    EXPECT_TRUE(provider_->write_back().entries().empty());
+    EXPECT_EQ(0, staged_files());
+
+    struct stat buf;
+    ASSERT_EQ(0, stat(local_file("filename.txt").c_str(), &buf));
+    EXPECT_EQ(off_t(file_contents.size()), buf.st_size);
+
+    unique_ptr<ItemJob> job(account.get("filename.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_FALSE(job->item().etag().startsWith("\"staged-"));
+}
+
+TEST_F(DavProviderWriteBackTests, create_file_conflict)
+{
+    make_file("filename.txt");
+    auto account = get_client();
+    Item root = get_root(account);
+
+    unique_ptr<Uploader> uploader(
+        root.createFile("filename.txt", Item::ErrorIfConflict,
+                        file_contents.size(), "text/plain"));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    uploader->write(&file_contents[0], file_contents.size());
+    uploader->close();
+    while (uploader->status() == Uploader::Loading ||
+           uploader->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    // Uploads with a precondition aren't staged, so the conflict is
+    // reported to the client.
+    ASSERT_EQ(Uploader::Error, uploader->status());
+    EXPECT_EQ(StorageError::Conflict, uploader->error().type());
+    EXPECT_EQ(0, staged_files());
+    EXPECT_TRUE(provider_->write_back().entries().empty());
+    struct stat buf;
+    ASSERT_EQ(0, stat(local_file("filename.txt").c_str(), &buf));
+    EXPECT_EQ(0, buf.st_size);
+}
+
+namespace
+{
+
+Item stage_file(Item const& parent, string const& name)
+{
+    unique_ptr<Uploader> uploader(
+        parent.createFile(QString::fromStdString(name), Item::IgnoreConflict,
+                          file_contents.size(), "text/plain"));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    uploader->write(&file_contents[0], file_contents.size());
+    uploader->close();
+    while (uploader->status() == Uploader::Loading ||
+           uploader->status() == Uploader::Ready)
+    {
+        if (!spy.wait(SIGNAL_WAIT_TIME))
+        {
+            throw runtime_error("Wait for statusChanged signal timed out");
+        }
+    }
+    if (uploader->status() != Uploader::Finished)
+    {
+        throw runtime_error("Upload failed: " +
+                            uploader->error().errorString().toStdString());
+    }
+    return uploader->item();
+}
+
+}
+
+TEST_F(DavProviderWriteBackTests, download_staged_file)
+{
+    hold_uploads();
+    auto account = get_client();
+    Item root = get_root(account);
+
+    Item file = stage_file(root, "filename.txt");
+    EXPECT_TRUE(file.etag().startsWith("\"staged-")) << file.etag().toStdString();
+
+    // The staged data is sent, though the server doesn't have it yet.
+    EXPECT_EQ(file_contents, download_contents(file));
+    struct stat buf;
+    EXPECT_EQ(-1, stat(local_file("filename.txt").c_str(), &buf));
+}
+
+TEST_F(DavProviderWriteBackTests, update_after_upload)
+{
+    auto account = get_client();
+    Item root = get_root(account);
+
+    Item file = stage_file(root, "filename.txt");
+    ASSERT_TRUE(wait_for_write_back());
+    ASSERT_TRUE(provider_->write_back().entries().empty());
+
+    // The provisional ETag still stands for the version uploaded.
+    EXPECT_EQ(file_contents, download_contents(file));
+
+    string const contents = "New contents";
+    unique_ptr<Uploader> uploader(
+        file.createUploader(Item::ErrorIfConflict, contents.size()));
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    uploader->write(&contents[0], contents.size());
+    uploader->close();
+    while (uploader->status() == Uploader::Loading ||
+           uploader->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Uploader::Finished, uploader->status())
+        << uploader->error().errorString().toStdString();
+    // With a precondition to check, the update isn't staged.
+    EXPECT_FALSE(uploader->item().etag().startsWith("\"staged-"));
+
+    struct stat buf;
+    ASSERT_EQ(0, stat(local_file("filename.txt").c_str(), &buf));
+    EXPECT_EQ(off_t(contents.size()), buf.st_size);
+
+    // The first version's ETag no longer matches.
+    unique_ptr<Uploader> stale(
+        file.createUploader(Item::ErrorIfConflict, 0));
+    QSignalSpy stale_spy(stale.get(), &Uploader::statusChanged);
+    while (stale->status() == Uploader::Loading)
+    {
+        ASSERT_TRUE(stale_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    stale->close();
+    while (stale->status() == Uploader::Ready)
+    {
+        ASSERT_TRUE(stale_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(Uploader::Error, stale->status());
+    EXPECT_EQ(StorageError::Conflict, stale->error().type());
+}
+
+TEST_F(DavProviderWriteBackTests, delete_staged_file)
+{
+    hold_uploads();
+    auto account = get_client();
+    Item root = get_root(account);
+
+    Item file = stage_file(root, "filename.txt");
+    ASSERT_EQ(2, staged_files());
+
+    // The file only exists as a staged upload, which is dropped.
+    unique_ptr<VoidJob> delete_job(file.deleteItem());
+    wait_for(delete_job.get());
+    ASSERT_EQ(VoidJob::Finished, delete_job->status())
+        << delete_job->error().errorString().toStdString();
+    EXPECT_EQ(0, staged_files());
+    EXPECT_TRUE(provider_->write_back().entries().empty());
+
+    unique_ptr<ItemJob> job(account.get("filename.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
+    EXPECT_EQ(StorageError::NotExists, job->error().type());
+}
+
+TEST_F(DavProviderWriteBackTests, move_staged_file)
+{
+    hold_uploads();
+    auto account = get_client();
+    Item root = get_root(account);
+
+    Item file = stage_file(root, "filename.txt");
+
+    unique_ptr<ItemJob> job(file.move(root, "new-name.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
+    EXPECT_EQ(StorageError::ResourceError, job->error().type());
+
+    job.reset(file.copy(root, "new-name.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Error, job->status());
+    EXPECT_EQ(StorageError::ResourceError, job->error().type());
+
+    // The upload is still waiting to be sent.
+    EXPECT_EQ(1u, provider_->write_back().entries().size());
+    struct stat buf;
+    EXPECT_EQ(-1, stat(local_file("new-name.txt").c_str(), &buf));
+}
+
+TEST_F(DavProviderWriteBackFailureTests, failed_uploads)
+{
+    server().inject_fault(LocalDavServer::Fault::error_status, 2, "PUT", 403);
+    auto account = get_client();
+    Item root = get_root(account);
+
+    stage_file(root, "first.txt");
+    ASSERT_TRUE(wait_for_write_back());
+    stage_file(root, "second.txt");
+    ASSERT_TRUE(wait_for_write_back());
+
+    // Only the most recent failure is kept.
+    auto entries = provider_->write_back().entries();
+    ASSERT_EQ(1u, entries.size());
+    EXPECT_EQ("second.txt", entries[0].item_id);
+    EXPECT_TRUE(entries[0].failed);
+    EXPECT_EQ(2, staged_files());
+}
+
+namespace
+{
+
+// Upload several small files at once, allowing them to replace
+// existing files.
+vector<Item> upload_files(Item const& parent, int count)
+{
+    vector<unique_ptr<Uploader>> uploaders;
+    for (int i = 0; i < count; i++)
+    {
+        uploaders.emplace_back(
+            parent.createFile(QStringLiteral("file%1.txt").arg(i),
+                              Item::IgnoreConflict, file_contents.size(),
+                              "text/plain"));
+    }
+    for (auto& uploader : uploaders)
+    {
+        uploader->write(&file_contents[0], file_contents.size());
+        uploader->close();
+    }
+    vector<Item> items;
+    for (auto& uploader : uploaders)
+    {
+        QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+        while (uploader->status() == Uploader::Loading ||
+               uploader->status() == Uploader::Ready)
+        {
+            if (!spy.wait(SIGNAL_WAIT_TIME))
+            {
+                throw runtime_error("Wait for upload timed out");
+            }
+        }
+        if (uploader->status() != Uploader::Finished)
+        {
+            throw runtime_error("Upload failed: " +
+                                uploader->error().errorString().toStdString());
+        }
+        items.push_back(uploader->item());
+    }
+    return items;
+}
+
+}
+
+TEST_F(DavProviderBulkUploadTests, create_files)
+{
+    make_file("file0.txt");
+    auto account = get_client();
+    Item root = get_root(account);
+
+    auto const metadata_requests = statuses("metadata");
+    auto const items = upload_files(root, 5);
+    ASSERT_EQ(5u, items.size());
+    // The files went up together, without a PROPFIND for each.
+    EXPECT_EQ(1u, statuses("bulk_upload")[200]);
+    EXPECT_TRUE(statuses("upload").empty());
+    EXPECT_EQ(metadata_requests, statuses("metadata"));
+
+    for (int i = 0; i < 5; i++)
+    {
+        string const name = "file" + to_string(i) + ".txt";
+        EXPECT_EQ(name, items[i].itemId().toStdString());
+        EXPECT_EQ(Item::File, items[i].type());
+        EXPECT_EQ(int64_t(file_contents.size()), items[i].sizeInBytes());
+
+        struct stat buf;
+        ASSERT_EQ(0, stat(local_file(name).c_str(), &buf));
+        EXPECT_EQ(off_t(file_contents.size()), buf.st_size);
+        EXPECT_EQ(int64_t(buf.st_mtime),
+                  items[i].lastModifiedTime().toMSecsSinceEpoch() / 1000);
+    }
+
+    // The ETags reported by the bulk upload match the server's.
+    provider_->metadata_cache().clear();
+    unique_ptr<ItemJob> job(account.get("file3.txt"));
+    wait_for(job.get());
+    ASSERT_EQ(ItemJob::Finished, job->status())
+        << job->error().errorString().toStdString();
+    EXPECT_EQ(items[3].etag(), job->item().etag());
+}
+
+TEST_F(DavProviderBulkUploadTests, create_file_alone)
+{
+    auto account = get_client();
+    Item root = get_root(account);
+
+    // A batch of one is sent with a plain PUT.
+    auto const items = upload_files(root, 1);
+    ASSERT_EQ(1u, items.size());
+    EXPECT_TRUE(statuses("bulk_upload").empty());
+    EXPECT_EQ(1u, statuses("upload")[201]);
+}
+
+TEST_F(DavProviderBulkUploadTests, create_files_unsupported)
+{
+    server().inject_fault(LocalDavServer::Fault::error_status, 1, "POST", 501);
+    auto account = get_client();
+    Item root = get_root(account);
+
+    // The files are sent one by one instead.
+    auto items = upload_files(root, 3);
+    ASSERT_EQ(3u, items.size());
+    EXPECT_EQ(1u, statuses("bulk_upload")[501]);
+    EXPECT_EQ(3u, statuses("upload")[201]);
+    for (int i = 0; i < 3; i++)
+    {
+        struct stat buf;
+        ASSERT_EQ(0, stat(local_file("file" + to_string(i) + ".txt").c_str(), &buf));
+        EXPECT_EQ(off_t(file_contents.size()), buf.st_size);
+    }
+
+    // Bulk uploads aren't tried again.
+    items = upload_files(root, 3);
+    ASSERT_EQ(3u, items.size());
+    EXPECT_EQ(1u, statuses("bulk_upload")[501]);
+    EXPECT_EQ(3u, statuses("upload")[201]);
+    EXPECT_EQ(3u, statuses("upload")[204]);
+}
+
 TEST_F(DavProviderTests, delete_item)
 {
     auto account = get_client();
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/DownloadSink.h"
+
+#include <gtest/gtest.h>
+#include <QBuffer>
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QTemporaryFile>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+QByteArray make_data(int size)
+{
+    QByteArray data(size, '\0');
+    for (int i = 0; i < size; i++)
+    {
+        data[i] = char(i * 7 + i / 251);
+    }
+    return data;
+}
+
+class DownloadSinkTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        reader_ = fds[0];
+        sink_.reset(new DownloadSink(fds[1]));
+    }
+
+    void TearDown() override
+    {
+        sink_.reset();
+        if (reader_ >= 0)
+        {
+            close(reader_);
+        }
+    }
+
+    // Read whatever the sink has written so far.
+    void drain()
+    {
+        char buffer[16 * 1024];
+        ssize_t n;
+        while ((n = read(reader_, buffer, sizeof(buffer))) > 0)
+        {
+            received_.append(buffer, n);
+        }
+    }
+
+    int reader_ = -1;
+    unique_ptr<DownloadSink> sink_;
+    QByteArray received_;
+};
+
+}
+
+TEST_F(DownloadSinkTest, copies_from_device)
+{
+    QByteArray const data = make_data(1024 * 1024 + 17);
+    QBuffer source;
+    source.setData(data);
+    ASSERT_TRUE(source.open(QIODevice::ReadOnly));
+
+    int64_t total = 0;
+    while (source.bytesAvailable() > 0 || sink_->pending() > 0)
+    {
+        int64_t n = sink_->fill(&source);
+        ASSERT_GE(n, 0);
+        total += n;
+        EXPECT_LE(sink_->pending(), 2 * DownloadSink::BUFFER_SIZE);
+        ASSERT_TRUE(sink_->flush());
+        drain();
+        QCoreApplication::processEvents();
+    }
+    drain();
+    EXPECT_EQ(data.size(), total);
+    EXPECT_EQ(data, received_);
+}
+
+TEST_F(DownloadSinkTest, buffers_while_socket_full)
+{
+    QBuffer source;
+    source.setData(make_data(8 * 1024 * 1024));
+    ASSERT_TRUE(source.open(QIODevice::ReadOnly));
+
+    // Without a reader, the sink stops accepting data once the socket
+    // and both buffers are full.
+    while (sink_->hasRoom())
+    {
+        ASSERT_GT(sink_->fill(&source), 0);
+        ASSERT_TRUE(sink_->flush());
+    }
+    EXPECT_EQ(0, sink_->fill(&source));
+    EXPECT_GT(sink_->pending(), DownloadSink::BUFFER_SIZE);
+    EXPECT_LE(sink_->pending(), 2 * DownloadSink::BUFFER_SIZE);
+}
+
+TEST_F(DownloadSinkTest, watermarks)
+{
+    int const B = DownloadSink::BUFFER_SIZE;
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    int small = 4096;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    DownloadSink sink(fds[1], 4 * B, B);
+    EXPECT_EQ(4 * B, sink.highWatermark());
+    EXPECT_EQ(B, sink.lowWatermark());
+
+    QBuffer source;
+    source.setData(make_data(8 * B));
+    ASSERT_TRUE(source.open(QIODevice::ReadOnly));
+    EXPECT_EQ(4 * B, sink.fill(&source));
+    EXPECT_FALSE(sink.hasRoom());
+    EXPECT_EQ(0, sink.fill(&source));
+
+    // No more is read until the queue drains to the low watermark.
+    char buffer[4096];
+    for (;;)
+    {
+        ASSERT_TRUE(sink.flush());
+        if (sink.pending() <= B)
+        {
+            break;
+        }
+        EXPECT_FALSE(sink.hasRoom());
+        ASSERT_GT(read(fds[0], buffer, sizeof(buffer)), 0);
+    }
+    EXPECT_TRUE(sink.hasRoom());
+    EXPECT_GT(sink.fill(&source), 0);
+    EXPECT_EQ(4 * B, sink.pending());
+    close(fds[0]);
+}
+
+TEST_F(DownloadSinkTest, adaptive_growth)
+{
+    int const B = DownloadSink::BUFFER_SIZE;
+    sink_.reset();
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    close(reader_);
+    reader_ = fds[0];
+    fcntl(reader_, F_SETFL, fcntl(reader_, F_GETFL) | O_NONBLOCK);
+    sink_.reset(new DownloadSink(fds[1], 2 * B, B));
+    sink_->setMaxCapacity(16 * B);
+
+    QBuffer source;
+    source.setData(make_data(64 * B));
+    // The client only reads once the queue is full, so the sink
+    // should respond by queuing more.
+    auto const end = chrono::steady_clock::now() + chrono::milliseconds(500);
+    while (chrono::steady_clock::now() < end)
+    {
+        if (!source.isOpen() || source.atEnd())
+        {
+            source.close();
+            ASSERT_TRUE(source.open(QIODevice::ReadOnly));
+        }
+        ASSERT_GE(sink_->fill(&source), 0);
+        ASSERT_TRUE(sink_->flush());
+        if (!sink_->hasRoom())
+        {
+            drain();
+            received_.clear();
+        }
+    }
+    EXPECT_GT(sink_->highWatermark(), 2 * B);
+    EXPECT_LE(sink_->highWatermark(), 16 * B);
+    EXPECT_LT(sink_->lowWatermark(), sink_->highWatermark());
+}
+
+TEST_F(DownloadSinkTest, sends_file)
+{
+    QByteArray const data = make_data(3 * 1024 * 1024 + 5);
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    ASSERT_EQ(data.size(), file.write(data));
+    ASSERT_TRUE(file.flush());
+
+    int64_t offset = 100;
+    int64_t const end = data.size();
+    while (offset < end)
+    {
+        int64_t n = sink_->sendFile(file.handle(), offset, end - offset);
+        ASSERT_GE(n, 0);
+        drain();
+        QCoreApplication::processEvents();
+    }
+    drain();
+    EXPECT_EQ(end, offset);
+    EXPECT_EQ(data.mid(100), received_);
+}
+
+TEST_F(DownloadSinkTest, reader_closed)
+{
+    close(reader_);
+    reader_ = -1;
+
+    QBuffer source;
+    source.setData(make_data(1000));
+    ASSERT_TRUE(source.open(QIODevice::ReadOnly));
+    EXPECT_EQ(1000, sink_->fill(&source));
+    EXPECT_FALSE(sink_->flush());
+    EXPECT_FALSE(sink_->errorString().isEmpty());
+
+    // sendfile() fails rather than raising SIGPIPE.
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    ASSERT_EQ(1000, file.write(make_data(1000)));
+    ASSERT_TRUE(file.flush());
+    DownloadSink other([] {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            close(fds[0]);
+            return fds[1];
+        }());
+    int64_t offset = 0;
+    EXPECT_EQ(-1, other.sendFile(file.handle(), offset, 1000));
+    EXPECT_EQ(0, offset);
+}
+
+int main(int argc, char**argv)
+{
+    QCoreApplication app(argc, argv);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -88,6 +88,16 @@ TEST(ItemId, make_child_id)
     EXPECT_THROW(make_child_id("foo/", ".."), InvalidArgumentException);
 }
 
+TEST(ItemId, parent_id)
+{
+    EXPECT_EQ("", parent_id("."));
+    EXPECT_EQ(".", parent_id("foo"));
+    EXPECT_EQ(".", parent_id("foo/"));
+    EXPECT_EQ("foo/", parent_id("foo/bar"));
+    EXPECT_EQ("foo/", parent_id("foo/bar/"));
+    EXPECT_EQ("foo/bar/", parent_id("foo/bar/baz"));
+}
+
 TEST(ItemId, is_folder)
 {
     EXPECT_TRUE(is_folder("."));
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/MetadataCache.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+using namespace std;
+using unity::storage::provider::Item;
+
+namespace
+{
+
+Item make_item(string const& item_id, string const& etag)
+{
+    Item item;
+    item.item_id = item_id;
+    item.etag = etag;
+    return item;
+}
+
+}
+
+TEST(MetadataCache, get_put)
+{
+    MetadataCache cache(10, chrono::seconds(60));
+    Item item;
+    EXPECT_FALSE(cache.get("account", "foo.txt", dav_property::standard, item));
+
+    cache.put("account", make_item("foo.txt", "etag1"), dav_property::standard);
+    ASSERT_TRUE(cache.get("account", "foo.txt", dav_property::standard, item));
+    EXPECT_EQ("foo.txt", item.item_id);
+    EXPECT_EQ("etag1", item.etag);
+
+    // A later response replaces the cached entry
+    cache.put("account", make_item("foo.txt", "etag2"), dav_property::standard);
+    ASSERT_TRUE(cache.get("account", "foo.txt", dav_property::standard, item));
+    EXPECT_EQ("etag2", item.etag);
+    EXPECT_EQ(1u, cache.size());
+
+    // Accounts are kept separate
+    EXPECT_FALSE(cache.get("other", "foo.txt", dav_property::standard, item));
+}
+
+TEST(MetadataCache, lru_eviction)
+{
+    MetadataCache cache(2, chrono::seconds(60));
+    Item item;
+
+    cache.put("account", make_item("a", "1"), dav_property::standard);
+    cache.put("account", make_item("b", "1"), dav_property::standard);
+    // Touch "a" so that "b" is the least recently used entry
+    ASSERT_TRUE(cache.get("account", "a", dav_property::standard, item));
+    cache.put("account", make_item("c", "1"), dav_property::standard);
+
+    EXPECT_EQ(2u, cache.size());
+    EXPECT_TRUE(cache.get("account", "a", dav_property::standard, item));
+    EXPECT_FALSE(cache.get("account", "b", dav_property::standard, item));
+    EXPECT_TRUE(cache.get("account", "c", dav_property::standard, item));
+}
+
+TEST(MetadataCache, ttl)
+{
+    MetadataCache cache(10, chrono::milliseconds(20));
+    Item item;
+
+    cache.put("account", make_item("foo.txt", "etag"), dav_property::standard);
+    EXPECT_TRUE(cache.get("account", "foo.txt", dav_property::standard, item));
+    this_thread::sleep_for(chrono::milliseconds(50));
+    EXPECT_FALSE(cache.get("account", "foo.txt", dav_property::standard, item));
+    EXPECT_EQ(0u, cache.size());
+
+    // A zero TTL disables the cache
+    cache.set_ttl(chrono::seconds(0));
+    cache.put("account", make_item("foo.txt", "etag"), dav_property::standard);
+    EXPECT_FALSE(cache.get("account", "foo.txt", dav_property::standard, item));
+}
+
+TEST(MetadataCache, remove_tree)
+{
+    MetadataCache cache(10, chrono::seconds(60));
+    Item item;
+
+    cache.put("account", make_item("folder/", "1"), dav_property::standard);
+    cache.put("account", make_item("folder/a", "1"), dav_property::standard);
+    cache.put("account", make_item("folder/sub/b", "1"), dav_property::standard);
+    cache.put("account", make_item("folder2/c", "1"), dav_property::standard);
+    cache.put("account", make_item("other", "1"), dav_property::standard);
+
+    cache.remove_tree("account", "folder/");
+    EXPECT_FALSE(cache.get("account", "folder/", dav_property::standard, item));
+    EXPECT_FALSE(cache.get("account", "folder/a", dav_property::standard, item));
+    EXPECT_FALSE(cache.get("account", "folder/sub/b", dav_property::standard, item));
+    EXPECT_TRUE(cache.get("account", "folder2/c", dav_property::standard, item));
+    EXPECT_TRUE(cache.get("account", "other", dav_property::standard, item));
+
+    // Removing a file only removes that entry
+    cache.remove_tree("account", "other");
+    EXPECT_FALSE(cache.get("account", "other", dav_property::standard, item));
+    EXPECT_TRUE(cache.get("account", "folder2/c", dav_property::standard, item));
+
+    cache.remove_tree("account", ".");
+    EXPECT_EQ(0u, cache.size());
+}
+
+TEST(MetadataCache, properties)
+{
+    MetadataCache cache(10, chrono::seconds(60));
+    Item item;
+
+    // An item is only reused for requests its properties cover.
+    cache.put("account", make_item("foo.txt", "etag"), dav_property::required);
+    EXPECT_TRUE(cache.get("account", "foo.txt", dav_property::required, item));
+    EXPECT_FALSE(cache.get("account", "foo.txt", dav_property::standard, item));
+    EXPECT_EQ(1u, cache.size());
+
+    cache.put("account", make_item("foo.txt", "etag"), dav_property::all);
+    EXPECT_TRUE(cache.get("account", "foo.txt", dav_property::standard, item));
+    EXPECT_TRUE(cache.get("account", "foo.txt",
+                          dav_property::required | dav_property::oc_fileid,
+                          item));
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
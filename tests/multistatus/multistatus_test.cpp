@@ -25,7 +25,11 @@
 
 using namespace std;
 
-TEST(MultiStatus, garbage_input)
+class MultiStatus : public ::testing::TestWithParam<MultiStatusParser::Engine>
+{
+};
+
+TEST_P(MultiStatus, garbage_input)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -33,7 +37,7 @@ TEST(MultiStatus, garbage_input)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -44,7 +48,7 @@ TEST(MultiStatus, garbage_input)
     EXPECT_EQ(0, response_spy.count());
 }
 
-TEST(MultiStatus, invalid_xml)
+TEST_P(MultiStatus, invalid_xml)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -58,7 +62,7 @@ TEST(MultiStatus, invalid_xml)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -69,7 +73,7 @@ TEST(MultiStatus, invalid_xml)
     EXPECT_EQ(0, response_spy.count());
 }
 
-TEST(MultiStatus, incomplete_xml)
+TEST_P(MultiStatus, incomplete_xml)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -82,7 +86,7 @@ TEST(MultiStatus, incomplete_xml)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -92,7 +96,7 @@ TEST(MultiStatus, incomplete_xml)
     EXPECT_EQ("unexpected end of file", parser.errorString()) << parser.errorString().toStdString();
 }
 
-TEST(MultiStatus, non_multistatus_xml)
+TEST_P(MultiStatus, non_multistatus_xml)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -100,7 +104,7 @@ TEST(MultiStatus, non_multistatus_xml)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -111,12 +115,12 @@ TEST(MultiStatus, non_multistatus_xml)
     EXPECT_EQ(0, response_spy.count());
 }
 
-TEST(MultiStatus, empty)
+TEST_P(MultiStatus, empty)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
     parser.startParsing();
@@ -125,7 +129,7 @@ TEST(MultiStatus, empty)
     EXPECT_EQ("Unexpectedly reached end of input", parser.errorString()) << parser.errorString().toStdString();
 }
 
-TEST(MultiStatus, response_status)
+TEST_P(MultiStatus, response_status)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -145,7 +149,7 @@ TEST(MultiStatus, response_status)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -166,7 +170,55 @@ TEST(MultiStatus, response_status)
     EXPECT_EQ(424, args[2].value<int>());
 }
 
-TEST(MultiStatus, response_properties)
+TEST_P(MultiStatus, sync_token)
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    // Multi-status response based on one from RFC 6578 Section 3.8
+    buffer.write(R"(<?xml version="1.0" encoding="utf-8" ?>
+<D:multistatus xmlns:D="DAV:">
+  <D:response>
+    <D:href>http://example.com/webdav/new.txt</D:href>
+    <D:propstat>
+      <D:prop>
+        <D:getetag>"00001-abcd1"</D:getetag>
+      </D:prop>
+      <D:status>HTTP/1.1 200 OK</D:status>
+    </D:propstat>
+  </D:response>
+  <D:response>
+    <D:href>http://example.com/webdav/old.txt</D:href>
+    <D:status>HTTP/1.1 404 Not Found</D:status>
+  </D:response>
+  <D:sync-token>http://example.com/ns/sync/1234</D:sync-token>
+</D:multistatus>
+)");
+    buffer.seek(0);
+
+    QUrl base_url("http://www.example.com/");
+    MultiStatusParser parser(base_url, &buffer, GetParam());
+    QSignalSpy response_spy(&parser, &MultiStatusParser::response);
+    QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
+
+    parser.startParsing();
+    Q_EMIT buffer.readChannelFinished();
+    ASSERT_EQ(1, finished_spy.count());
+    EXPECT_EQ("", parser.errorString()) << parser.errorString().toStdString();
+    EXPECT_EQ("http://example.com/ns/sync/1234", parser.syncToken());
+
+    ASSERT_EQ(2, response_spy.count());
+    QList<QVariant> args = response_spy.takeFirst();
+    EXPECT_EQ("http://example.com/webdav/new.txt", args[0].value<QUrl>().toEncoded().toStdString());
+    EXPECT_EQ(1u, args[1].value<vector<MultiStatusProperty>>().size());
+    EXPECT_EQ(0, args[2].value<int>());
+
+    args = response_spy.takeFirst();
+    EXPECT_EQ("http://example.com/webdav/old.txt", args[0].value<QUrl>().toEncoded().toStdString());
+    EXPECT_EQ(0u, args[1].value<vector<MultiStatusProperty>>().size());
+    EXPECT_EQ(404, args[2].value<int>());
+}
+
+TEST_P(MultiStatus, response_properties)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -200,7 +252,7 @@ TEST(MultiStatus, response_properties)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -239,7 +291,7 @@ TEST(MultiStatus, response_properties)
     EXPECT_EQ(403, props[3].status);
 }
 
-TEST(MultiStatus, resourcetype_container)
+TEST_P(MultiStatus, resourcetype_container)
 {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
@@ -261,7 +313,7 @@ TEST(MultiStatus, resourcetype_container)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -282,7 +334,50 @@ TEST(MultiStatus, resourcetype_container)
     EXPECT_EQ(200, props[0].status);
 }
 
-TEST(MultiStatus, incremental_parse)
+TEST_P(MultiStatus, nested_checksums)
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    buffer.write(R"(
+<D:multistatus xmlns:D='DAV:' xmlns:oc='http://owncloud.org/ns'>
+  <D:response>
+    <D:href>http://www.example.com/file</D:href>
+    <D:propstat>
+      <D:prop>
+        <oc:checksums>
+          <oc:checksum>SHA1:abcd</oc:checksum>
+          <oc:checksum>MD5:<![CDATA[1234]]></oc:checksum>
+        </oc:checksums>
+      </D:prop>
+      <D:status>HTTP/1.1 200 OK</D:status>
+    </D:propstat>
+  </D:response>
+</D:multistatus>
+)");
+    buffer.seek(0);
+
+    QUrl base_url("http://www.example.com/");
+    MultiStatusParser parser(base_url, &buffer, GetParam());
+    QSignalSpy response_spy(&parser, &MultiStatusParser::response);
+    QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
+
+    parser.startParsing();
+    Q_EMIT buffer.readChannelFinished();
+    ASSERT_EQ(1, finished_spy.count());
+    EXPECT_EQ("", parser.errorString()) << parser.errorString().toStdString();
+
+    ASSERT_EQ(1, response_spy.count());
+    QList<QVariant> args = response_spy.takeFirst();
+    auto props = args[1].value<vector<MultiStatusProperty>>();
+
+    ASSERT_EQ(1u, props.size());
+    EXPECT_EQ("http://owncloud.org/ns", props[0].ns);
+    EXPECT_EQ("checksums", props[0].name);
+    EXPECT_EQ("SHA1:abcd MD5:1234", props[0].value.simplified());
+    EXPECT_EQ(200, props[0].status);
+}
+
+TEST_P(MultiStatus, incremental_parse)
 {
     static char const first_chunk[] = R"(
      <D:multistatus xmlns:D='DAV:'>
@@ -322,7 +417,7 @@ TEST(MultiStatus, incremental_parse)
     buffer.seek(0);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -360,7 +455,7 @@ TEST(MultiStatus, incremental_parse)
     EXPECT_EQ("resourcetype", props[6].name);
 }
 
-TEST(MultiStatus, incremental_parse_initially_empty)
+TEST_P(MultiStatus, incremental_parse_initially_empty)
 {
     static char const data[] = R"(
      <D:multistatus xmlns:D='DAV:'>
@@ -381,7 +476,7 @@ TEST(MultiStatus, incremental_parse_initially_empty)
     buffer.open(QIODevice::ReadWrite);
 
     QUrl base_url("http://www.example.com/");
-    MultiStatusParser parser(base_url, &buffer);
+    MultiStatusParser parser(base_url, &buffer, GetParam());
     QSignalSpy response_spy(&parser, &MultiStatusParser::response);
     QSignalSpy finished_spy(&parser, &MultiStatusParser::finished);
 
@@ -400,6 +495,10 @@ TEST(MultiStatus, incremental_parse_initially_empty)
     EXPECT_EQ("http://www.example.com/container/", args[0].value<QUrl>().toEncoded().toStdString());
 }
 
+INSTANTIATE_TEST_CASE_P(Engines, MultiStatus,
+                        ::testing::Values(MultiStatusParser::Engine::qxml,
+                                          MultiStatusParser::Engine::bytes));
+
 int main(int argc, char**argv)
 {
     QCoreApplication app(argc, argv);
@@ -43,6 +43,70 @@ TEST(NextcloudProviderTests, base_url)
     EXPECT_EQ("http://example.com/nextcloud/remote.php/dav/files/username/", url);
 }
 
+TEST(NextcloudProviderTests, upload_collection_url)
+{
+    provider::PasswordCredentials credentials;
+    credentials.username = "username";
+    credentials.password = "password";
+    credentials.host = "http://example.com/nextcloud/";
+
+    provider::Context context;
+    context.uid = 0;
+    context.pid = 0;
+    context.credentials = credentials;
+
+    NextcloudProvider provider;
+    auto url = provider.upload_collection_url(context).toEncoded().toStdString();
+    EXPECT_EQ("http://example.com/nextcloud/remote.php/dav/uploads/username/", url);
+}
+
+TEST(NextcloudProviderTests, bulk_upload_url)
+{
+    provider::PasswordCredentials credentials;
+    credentials.username = "username";
+    credentials.password = "password";
+    credentials.host = "http://example.com/nextcloud/";
+
+    provider::Context context;
+    context.uid = 0;
+    context.pid = 0;
+    context.credentials = credentials;
+
+    NextcloudProvider provider;
+    auto url = provider.session(context)->bulk_upload_url().toEncoded().toStdString();
+    EXPECT_EQ("http://example.com/nextcloud/remote.php/dav/bulk", url);
+}
+
+TEST(NextcloudProviderTests, session)
+{
+    provider::PasswordCredentials credentials;
+    credentials.username = "username";
+    credentials.password = "password";
+    credentials.host = "http://example.com/nextcloud/";
+
+    provider::Context context;
+    context.uid = 0;
+    context.pid = 0;
+    context.credentials = credentials;
+
+    NextcloudProvider provider;
+    auto session = provider.session(context);
+    EXPECT_EQ("Basic dXNlcm5hbWU6cGFzc3dvcmQ=",
+              session->authorization().toStdString());
+    EXPECT_EQ("http://example.com/nextcloud/remote.php/dav/files/username/foo.txt",
+              session->id_to_url("foo.txt").toEncoded().toStdString());
+    EXPECT_EQ(session, provider.session(context));
+
+    // Changing the password replaces the session
+    credentials.password = "secret";
+    context.credentials = credentials;
+    auto new_session = provider.session(context);
+    EXPECT_NE(session, new_session);
+    EXPECT_EQ("Basic dXNlcm5hbWU6c2VjcmV0",
+              new_session->authorization().toStdString());
+    EXPECT_EQ(new_session, provider.session(context));
+}
+
 int main(int argc, char**argv)
 {
     QCoreApplication app(argc, argv);
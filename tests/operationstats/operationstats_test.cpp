@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/Histogram.h"
+#include "../../src/OperationStats.h"
+#include "../../src/StatsInterface.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+TEST(Histogram, empty)
+{
+    Histogram h;
+    EXPECT_EQ(0u, h.count());
+    EXPECT_EQ(0, h.min());
+    EXPECT_EQ(0, h.max());
+    EXPECT_EQ(0, h.mean());
+    EXPECT_EQ(0, h.percentile(0.5));
+}
+
+TEST(Histogram, small_values_are_exact)
+{
+    Histogram h;
+    for (int i = 1; i <= 100; i++)
+    {
+        h.record(i);
+    }
+    EXPECT_EQ(100u, h.count());
+    EXPECT_EQ(1, h.min());
+    EXPECT_EQ(100, h.max());
+    EXPECT_DOUBLE_EQ(50.5, h.mean());
+    EXPECT_EQ(50, h.percentile(0.5));
+    EXPECT_EQ(99, h.percentile(0.99));
+    EXPECT_EQ(100, h.percentile(1.0));
+    EXPECT_EQ(1, h.percentile(0.0));
+}
+
+TEST(Histogram, large_values_are_approximate)
+{
+    Histogram h;
+    for (int64_t i = 1; i <= 1000000; i++)
+    {
+        h.record(i * 1000);
+    }
+    EXPECT_EQ(1000, h.min());
+    EXPECT_EQ(1000000000, h.max());
+    for (double p : {0.5, 0.9, 0.99, 0.999})
+    {
+        double const expected = p * 1e9;
+        int64_t const actual = h.percentile(p);
+        EXPECT_GE(actual, expected) << p;
+        EXPECT_LE(actual, expected * (1 + 1.0 / 64)) << p;
+    }
+    EXPECT_EQ(1000000000, h.percentile(1.0));
+}
+
+TEST(Histogram, extremes)
+{
+    Histogram h;
+    h.record(-5);
+    h.record(INT64_MAX);
+    EXPECT_EQ(0, h.min());
+    EXPECT_EQ(INT64_MAX, h.max());
+    EXPECT_EQ(0, h.percentile(0.5));
+    EXPECT_EQ(INT64_MAX, h.percentile(1.0));
+
+    h.reset();
+    EXPECT_EQ(0u, h.count());
+    EXPECT_EQ(0, h.max());
+}
+
+TEST(OperationStats, record)
+{
+    OperationStats stats;
+    OperationStats::Sample sample;
+    sample.status = 207;
+    sample.responded = true;
+    sample.time_to_first_byte = chrono::milliseconds(2);
+    sample.latency = chrono::milliseconds(5);
+    sample.bytes = 1000;
+    stats.record("list", sample);
+    stats.record("list", sample);
+
+    OperationStats::Sample failed;
+    failed.latency = chrono::milliseconds(1);
+    stats.record("list", failed);
+
+    ASSERT_EQ(1u, stats.operations().size());
+    auto const& list = stats.operations().at("list");
+    // No time to first byte without a response.
+    EXPECT_EQ(2u, list.time_to_first_byte.count());
+    EXPECT_EQ(2000, list.time_to_first_byte.max());
+    EXPECT_EQ(3u, list.latency.count());
+    EXPECT_EQ(1000, list.latency.min());
+    EXPECT_EQ(5000, list.latency.max());
+    EXPECT_EQ(1000, list.bytes.max());
+    EXPECT_EQ(2u, list.statuses.at(207));
+    EXPECT_EQ(1u, list.statuses.at(0));
+
+    stats.reset();
+    EXPECT_TRUE(stats.operations().empty());
+}
+
+TEST(StatsInterface, get_stats)
+{
+    OperationStats stats;
+    OperationStats::Sample sample;
+    sample.status = 404;
+    sample.responded = true;
+    sample.time_to_first_byte = chrono::microseconds(40);
+    sample.latency = chrono::microseconds(50);
+    stats.record("metadata", sample);
+
+    StatsInterface iface(stats);
+    QVariantMap const result = iface.GetStats();
+    ASSERT_EQ(QStringList{"metadata"}, result.keys());
+    QVariantMap const metadata = result["metadata"].toMap();
+    QVariantMap const latency = metadata["latency_us"].toMap();
+    EXPECT_EQ(1u, latency["count"].toULongLong());
+    EXPECT_EQ(50, latency["p99"].toLongLong());
+    EXPECT_EQ(40, metadata["time_to_first_byte_us"].toMap()["max"].toLongLong());
+    EXPECT_EQ(1u, metadata["statuses"].toMap()["404"].toULongLong());
+
+    iface.Reset();
+    EXPECT_TRUE(iface.GetStats().isEmpty());
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
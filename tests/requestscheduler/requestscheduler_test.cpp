@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+
+#include "../../src/RequestScheduler.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using Priority = RequestScheduler::Priority;
+
+namespace
+{
+
+// Records the order in which requests are started.
+struct Recorder
+{
+    vector<string> started;
+
+    RequestScheduler::Start start(string const& name)
+    {
+        return [this, name]() { started.push_back(name); };
+    }
+};
+
+}
+
+TEST(RequestScheduler, per_host_limit)
+{
+    RequestScheduler scheduler(2);
+    Recorder r;
+    auto a = scheduler.submit("host1", "acct", Priority::interactive, r.start("a"));
+    auto b = scheduler.submit("host1", "acct", Priority::interactive, r.start("b"));
+    scheduler.submit("host1", "acct", Priority::interactive, r.start("c"));
+    // Other hosts have their own limit.
+    scheduler.submit("host2", "acct", Priority::interactive, r.start("d"));
+    EXPECT_EQ(vector<string>({"a", "b", "d"}), r.started);
+    EXPECT_EQ(2, scheduler.active("host1"));
+    EXPECT_EQ(1, scheduler.queued("host1"));
+
+    scheduler.finish(a);
+    EXPECT_EQ(vector<string>({"a", "b", "d", "c"}), r.started);
+    EXPECT_EQ(0, scheduler.queued("host1"));
+
+    // Finishing twice doesn't free another slot.
+    scheduler.finish(a);
+    EXPECT_EQ(2, scheduler.active("host1"));
+    scheduler.finish(b);
+    EXPECT_EQ(1, scheduler.active("host1"));
+}
+
+TEST(RequestScheduler, interactive_slot_reserved)
+{
+    RequestScheduler scheduler(3);
+    Recorder r;
+    for (int i = 0; i < 4; i++)
+    {
+        scheduler.submit("host", "acct", Priority::transfer,
+                         r.start("t" + to_string(i)));
+    }
+    // Bulk requests leave one slot free.
+    EXPECT_EQ(vector<string>({"t0", "t1"}), r.started);
+    scheduler.submit("host", "acct", Priority::interactive, r.start("i"));
+    EXPECT_EQ(vector<string>({"t0", "t1", "i"}), r.started);
+    EXPECT_EQ(2, scheduler.queued("host"));
+}
+
+TEST(RequestScheduler, weighted_round_robin)
+{
+    RequestScheduler scheduler(1);
+    vector<string> started;
+    vector<uint64_t> tickets;
+    uint64_t current = scheduler.submit("host", "acct", Priority::interactive,
+                                        []{});
+    auto submit = [&](Priority priority, string const& name) {
+        size_t const i = tickets.size();
+        tickets.push_back(scheduler.submit(
+            "host", "acct", priority, [&, i, name]() {
+                started.push_back(name);
+                current = tickets[i];
+            }));
+    };
+    for (int i = 0; i < 10; i++)
+    {
+        submit(Priority::interactive, "i");
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        submit(Priority::background, "b");
+    }
+    while (scheduler.active("host") > 0)
+    {
+        scheduler.finish(current);
+    }
+    // Background requests get a turn after each run of interactive
+    // requests, rather than waiting for them all to complete.
+    EXPECT_EQ(vector<string>({"i", "i", "i", "i", "i", "i", "i", "i",
+                    "b", "i", "i", "b"}), started);
+}
+
+TEST(RequestScheduler, fair_between_accounts)
+{
+    RequestScheduler scheduler(1);
+    Recorder r;
+    auto first = scheduler.submit("host", "a", Priority::interactive,
+                                  r.start("first"));
+    vector<uint64_t> tickets;
+    for (int i = 0; i < 3; i++)
+    {
+        tickets.push_back(scheduler.submit("host", "a", Priority::interactive,
+                                           r.start("a")));
+    }
+    tickets.push_back(scheduler.submit("host", "b", Priority::interactive,
+                                       r.start("b")));
+    scheduler.finish(first);
+    scheduler.finish(tickets[0]);
+    EXPECT_EQ(vector<string>({"first", "a", "b"}), r.started);
+}
+
+TEST(RequestScheduler, cancel_queued)
+{
+    RequestScheduler scheduler(1);
+    Recorder r;
+    auto a = scheduler.submit("host", "acct", Priority::interactive, r.start("a"));
+    auto b = scheduler.submit("host", "acct", Priority::interactive, r.start("b"));
+    scheduler.submit("host", "acct", Priority::interactive, r.start("c"));
+    scheduler.finish(b);
+    EXPECT_EQ(1, scheduler.queued("host"));
+    scheduler.finish(a);
+    EXPECT_EQ(vector<string>({"a", "c"}), r.started);
+}
+
+TEST(RequestScheduler, finish_from_start)
+{
+    // A request that fails immediately frees its slot for the next.
+    RequestScheduler scheduler(1);
+    vector<uint64_t> tickets;
+    int started = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        tickets.push_back(scheduler.submit(
+            "host", "acct", Priority::interactive, [&, i]() {
+                started++;
+                if (i < static_cast<int>(tickets.size()))
+                {
+                    scheduler.finish(tickets[i]);
+                }
+            }));
+    }
+    scheduler.finish(tickets[0]);
+    EXPECT_EQ(3, started);
+    EXPECT_EQ(0, scheduler.active("host"));
+    EXPECT_EQ(0, scheduler.queued("host"));
+}
+
+TEST(RequestScheduler, stats)
+{
+    RequestScheduler scheduler(1);
+    auto a = scheduler.submit("host", "acct", Priority::interactive, []{});
+    scheduler.submit("host", "acct", Priority::interactive, []{});
+    scheduler.submit("host", "acct", Priority::transfer, []{});
+    scheduler.finish(a);
+
+    auto const& interactive = scheduler.stats(Priority::interactive);
+    EXPECT_EQ(2u, interactive.requests);
+    EXPECT_EQ(1u, interactive.queued);
+    EXPECT_LE(interactive.max_wait, interactive.total_wait);
+    auto const& transfer = scheduler.stats(Priority::transfer);
+    EXPECT_EQ(1u, transfer.requests);
+    EXPECT_EQ(1u, transfer.queued);
+    EXPECT_EQ(0u, scheduler.stats(Priority::background).requests);
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/Singleflight.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+using namespace std;
+
+TEST(Singleflight, coalesce)
+{
+    Singleflight<int> flights;
+    vector<int> results;
+    auto callback = [&](int const& value, boost::exception_ptr const& error) {
+        EXPECT_FALSE(error);
+        results.push_back(value);
+    };
+
+    uint64_t id = flights.join("key", callback);
+    EXPECT_NE(0u, id);
+    // Later callers share the request
+    EXPECT_EQ(0u, flights.join("key", callback));
+    EXPECT_EQ(0u, flights.join("key", callback));
+    // Different keys get their own request
+    uint64_t other = flights.join("other", callback);
+    EXPECT_NE(0u, other);
+    EXPECT_NE(id, other);
+    EXPECT_EQ(2u, flights.size());
+
+    flights.finish("key", id, 42, boost::exception_ptr());
+    EXPECT_EQ(vector<int>({42, 42, 42}), results);
+    EXPECT_EQ(1u, flights.size());
+
+    // Once finished, a new request is needed
+    results.clear();
+    uint64_t next = flights.join("key", callback);
+    EXPECT_NE(0u, next);
+    EXPECT_NE(id, next);
+}
+
+TEST(Singleflight, error)
+{
+    Singleflight<int> flights;
+    int errors = 0;
+    auto callback = [&](int const&, boost::exception_ptr const& error) {
+        EXPECT_TRUE(bool(error));
+        errors++;
+    };
+    uint64_t id = flights.join("key", callback);
+    flights.join("key", callback);
+    flights.finish("key", id, 0,
+                   boost::copy_exception(runtime_error("failed")));
+    EXPECT_EQ(2, errors);
+    EXPECT_EQ(0u, flights.size());
+}
+
+TEST(Singleflight, forget_prefix)
+{
+    Singleflight<int> flights;
+    vector<string> results;
+    auto make_callback = [&](string const& name) {
+        return [&results, name](int const& value, boost::exception_ptr const&) {
+            results.push_back(name + "=" + to_string(value));
+        };
+    };
+
+    uint64_t old_id = flights.join("account\nfolder/file", make_callback("a"));
+    uint64_t other_id = flights.join("account\nother", make_callback("b"));
+    flights.forget_prefix("account\nfolder/");
+
+    // A request after the forget starts a new flight
+    uint64_t new_id = flights.join("account\nfolder/file", make_callback("c"));
+    EXPECT_NE(0u, new_id);
+    EXPECT_EQ(3u, flights.size());
+
+    // The old flight's result only goes to its own waiters
+    flights.finish("account\nfolder/file", old_id, 1, boost::exception_ptr());
+    EXPECT_EQ(vector<string>({"a=1"}), results);
+    flights.finish("account\nfolder/file", new_id, 2, boost::exception_ptr());
+    flights.finish("account\nother", other_id, 3, boost::exception_ptr());
+    EXPECT_EQ(vector<string>({"a=1", "c=2", "b=3"}), results);
+    EXPECT_EQ(0u, flights.size());
+
+    // Finishing an unknown flight is harmless
+    flights.finish("account\nother", other_id, 4, boost::exception_ptr());
+    EXPECT_EQ(3u, results.size());
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "../../src/Trace.h"
+#include <testsetup.h>
+
+#include <gtest/gtest.h>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <memory>
+
+using namespace std;
+
+class TraceTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        tmp_dir_.reset(new QTemporaryDir(TEST_BIN_DIR "/trace-test.XXXXXX"));
+        ASSERT_TRUE(tmp_dir_->isValid());
+        path_ = tmp_dir_->filePath("trace.json");
+    }
+
+    void TearDown() override
+    {
+        Trace::stop();
+        tmp_dir_.reset();
+    }
+
+    QJsonArray read_events()
+    {
+        QFile file(path_);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            return QJsonArray();
+        }
+        QJsonParseError error;
+        auto doc = QJsonDocument::fromJson(file.readAll(), &error);
+        EXPECT_EQ(QJsonParseError::NoError, error.error)
+            << error.errorString().toStdString();
+        return doc.array();
+    }
+
+    unique_ptr<QTemporaryDir> tmp_dir_;
+    QString path_;
+};
+
+TEST_F(TraceTest, disabled)
+{
+    EXPECT_FALSE(Trace::enabled());
+    Trace::Call call("metadata", "foo.txt");
+    EXPECT_EQ(0u, call.id());
+    EXPECT_EQ(0u, Trace::current_call());
+}
+
+TEST_F(TraceTest, spans)
+{
+    ASSERT_TRUE(Trace::start(path_.toStdString()));
+    EXPECT_TRUE(Trace::enabled());
+
+    uint64_t call_id;
+    {
+        Trace::Call call("metadata", "dir/\"quoted\".txt");
+        call_id = call.id();
+        EXPECT_NE(0u, call_id);
+        EXPECT_EQ(call_id, Trace::current_call());
+
+        Trace::Scope scope("items", "make_item");
+        scope.arg("bytes", "42");
+
+        uint64_t const id = Trace::next_id();
+        Trace::begin("request", "PROPFIND", id,
+                     {{"call", to_string(Trace::current_call())}});
+        Trace::step("request", "first_read", id);
+        Trace::end("request", "finished", id, {{"status", "207"}});
+    }
+    EXPECT_EQ(0u, Trace::current_call());
+    Trace::end_call(call_id);
+    Trace::stop();
+    EXPECT_FALSE(Trace::enabled());
+
+    QJsonArray const events = read_events();
+    // Six events, followed by the process name.
+    ASSERT_EQ(7, events.size());
+
+    QJsonObject call = events[0].toObject();
+    EXPECT_EQ("b", call["ph"].toString());
+    EXPECT_EQ("dbus", call["cat"].toString());
+    EXPECT_EQ("metadata", call["name"].toString());
+    EXPECT_EQ(double(call_id), call["id"].toDouble());
+    EXPECT_EQ("dir/\"quoted\".txt",
+              call["args"].toObject()["item_id"].toString());
+
+    QJsonObject request = events[1].toObject();
+    EXPECT_EQ("b", request["ph"].toString());
+    EXPECT_EQ(QString::number(call_id),
+              request["args"].toObject()["call"].toString());
+    EXPECT_EQ("n", events[2].toObject()["ph"].toString());
+    EXPECT_EQ("e", events[3].toObject()["ph"].toString());
+
+    // The scope is recorded when it ends.
+    QJsonObject scope = events[4].toObject();
+    EXPECT_EQ("X", scope["ph"].toString());
+    EXPECT_EQ("make_item", scope["name"].toString());
+    EXPECT_LE(0, scope["dur"].toDouble());
+    EXPECT_EQ("42", scope["args"].toObject()["bytes"].toString());
+
+    QJsonObject end = events[5].toObject();
+    EXPECT_EQ("e", end["ph"].toString());
+    EXPECT_EQ(double(call_id), end["id"].toDouble());
+    EXPECT_EQ("M", events[6].toObject()["ph"].toString());
+}
+
+TEST_F(TraceTest, start_fails)
+{
+    EXPECT_FALSE(Trace::start(path_.toStdString() + "/missing/trace.json"));
+    EXPECT_FALSE(Trace::enabled());
+}
+
+int main(int argc, char**argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
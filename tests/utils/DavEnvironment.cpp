@@ -17,9 +17,13 @@
  */
 
 #include "DavEnvironment.h"
+#include "LocalDavServer.h"
 #include <testsetup.h>
 
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QProcessEnvironment>
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -27,6 +31,8 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <thread>
 
@@ -99,8 +105,23 @@ void wait_for_listen(int port)
 
 DavEnvironment::DavEnvironment(QString const& base_dir)
 {
+    char const* backend = getenv("DAV_TEST_SERVER");
+    if (backend != nullptr && strcmp(backend, "local") == 0)
+    {
+        local_server_.reset(new LocalDavServer(base_dir));
+        base_url_ = local_server_->base_url();
+        return;
+    }
+
     int port = get_free_port();
 
+    if (!state_dir_.isValid())
+    {
+        throw runtime_error("DavServer::DavServer(): could not create state directory");
+    }
+    auto env = QProcessEnvironment::systemEnvironment();
+    env.insert("SABREDAV_STATE_DIR", state_dir_.path());
+    server_.setProcessEnvironment(env);
     server_.setProcessChannelMode(QProcess::ForwardedChannels);
     server_.setWorkingDirectory(base_dir);
     server_.start("php", {"-S", QStringLiteral("127.0.0.1:%1").arg(port),
@@ -117,6 +138,10 @@ DavEnvironment::DavEnvironment(QString const& base_dir)
 
 DavEnvironment::~DavEnvironment()
 {
+    if (local_server_)
+    {
+        return;
+    }
     server_.terminate();
     if (!server_.waitForFinished())
     {
@@ -128,3 +153,36 @@ QUrl const& DavEnvironment::base_url() const
 {
     return base_url_;
 }
+
+int DavEnvironment::auth_count() const
+{
+    if (local_server_)
+    {
+        return local_server_->auth_count();
+    }
+    QFile file(state_dir_.path() + "/auth-count");
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return 0;
+    }
+    return file.readAll().trimmed().toInt();
+}
+
+void DavEnvironment::expire_sessions()
+{
+    if (local_server_)
+    {
+        local_server_->expire_sessions();
+        return;
+    }
+    QDir dir(state_dir_.path());
+    for (auto const& name : dir.entryList({"session-*"}, QDir::Files))
+    {
+        dir.remove(name);
+    }
+}
+
+LocalDavServer* DavEnvironment::local_server() const
+{
+    return local_server_.get();
+}
@@ -20,8 +20,18 @@
 
 #include <QProcess>
 #include <QString>
+#include <QTemporaryDir>
 #include <QUrl>
 
+#include <memory>
+
+class LocalDavServer;
+
+// Serves a directory over WebDAV for the duration of a test.
+//
+// By default this runs sabredav-server.php under "php -S".  If
+// DAV_TEST_SERVER is set to "local", the in-process LocalDavServer is
+// used instead, which starts much faster and doesn't need PHP.
 class DavEnvironment {
 public:
     DavEnvironment(QString const& base_dir);
@@ -29,7 +39,17 @@ public:
 
     QUrl const& base_url() const;
 
+    // The number of times the server has checked a password.
+    int auth_count() const;
+    // Make the server forget the login sessions it has handed out.
+    void expire_sessions();
+
+    // The in-process server, or nullptr if SabreDAV is being used.
+    LocalDavServer* local_server() const;
+
 private:
+    QTemporaryDir state_dir_;
     QProcess server_;
+    std::unique_ptr<LocalDavServer> local_server_;
     QUrl base_url_;
 };
@@ -0,0 +1,1975 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+
+#include "LocalDavServer.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHostAddress>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QMimeDatabase>
+#include <QRegularExpression>
+#include <QStorageInfo>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUuid>
+#include <QXmlStreamReader>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+using namespace std;
+
+namespace
+{
+
+constexpr qint64 CHUNK_SIZE = 64 * 1024;
+// Keep at most this much response data queued in the socket.
+constexpr qint64 MAX_QUEUED_OUTPUT = 4 * CHUNK_SIZE;
+constexpr int MAX_HEADER_SIZE = 64 * 1024;
+// Request bodies other than uploads are held in memory.
+constexpr qint64 MAX_BUFFERED_BODY = 16 * 1024 * 1024;
+// The number of sync tokens that remain valid.
+constexpr size_t MAX_SYNC_SNAPSHOTS = 64;
+
+// Uploads are written to a staging file in the root directory and
+// renamed into place once complete.  These files are hidden from
+// clients.
+char const STAGING_PREFIX[] = ".~dav-upload-";
+char const SYNC_TOKEN_PREFIX[] = "http://sabre.io/ns/sync/";
+char const DAV_NS[] = "DAV:";
+char const OC_NS[] = "http://owncloud.org/ns";
+
+char const MULTISTATUS_START[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\""
+    " xmlns:oc=\"http://owncloud.org/ns\">\n";
+char const MULTISTATUS_END[] = "</d:multistatus>\n";
+
+struct Request
+{
+    QByteArray method;
+    // The decoded URL path.
+    QString path;
+    // Keyed by lower case header name.
+    map<QByteArray, QByteArray> headers;
+    QByteArray body;
+    // The staging file holding the body of a PUT request.
+    QString upload_file;
+
+    QByteArray header(char const* name) const
+    {
+        auto it = headers.find(name);
+        return it != headers.end() ? it->second : QByteArray();
+    }
+};
+
+struct Response
+{
+    int status = 200;
+    vector<pair<QByteArray, QByteArray>> headers;
+    QByteArray body;
+    // Alternatively, the body is read from a file.
+    unique_ptr<QFile> file;
+    qint64 file_length = 0;
+
+    void set_header(QByteArray const& name, QByteArray const& value)
+    {
+        headers.emplace_back(name, value);
+    }
+};
+
+struct Entry
+{
+    // False if the path can't be mapped to the root directory.
+    bool valid = false;
+    bool exists = false;
+    bool is_dir = false;
+    QString fs_path;
+    // Decoded URL path, with a trailing slash for folders.
+    QString url_path;
+    qint64 size = 0;
+    time_t mtime = 0;
+    dev_t dev = 0;
+    ino_t ino = 0;
+};
+
+struct PropName
+{
+    QString ns;
+    QString name;
+};
+
+// A request body listing properties, such as a PROPFIND or REPORT.
+struct PropRequest
+{
+    QString root;
+    bool allprop = true;
+    vector<PropName> props;
+    // The text of other elements below the root.
+    map<QString, QString> values;
+};
+
+QByteArray reason_phrase(int status)
+{
+    switch (status)
+    {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 207: return "Multi-Status";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 412: return "Precondition Failed";
+    case 413: return "Payload Too Large";
+    case 415: return "Unsupported Media Type";
+    case 416: return "Requested Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 507: return "Insufficient Storage";
+    default: return "Unknown";
+    }
+}
+
+QByteArray xml_escape(QString const& text)
+{
+    return text.toHtmlEscaped().toUtf8();
+}
+
+QByteArray http_date(time_t time)
+{
+    auto const date = QDateTime::fromMSecsSinceEpoch(qint64(time) * 1000, Qt::UTC);
+    return QLocale::c().toString(
+        date, QStringLiteral("ddd, dd MMM yyyy hh:mm:ss 'GMT'")).toUtf8();
+}
+
+bool is_hidden(QString const& name)
+{
+    return name.startsWith(QLatin1String(STAGING_PREFIX));
+}
+
+QString parent_path(QString const& url_path)
+{
+    QString path = url_path;
+    while (path.endsWith('/'))
+    {
+        path.chop(1);
+    }
+    return path.left(path.lastIndexOf('/') + 1);
+}
+
+QString base_name(QString const& url_path)
+{
+    QString path = url_path;
+    while (path.endsWith('/'))
+    {
+        path.chop(1);
+    }
+    return path.mid(path.lastIndexOf('/') + 1);
+}
+
+QStringList children(QString const& fs_path)
+{
+    QStringList names = QDir(fs_path).entryList(
+        QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+        QDir::Name);
+    names.erase(remove_if(names.begin(), names.end(), is_hidden), names.end());
+    return names;
+}
+
+Entry stat_entry(QString const& fs_path, QString const& url_path)
+{
+    Entry entry;
+    entry.valid = true;
+    entry.fs_path = fs_path;
+    entry.url_path = url_path;
+    while (entry.url_path.size() > 1 && entry.url_path.endsWith('/'))
+    {
+        entry.url_path.chop(1);
+    }
+
+    struct stat buf;
+    if (stat(QFile::encodeName(fs_path).constData(), &buf) < 0)
+    {
+        return entry;
+    }
+    entry.exists = true;
+    entry.is_dir = S_ISDIR(buf.st_mode);
+    entry.size = buf.st_size;
+    entry.mtime = buf.st_mtime;
+    entry.dev = buf.st_dev;
+    entry.ino = buf.st_ino;
+    if (entry.is_dir && !entry.url_path.endsWith('/'))
+    {
+        entry.url_path += '/';
+    }
+    return entry;
+}
+
+Entry child_entry(Entry const& parent, QString const& name)
+{
+    return stat_entry(parent.fs_path + '/' + name, parent.url_path + name);
+}
+
+// ETags follow sabredav-server.php: files are identified by inode and
+// modification time, and folders by a digest of their contents.
+QByteArray file_etag(Entry const& entry)
+{
+    return '"' + QByteArray::number(qulonglong(entry.dev)) + '.' +
+        QByteArray::number(qulonglong(entry.ino)) + '.' +
+        QByteArray::number(qlonglong(entry.mtime)) + '"';
+}
+
+QByteArray dir_etag(Entry const& entry)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    bool first = true;
+    for (auto const& name : children(entry.fs_path))
+    {
+        Entry const child = child_entry(entry, name);
+        if (!first)
+        {
+            hash.addData("/", 1);
+        }
+        first = false;
+        hash.addData(name.toUtf8() + ':' +
+                     QByteArray::number(qulonglong(child.ino)) + '.' +
+                     QByteArray::number(qlonglong(child.mtime)) + '.' +
+                     QByteArray::number(child.size));
+    }
+    return '"' + hash.result().toHex() + '"';
+}
+
+QByteArray etag(Entry const& entry)
+{
+    return entry.is_dir ? dir_etag(entry) : file_etag(entry);
+}
+
+QByteArray content_type(Entry const& entry)
+{
+    static QMimeDatabase const db;
+    return db.mimeTypeForFile(entry.fs_path, QMimeDatabase::MatchExtension)
+        .name().toUtf8();
+}
+
+qint64 tree_size(QString const& fs_path)
+{
+    qint64 size = 0;
+    for (auto const& name : children(fs_path))
+    {
+        QString const path = fs_path + '/' + name;
+        struct stat buf;
+        if (stat(QFile::encodeName(path).constData(), &buf) < 0)
+        {
+            continue;
+        }
+        size += S_ISDIR(buf.st_mode) ? tree_size(path) : buf.st_size;
+    }
+    return size;
+}
+
+bool remove_tree(Entry const& entry)
+{
+    if (entry.is_dir)
+    {
+        return QDir(entry.fs_path).removeRecursively();
+    }
+    return QFile::remove(entry.fs_path);
+}
+
+bool copy_tree(QString const& from, QString const& to)
+{
+    struct stat buf;
+    if (stat(QFile::encodeName(from).constData(), &buf) < 0)
+    {
+        return false;
+    }
+    if (!S_ISDIR(buf.st_mode))
+    {
+        return QFile::copy(from, to);
+    }
+    if (!QDir().mkdir(to))
+    {
+        return false;
+    }
+    for (auto const& name : children(from))
+    {
+        if (!copy_tree(from + '/' + name, to + '/' + name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArray empty_element(PropName const& prop)
+{
+    if (prop.ns == DAV_NS)
+    {
+        return "<d:" + prop.name.toUtf8() + "/>";
+    }
+    if (prop.ns == OC_NS)
+    {
+        return "<oc:" + prop.name.toUtf8() + "/>";
+    }
+    return "<x:" + prop.name.toUtf8() + " xmlns:x=\"" +
+        xml_escape(prop.ns) + "\"/>";
+}
+
+QByteArray element(char const* name, QByteArray const& value)
+{
+    return '<' + QByteArray(name) + '>' + value + "</" + QByteArray(name) + '>';
+}
+
+vector<PropName> const& all_props()
+{
+    static vector<PropName> const props = {
+        {DAV_NS, "resourcetype"},
+        {DAV_NS, "getetag"},
+        {DAV_NS, "getlastmodified"},
+        {DAV_NS, "getcontentlength"},
+        {DAV_NS, "getcontenttype"},
+    };
+    return props;
+}
+
+bool parse_prop_request(QByteArray const& body, PropRequest& request)
+{
+    if (body.trimmed().isEmpty())
+    {
+        return true;
+    }
+    QXmlStreamReader reader(body);
+    int depth = 0;
+    bool in_prop = false;
+    QString value_name;
+    while (!reader.atEnd())
+    {
+        switch (reader.readNext())
+        {
+        case QXmlStreamReader::StartElement:
+            depth++;
+            if (depth == 1)
+            {
+                request.root = reader.name().toString();
+            }
+            else if (depth == 2 && reader.namespaceUri() == DAV_NS &&
+                     reader.name() == "prop")
+            {
+                in_prop = true;
+                request.allprop = false;
+            }
+            else if (depth == 2)
+            {
+                value_name = reader.name().toString();
+                request.values[value_name] = QString();
+            }
+            else if (depth == 3 && in_prop)
+            {
+                request.props.push_back({reader.namespaceUri().toString(),
+                                         reader.name().toString()});
+            }
+            break;
+        case QXmlStreamReader::Characters:
+            if (depth == 2 && !value_name.isEmpty())
+            {
+                request.values[value_name] += reader.text();
+            }
+            break;
+        case QXmlStreamReader::EndElement:
+            if (depth == 2)
+            {
+                in_prop = false;
+                value_name.clear();
+            }
+            depth--;
+            break;
+        default:
+            break;
+        }
+    }
+    return !reader.hasError();
+}
+
+}
+
+struct LocalDavServer::State
+{
+    struct FaultRule
+    {
+        Fault fault;
+        int count;
+        QByteArray method;
+        int status;
+    };
+
+    mutex lock;
+    chrono::milliseconds latency{0};
+    int64_t bandwidth = 0;
+    bool ranges_supported = true;
+    deque<FaultRule> faults;
+    int request_count = 0;
+    int auth_count = 0;
+    set<QByteArray> sessions;
+
+    // Take the fault to inject into a request, if any.
+    bool take_fault(QByteArray const& method, FaultRule& rule)
+    {
+        lock_guard<mutex> guard(lock);
+        for (auto it = faults.begin(); it != faults.end(); ++it)
+        {
+            if (!it->method.isEmpty() && it->method != method)
+            {
+                continue;
+            }
+            rule = *it;
+            if (--it->count <= 0)
+            {
+                faults.erase(it);
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+class LocalDavServer::Worker : public QObject
+{
+public:
+    Worker(QString const& root_dir, shared_ptr<State> const& state);
+
+    // Start listening.  Called on the server thread.
+    quint16 listen();
+
+    State& state() const;
+    QString new_staging_file();
+    void handle(Request& request, Response& response);
+
+private:
+    bool authenticate(Request const& request, Response& response);
+    Entry lookup(QString const& url_path) const;
+    void error(Response& response, int status, char const* exception,
+               QString const& message,
+               QByteArray const& detail = QByteArray()) const;
+    void not_found(Response& response, Entry const& entry) const;
+    bool check_preconditions(Request const& request, Entry const& entry,
+                             Response& response) const;
+    void append_response(QByteArray& out, Entry const& entry,
+                         PropRequest const& props);
+    bool property(Entry const& entry, PropName const& prop,
+                  QByteArray& out);
+    void append_tree(QByteArray& out, Entry const& entry, int depth,
+                     PropRequest const& props);
+    void finish_put(Request const& request, Entry const& target,
+                    Response& response) const;
+    int sync_current();
+    void snapshot(Entry const& dir, QString const& prefix,
+                  map<QString, QByteArray>& result) const;
+
+    void options(Request const& request, Response& response);
+    void propfind(Request const& request, Response& response);
+    void get(Request const& request, Response& response);
+    void put(Request& request, Response& response);
+    void mkcol(Request const& request, Response& response);
+    void remove(Request const& request, Response& response);
+    void copy_move(Request const& request, Response& response, bool move);
+    void assemble_chunks(Request const& request, Response& response);
+    void bulk_upload(Request const& request, Response& response);
+    void report(Request const& request, Response& response);
+
+    QString const root_;
+    shared_ptr<State> const state_;
+    QTcpServer* server_ = nullptr;
+    uint64_t last_upload_ = 0;
+    // Snapshots of the tree by sync token, to report changes since.
+    map<int, map<QString, QByteArray>> snapshots_;
+};
+
+class LocalDavServer::Connection : public QObject
+{
+public:
+    Connection(Worker* worker, QTcpSocket* socket);
+    ~Connection();
+
+private:
+    enum class Phase
+    {
+        headers,
+        body,
+        processing,
+        sending,
+        closing,
+    };
+
+    void onReadyRead();
+    bool parseHeaders();
+    void readBody();
+    void process();
+    void respond();
+    void send(Response&& response, bool truncate);
+    void pump();
+    void finishResponse();
+    void resume();
+    QByteArray takeInput(qint64 max_size);
+    // How many bytes may be transferred now, keeping to the bandwidth
+    // limit.  If none, resume() is called later.
+    qint64 allowance(qint64 wanted);
+    void discardUpload();
+
+    Worker* const worker_;
+    QTcpSocket* const socket_;
+    Phase phase_ = Phase::headers;
+    QByteArray buffer_;
+    bool keep_alive_ = true;
+
+    Request request_;
+    qint64 body_remaining_ = 0;
+    unique_ptr<QFile> upload_;
+    bool upload_failed_ = false;
+
+    Response response_;
+    qint64 send_remaining_ = 0;
+    qint64 body_offset_ = 0;
+
+    QElapsedTimer rate_clock_;
+    qint64 rate_bytes_ = 0;
+    bool throttled_ = false;
+};
+
+LocalDavServer::LocalDavServer(QString const& root_dir)
+    : state_(make_shared<State>())
+{
+    worker_ = new Worker(root_dir, state_);
+    worker_->moveToThread(&thread_);
+    QObject::connect(&thread_, &QThread::finished,
+                     worker_, &QObject::deleteLater);
+
+    promise<quint16> port;
+    QObject::connect(&thread_, &QThread::started, worker_, [&]() {
+            try
+            {
+                port.set_value(worker_->listen());
+            }
+            catch (...)
+            {
+                port.set_exception(current_exception());
+            }
+        });
+    thread_.start();
+    try
+    {
+        base_url_.setUrl(QStringLiteral("http://127.0.0.1:%1/")
+                         .arg(port.get_future().get()), QUrl::StrictMode);
+    }
+    catch (...)
+    {
+        thread_.quit();
+        thread_.wait();
+        throw;
+    }
+}
+
+LocalDavServer::~LocalDavServer()
+{
+    thread_.quit();
+    thread_.wait();
+}
+
+QUrl const& LocalDavServer::base_url() const
+{
+    return base_url_;
+}
+
+void LocalDavServer::set_latency(chrono::milliseconds latency)
+{
+    lock_guard<mutex> guard(state_->lock);
+    state_->latency = latency;
+}
+
+void LocalDavServer::set_bandwidth(int64_t bytes_per_second)
+{
+    lock_guard<mutex> guard(state_->lock);
+    state_->bandwidth = bytes_per_second;
+}
+
+void LocalDavServer::set_ranges_supported(bool supported)
+{
+    lock_guard<mutex> guard(state_->lock);
+    state_->ranges_supported = supported;
+}
+
+void LocalDavServer::inject_fault(Fault fault, int count,
+                                  QByteArray const& method, int status)
+{
+    lock_guard<mutex> guard(state_->lock);
+    state_->faults.push_back({fault, count, method, status});
+}
+
+void LocalDavServer::clear_faults()
+{
+    lock_guard<mutex> guard(state_->lock);
+    state_->faults.clear();
+}
+
+int LocalDavServer::request_count() const
+{
+    lock_guard<mutex> guard(state_->lock);
+    return state_->request_count;
+}
+
+int LocalDavServer::auth_count() const
+{
+    lock_guard<mutex> guard(state_->lock);
+    return state_->auth_count;
+}
+
+void LocalDavServer::expire_sessions()
+{
+    lock_guard<mutex> guard(state_->lock);
+    state_->sessions.clear();
+}
+
+LocalDavServer::Worker::Worker(QString const& root_dir,
+                               shared_ptr<State> const& state)
+    : root_(QDir(root_dir).absolutePath()), state_(state)
+{
+}
+
+quint16 LocalDavServer::Worker::listen()
+{
+    server_ = new QTcpServer(this);
+    if (!server_->listen(QHostAddress::LocalHost, 0))
+    {
+        throw runtime_error("LocalDavServer: could not listen: " +
+                            server_->errorString().toStdString());
+    }
+    connect(server_, &QTcpServer::newConnection, this, [this]() {
+            while (QTcpSocket* socket = server_->nextPendingConnection())
+            {
+                new Connection(this, socket);
+            }
+        });
+    return server_->serverPort();
+}
+
+LocalDavServer::State& LocalDavServer::Worker::state() const
+{
+    return *state_;
+}
+
+QString LocalDavServer::Worker::new_staging_file()
+{
+    return root_ + '/' + STAGING_PREFIX + QString::number(++last_upload_);
+}
+
+void LocalDavServer::Worker::handle(Request& request, Response& response)
+{
+    if (!authenticate(request, response))
+    {
+        return;
+    }
+    auto const& method = request.method;
+    if (method == "OPTIONS")
+    {
+        options(request, response);
+    }
+    else if (method == "PROPFIND")
+    {
+        propfind(request, response);
+    }
+    else if (method == "GET" || method == "HEAD")
+    {
+        get(request, response);
+    }
+    else if (method == "PUT")
+    {
+        put(request, response);
+    }
+    else if (method == "MKCOL")
+    {
+        mkcol(request, response);
+    }
+    else if (method == "DELETE")
+    {
+        remove(request, response);
+    }
+    else if (method == "COPY" || method == "MOVE")
+    {
+        copy_move(request, response, method == "MOVE");
+    }
+    else if (method == "REPORT")
+    {
+        report(request, response);
+    }
+    else if (method == "POST")
+    {
+        bulk_upload(request, response);
+    }
+    else
+    {
+        error(response, 501, "Sabre\\DAV\\Exception\\NotImplemented",
+              QStringLiteral("There was no plugin in the system that was willing to handle this %1 method.").arg(QString::fromUtf8(method)));
+    }
+}
+
+// Like DummyAuth in sabredav-server.php, any password is accepted,
+// and each password check hands out a new login session cookie.
+bool LocalDavServer::Worker::authenticate(Request const& request,
+                                          Response& response)
+{
+    QByteArray const authorization = request.header("authorization");
+    if (authorization.startsWith("Basic "))
+    {
+        QByteArray const session = QUuid::createUuid().toRfc4122().toHex();
+        {
+            lock_guard<mutex> guard(state_->lock);
+            state_->auth_count++;
+            state_->sessions.insert(session);
+        }
+        response.set_header("Set-Cookie",
+                            "nc_session_id=" + session + "; path=/; HttpOnly");
+        return true;
+    }
+    if (authorization.isEmpty())
+    {
+        for (auto const& cookie : request.header("cookie").split(';'))
+        {
+            QByteArray const c = cookie.trimmed();
+            if (!c.startsWith("nc_session_id="))
+            {
+                continue;
+            }
+            lock_guard<mutex> guard(state_->lock);
+            if (state_->sessions.count(c.mid(strlen("nc_session_id="))) > 0)
+            {
+                return true;
+            }
+        }
+    }
+    response.set_header("WWW-Authenticate",
+                        "Basic realm=\"realm\", charset=\"UTF-8\"");
+    error(response, 401, "Sabre\\DAV\\Exception\\NotAuthenticated",
+          "No 'Authorization: Basic' header found. Either the client didn't send one, or the server is misconfigured");
+    return false;
+}
+
+Entry LocalDavServer::Worker::lookup(QString const& url_path) const
+{
+    if (!url_path.startsWith('/'))
+    {
+        return Entry();
+    }
+    QStringList parts;
+    for (auto const& part : url_path.split('/', QString::SkipEmptyParts))
+    {
+        if (part == "." || part == ".." || is_hidden(part))
+        {
+            return Entry();
+        }
+        parts.append(part);
+    }
+    if (parts.isEmpty())
+    {
+        return stat_entry(root_, QStringLiteral("/"));
+    }
+    return stat_entry(root_ + '/' + parts.join('/'), '/' + parts.join('/'));
+}
+
+void LocalDavServer::Worker::error(Response& response, int status,
+                                   char const* exception,
+                                   QString const& message,
+                                   QByteArray const& detail) const
+{
+    response.status = status;
+    response.set_header("Content-Type", "application/xml; charset=utf-8");
+    response.body =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<d:error xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\">\n"
+        "  <s:exception>" + xml_escape(QString::fromUtf8(exception)) +
+        "</s:exception>\n"
+        "  <s:message>" + xml_escape(message) + "</s:message>\n" +
+        detail +
+        "</d:error>\n";
+}
+
+void LocalDavServer::Worker::not_found(Response& response,
+                                       Entry const& entry) const
+{
+    error(response, 404, "Sabre\\DAV\\Exception\\NotFound",
+          QStringLiteral("File with name %1 could not be located")
+          .arg(entry.url_path));
+}
+
+bool LocalDavServer::Worker::check_preconditions(Request const& request,
+                                                 Entry const& entry,
+                                                 Response& response) const
+{
+    auto matches = [&entry](QByteArray const& header) {
+        if (header.trimmed() == "*")
+        {
+            return true;
+        }
+        QByteArray const tag = etag(entry);
+        for (auto const& candidate : header.split(','))
+        {
+            if (candidate.trimmed() == tag)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    QByteArray const if_match = request.header("if-match");
+    if (!if_match.isEmpty())
+    {
+        if (!entry.exists)
+        {
+            error(response, 412, "Sabre\\DAV\\Exception\\PreconditionFailed",
+                  "An If-Match header was specified and the resource did not exist");
+            return false;
+        }
+        if (!matches(if_match))
+        {
+            error(response, 412, "Sabre\\DAV\\Exception\\PreconditionFailed",
+                  "An If-Match header was specified, but none of the specified the ETags matched.");
+            return false;
+        }
+    }
+    QByteArray const if_none_match = request.header("if-none-match");
+    if (!if_none_match.isEmpty() && entry.exists && matches(if_none_match))
+    {
+        if (request.method == "GET" || request.method == "HEAD")
+        {
+            response.status = 304;
+            response.set_header("ETag", etag(entry));
+        }
+        else
+        {
+            error(response, 412, "Sabre\\DAV\\Exception\\PreconditionFailed",
+                  "An If-None-Match header was specified, but the ETag matched (or * was specified).");
+        }
+        return false;
+    }
+    return true;
+}
+
+bool LocalDavServer::Worker::property(Entry const& entry, PropName const& prop,
+                                      QByteArray& out)
+{
+    QString const& name = prop.name;
+    if (prop.ns == DAV_NS)
+    {
+        if (name == "resourcetype")
+        {
+            out += entry.is_dir ?
+                "<d:resourcetype><d:collection/></d:resourcetype>" :
+                "<d:resourcetype/>";
+            return true;
+        }
+        if (name == "getetag")
+        {
+            out += element("d:getetag", xml_escape(QString::fromUtf8(etag(entry))));
+            return true;
+        }
+        if (name == "getlastmodified")
+        {
+            out += element("d:getlastmodified", http_date(entry.mtime));
+            return true;
+        }
+        if (name == "getcontentlength" && !entry.is_dir)
+        {
+            out += element("d:getcontentlength", QByteArray::number(entry.size));
+            return true;
+        }
+        if (name == "getcontenttype" && !entry.is_dir)
+        {
+            out += element("d:getcontenttype", content_type(entry));
+            return true;
+        }
+        if ((name == "quota-available-bytes" || name == "quota-used-bytes") &&
+            entry.is_dir)
+        {
+            QStorageInfo const storage(entry.fs_path);
+            qint64 const value = name == "quota-available-bytes" ?
+                storage.bytesAvailable() :
+                storage.bytesTotal() - storage.bytesFree();
+            out += '<' + ("d:" + name.toUtf8()) + '>' +
+                QByteArray::number(value) + "</" + ("d:" + name.toUtf8()) + '>';
+            return true;
+        }
+        if (name == "sync-token" && entry.url_path == "/")
+        {
+            out += element("d:sync-token", SYNC_TOKEN_PREFIX +
+                           QByteArray::number(sync_current()));
+            return true;
+        }
+    }
+    else if (prop.ns == OC_NS)
+    {
+        if (name == "fileid")
+        {
+            out += element("oc:fileid", QByteArray::number(qulonglong(entry.ino)));
+            return true;
+        }
+        if (name == "size")
+        {
+            out += element("oc:size", QByteArray::number(
+                               entry.is_dir ? tree_size(entry.fs_path) : entry.size));
+            return true;
+        }
+    }
+    return false;
+}
+
+void LocalDavServer::Worker::append_response(QByteArray& out,
+                                             Entry const& entry,
+                                             PropRequest const& props)
+{
+    QByteArray found;
+    QByteArray missing;
+    for (auto const& prop : props.allprop ? all_props() : props.props)
+    {
+        if (!property(entry, prop, found) && !props.allprop)
+        {
+            missing += empty_element(prop);
+        }
+    }
+
+    out += "<d:response><d:href>";
+    out += xml_escape(QString::fromUtf8(QUrl::toPercentEncoding(entry.url_path, "/")));
+    out += "</d:href>";
+    if (!found.isEmpty())
+    {
+        out += "<d:propstat><d:prop>" + found +
+            "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat>";
+    }
+    if (!missing.isEmpty())
+    {
+        out += "<d:propstat><d:prop>" + missing +
+            "</d:prop><d:status>HTTP/1.1 404 Not Found</d:status></d:propstat>";
+    }
+    out += "</d:response>\n";
+}
+
+void LocalDavServer::Worker::append_tree(QByteArray& out, Entry const& entry,
+                                         int depth, PropRequest const& props)
+{
+    append_response(out, entry, props);
+    if (!entry.is_dir || depth == 0)
+    {
+        return;
+    }
+    for (auto const& name : children(entry.fs_path))
+    {
+        Entry const child = child_entry(entry, name);
+        if (child.exists)
+        {
+            append_tree(out, child, depth < 0 ? depth : depth - 1, props);
+        }
+    }
+}
+
+void LocalDavServer::Worker::finish_put(Request const& request,
+                                        Entry const& target,
+                                        Response& response) const
+{
+    QByteArray const mtime = request.header("x-oc-mtime");
+    if (!mtime.isEmpty())
+    {
+        struct utimbuf times;
+        times.actime = times.modtime = mtime.toLongLong();
+        if (utime(QFile::encodeName(target.fs_path).constData(), &times) == 0)
+        {
+            response.set_header("X-OC-MTime", "accepted");
+        }
+    }
+    Entry const entry = stat_entry(target.fs_path, target.url_path);
+    QByteArray const tag = file_etag(entry);
+    response.set_header("ETag", tag);
+    response.set_header("OC-ETag", tag);
+    response.set_header("OC-FileId", QByteArray::number(qulonglong(entry.ino)));
+}
+
+void LocalDavServer::Worker::snapshot(Entry const& dir, QString const& prefix,
+                                      map<QString, QByteArray>& result) const
+{
+    for (auto const& name : children(dir.fs_path))
+    {
+        Entry const child = child_entry(dir, name);
+        if (!child.exists)
+        {
+            continue;
+        }
+        if (child.is_dir)
+        {
+            result[prefix + name + '/'] = dir_etag(child);
+            snapshot(child, prefix + name + '/', result);
+        }
+        else
+        {
+            result[prefix + name] = QByteArray::number(qulonglong(child.ino)) +
+                '.' + QByteArray::number(qlonglong(child.mtime)) + '.' +
+                QByteArray::number(child.size);
+        }
+    }
+}
+
+// Returns the token for the current state of the tree, recording a
+// new snapshot if it has changed.
+int LocalDavServer::Worker::sync_current()
+{
+    map<QString, QByteArray> current;
+    snapshot(lookup(QStringLiteral("/")), QString(), current);
+    if (!snapshots_.empty() && snapshots_.rbegin()->second == current)
+    {
+        return snapshots_.rbegin()->first;
+    }
+    int const token = snapshots_.empty() ? 1 : snapshots_.rbegin()->first + 1;
+    snapshots_.emplace(token, move(current));
+    while (snapshots_.size() > MAX_SYNC_SNAPSHOTS)
+    {
+        snapshots_.erase(snapshots_.begin());
+    }
+    return token;
+}
+
+void LocalDavServer::Worker::options(Request const&, Response& response)
+{
+    response.set_header("DAV", "1, 2, 3, extended-mkcol");
+    response.set_header("MS-Author-Via", "DAV");
+    response.set_header("Allow", "OPTIONS, GET, HEAD, DELETE, PROPFIND, PUT, "
+                        "PROPPATCH, COPY, MOVE, REPORT, MKCOL");
+    response.set_header("Accept-Ranges", "bytes");
+}
+
+void LocalDavServer::Worker::propfind(Request const& request, Response& response)
+{
+    Entry const entry = lookup(request.path);
+    if (!entry.exists)
+    {
+        not_found(response, entry);
+        return;
+    }
+    PropRequest props;
+    if (!parse_prop_request(request.body, props))
+    {
+        error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+              "The request body had an invalid XML body.");
+        return;
+    }
+    QByteArray const depth_header = request.header("depth");
+    int const depth = depth_header == "0" ? 0 : depth_header == "1" ? 1 : -1;
+
+    response.status = 207;
+    response.set_header("Content-Type", "application/xml; charset=utf-8");
+    response.set_header("Vary", "Brief,Prefer");
+    response.body = MULTISTATUS_START;
+    append_tree(response.body, entry, depth, props);
+    response.body += MULTISTATUS_END;
+}
+
+void LocalDavServer::Worker::get(Request const& request, Response& response)
+{
+    Entry const entry = lookup(request.path);
+    if (!entry.exists)
+    {
+        not_found(response, entry);
+        return;
+    }
+    if (entry.is_dir)
+    {
+        error(response, 501, "Sabre\\DAV\\Exception\\NotImplemented",
+              "GET is only implemented on File objects");
+        return;
+    }
+    if (!check_preconditions(request, entry, response))
+    {
+        return;
+    }
+    QByteArray const tag = file_etag(entry);
+    response.set_header("Content-Type", content_type(entry));
+    response.set_header("ETag", tag);
+    response.set_header("Last-Modified", http_date(entry.mtime));
+    bool ranges_supported;
+    {
+        lock_guard<mutex> guard(state_->lock);
+        ranges_supported = state_->ranges_supported;
+    }
+    response.set_header("Accept-Ranges", ranges_supported ? "bytes" : "none");
+
+    qint64 start = 0;
+    qint64 end = entry.size - 1;
+    QByteArray const range = request.header("range");
+    QByteArray const if_range = request.header("if-range");
+    static QRegularExpression const range_re(R"(^bytes=(\d*)-(\d*)$)");
+    auto const match = range_re.match(QString::fromLatin1(range.trimmed()));
+    // Ranges are only honoured if the file is still the one the
+    // client expected.  Malformed ranges are ignored, like SabreDAV.
+    if (ranges_supported && match.hasMatch() &&
+        (if_range.isEmpty() || if_range == tag) &&
+        !(match.capturedRef(1).isEmpty() && match.capturedRef(2).isEmpty()))
+    {
+        if (match.capturedRef(1).isEmpty())
+        {
+            start = max<qint64>(0, entry.size - match.capturedRef(2).toLongLong());
+        }
+        else
+        {
+            start = match.capturedRef(1).toLongLong();
+            if (!match.capturedRef(2).isEmpty())
+            {
+                end = min(end, match.capturedRef(2).toLongLong());
+            }
+        }
+        if (start >= entry.size || start > end)
+        {
+            response.set_header("Content-Range",
+                                "bytes */" + QByteArray::number(entry.size));
+            error(response, 416,
+                  "Sabre\\DAV\\Exception\\RequestedRangeNotSatisfiable",
+                  "The start offset of the range exceeds the total size of the file");
+            return;
+        }
+        response.status = 206;
+        response.set_header("Content-Range", "bytes " +
+                            QByteArray::number(start) + '-' +
+                            QByteArray::number(end) + '/' +
+                            QByteArray::number(entry.size));
+    }
+
+    response.file.reset(new QFile(entry.fs_path));
+    if (!response.file->open(QIODevice::ReadOnly) ||
+        !response.file->seek(start))
+    {
+        response = Response();
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to read this file");
+        return;
+    }
+    response.file_length = end - start + 1;
+}
+
+void LocalDavServer::Worker::put(Request& request, Response& response)
+{
+    Entry const entry = lookup(request.path);
+    if (!entry.valid)
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to create file");
+        return;
+    }
+    if (entry.is_dir)
+    {
+        error(response, 405, "Sabre\\DAV\\Exception\\MethodNotAllowed",
+              "PUT is not allowed on non-files.");
+        return;
+    }
+    Entry const parent = lookup(parent_path(entry.url_path));
+    if (!parent.exists || !parent.is_dir)
+    {
+        error(response, 409, "Sabre\\DAV\\Exception\\Conflict",
+              "Files can only be created as children of collections");
+        return;
+    }
+    if (!check_preconditions(request, entry, response))
+    {
+        return;
+    }
+    if (rename(QFile::encodeName(request.upload_file).constData(),
+               QFile::encodeName(entry.fs_path).constData()) < 0)
+    {
+        error(response, 507, "Sabre\\DAV\\Exception\\InsufficientStorage",
+              QStringLiteral("Could not store file: %1").arg(strerror(errno)));
+        return;
+    }
+    request.upload_file.clear();
+    response.status = entry.exists ? 204 : 201;
+    finish_put(request, entry, response);
+}
+
+void LocalDavServer::Worker::mkcol(Request const& request, Response& response)
+{
+    Entry const entry = lookup(request.path);
+    if (!entry.valid)
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to create collection");
+        return;
+    }
+    if (entry.exists)
+    {
+        error(response, 405, "Sabre\\DAV\\Exception\\MethodNotAllowed",
+              "The resource you tried to create already exists");
+        return;
+    }
+    Entry const parent = lookup(parent_path(entry.url_path));
+    if (!parent.exists || !parent.is_dir)
+    {
+        error(response, 409, "Sabre\\DAV\\Exception\\Conflict",
+              "Parent node does not exist");
+        return;
+    }
+    if (!QDir().mkdir(entry.fs_path))
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to create collection");
+        return;
+    }
+    response.status = 201;
+}
+
+void LocalDavServer::Worker::remove(Request const& request, Response& response)
+{
+    Entry const entry = lookup(request.path);
+    if (!entry.exists)
+    {
+        not_found(response, entry);
+        return;
+    }
+    if (!check_preconditions(request, entry, response))
+    {
+        return;
+    }
+    if (!remove_tree(entry))
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to delete node");
+        return;
+    }
+    response.status = 204;
+}
+
+void LocalDavServer::Worker::copy_move(Request const& request,
+                                       Response& response, bool move)
+{
+    if (move && base_name(request.path) == ".file")
+    {
+        assemble_chunks(request, response);
+        return;
+    }
+    Entry const source = lookup(request.path);
+    if (!source.exists)
+    {
+        not_found(response, source);
+        return;
+    }
+    QByteArray const destination = request.header("destination");
+    if (destination.isEmpty())
+    {
+        error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+              "The destination header was not supplied");
+        return;
+    }
+    Entry const target = lookup(
+        QUrl(QString::fromUtf8(destination)).path(QUrl::FullyDecoded));
+    if (!target.valid)
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to create destination");
+        return;
+    }
+    if (target.fs_path == source.fs_path)
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Source and destination uri are identical.");
+        return;
+    }
+    if (source.is_dir && target.url_path.startsWith(source.url_path))
+    {
+        error(response, 409, "Sabre\\DAV\\Exception\\Conflict",
+              "The destination may not be part of the same subtree as the source path.");
+        return;
+    }
+    Entry const parent = lookup(parent_path(target.url_path));
+    if (!parent.exists || !parent.is_dir)
+    {
+        error(response, 409, "Sabre\\DAV\\Exception\\Conflict",
+              "The destination node is not found");
+        return;
+    }
+    bool const overwrite = request.header("overwrite").toUpper() != "F";
+    if (target.exists && !overwrite)
+    {
+        error(response, 412, "Sabre\\DAV\\Exception\\PreconditionFailed",
+              "The destination node already exists, and the overwrite header is set to false");
+        return;
+    }
+    if (!check_preconditions(request, source, response))
+    {
+        return;
+    }
+    if (target.exists && !remove_tree(target))
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              "Permission denied to replace destination");
+        return;
+    }
+    bool const ok = move ?
+        rename(QFile::encodeName(source.fs_path).constData(),
+               QFile::encodeName(target.fs_path).constData()) == 0 :
+        copy_tree(source.fs_path, target.fs_path);
+    if (!ok)
+    {
+        error(response, 403, "Sabre\\DAV\\Exception\\Forbidden",
+              QStringLiteral("Could not %1 node").arg(move ? "move" : "copy"));
+        return;
+    }
+    response.status = target.exists ? 204 : 201;
+}
+
+// Nextcloud's bulk upload endpoint: a multipart/related POST whose
+// parts each hold a file, named relative to the root by their
+// X-File-Path header.  Any URL is accepted.  The response maps each
+// path to its ETag and file ID, or to an error message.
+void LocalDavServer::Worker::bulk_upload(Request const& request,
+                                         Response& response)
+{
+    static QRegularExpression const boundary_re(
+        QStringLiteral("^multipart/related;.*boundary=\"?([^\";]+)"));
+    auto const match = boundary_re.match(
+        QString::fromUtf8(request.header("content-type")));
+    if (!match.hasMatch())
+    {
+        error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+              "Content-Type must be multipart/related");
+        return;
+    }
+    QByteArray const delimiter = "--" + match.captured(1).toUtf8();
+    QByteArray const& body = request.body;
+    QJsonObject results;
+    int pos = 0;
+    while (true)
+    {
+        if (body.indexOf(delimiter, pos) != pos)
+        {
+            error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+                  "Expected a multipart boundary");
+            return;
+        }
+        pos += delimiter.size();
+        if (body.mid(pos, 2) == "--")
+        {
+            break;
+        }
+        int const headers_end = body.indexOf("\r\n\r\n", pos);
+        if (body.mid(pos, 2) != "\r\n" || headers_end < 0)
+        {
+            error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+                  "Malformed multipart headers");
+            return;
+        }
+        map<QByteArray, QByteArray> headers;
+        for (auto const& line : body.mid(pos + 2, headers_end - pos - 2).split('\n'))
+        {
+            int const colon = line.indexOf(':');
+            if (colon > 0)
+            {
+                headers[line.left(colon).trimmed().toLower()] =
+                    line.mid(colon + 1).trimmed();
+            }
+        }
+        qint64 const length = headers["content-length"].toLongLong();
+        pos = headers_end + 4;
+        if (headers["x-file-path"].isEmpty() || length < 0 ||
+            pos + length + 2 > body.size())
+        {
+            error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+                  "Malformed multipart part");
+            return;
+        }
+        QByteArray const content = body.mid(pos, length);
+        pos += length + 2;
+
+        QString const path = QString::fromUtf8(headers["x-file-path"]);
+        Entry const entry = lookup(path);
+        Entry const parent = lookup(parent_path(entry.url_path));
+        QString message;
+        if (QCryptographicHash::hash(content, QCryptographicHash::Md5).toHex() !=
+            headers["x-file-md5"].toLower())
+        {
+            message = QStringLiteral("Computed md5 hash is incorrect.");
+        }
+        else if (!entry.valid || entry.is_dir || !parent.exists || !parent.is_dir)
+        {
+            message = QStringLiteral("Could not create file %1").arg(path);
+        }
+        else
+        {
+            QString const staging = new_staging_file();
+            QFile file(staging);
+            if (!file.open(QIODevice::WriteOnly) ||
+                file.write(content) != content.size() || !file.flush() ||
+                rename(QFile::encodeName(staging).constData(),
+                       QFile::encodeName(entry.fs_path).constData()) < 0)
+            {
+                QFile::remove(staging);
+                message = QStringLiteral("Could not store file %1").arg(path);
+            }
+        }
+        if (!message.isEmpty())
+        {
+            results[path] = QJsonObject{{"error", true}, {"message", message}};
+            continue;
+        }
+        QByteArray const mtime = headers["x-file-mtime"];
+        if (!mtime.isEmpty())
+        {
+            struct utimbuf times;
+            times.actime = times.modtime = mtime.toLongLong();
+            utime(QFile::encodeName(entry.fs_path).constData(), &times);
+        }
+        Entry const written = stat_entry(entry.fs_path, entry.url_path);
+        QByteArray etag = file_etag(written);
+        results[path] = QJsonObject{
+            {"error", false},
+            // Nextcloud leaves the quotes off.
+            {"etag", QString::fromUtf8(etag.mid(1, etag.size() - 2))},
+            {"fileid", QString::number(qulonglong(written.ino))},
+        };
+    }
+    response.set_header("Content-Type", "application/json; charset=utf-8");
+    response.body = QJsonDocument(results).toJson(QJsonDocument::Compact);
+}
+
+// Nextcloud's chunked upload protocol: chunks are PUT into a staging
+// collection, and a MOVE of its ".file" member assembles them over
+// the destination.
+void LocalDavServer::Worker::assemble_chunks(Request const& request,
+                                             Response& response)
+{
+    Entry const staging = lookup(parent_path(request.path));
+    if (!staging.exists || !staging.is_dir)
+    {
+        error(response, 404, "Sabre\\DAV\\Exception\\NotFound",
+              QStringLiteral("Upload %1 not found").arg(staging.url_path));
+        return;
+    }
+    Entry const target = lookup(QUrl(QString::fromUtf8(
+        request.header("destination"))).path(QUrl::FullyDecoded));
+    if (!target.valid || target.is_dir)
+    {
+        error(response, 409, "Sabre\\DAV\\Exception\\Conflict",
+              "The destination node is not found");
+        return;
+    }
+    if (target.exists && request.header("overwrite").toUpper() == "F")
+    {
+        error(response, 412, "Sabre\\DAV\\Exception\\PreconditionFailed",
+              "The destination node already exists, and the overwrite header is set to false");
+        return;
+    }
+
+    QFile out(target.fs_path);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        error(response, 409, "Sabre\\DAV\\Exception\\Conflict",
+              "The destination node is not found");
+        return;
+    }
+    for (auto const& name : children(staging.fs_path))
+    {
+        QFile in(staging.fs_path + '/' + name);
+        if (!in.open(QIODevice::ReadOnly))
+        {
+            continue;
+        }
+        while (!in.atEnd())
+        {
+            out.write(in.read(CHUNK_SIZE));
+        }
+        in.close();
+        in.remove();
+    }
+    out.close();
+    QDir().rmdir(staging.fs_path);
+
+    QByteArray const total = request.header("oc-total-length");
+    if (!total.isEmpty() && out.size() != total.toLongLong())
+    {
+        out.remove();
+        error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+              "Chunks do not add up to OC-Total-Length");
+        return;
+    }
+    response.status = 201;
+    finish_put(request, target, response);
+}
+
+// The sync-collection REPORT (RFC 6578), reporting the changes to the
+// whole tree since an earlier sync token.
+void LocalDavServer::Worker::report(Request const& request, Response& response)
+{
+    PropRequest props;
+    if (!parse_prop_request(request.body, props))
+    {
+        error(response, 400, "Sabre\\DAV\\Exception\\BadRequest",
+              "The request body had an invalid XML body.");
+        return;
+    }
+    Entry const root = lookup(request.path);
+    if (props.root != "sync-collection" || root.url_path != "/")
+    {
+        error(response, 415, "Sabre\\DAV\\Exception\\ReportNotSupported",
+              "The {DAV:}" + props.root + " REPORT is not supported on this url.",
+              "  <d:supported-report/>\n");
+        return;
+    }
+
+    QString const token = props.values["sync-token"].trimmed();
+    map<QString, QByteArray> previous;
+    if (!token.isEmpty())
+    {
+        bool ok = false;
+        int const number = token.startsWith(SYNC_TOKEN_PREFIX) ?
+            token.mid(strlen(SYNC_TOKEN_PREFIX)).toInt(&ok) : 0;
+        auto it = snapshots_.find(number);
+        if (!ok || it == snapshots_.end())
+        {
+            error(response, 403, "Sabre\\DAV\\Exception\\InvalidSyncToken",
+                  "Invalid or unknown sync token",
+                  "  <d:valid-sync-token/>\n");
+            return;
+        }
+        previous = it->second;
+    }
+    int const current_token = sync_current();
+    auto const& current = snapshots_.at(current_token);
+    bool const one_level = props.values["sync-level"].trimmed() == "1";
+    auto in_scope = [one_level](QString const& path) {
+        if (!one_level)
+        {
+            return true;
+        }
+        int const slash = path.indexOf('/');
+        return slash < 0 || slash == path.size() - 1;
+    };
+
+    response.status = 207;
+    response.set_header("Content-Type", "application/xml; charset=utf-8");
+    response.body = MULTISTATUS_START;
+    for (auto const& item : current)
+    {
+        auto it = previous.find(item.first);
+        if ((it != previous.end() && it->second == item.second) ||
+            !in_scope(item.first))
+        {
+            continue;
+        }
+        Entry const entry = lookup('/' + item.first);
+        if (entry.exists)
+        {
+            append_response(response.body, entry, props);
+        }
+    }
+    for (auto const& item : previous)
+    {
+        if (current.count(item.first) > 0 || !in_scope(item.first))
+        {
+            continue;
+        }
+        response.body += "<d:response><d:href>" +
+            xml_escape(QString::fromUtf8(QUrl::toPercentEncoding('/' + item.first, "/"))) +
+            "</d:href><d:status>HTTP/1.1 404 Not Found</d:status></d:response>\n";
+    }
+    response.body += element("d:sync-token", SYNC_TOKEN_PREFIX +
+                             QByteArray::number(current_token)) + '\n';
+    response.body += MULTISTATUS_END;
+}
+
+LocalDavServer::Connection::Connection(Worker* worker, QTcpSocket* socket)
+    : QObject(worker), worker_(worker), socket_(socket)
+{
+    socket_->setParent(this);
+    // Apply back pressure to clients rather than buffering uploads.
+    socket_->setReadBufferSize(MAX_QUEUED_OUTPUT);
+    connect(socket_, &QIODevice::readyRead, this, &Connection::onReadyRead);
+    connect(socket_, &QIODevice::bytesWritten, this, &Connection::pump);
+    connect(socket_, &QAbstractSocket::disconnected, this, [this]() {
+            phase_ = Phase::closing;
+            discardUpload();
+            deleteLater();
+        });
+    onReadyRead();
+}
+
+LocalDavServer::Connection::~Connection()
+{
+    discardUpload();
+}
+
+void LocalDavServer::Connection::onReadyRead()
+{
+    switch (phase_)
+    {
+    case Phase::headers:
+        parseHeaders();
+        break;
+    case Phase::body:
+        readBody();
+        break;
+    default:
+        // Further requests wait until the current one is answered.
+        break;
+    }
+}
+
+bool LocalDavServer::Connection::parseHeaders()
+{
+    buffer_ += socket_->readAll();
+    int const end = buffer_.indexOf("\r\n\r\n");
+    if (end < 0)
+    {
+        if (buffer_.size() > MAX_HEADER_SIZE)
+        {
+            socket_->abort();
+        }
+        return false;
+    }
+    QList<QByteArray> lines = buffer_.left(end).split('\n');
+    buffer_.remove(0, end + 4);
+
+    QList<QByteArray> const request_line = lines.takeFirst().trimmed().split(' ');
+    if (request_line.size() != 3)
+    {
+        socket_->abort();
+        return false;
+    }
+    request_ = Request();
+    upload_failed_ = false;
+    request_.method = request_line[0];
+    QByteArray target = request_line[1];
+    int const query = target.indexOf('?');
+    if (query >= 0)
+    {
+        target.truncate(query);
+    }
+    request_.path = QUrl::fromPercentEncoding(target);
+    for (auto const& line : lines)
+    {
+        int const colon = line.indexOf(':');
+        if (colon <= 0)
+        {
+            continue;
+        }
+        QByteArray& value = request_.headers[line.left(colon).trimmed().toLower()];
+        if (!value.isEmpty())
+        {
+            value += ", ";
+        }
+        value += line.mid(colon + 1).trimmed();
+    }
+    QByteArray const connection = request_.header("connection").toLower();
+    keep_alive_ = request_line[2] == "HTTP/1.1" ?
+        connection != "close" : connection == "keep-alive";
+
+    body_remaining_ = request_.header("content-length").toLongLong();
+    if (!request_.header("transfer-encoding").isEmpty() ||
+        body_remaining_ < 0 ||
+        (request_.method != "PUT" && body_remaining_ > MAX_BUFFERED_BODY))
+    {
+        // Chunked request bodies aren't supported: the provider
+        // always gives the length up front.
+        keep_alive_ = false;
+        body_remaining_ = 0;
+        Response response;
+        response.status = request_.header("transfer-encoding").isEmpty() ? 413 : 501;
+        send(move(response), false);
+        return false;
+    }
+    if (request_.method == "PUT")
+    {
+        request_.upload_file = worker_->new_staging_file();
+        upload_.reset(new QFile(request_.upload_file));
+        upload_failed_ = !upload_->open(QIODevice::WriteOnly | QIODevice::Truncate);
+    }
+    phase_ = Phase::body;
+    rate_clock_.invalidate();
+    readBody();
+    return true;
+}
+
+void LocalDavServer::Connection::readBody()
+{
+    while (body_remaining_ > 0)
+    {
+        qint64 const n = allowance(min(body_remaining_, CHUNK_SIZE));
+        if (n == 0)
+        {
+            return;
+        }
+        QByteArray const data = takeInput(n);
+        if (data.isEmpty())
+        {
+            return;
+        }
+        body_remaining_ -= data.size();
+        rate_bytes_ += data.size();
+        if (upload_)
+        {
+            upload_failed_ = upload_failed_ ||
+                upload_->write(data) != data.size();
+        }
+        else
+        {
+            request_.body += data;
+        }
+    }
+    if (upload_)
+    {
+        upload_->close();
+        upload_.reset();
+    }
+    process();
+}
+
+void LocalDavServer::Connection::process()
+{
+    phase_ = Phase::processing;
+    chrono::milliseconds latency;
+    {
+        State& state = worker_->state();
+        lock_guard<mutex> guard(state.lock);
+        state.request_count++;
+        latency = state.latency;
+    }
+    if (latency.count() > 0)
+    {
+        QTimer::singleShot(latency.count(), this, [this]() { respond(); });
+    }
+    else
+    {
+        respond();
+    }
+}
+
+void LocalDavServer::Connection::respond()
+{
+    State::FaultRule fault;
+    bool const faulty = worker_->state().take_fault(request_.method, fault);
+    if (faulty && fault.fault == Fault::disconnect)
+    {
+        socket_->abort();
+        return;
+    }
+
+    Response response;
+    if (faulty && fault.fault == Fault::error_status)
+    {
+        response.status = fault.status;
+        response.set_header("Content-Type", "text/plain");
+        response.body = "Injected fault: HTTP " +
+            QByteArray::number(fault.status) + ' ' +
+            reason_phrase(fault.status);
+    }
+    else if (upload_failed_)
+    {
+        response.status = 507;
+        response.set_header("Content-Type", "text/plain");
+        response.body = "Could not write upload";
+    }
+    else
+    {
+        worker_->handle(request_, response);
+    }
+    discardUpload();
+    send(move(response), faulty && fault.fault == Fault::truncate_body);
+}
+
+void LocalDavServer::Connection::send(Response&& response, bool truncate)
+{
+    response_ = move(response);
+    qint64 const length = response_.file ?
+        response_.file_length : response_.body.size();
+
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(response_.status) +
+        ' ' + reason_phrase(response_.status) + "\r\n";
+    head += "Date: " + http_date(time(nullptr)) + "\r\n";
+    for (auto const& header : response_.headers)
+    {
+        head += header.first + ": " + header.second + "\r\n";
+    }
+    if (response_.status != 204 && response_.status != 304)
+    {
+        head += "Content-Length: " + QByteArray::number(length) + "\r\n";
+    }
+    if (truncate)
+    {
+        keep_alive_ = false;
+    }
+    if (!keep_alive_)
+    {
+        head += "Connection: close\r\n";
+    }
+    head += "\r\n";
+    socket_->write(head);
+
+    send_remaining_ = request_.method == "HEAD" ? 0 : length;
+    if (truncate)
+    {
+        send_remaining_ /= 2;
+    }
+    body_offset_ = 0;
+    phase_ = Phase::sending;
+    rate_clock_.invalidate();
+    pump();
+}
+
+void LocalDavServer::Connection::pump()
+{
+    if (phase_ != Phase::sending)
+    {
+        return;
+    }
+    while (send_remaining_ > 0 && socket_->bytesToWrite() < MAX_QUEUED_OUTPUT)
+    {
+        qint64 const n = allowance(min(send_remaining_, CHUNK_SIZE));
+        if (n == 0)
+        {
+            return;
+        }
+        QByteArray const chunk = response_.file ?
+            response_.file->read(n) : response_.body.mid(body_offset_, n);
+        if (chunk.isEmpty())
+        {
+            // The file shrank under us.
+            socket_->abort();
+            return;
+        }
+        body_offset_ += chunk.size();
+        send_remaining_ -= chunk.size();
+        rate_bytes_ += chunk.size();
+        socket_->write(chunk);
+    }
+    if (send_remaining_ == 0 && socket_->bytesToWrite() == 0)
+    {
+        finishResponse();
+    }
+}
+
+void LocalDavServer::Connection::finishResponse()
+{
+    response_ = Response();
+    request_ = Request();
+    if (!keep_alive_)
+    {
+        phase_ = Phase::closing;
+        socket_->disconnectFromHost();
+        return;
+    }
+    phase_ = Phase::headers;
+    if (!buffer_.isEmpty() || socket_->bytesAvailable() > 0)
+    {
+        QTimer::singleShot(0, this, [this]() { onReadyRead(); });
+    }
+}
+
+void LocalDavServer::Connection::resume()
+{
+    if (phase_ == Phase::body)
+    {
+        readBody();
+    }
+    else if (phase_ == Phase::sending)
+    {
+        pump();
+    }
+}
+
+QByteArray LocalDavServer::Connection::takeInput(qint64 max_size)
+{
+    if (!buffer_.isEmpty())
+    {
+        QByteArray const data = buffer_.left(max_size);
+        buffer_.remove(0, data.size());
+        return data;
+    }
+    return socket_->read(max_size);
+}
+
+qint64 LocalDavServer::Connection::allowance(qint64 wanted)
+{
+    int64_t bandwidth;
+    {
+        State& state = worker_->state();
+        lock_guard<mutex> guard(state.lock);
+        bandwidth = state.bandwidth;
+    }
+    if (bandwidth <= 0)
+    {
+        return wanted;
+    }
+    if (!rate_clock_.isValid())
+    {
+        rate_clock_.start();
+        rate_bytes_ = 0;
+    }
+    qint64 const wait = rate_bytes_ * 1000 / bandwidth - rate_clock_.elapsed();
+    if (wait > 0)
+    {
+        if (!throttled_)
+        {
+            throttled_ = true;
+            QTimer::singleShot(wait, this, [this]() {
+                    throttled_ = false;
+                    resume();
+                });
+        }
+        return 0;
+    }
+    // Transfer at most 50ms worth at a time, to avoid bursts.
+    return min(wanted, max<qint64>(bandwidth / 20, 1));
+}
+
+void LocalDavServer::Connection::discardUpload()
+{
+    upload_.reset();
+    if (!request_.upload_file.isEmpty())
+    {
+        QFile::remove(request_.upload_file);
+        request_.upload_file.clear();
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QThread>
+#include <QUrl>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// A WebDAV server serving a local directory, run on its own thread
+// within the test process.
+//
+// It implements the subset of WebDAV the provider uses (PROPFIND,
+// GET/HEAD with Range and conditional headers, PUT, MKCOL, COPY,
+// MOVE, DELETE and the sync-collection REPORT), along with the
+// ownCloud/Nextcloud extensions emulated by sabredav-server.php:
+// X-OC-Mtime, OC-ETag/OC-FileId response headers, chunked upload
+// assembly and login session cookies.  It also accepts Nextcloud's
+// bulk upload POST, which the PHP server lacks.  Error responses use
+// SabreDAV's format, so tests see the same error messages with either
+// server.
+//
+// Unlike the PHP server it starts instantly, handles many connections
+// at once, and can be slowed down or made to fail on demand, so it is
+// also suitable as a target for benchmarks.
+//
+// The configuration methods may be called from any thread.
+class LocalDavServer
+{
+public:
+    enum class Fault
+    {
+        // Respond with an error status.
+        error_status,
+        // Close the connection without responding.
+        disconnect,
+        // Send the response headers and half of the body, then close
+        // the connection.
+        truncate_body,
+    };
+
+    explicit LocalDavServer(QString const& root_dir);
+    ~LocalDavServer();
+
+    LocalDavServer(LocalDavServer const&) = delete;
+    LocalDavServer& operator=(LocalDavServer const&) = delete;
+
+    QUrl const& base_url() const;
+
+    // Delay each response by this long after its request is received.
+    void set_latency(std::chrono::milliseconds latency);
+    // Limit request and response bodies to this many bytes per second
+    // on each connection.  Zero means unlimited.
+    void set_bandwidth(int64_t bytes_per_second);
+    // Whether GET honours the Range header, as it does by default.
+    void set_ranges_supported(bool supported);
+    // Inject a fault into the next count requests using the given
+    // method, or any method if it is empty.
+    void inject_fault(Fault fault, int count = 1,
+                      QByteArray const& method = QByteArray(),
+                      int status = 500);
+    void clear_faults();
+
+    // The number of requests received.
+    int request_count() const;
+    // The number of times a password has been checked.
+    int auth_count() const;
+    // Forget the login sessions handed out so far.
+    void expire_sessions();
+
+private:
+    struct State;
+    class Worker;
+    class Connection;
+
+    std::shared_ptr<State> const state_;
+    QThread thread_;
+    Worker* worker_ = nullptr;
+    QUrl base_url_;
+};
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authored by: James Henstridge <james.henstridge@canonical.com>
+ */
+
+#include "ScopedEnv.h"
+
+#include <cstdlib>
+
+using namespace std;
+
+ScopedEnv::ScopedEnv(Settings const& settings)
+{
+    for (auto const& setting : settings)
+    {
+        char const* old = getenv(setting.first.c_str());
+        saved_.push_back({setting.first, old != nullptr, old ? old : ""});
+        setenv(setting.first.c_str(), setting.second.c_str(), true);
+    }
+}
+
+ScopedEnv::~ScopedEnv()
+{
+    // Restore in reverse, in case a variable was set more than once.
+    for (auto it = saved_.rbegin(); it != saved_.rend(); ++it)
+    {
+        if (it->was_set)
+        {
+            setenv(it->name.c_str(), it->value.c_str(), true);
+        }
+        else
+        {
+            unsetenv(it->name.c_str());
+        }
+    }
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2016 Canonical Ltd.
+ * Copyright (C) 2017 Canonical Ltd.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 3 as
@@ -18,25 +18,29 @@
 
 #pragma once
 
-#include <QObject>
+#include <string>
+#include <utility>
+#include <vector>
 
-#include <memory>
-
-#include "PropFindHandler.h"
-
-class MetadataHandler : public PropFindHandler {
-    Q_OBJECT
+// Set environment variables for the lifetime of the object, restoring
+// their previous values (or absence) when it is destroyed.
+class ScopedEnv
+{
 public:
-    MetadataHandler(std::shared_ptr<DavProvider> const& provider,
-                    std::string const& item_id,
-                    unity::storage::provider::Context const& ctx);
-    ~MetadataHandler();
+    typedef std::vector<std::pair<std::string, std::string>> Settings;
 
-    boost::future<unity::storage::provider::Item> get_future();
+    explicit ScopedEnv(Settings const& settings);
+    ~ScopedEnv();
 
-private:
-    boost::promise<unity::storage::provider::Item> promise_;
+    ScopedEnv(ScopedEnv const&) = delete;
+    ScopedEnv& operator=(ScopedEnv const&) = delete;
 
-protected:
-    void finish() override;
+private:
+    struct Saved
+    {
+        std::string name;
+        bool was_set;
+        std::string value;
+    };
+    std::vector<Saved> saved_;
 };
@@ -30,14 +30,150 @@ spl_autoload_register(function($class_name) {
     }
 });
 
+// Emulate the headers ownCloud and Nextcloud send in response to a
+// PUT, applying the modification time requested by the client.
+function finish_put($path) {
+    clearstatcache(true, $path);
+    if (isset($_SERVER['HTTP_X_OC_MTIME'])) {
+        touch($path, (int)$_SERVER['HTTP_X_OC_MTIME']);
+        clearstatcache(true, $path);
+        header('X-OC-MTime: accepted');
+    }
+    $stat = stat($path);
+    $etag = '"' . $stat['dev'] . '.' . $stat['ino'] . '.' . $stat['mtime'] . '"';
+    header('OC-ETag: ' . $etag);
+    header('OC-FileId: ' . $stat['ino']);
+    return $etag;
+}
+
+// Emulate sync-collection support by recording a snapshot of the tree
+// for each sync token, so changes made directly on disk are noticed.
+function sync_snapshot($dir, $prefix = '') {
+    $snapshot = [];
+    foreach (scandir($dir) as $name) {
+        if ($name === '.' || $name === '..') continue;
+        $path = $dir . '/' . $name;
+        if (is_dir($path)) {
+            $node = new MyDirectory($path);
+            $snapshot[$prefix . $name . '/'] = $node->getETag();
+            $snapshot += sync_snapshot($path, $prefix . $name . '/');
+        } else {
+            $stat = stat($path);
+            $snapshot[$prefix . $name] = $stat['ino'] . '.' . $stat['mtime'] . '.' . $stat['size'];
+        }
+    }
+    return $snapshot;
+}
+
+function sync_journal_path($token) {
+    global $publicDir;
+    return sys_get_temp_dir() . '/sabredav-sync-' . md5($publicDir) . '-' . $token;
+}
+
+// Returns the token for the current state of the tree, recording a
+// new snapshot if it has changed.
+function sync_current() {
+    clearstatcache();
+    $snapshot = sync_snapshot($GLOBALS['publicDir']);
+    $token = 0;
+    $latest = @file_get_contents(sync_journal_path('latest'));
+    if ($latest !== false) {
+        $token = (int)$latest;
+        $previous = json_decode(file_get_contents(sync_journal_path($token)), true);
+        if ($previous == $snapshot) {
+            return [$token, $snapshot];
+        }
+    }
+    $token++;
+    file_put_contents(sync_journal_path($token), json_encode($snapshot));
+    file_put_contents(sync_journal_path('latest'), (string)$token);
+    return [$token, $snapshot];
+}
+
 class MyFile extends \Sabre\DAV\FS\File {
     public function getETag() {
         $stat = stat($this->path);
         return '"' . $stat['dev'] . '.' . $stat['ino'] . '.' . $stat['mtime'] . '"';
     }
+
+    public function put($data) {
+        parent::put($data);
+        return finish_put($this->path);
+    }
 }
 
-class MyDirectory extends \Sabre\DAV\FS\Directory {
+class MyDirectory extends \Sabre\DAV\FS\Directory implements \Sabre\DAV\IProperties, \Sabre\DAV\Sync\ISyncCollection {
+    // Like Nextcloud, give collections an ETag that changes
+    // whenever their contents change.
+    public function getETag() {
+        $parts = [];
+        foreach (scandir($this->path) as $name) {
+            if ($name === '.' || $name === '..') continue;
+            $stat = stat($this->path . '/' . $name);
+            $parts[] = $name . ':' . $stat['ino'] . '.' . $stat['mtime'] . '.' . $stat['size'];
+        }
+        return '"' . md5(implode('/', $parts)) . '"';
+    }
+
+    public function getProperties($properties) {
+        if (in_array('{DAV:}getetag', $properties)) {
+            return ['{DAV:}getetag' => $this->getETag()];
+        }
+        return [];
+    }
+
+    public function propPatch(\Sabre\DAV\PropPatch $propPatch) {
+    }
+
+    // Only the root collection supports sync-collection.
+    public function getSyncToken() {
+        global $publicDir;
+        if ($this->path !== $publicDir) return null;
+        list($token, $snapshot) = sync_current();
+        return $token;
+    }
+
+    public function getChanges($syncToken, $syncLevel, $limit = null) {
+        global $publicDir;
+        if ($this->path !== $publicDir) return null;
+        list($token, $current) = sync_current();
+        $result = ['syncToken' => $token, 'added' => [], 'modified' => [], 'deleted' => []];
+        if ($syncToken === null) {
+            $previous = [];
+        } else {
+            $data = @file_get_contents(sync_journal_path((int)$syncToken));
+            if ($data === false) return null;
+            $previous = json_decode($data, true);
+        }
+        foreach ($current as $path => $state) {
+            if (!isset($previous[$path])) {
+                $result['added'][] = rtrim((string)$path, '/');
+            } elseif ($previous[$path] !== $state) {
+                $result['modified'][] = rtrim((string)$path, '/');
+            }
+        }
+        foreach ($previous as $path => $state) {
+            if (!isset($current[$path])) {
+                // Keep the trailing slash, so removed folders are
+                // reported with a folder URL.
+                $result['deleted'][] = (string)$path;
+            }
+        }
+        if ($syncLevel == 1) {
+            foreach (['added', 'modified', 'deleted'] as $kind) {
+                $result[$kind] = array_values(array_filter($result[$kind], function($path) {
+                    return strpos($path, '/') === false;
+                }));
+            }
+        }
+        return $result;
+    }
+
+    public function createFile($name, $data = null) {
+        parent::createFile($name, $data);
+        return finish_put($this->path . '/' . $name);
+    }
+
     public function getChild($name) {
         $path = $this->path . '/' . $name;
 
@@ -52,8 +188,87 @@ class MyDirectory extends \Sabre\DAV\FS\Directory {
     }
 }
 
+// Emulate Nextcloud's chunked upload protocol: chunks are PUT into a
+// staging collection, and a MOVE of its ".file" member assembles them
+// over the destination.
+class ChunkingPlugin extends \Sabre\DAV\ServerPlugin {
+    private $server;
+
+    public function initialize(\Sabre\DAV\Server $server) {
+        $this->server = $server;
+        $server->on('method:MOVE', [$this, 'httpMove'], 90);
+    }
+
+    public function httpMove($request, $response) {
+        global $publicDir;
+        $path = $request->getPath();
+        if (basename($path) !== '.file') {
+            return true;
+        }
+        $staging = $publicDir . '/' . dirname($path);
+        if (!is_dir($staging)) {
+            throw new \Sabre\DAV\Exception\NotFound('Upload ' . dirname($path) . ' not found');
+        }
+        $dest = $publicDir . '/' . $this->server->calculateUri($request->getHeader('Destination'));
+        if (file_exists($dest) && $request->getHeader('Overwrite') === 'F') {
+            throw new \Sabre\DAV\Exception\PreconditionFailed('The destination node already exists, and the overwrite header is set to false', 'Overwrite');
+        }
+
+        $chunks = array_values(array_diff(scandir($staging), ['.', '..']));
+        sort($chunks);
+        $out = fopen($dest, 'wb');
+        foreach ($chunks as $chunk) {
+            $in = fopen($staging . '/' . $chunk, 'rb');
+            stream_copy_to_stream($in, $out);
+            fclose($in);
+            unlink($staging . '/' . $chunk);
+        }
+        fclose($out);
+        rmdir($staging);
+
+        $total = $request->getHeader('OC-Total-Length');
+        if ($total !== null && filesize($dest) != (int)$total) {
+            unlink($dest);
+            throw new \Sabre\DAV\Exception\BadRequest('Chunks do not add up to OC-Total-Length');
+        }
+        $response->setHeader('ETag', finish_put($dest));
+        $response->setStatus(201);
+        return false;
+    }
+}
+
+// Login sessions are modelled on Nextcloud's: a password check hands
+// out a session cookie, and requests presenting the cookie without
+// credentials skip the check.  Password checks are counted so tests
+// can see how often clients fall back on them.
+function state_path($name) {
+    return getenv('SABREDAV_STATE_DIR') . '/' . $name;
+}
+
+$sessionAuthenticated = false;
+if (getenv('SABREDAV_STATE_DIR') !== false &&
+    isset($_COOKIE['nc_session_id']) &&
+    !isset($_SERVER['HTTP_AUTHORIZATION']) &&
+    !isset($_SERVER['PHP_AUTH_USER']) &&
+    ctype_xdigit($_COOKIE['nc_session_id']) &&
+    file_exists(state_path('session-' . $_COOKIE['nc_session_id']))) {
+    $sessionAuthenticated = true;
+    $_SERVER['PHP_AUTH_USER'] = 'session';
+    $_SERVER['PHP_AUTH_PW'] = '';
+    $_SERVER['HTTP_AUTHORIZATION'] = 'Basic ' . base64_encode('session:');
+}
+
 class DummyAuth extends \Sabre\DAV\Auth\Backend\AbstractBasic {
     protected function validateUserPass($username, $password) {
+        global $sessionAuthenticated;
+        if ($sessionAuthenticated || getenv('SABREDAV_STATE_DIR') === false) {
+            return true;
+        }
+        $count = (int)@file_get_contents(state_path('auth-count'));
+        file_put_contents(state_path('auth-count'), (string)($count + 1));
+        $session = md5(uniqid(mt_rand(), true));
+        touch(state_path('session-' . $session));
+        setcookie('nc_session_id', $session, 0, '/', '', false, true);
         return true;
     }
 }
@@ -66,6 +281,8 @@ $server = new \Sabre\DAV\Server($rootNode);
 
 $server->addPlugin(new \Sabre\DAV\Auth\Plugin(new DummyAuth(), "realm"));
 $server->addPlugin(new \Sabre\DAV\Browser\GuessContentType());
+$server->addPlugin(new ChunkingPlugin());
+$server->addPlugin(new \Sabre\DAV\Sync\Plugin());
 
 // And off we go!
 $server->exec();